@@ -0,0 +1,98 @@
+#ifndef _ASM_X86_WORD_AT_A_TIME_H
+#define _ASM_X86_WORD_AT_A_TIME_H
+
+#include <asm/asm.h>
+
+/*
+ * Helpers for scanning strings a word at a time, used by the dcache and
+ * the path walk.  This is largely generic for little-endian machines,
+ * but counting the bytes of a mask is architecture specific: a multiply
+ * and shift is the cheapest way on x86.
+ */
+
+#define REPEAT_BYTE(x)	((~0ul / 0xff) * (x))
+
+#ifdef CONFIG_64BIT
+
+/*
+ * Number of 0xff bytes in @mask, which are all in the low end
+ * (Carl Chatfield / Jan Achrenius).
+ */
+static inline long count_masked_bytes(unsigned long mask)
+{
+	return mask*0x0001020304050608ul >> 56;
+}
+
+#else	/* 32-bit case */
+
+/* Modified Carl Chatfield G+ version for 32-bit */
+static inline long count_masked_bytes(long mask)
+{
+	/*
+	 * (a) gives us
+	 *   -1 (0, ff), 0 (ffff) or 1 (ffffff)
+	 * (b) gives us
+	 *   0 for 0, 1 for (ff ffff ffffff)
+	 * (a+b+1) gives us
+	 *   correct 0-3 bytemask count result
+	 */
+	long a = (mask - 256) >> 23;
+	long b = mask & 1;
+	return a + b + 1;
+}
+
+#endif
+
+/*
+ * Return the high bit set in the first byte that is zero.  Bytes after
+ * the first zero one may be flagged spuriously, which is fine as only
+ * the lowest one is ever used.
+ */
+static inline unsigned long has_zero(unsigned long a)
+{
+	return ((a - REPEAT_BYTE(0x01)) & ~a) & REPEAT_BYTE(0x80);
+}
+
+/*
+ * Turn the result of has_zero() into a mask of the bytes before the
+ * first zero byte.
+ */
+static inline unsigned long zero_bytemask(unsigned long mask)
+{
+	return ((mask - 1) & ~mask) >> 7;
+}
+
+/*
+ * Load an unaligned word from kernel space.
+ *
+ * In the (very unlikely) case of the word being a page-crosser
+ * and the next page not being mapped, take the exception and
+ * return zeroes in the non-existing part.
+ */
+static inline unsigned long load_unaligned_zeropad(const void *addr)
+{
+	unsigned long ret, dummy;
+
+	asm(
+		"1:\tmov %2,%0\n"
+		"2:\n"
+		".section .fixup,\"ax\"\n"
+		"3:\t"
+		"lea %2,%1\n\t"
+		"and %3,%1\n\t"
+		"mov (%1),%0\n\t"
+		"leal %2,%%ecx\n\t"
+		"andl %4,%%ecx\n\t"
+		"shll $3,%%ecx\n\t"
+		"shr %%cl,%0\n\t"
+		"jmp 2b\n"
+		".previous\n"
+		_ASM_EXTABLE(1b, 3b)
+		:"=&r" (ret),"=&c" (dummy)
+		:"m" (*(unsigned long *)addr),
+		 "i" (-sizeof(unsigned long)),
+		 "i" (sizeof(unsigned long)-1));
+	return ret;
+}
+
+#endif /* _ASM_X86_WORD_AT_A_TIME_H */
@@ -1083,6 +1083,21 @@ do_page_fault(struct pt_regs *regs, unsigned long error_code)
 		return;
 	}
 
+	/*
+	 * Try to handle user faults without mmap_sem first; only the
+	 * simple cases are handled there, everything else comes back
+	 * with VM_FAULT_RETRY and takes the regular path below.
+	 */
+	if (error_code & PF_USER) {
+		fault = handle_speculative_fault(mm, address, flags);
+		if (!(fault & VM_FAULT_RETRY)) {
+			tsk->min_flt++;
+			perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, 1,
+				      regs, address);
+			return;
+		}
+	}
+
 	/*
 	 * When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in
@@ -6,6 +6,8 @@
 #include <asm/fixmap.h>
 
 #define PGALLOC_GFP GFP_KERNEL | __GFP_NOTRACK | __GFP_REPEAT | __GFP_ZERO
+/* Page tables of user address spaces are charged to the memory cgroup */
+#define PGALLOC_USER_GFP_KMEMCG	(PGALLOC_GFP | __GFP_KMEMCG)
 
 #ifdef CONFIG_HIGHPTE
 #define PGALLOC_USER_GFP __GFP_HIGHMEM
@@ -13,7 +15,7 @@
 #define PGALLOC_USER_GFP 0
 #endif
 
-gfp_t __userpte_alloc_gfp = PGALLOC_GFP | PGALLOC_USER_GFP;
+gfp_t __userpte_alloc_gfp = PGALLOC_USER_GFP_KMEMCG | PGALLOC_USER_GFP;
 
 pte_t *pte_alloc_one_kernel(struct mm_struct *mm, unsigned long address)
 {
@@ -192,7 +194,7 @@ static int preallocate_pmds(pmd_t *pmds[])
 	bool failed = false;
 
 	for(i = 0; i < PREALLOCATED_PMDS; i++) {
-		pmd_t *pmd = (pmd_t *)__get_free_page(PGALLOC_GFP);
+		pmd_t *pmd = (pmd_t *)__get_free_page(PGALLOC_USER_GFP_KMEMCG);
 		if (pmd == NULL)
 			failed = true;
 		pmds[i] = pmd;
@@ -258,7 +260,7 @@ pgd_t *pgd_alloc(struct mm_struct *mm)
 	pgd_t *pgd;
 	pmd_t *pmds[PREALLOCATED_PMDS];
 
-	pgd = (pgd_t *)__get_free_page(PGALLOC_GFP);
+	pgd = (pgd_t *)__get_free_page(PGALLOC_USER_GFP_KMEMCG);
 
 	if (pgd == NULL)
 		goto out;
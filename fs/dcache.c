@@ -746,10 +746,13 @@ static void shrink_dentry_list(struct list_head *list)
  * @sb:		superblock to shrink dentry LRU.
  * @count:	number of entries to prune
  * @flags:	flags to control the dentry processing
+ * @memcg:	only prune dentries charged to this memory cgroup, if set
  *
  * If flags contains DCACHE_REFERENCED reference dentries will not be pruned.
+ * Dentries skipped for @memcg count against @count.
  */
-static void __shrink_dcache_sb(struct super_block *sb, int count, int flags)
+static void __shrink_dcache_sb(struct super_block *sb, int count, int flags,
+			       struct mem_cgroup *memcg)
 {
 	struct dentry *dentry;
 	LIST_HEAD(referenced);
@@ -773,7 +776,12 @@ relock:
 		 * dentry has this flag set, don't free it.  Clear the flag
 		 * and put it back on the LRU.
 		 */
-		if (flags & DCACHE_REFERENCED &&
+		if (!mem_cgroup_owns_kmem(memcg, dentry)) {
+			list_move(&dentry->d_lru, &referenced);
+			spin_unlock(&dentry->d_lock);
+			if (!--count)
+				break;
+		} else if (flags & DCACHE_REFERENCED &&
 				dentry->d_flags & DCACHE_REFERENCED) {
 			dentry->d_flags &= ~DCACHE_REFERENCED;
 			list_move(&dentry->d_lru, &referenced);
@@ -797,6 +805,7 @@ relock:
  * prune_dcache_sb - shrink the dcache
  * @sb: superblock
  * @nr_to_scan: number of entries to try to free
+ * @memcg: memory cgroup being reclaimed from, or %NULL
  *
  * Attempt to shrink the superblock dcache LRU by @nr_to_scan entries. This is
  * done when we need more memory an called from the superblock shrinker
@@ -805,9 +814,10 @@ relock:
  * This function may fail to free any resources if all the dentries are in
  * use.
  */
-void prune_dcache_sb(struct super_block *sb, int nr_to_scan)
+void prune_dcache_sb(struct super_block *sb, int nr_to_scan,
+		     struct mem_cgroup *memcg)
 {
-	__shrink_dcache_sb(sb, nr_to_scan, DCACHE_REFERENCED);
+	__shrink_dcache_sb(sb, nr_to_scan, DCACHE_REFERENCED, memcg);
 }
 
 /**
@@ -1156,7 +1166,7 @@ void shrink_dcache_parent(struct dentry * parent)
 	int found;
 
 	while ((found = select_parent(parent)) != 0)
-		__shrink_dcache_sb(sb, found, 0);
+		__shrink_dcache_sb(sb, found, 0, NULL);
 }
 EXPORT_SYMBOL(shrink_dcache_parent);
 
@@ -2955,7 +2965,7 @@ static void __init dcache_init(void)
 	 * of the dcache. 
 	 */
 	dentry_cache = KMEM_CACHE(dentry,
-		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD);
+		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD|SLAB_ACCOUNT);
 
 	/* Hash may have been set up in dcache_init_early */
 	if (!hashdist)
@@ -0,0 +1,604 @@
+/*
+ *  linux/fs/ext4/extent_status.c
+ *
+ * Per-inode cache of the block mapping state, kept as an rbtree of
+ * non-overlapping extents.
+ *
+ * Each extent records whether its blocks are written, unwritten,
+ * delayed or a hole.  Written and unwritten extents and holes mirror
+ * the on-disk mapping and are only a cache: they are filled in by
+ * ext4_map_blocks() and may be dropped by the shrinker at any time.
+ * Delayed extents are the only record of which blocks have been
+ * reserved by delayed allocation without being allocated, and they
+ * stay in the tree until the blocks are allocated or the pages that
+ * dirtied them are invalidated.
+ *
+ * Modifications of the cached on-disk state happen under i_data_sem
+ * held for writing, lookups only need i_es_lock.
+ */
+
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include "ext4.h"
+#include "ext4_extents.h"
+
+static struct kmem_cache *ext4_es_cachep;
+
+int __init ext4_init_es(void)
+{
+	ext4_es_cachep = KMEM_CACHE(extent_status, SLAB_RECLAIM_ACCOUNT);
+	if (ext4_es_cachep == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+void ext4_exit_es(void)
+{
+	kmem_cache_destroy(ext4_es_cachep);
+}
+
+void ext4_es_init_tree(struct ext4_es_tree *tree)
+{
+	tree->root = RB_ROOT;
+	tree->cache_es = NULL;
+}
+
+static inline ext4_lblk_t ext4_es_end(struct extent_status *es)
+{
+	BUG_ON(es->es_lblk + es->es_len < es->es_lblk);
+	return es->es_lblk + es->es_len - 1;
+}
+
+static inline struct extent_status *ext4_es_next(struct extent_status *es)
+{
+	struct rb_node *node = rb_next(&es->rb_node);
+
+	return node ? rb_entry(node, struct extent_status, rb_node) : NULL;
+}
+
+/*
+ * Return the extent containing @lblk, or the first one after it if
+ * @lblk is not covered by any extent.
+ */
+static struct extent_status *__es_tree_search(struct rb_root *root,
+					      ext4_lblk_t lblk)
+{
+	struct rb_node *node = root->rb_node;
+	struct extent_status *es = NULL;
+
+	while (node) {
+		es = rb_entry(node, struct extent_status, rb_node);
+		if (lblk < es->es_lblk)
+			node = node->rb_left;
+		else if (lblk > ext4_es_end(es))
+			node = node->rb_right;
+		else
+			return es;
+	}
+
+	if (es && lblk > ext4_es_end(es))
+		es = ext4_es_next(es);
+	return es;
+}
+
+/*
+ * Nodes are allocated with i_es_lock held.  If the atomic allocation
+ * fails the caller drops the lock, refills @spare with a sleeping
+ * allocation and tries again.
+ */
+static struct extent_status *
+ext4_es_alloc_extent(struct inode *inode, ext4_lblk_t lblk, ext4_lblk_t len,
+		     ext4_fsblk_t pblk, struct extent_status **spare)
+{
+	struct extent_status *es;
+
+	if (*spare) {
+		es = *spare;
+		*spare = NULL;
+	} else {
+		es = kmem_cache_alloc(ext4_es_cachep, GFP_ATOMIC);
+		if (es == NULL)
+			return NULL;
+	}
+	es->es_lblk = lblk;
+	es->es_len = len;
+	es->es_pblk = pblk;
+
+	/* Delayed extents are not a cache and cannot be reclaimed */
+	if (!ext4_es_is_delayed(es)) {
+		EXT4_I(inode)->i_es_lru_nr++;
+		percpu_counter_inc(&EXT4_SB(inode->i_sb)->s_extent_cache_cnt);
+	}
+	return es;
+}
+
+static void ext4_es_free_extent(struct inode *inode, struct extent_status *es)
+{
+	if (!ext4_es_is_delayed(es)) {
+		BUG_ON(EXT4_I(inode)->i_es_lru_nr == 0);
+		EXT4_I(inode)->i_es_lru_nr--;
+		percpu_counter_dec(&EXT4_SB(inode->i_sb)->s_extent_cache_cnt);
+	}
+	kmem_cache_free(ext4_es_cachep, es);
+}
+
+/*
+ * Check whether @es2 directly follows @es1 with the same status, and
+ * for mapped extents, the same physical layout.
+ */
+static int ext4_es_can_be_merged(struct extent_status *es1,
+				 struct extent_status *es2)
+{
+	if (ext4_es_status(es1) != ext4_es_status(es2))
+		return 0;
+
+	if ((__u64)es1->es_len + es2->es_len > EXT_MAX_BLOCKS)
+		return 0;
+
+	if ((__u64)es1->es_lblk + es1->es_len != es2->es_lblk)
+		return 0;
+
+	if ((ext4_es_is_written(es1) || ext4_es_is_unwritten(es1)) &&
+	    ext4_es_pblock(es1) + es1->es_len != ext4_es_pblock(es2))
+		return 0;
+
+	return 1;
+}
+
+static struct extent_status *
+ext4_es_try_to_merge_left(struct inode *inode, struct extent_status *es)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct extent_status *es1;
+	struct rb_node *node;
+
+	node = rb_prev(&es->rb_node);
+	if (!node)
+		return es;
+
+	es1 = rb_entry(node, struct extent_status, rb_node);
+	if (ext4_es_can_be_merged(es1, es)) {
+		es1->es_len += es->es_len;
+		rb_erase(&es->rb_node, &tree->root);
+		ext4_es_free_extent(inode, es);
+		es = es1;
+	}
+
+	return es;
+}
+
+static struct extent_status *
+ext4_es_try_to_merge_right(struct inode *inode, struct extent_status *es)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct extent_status *es1;
+
+	es1 = ext4_es_next(es);
+	if (es1 && ext4_es_can_be_merged(es, es1)) {
+		es->es_len += es1->es_len;
+		rb_erase(&es1->rb_node, &tree->root);
+		ext4_es_free_extent(inode, es1);
+	}
+
+	return es;
+}
+
+/*
+ * Insert @newes into the tree, which must not contain any extent
+ * overlapping it.  Neighbours it can be merged with are always on
+ * the search path, so they are merged on the way down.
+ */
+static int __es_insert_extent(struct inode *inode, struct extent_status *newes,
+			      struct extent_status **spare)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct rb_node **p = &tree->root.rb_node;
+	struct rb_node *parent = NULL;
+	struct extent_status *es;
+
+	while (*p) {
+		parent = *p;
+		es = rb_entry(parent, struct extent_status, rb_node);
+
+		if (newes->es_lblk < es->es_lblk) {
+			if (ext4_es_can_be_merged(newes, es)) {
+				es->es_lblk = newes->es_lblk;
+				es->es_len += newes->es_len;
+				ext4_es_store_pblock(es, newes->es_pblk);
+				es = ext4_es_try_to_merge_left(inode, es);
+				goto out;
+			}
+			p = &(*p)->rb_left;
+		} else if (newes->es_lblk > ext4_es_end(es)) {
+			if (ext4_es_can_be_merged(es, newes)) {
+				es->es_len += newes->es_len;
+				es = ext4_es_try_to_merge_right(inode, es);
+				goto out;
+			}
+			p = &(*p)->rb_right;
+		} else {
+			BUG();
+			return -EINVAL;
+		}
+	}
+
+	es = ext4_es_alloc_extent(inode, newes->es_lblk, newes->es_len,
+				  newes->es_pblk, spare);
+	if (!es)
+		return -ENOMEM;
+	rb_link_node(&es->rb_node, parent, p);
+	rb_insert_color(&es->rb_node, &tree->root);
+
+out:
+	tree->cache_es = es;
+	return 0;
+}
+
+/*
+ * Remove [@lblk, @end] from the tree.  The only case that needs a new
+ * node is punching a range out of the middle of a single extent, and
+ * nothing has been changed yet when that allocation fails.
+ */
+static int __es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
+			      ext4_lblk_t end, struct extent_status **spare)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct extent_status *es, *next;
+	struct extent_status orig_es;
+	ext4_lblk_t len1, len2;
+	ext4_fsblk_t block;
+	int err;
+
+	es = __es_tree_search(&tree->root, lblk);
+	if (!es || es->es_lblk > end)
+		return 0;
+
+	tree->cache_es = NULL;
+
+	orig_es = *es;
+	len1 = lblk > es->es_lblk ? lblk - es->es_lblk : 0;
+	len2 = ext4_es_end(es) > end ? ext4_es_end(es) - end : 0;
+	if (len1 > 0)
+		es->es_len = len1;
+	if (len2 > 0) {
+		block = 0;
+		if (ext4_es_is_written(&orig_es) ||
+		    ext4_es_is_unwritten(&orig_es))
+			block = ext4_es_pblock(&orig_es) +
+				orig_es.es_len - len2;
+		if (len1 > 0) {
+			struct extent_status newes;
+
+			newes.es_lblk = end + 1;
+			newes.es_len = len2;
+			newes.es_pblk = orig_es.es_pblk;
+			ext4_es_store_pblock(&newes, block);
+			err = __es_insert_extent(inode, &newes, spare);
+			if (err) {
+				es->es_len = orig_es.es_len;
+				return err;
+			}
+		} else {
+			es->es_lblk = end + 1;
+			es->es_len = len2;
+			ext4_es_store_pblock(es, block);
+		}
+		return 0;
+	}
+
+	if (len1 > 0)
+		es = ext4_es_next(es);
+
+	while (es && ext4_es_end(es) <= end) {
+		next = ext4_es_next(es);
+		rb_erase(&es->rb_node, &tree->root);
+		ext4_es_free_extent(inode, es);
+		es = next;
+	}
+
+	if (es && es->es_lblk <= end) {
+		ext4_lblk_t orig_len = es->es_len;
+
+		es->es_len = ext4_es_end(es) - end;
+		es->es_lblk = end + 1;
+		if (ext4_es_is_written(es) || ext4_es_is_unwritten(es))
+			ext4_es_store_pblock(es, ext4_es_pblock(es) +
+					     orig_len - es->es_len);
+	}
+	return 0;
+}
+
+/*
+ * Holes are cached from the on-disk mapping, which knows nothing about
+ * delayed allocation.  Clip a hole so that it never replaces a delayed
+ * extent that was added while the mapping was being looked up.
+ */
+static ext4_lblk_t __es_clip_hole(struct ext4_es_tree *tree,
+				  ext4_lblk_t lblk, ext4_lblk_t end)
+{
+	struct extent_status *es;
+
+	es = __es_tree_search(&tree->root, lblk);
+	while (es && es->es_lblk <= end) {
+		if (!ext4_es_is_hole(es))
+			return es->es_lblk > lblk ? es->es_lblk - lblk : 0;
+		es = ext4_es_next(es);
+	}
+	return end - lblk + 1;
+}
+
+static void ext4_es_lru_add(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+
+	/* Once on the list, the shrinker is the one rotating it */
+	if (!list_empty(&ei->i_es_lru))
+		return;
+
+	spin_lock(&sbi->s_es_lru_lock);
+	if (list_empty(&ei->i_es_lru))
+		list_add_tail(&ei->i_es_lru, &sbi->s_es_lru);
+	spin_unlock(&sbi->s_es_lru_lock);
+}
+
+void ext4_es_lru_del(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+
+	spin_lock(&sbi->s_es_lru_lock);
+	if (!list_empty(&ei->i_es_lru))
+		list_del_init(&ei->i_es_lru);
+	spin_unlock(&sbi->s_es_lru_lock);
+}
+
+/*
+ * ext4_es_insert_extent() adds [@lblk, @lblk + @len) with @status to
+ * the tree, replacing whatever was cached for that range before.
+ *
+ * Failing to cache a written or unwritten extent or a hole is
+ * harmless once the stale state is gone, but a delayed extent must
+ * never be lost.
+ */
+int ext4_es_insert_extent(struct inode *inode, ext4_lblk_t lblk,
+			  ext4_lblk_t len, ext4_fsblk_t pblk,
+			  unsigned long long status)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct extent_status newes, *spare = NULL;
+	ext4_lblk_t end;
+	int err = 0;
+
+	if (len == 0)
+		return 0;
+	if (len > EXT_MAX_BLOCKS - lblk)
+		len = EXT_MAX_BLOCKS - lblk;
+	end = lblk + len - 1;
+
+	newes.es_lblk = lblk;
+	newes.es_len = len;
+	newes.es_pblk = (pblk & ~EXTENT_STATUS_FLAGS) |
+			(status & EXTENT_STATUS_FLAGS);
+
+retry:
+	write_lock(&ei->i_es_lock);
+	if (ext4_es_is_hole(&newes)) {
+		newes.es_len = __es_clip_hole(&ei->i_es_tree, lblk, end);
+		if (newes.es_len == 0) {
+			write_unlock(&ei->i_es_lock);
+			goto out;
+		}
+		end = lblk + newes.es_len - 1;
+	}
+
+	err = __es_remove_extent(inode, lblk, end, &spare);
+	if (!err) {
+		err = __es_insert_extent(inode, &newes, &spare);
+		if (err == -ENOMEM && !ext4_es_is_delayed(&newes))
+			err = 0;
+	}
+	write_unlock(&ei->i_es_lock);
+
+	if (err == -ENOMEM) {
+		spare = kmem_cache_alloc(ext4_es_cachep,
+					 GFP_NOFS | __GFP_NOFAIL);
+		goto retry;
+	}
+
+	ext4_es_lru_add(inode);
+out:
+	if (spare)
+		kmem_cache_free(ext4_es_cachep, spare);
+	return err;
+}
+
+/*
+ * ext4_es_remove_extent() forgets everything cached for
+ * [@lblk, @lblk + @len).  This cannot fail.
+ */
+int ext4_es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
+			  ext4_lblk_t len)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct extent_status *spare = NULL;
+	int err;
+
+	if (len == 0)
+		return 0;
+	if (len > EXT_MAX_BLOCKS - lblk)
+		len = EXT_MAX_BLOCKS - lblk;
+
+retry:
+	write_lock(&ei->i_es_lock);
+	err = __es_remove_extent(inode, lblk, lblk + len - 1, &spare);
+	write_unlock(&ei->i_es_lock);
+
+	if (err == -ENOMEM) {
+		spare = kmem_cache_alloc(ext4_es_cachep,
+					 GFP_NOFS | __GFP_NOFAIL);
+		goto retry;
+	}
+
+	if (spare)
+		kmem_cache_free(ext4_es_cachep, spare);
+	return err;
+}
+
+/*
+ * ext4_es_find_delayed_extent() returns the first delayed extent that
+ * overlaps [@lblk, @end] in @es, or sets es->es_len to 0 if there is
+ * none.
+ */
+void ext4_es_find_delayed_extent(struct inode *inode, ext4_lblk_t lblk,
+				 ext4_lblk_t end, struct extent_status *es)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_es_tree *tree = &ei->i_es_tree;
+	struct extent_status *es1;
+
+	es->es_lblk = es->es_len = es->es_pblk = 0;
+
+	read_lock(&ei->i_es_lock);
+	es1 = tree->cache_es;
+	if (!es1 || !in_range(lblk, es1->es_lblk, es1->es_len))
+		es1 = __es_tree_search(&tree->root, lblk);
+
+	while (es1 && es1->es_lblk <= end && !ext4_es_is_delayed(es1))
+		es1 = ext4_es_next(es1);
+
+	if (es1 && es1->es_lblk <= end) {
+		es->es_lblk = es1->es_lblk;
+		es->es_len = es1->es_len;
+		es->es_pblk = es1->es_pblk;
+	}
+	read_unlock(&ei->i_es_lock);
+}
+
+/*
+ * ext4_es_lookup_extent() looks up the extent containing @lblk and
+ * copies it to @es.  Returns 1 if found, 0 if @lblk is not cached.
+ */
+int ext4_es_lookup_extent(struct inode *inode, ext4_lblk_t lblk,
+			  struct extent_status *es)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_es_tree *tree = &ei->i_es_tree;
+	struct extent_status *es1;
+	struct rb_node *node;
+	int found = 0;
+
+	read_lock(&ei->i_es_lock);
+	es1 = tree->cache_es;
+	if (es1 && in_range(lblk, es1->es_lblk, es1->es_len)) {
+		found = 1;
+		goto out;
+	}
+
+	node = tree->root.rb_node;
+	while (node) {
+		es1 = rb_entry(node, struct extent_status, rb_node);
+		if (lblk < es1->es_lblk)
+			node = node->rb_left;
+		else if (lblk > ext4_es_end(es1))
+			node = node->rb_right;
+		else {
+			found = 1;
+			break;
+		}
+	}
+
+out:
+	if (found) {
+		es->es_lblk = es1->es_lblk;
+		es->es_len = es1->es_len;
+		es->es_pblk = es1->es_pblk;
+	}
+	read_unlock(&ei->i_es_lock);
+
+	return found;
+}
+
+static int __es_try_to_reclaim_extents(struct ext4_inode_info *ei,
+				       int nr_to_scan)
+{
+	struct inode *inode = &ei->vfs_inode;
+	struct ext4_es_tree *tree = &ei->i_es_tree;
+	struct extent_status *es, *next;
+	struct rb_node *node;
+	int nr_shrunk = 0;
+
+	if (ei->i_es_lru_nr == 0)
+		return 0;
+
+	node = rb_first(&tree->root);
+	es = node ? rb_entry(node, struct extent_status, rb_node) : NULL;
+	while (es) {
+		next = ext4_es_next(es);
+		if (!ext4_es_is_delayed(es)) {
+			rb_erase(&es->rb_node, &tree->root);
+			ext4_es_free_extent(inode, es);
+			nr_shrunk++;
+			if (--nr_to_scan == 0)
+				break;
+		}
+		es = next;
+	}
+	tree->cache_es = NULL;
+	return nr_shrunk;
+}
+
+/*
+ * Walk the inodes in the order they first cached something, dropping
+ * every extent that is not delayed, and rotate the inodes that were
+ * scanned to the tail.
+ */
+static int ext4_es_shrink(struct shrinker *shrink, struct shrink_control *sc)
+{
+	struct ext4_sb_info *sbi = container_of(shrink,
+					struct ext4_sb_info, s_es_shrinker);
+	struct ext4_inode_info *ei;
+	struct list_head *cur, *tmp;
+	LIST_HEAD(scanned);
+	int nr_to_scan = sc->nr_to_scan;
+	int ret;
+
+	if (!nr_to_scan)
+		goto out;
+
+	spin_lock(&sbi->s_es_lru_lock);
+	list_for_each_safe(cur, tmp, &sbi->s_es_lru) {
+		list_move_tail(cur, &scanned);
+
+		ei = list_entry(cur, struct ext4_inode_info, i_es_lru);
+		if (!write_trylock(&ei->i_es_lock))
+			continue;
+		ret = __es_try_to_reclaim_extents(ei, nr_to_scan);
+		write_unlock(&ei->i_es_lock);
+
+		nr_to_scan -= ret;
+		if (nr_to_scan <= 0)
+			break;
+	}
+	list_splice_tail(&scanned, &sbi->s_es_lru);
+	spin_unlock(&sbi->s_es_lru_lock);
+
+out:
+	return percpu_counter_read_positive(&sbi->s_extent_cache_cnt);
+}
+
+void ext4_es_register_shrinker(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	INIT_LIST_HEAD(&sbi->s_es_lru);
+	spin_lock_init(&sbi->s_es_lru_lock);
+	sbi->s_es_shrinker.shrink = ext4_es_shrink;
+	sbi->s_es_shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&sbi->s_es_shrinker);
+}
+
+void ext4_es_unregister_shrinker(struct super_block *sb)
+{
+	unregister_shrinker(&EXT4_SB(sb)->s_es_shrinker);
+}
@@ -143,6 +143,7 @@ ext4_file_write(struct kiocb *iocb, const struct iovec *iov,
 
 static const struct vm_operations_struct ext4_file_vm_ops = {
 	.fault		= filemap_fault,
+	.map_pages	= filemap_map_pages,
 	.page_mkwrite   = ext4_page_mkwrite,
 };
 
@@ -210,10 +211,100 @@ static int ext4_file_open(struct inode * inode, struct file * filp)
 	return dquot_file_open(inode, filp);
 }
 
+/*
+ * Find the first block in [*lblkp, end] that holds data if @data is
+ * set, or that is a hole otherwise.  Blocks that are delayed or
+ * unwritten count as data.  Returns 1 and the block in *lblkp if one
+ * was found, 0 if not, or a negative error.
+ *
+ * The mapping comes from the extent status tree whenever it is cached
+ * there, and so do the lengths of holes.
+ */
+static int ext4_find_data_or_hole(struct inode *inode, ext4_lblk_t *lblkp,
+				  ext4_lblk_t end, int data)
+{
+	struct ext4_map_blocks map;
+	struct extent_status es, hole;
+	ext4_lblk_t lblk = *lblkp;
+	u64 len;
+	int ret;
+
+	while (lblk <= end) {
+		map.m_lblk = lblk;
+		map.m_len = end - lblk + 1;
+		ret = ext4_map_blocks(NULL, inode, &map, 0);
+		if (ret < 0)
+			return ret;
+		if (ret > 0) {
+			if (data)
+				goto found;
+			len = map.m_len;
+			goto next;
+		}
+
+		/* A hole on disk, unless delayed allocation has filled it */
+		ext4_es_find_delayed_extent(inode, lblk, end, &es);
+		if (es.es_len && es.es_lblk <= lblk) {
+			if (data)
+				goto found;
+			len = (u64)es.es_lblk + es.es_len - lblk;
+			goto next;
+		}
+		if (!data)
+			goto found;
+
+		len = 1;
+		if (ext4_es_lookup_extent(inode, lblk, &hole) &&
+		    ext4_es_is_hole(&hole))
+			len = (u64)hole.es_lblk + hole.es_len - lblk;
+		if (es.es_len && es.es_lblk - lblk < len)
+			len = es.es_lblk - lblk;
+next:
+		if ((u64)lblk + len > end)
+			break;
+		lblk += len;
+		cond_resched();
+	}
+	return 0;
+
+found:
+	*lblkp = lblk;
+	return 1;
+}
+
+static loff_t ext4_seek_data_or_hole(struct inode *inode, loff_t offset,
+				     int origin)
+{
+	unsigned int blkbits = inode->i_blkbits;
+	ext4_lblk_t lblk = offset >> blkbits;
+	ext4_lblk_t end = (inode->i_size - 1) >> blkbits;
+	int ret;
+
+	/*
+	 * Inline data has no block map at all.  Block-mapped files report
+	 * no hole lengths and have no holes cached, so walking one would
+	 * cost a block lookup per block of hole.  Treat either as all
+	 * data, as generic_file_llseek() does.
+	 */
+	if (ext4_has_inline_data(inode) ||
+	    !ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))
+		return origin == SEEK_DATA ? offset : inode->i_size;
+
+	ret = ext4_find_data_or_hole(inode, &lblk, end, origin == SEEK_DATA);
+	if (ret < 0)
+		return ret;
+	if (ret == 0)
+		return origin == SEEK_DATA ? -ENXIO : inode->i_size;
+	if (lblk == offset >> blkbits)
+		return offset;
+	return (loff_t)lblk << blkbits;
+}
+
 /*
  * ext4_llseek() copied from generic_file_llseek() to handle both
  * block-mapped and extent-mapped maxbytes values. This should
- * otherwise be identical with generic_file_llseek().
+ * otherwise be identical with generic_file_llseek(), except that
+ * SEEK_DATA and SEEK_HOLE look at the block mapping.
  */
 loff_t ext4_llseek(struct file *file, loff_t offset, int origin)
 {
@@ -237,25 +328,22 @@ loff_t ext4_llseek(struct file *file, loff_t offset, int origin)
 		offset += file->f_pos;
 		break;
 	case SEEK_DATA:
+	case SEEK_HOLE:
 		/*
-		 * In the generic case the entire file is data, so as long as
-		 * offset isn't at the end of the file then the offset is data.
+		 * There is a virtual hole at the end of the file, and
+		 * nothing to find past it.
 		 */
 		if (offset >= inode->i_size) {
 			mutex_unlock(&inode->i_mutex);
 			return -ENXIO;
 		}
-		break;
-	case SEEK_HOLE:
-		/*
-		 * There is a virtual hole at the end of the file, so as long as
-		 * offset isn't i_size or larger, return i_size.
-		 */
-		if (offset >= inode->i_size) {
+		if (offset < 0)
+			break;
+		offset = ext4_seek_data_or_hole(inode, offset, origin);
+		if (offset < 0) {
 			mutex_unlock(&inode->i_mutex);
-			return -ENXIO;
+			return offset;
 		}
-		offset = inode->i_size;
 		break;
 	}
 
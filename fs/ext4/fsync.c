@@ -265,7 +265,7 @@ int ext4_sync_file(struct file *file, loff_t start, loff_t end, int datasync)
 	jbd2_log_start_commit(journal, commit_tid);
 	ret = jbd2_log_wait_commit(journal, commit_tid);
 	if (needs_barrier)
-		blkdev_issue_flush(inode->i_sb->s_bdev, GFP_KERNEL, NULL);
+		jbd2_journal_flush_fs_dev(journal);
  out:
 	mutex_unlock(&inode->i_mutex);
 	trace_ext4_sync_file_exit(inode, ret);
@@ -0,0 +1,1368 @@
+/*
+ * linux/fs/ext4/inline.c
+ *
+ * Inline data: small files and directories stored in the inode itself.
+ *
+ * The first EXT4_MIN_INLINE_DATA_SIZE bytes of an inline inode live in
+ * i_block; anything beyond that is kept in the value of the in-inode
+ * "system.data" extended attribute, which can grow into whatever in-inode
+ * xattr space is left.  Once the data no longer fits it is moved out to a
+ * regular block and the inode carries on as an ordinary extent (or
+ * indirect) mapped inode.
+ *
+ * The inline area is protected by xattr_sem.  Lock ordering is journal
+ * handle -> page lock -> xattr_sem.
+ */
+
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/fiemap.h>
+#include <linux/slab.h>
+
+#include "ext4_jbd2.h"
+#include "ext4.h"
+#include "ext4_extents.h"
+#include "xattr.h"
+
+/*
+ * Take xattr_sem for writing.  Keep ext4_mark_inode_dirty() from trying
+ * to expand the inode while we hold it, as ext4_xattr_set_handle() does.
+ */
+static void ext4_write_lock_xattr(struct inode *inode, int *save)
+{
+	down_write(&EXT4_I(inode)->xattr_sem);
+	*save = ext4_test_inode_state(inode, EXT4_STATE_NO_EXPAND);
+	ext4_set_inode_state(inode, EXT4_STATE_NO_EXPAND);
+}
+
+static void ext4_write_unlock_xattr(struct inode *inode, int *save)
+{
+	if (!*save)
+		ext4_clear_inode_state(inode, EXT4_STATE_NO_EXPAND);
+	up_write(&EXT4_I(inode)->xattr_sem);
+}
+
+static int ext4_inline_xattr_find(struct inode *inode,
+				  struct ext4_iloc *iloc,
+				  struct ext4_xattr_ibody_find *is)
+{
+	struct ext4_xattr_info i = {
+		.name_index = EXT4_XATTR_INDEX_SYSTEM_DATA,
+		.name = EXT4_XATTR_SYSTEM_DATA,
+	};
+
+	memset(is, 0, sizeof(*is));
+	is->s.not_found = -ENODATA;
+	is->iloc = *iloc;
+	return ext4_xattr_ibody_find(inode, &i, is);
+}
+
+/*
+ * Return the start of the system.data value in the inode, or NULL if
+ * there is no such attribute.
+ */
+static void *ext4_get_inline_xattr_pos(struct inode *inode,
+				       struct ext4_iloc *iloc)
+{
+	struct ext4_xattr_ibody_find is;
+
+	if (ext4_inline_xattr_find(inode, iloc, &is) || is.s.not_found)
+		return NULL;
+	return is.s.base + le16_to_cpu(is.s.here->e_value_offs);
+}
+
+/*
+ * The largest value system.data could be given with the in-inode xattr
+ * space that is free now, rounded down to the xattr padding.
+ */
+static int get_max_inline_xattr_value_size(struct inode *inode,
+					   struct ext4_iloc *iloc)
+{
+	struct ext4_xattr_ibody_header *header;
+	struct ext4_xattr_entry *entry, *last;
+	struct ext4_inode *raw_inode;
+	void *base, *end;
+	size_t min_offs;
+	int free, entry_space = 0;
+
+	if (EXT4_I(inode)->i_extra_isize == 0)
+		return 0;
+
+	raw_inode = ext4_raw_inode(iloc);
+	header = IHDR(inode, raw_inode);
+	base = last = IFIRST(header);
+	end = (void *)raw_inode + EXT4_SB(inode->i_sb)->s_inode_size;
+	min_offs = end - base;
+
+	if (ext4_test_inode_state(inode, EXT4_STATE_XATTR)) {
+		for (entry = IFIRST(header); !IS_LAST_ENTRY(entry);
+		     entry = EXT4_XATTR_NEXT(entry)) {
+			if (!entry->e_value_block && entry->e_value_size) {
+				size_t offs = le16_to_cpu(entry->e_value_offs);
+				if (offs < min_offs)
+					min_offs = offs;
+			}
+			if (entry->e_name_index ==
+			    EXT4_XATTR_INDEX_SYSTEM_DATA &&
+			    entry->e_name_len ==
+			    strlen(EXT4_XATTR_SYSTEM_DATA) &&
+			    !memcmp(entry->e_name, EXT4_XATTR_SYSTEM_DATA,
+				    entry->e_name_len)) {
+				entry_space = EXT4_XATTR_SIZE(
+					le32_to_cpu(entry->e_value_size)) +
+					EXT4_XATTR_LEN(entry->e_name_len);
+			}
+		}
+		last = entry;
+	}
+
+	/* Mirrors the space accounting of ext4_xattr_set_entry() */
+	free = entry_space + min_offs - ((void *)last - base) -
+		sizeof(__u32) -
+		EXT4_XATTR_LEN(strlen(EXT4_XATTR_SYSTEM_DATA));
+	if (free < 0)
+		return 0;
+	return free & ~EXT4_XATTR_ROUND;
+}
+
+/*
+ * Get the maximum size we can store inline in this inode right now.
+ */
+int ext4_get_max_inline_size(struct inode *inode)
+{
+	struct ext4_iloc iloc;
+	int error, max_inline_size;
+
+	if (EXT4_I(inode)->i_extra_isize == 0)
+		return EXT4_MIN_INLINE_DATA_SIZE;
+
+	error = ext4_get_inode_loc(inode, &iloc);
+	if (error) {
+		ext4_error_inode(inode, __func__, __LINE__, 0,
+				 "can't get inode location %lu",
+				 inode->i_ino);
+		return 0;
+	}
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	max_inline_size = get_max_inline_xattr_value_size(inode, &iloc);
+	up_read(&EXT4_I(inode)->xattr_sem);
+
+	brelse(iloc.bh);
+	return max_inline_size + EXT4_MIN_INLINE_DATA_SIZE;
+}
+
+/*
+ * Set up i_inline_size when an inline inode is read in.  The caller
+ * must either hold xattr_sem or be the only user of the inode.
+ */
+int ext4_find_inline_data_nolock(struct inode *inode)
+{
+	struct ext4_xattr_ibody_find is;
+	struct ext4_iloc iloc;
+	int error;
+
+	EXT4_I(inode)->i_inline_size = EXT4_MIN_INLINE_DATA_SIZE;
+	if (EXT4_I(inode)->i_extra_isize == 0)
+		return 0;
+
+	error = ext4_get_inode_loc(inode, &iloc);
+	if (error)
+		return error;
+
+	error = ext4_inline_xattr_find(inode, &iloc, &is);
+	if (!error && !is.s.not_found)
+		EXT4_I(inode)->i_inline_size +=
+			le32_to_cpu(is.s.here->e_value_size);
+
+	brelse(iloc.bh);
+	return error;
+}
+
+/* Copy up to len bytes of inline data into buf; returns the byte count. */
+static int ext4_read_inline_data(struct inode *inode, void *buffer,
+				 unsigned int len, struct ext4_iloc *iloc)
+{
+	struct ext4_inode *raw_inode = ext4_raw_inode(iloc);
+	struct ext4_xattr_ibody_find is;
+	unsigned int cp_len, value_len;
+	int error;
+
+	if (!len)
+		return 0;
+
+	cp_len = min_t(unsigned int, len, EXT4_MIN_INLINE_DATA_SIZE);
+	memcpy(buffer, (void *)raw_inode->i_block, cp_len);
+	len -= cp_len;
+	buffer += cp_len;
+	if (!len)
+		return cp_len;
+
+	error = ext4_inline_xattr_find(inode, iloc, &is);
+	if (error)
+		return error;
+	if (is.s.not_found)
+		return cp_len;
+
+	value_len = min_t(unsigned int, len,
+			  le32_to_cpu(is.s.here->e_value_size));
+	memcpy(buffer, is.s.base + le16_to_cpu(is.s.here->e_value_offs),
+	       value_len);
+	return cp_len + value_len;
+}
+
+/*
+ * Write len bytes at pos into the inline area, which must already be big
+ * enough.  The caller holds xattr_sem for writing and write access to
+ * iloc->bh.
+ */
+static void ext4_write_inline_data(struct inode *inode,
+				   struct ext4_iloc *iloc,
+				   const void *buffer, loff_t pos,
+				   unsigned int len)
+{
+	struct ext4_inode *raw_inode = ext4_raw_inode(iloc);
+	unsigned int cp_len;
+	void *value;
+
+	BUG_ON(pos + len > EXT4_I(inode)->i_inline_size);
+
+	if (pos < EXT4_MIN_INLINE_DATA_SIZE) {
+		cp_len = min_t(unsigned int, len,
+			       EXT4_MIN_INLINE_DATA_SIZE - pos);
+		memcpy((void *)raw_inode->i_block + pos, buffer, cp_len);
+		len -= cp_len;
+		buffer += cp_len;
+		pos += cp_len;
+	}
+	if (!len)
+		return;
+
+	value = ext4_get_inline_xattr_pos(inode, iloc);
+	BUG_ON(!value);
+	memcpy(value + pos - EXT4_MIN_INLINE_DATA_SIZE, buffer, len);
+}
+
+/*
+ * Resize the inline area to len bytes, preserving its contents.  Only
+ * the part beyond i_block needs the system.data attribute; it is left
+ * out entirely for an area that fits i_block so that inodes without any
+ * in-inode xattr space can still hold EXT4_MIN_INLINE_DATA_SIZE bytes.
+ */
+static int ext4_set_inline_value_size(handle_t *handle, struct inode *inode,
+				      struct ext4_iloc *iloc,
+				      unsigned int len)
+{
+	struct ext4_xattr_info i = {
+		.name_index = EXT4_XATTR_INDEX_SYSTEM_DATA,
+		.name = EXT4_XATTR_SYSTEM_DATA,
+	};
+	struct ext4_xattr_ibody_find is;
+	size_t old_len = 0, new_len = 0;
+	void *value = NULL;
+	int error;
+
+	if (len > EXT4_MIN_INLINE_DATA_SIZE)
+		new_len = len - EXT4_MIN_INLINE_DATA_SIZE;
+
+	error = ext4_inline_xattr_find(inode, iloc, &is);
+	if (error)
+		return error;
+	if (!is.s.not_found)
+		old_len = le32_to_cpu(is.s.here->e_value_size);
+	else if (!new_len)
+		goto out;
+
+	if (new_len) {
+		value = kzalloc(new_len, GFP_NOFS);
+		if (!value)
+			return -ENOMEM;
+		if (old_len)
+			memcpy(value, is.s.base +
+			       le16_to_cpu(is.s.here->e_value_offs),
+			       min(old_len, new_len));
+		i.value = value;
+	} else
+		i.value = "";
+	i.value_len = new_len;
+
+	error = ext4_xattr_ibody_set(handle, inode, &i, &is);
+	kfree(value);
+	if (error)
+		return error;
+out:
+	EXT4_I(inode)->i_inline_size = EXT4_MIN_INLINE_DATA_SIZE + new_len;
+	return 0;
+}
+
+/*
+ * Make sure the inode has an inline area of at least len bytes, turning
+ * an empty inode into an inline one if needed.  Returns -ENOSPC if the
+ * inode can't hold that much.  Called with xattr_sem held for writing
+ * and write access to iloc->bh.
+ */
+static int ext4_prepare_inline_data(handle_t *handle, struct inode *inode,
+				    struct ext4_iloc *iloc, unsigned int len)
+{
+	int error;
+
+	if (ext4_has_inline_data(inode) &&
+	    len <= EXT4_I(inode)->i_inline_size)
+		return 0;
+
+	error = ext4_set_inline_value_size(handle, inode, iloc, len);
+	if (error)
+		return error;
+
+	if (!ext4_has_inline_data(inode)) {
+		memset((void *)ext4_raw_inode(iloc)->i_block, 0,
+		       EXT4_MIN_INLINE_DATA_SIZE);
+		ext4_clear_inode_flag(inode, EXT4_INODE_EXTENTS);
+		ext4_set_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+	}
+	return 0;
+}
+
+/*
+ * Drop the inline area and give the inode back an empty block map.
+ * Called with xattr_sem held for writing and write access to iloc->bh.
+ */
+static int ext4_destroy_inline_data_nolock(handle_t *handle,
+					   struct inode *inode,
+					   struct ext4_iloc *iloc)
+{
+	struct ext4_xattr_info i = {
+		.name_index = EXT4_XATTR_INDEX_SYSTEM_DATA,
+		.name = EXT4_XATTR_SYSTEM_DATA,
+		.value = NULL,
+		.value_len = 0,
+	};
+	struct ext4_xattr_ibody_find is;
+	int error;
+
+	error = ext4_inline_xattr_find(inode, iloc, &is);
+	if (error)
+		return error;
+	if (!is.s.not_found) {
+		error = ext4_xattr_ibody_set(handle, inode, &i, &is);
+		if (error)
+			return error;
+	}
+
+	memset((void *)ext4_raw_inode(iloc)->i_block, 0,
+	       EXT4_MIN_INLINE_DATA_SIZE);
+	memset(EXT4_I(inode)->i_data, 0, EXT4_MIN_INLINE_DATA_SIZE);
+	/* Set up the empty extent header before the flag says it is there */
+	if (EXT4_HAS_INCOMPAT_FEATURE(inode->i_sb,
+				      EXT4_FEATURE_INCOMPAT_EXTENTS)) {
+		ext4_ext_tree_init(handle, inode);
+		ext4_set_inode_flag(inode, EXT4_INODE_EXTENTS);
+	}
+	ext4_clear_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+	EXT4_I(inode)->i_inline_size = 0;
+
+	/*
+	 * Nothing that was cached while the data was inline describes a
+	 * real block: start the new block map with an empty status tree.
+	 */
+	ext4_es_remove_extent(inode, 0, EXT_MAX_BLOCKS);
+	return 0;
+}
+
+/*
+ * Put data that could not be moved out to a block back into the inode.
+ */
+static void ext4_restore_inline_data(handle_t *handle, struct inode *inode,
+				     struct ext4_iloc *iloc,
+				     void *buf, unsigned int inline_size)
+{
+	int error;
+
+	error = ext4_prepare_inline_data(handle, inode, iloc, inline_size);
+	if (error) {
+		ext4_msg(inode->i_sb, KERN_EMERG,
+			 "error restoring inline data for inode -- "
+			 "potential data loss! (inode %lu, error %d)",
+			 inode->i_ino, error);
+		return;
+	}
+	ext4_write_inline_data(inode, iloc, buf, 0, inline_size);
+	ext4_set_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+}
+
+/*
+ * Fill page 0 from the inline area.  Called with xattr_sem held.
+ */
+static int ext4_read_inline_page(struct inode *inode, struct page *page)
+{
+	struct ext4_iloc iloc;
+	unsigned int len;
+	void *kaddr;
+	int ret;
+
+	BUG_ON(!PageLocked(page));
+	BUG_ON(page->index);
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	len = min_t(loff_t, EXT4_I(inode)->i_inline_size, i_size_read(inode));
+	kaddr = kmap(page);
+	ret = ext4_read_inline_data(inode, kaddr, len, &iloc);
+	flush_dcache_page(page);
+	kunmap(page);
+	brelse(iloc.bh);
+	if (ret < 0)
+		return ret;
+
+	zero_user_segment(page, ret, PAGE_CACHE_SIZE);
+	SetPageUptodate(page);
+	return ret;
+}
+
+/*
+ * ->readpage() for an inline inode.  Returns -EAGAIN, with the page
+ * still locked, if the inode is no longer inline.
+ */
+int ext4_readpage_inline(struct inode *inode, struct page *page)
+{
+	int ret = 0;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		return -EAGAIN;
+	}
+
+	/* Inline data only ever covers the first page */
+	if (!page->index)
+		ret = ext4_read_inline_page(inode, page);
+	else if (!PageUptodate(page)) {
+		zero_user_segment(page, 0, PAGE_CACHE_SIZE);
+		SetPageUptodate(page);
+	}
+	up_read(&EXT4_I(inode)->xattr_sem);
+
+	unlock_page(page);
+	return ret >= 0 ? 0 : ret;
+}
+
+/*
+ * Try to handle a buffered write from ->write_begin() within the inline
+ * area.  Returns 1 with a running handle and a locked, uptodate page in
+ * *pagep if the write goes inline, 0 if the caller should carry on with
+ * the block based path (the data has been moved out to a block by then),
+ * or a negative error.
+ */
+int ext4_try_to_write_inline_data(struct address_space *mapping,
+				  struct inode *inode,
+				  loff_t pos, unsigned len,
+				  unsigned flags,
+				  struct page **pagep)
+{
+	struct ext4_iloc iloc;
+	struct page *page;
+	handle_t *handle;
+	int ret, no_expand;
+
+	if (pos + len > ext4_get_max_inline_size(inode))
+		return ext4_convert_inline_data(inode);
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	/* The inline area and the inode are the same block */
+	handle = ext4_journal_start(inode, 1);
+	if (IS_ERR(handle)) {
+		ret = PTR_ERR(handle);
+		goto out_brelse;
+	}
+
+	/* We cannot recurse into the filesystem as the transaction is already
+	 * started */
+	flags |= AOP_FLAG_NOFS;
+
+	page = grab_cache_page_write_begin(mapping, 0, flags);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out_stop;
+	}
+
+	ret = ext4_journal_get_write_access(handle, iloc.bh);
+	if (ret)
+		goto out_release;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	if (!ext4_has_inline_data(inode) &&
+	    !ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA)) {
+		/* Someone moved the data out to a block meanwhile */
+		ext4_write_unlock_xattr(inode, &no_expand);
+		ret = 0;
+		goto out_release;
+	}
+
+	ret = ext4_prepare_inline_data(handle, inode, &iloc, pos + len);
+	if (ret) {
+		ext4_write_unlock_xattr(inode, &no_expand);
+		goto out_release;
+	}
+
+	if (!PageUptodate(page)) {
+		ret = ext4_read_inline_page(inode, page);
+		if (ret < 0) {
+			ext4_write_unlock_xattr(inode, &no_expand);
+			goto out_release;
+		}
+	}
+	ext4_write_unlock_xattr(inode, &no_expand);
+
+	ret = ext4_mark_iloc_dirty(handle, inode, &iloc);
+	if (ret) {
+		unlock_page(page);
+		page_cache_release(page);
+		ext4_journal_stop(handle);
+		return ret;
+	}
+
+	*pagep = page;
+	return 1;
+
+out_release:
+	unlock_page(page);
+	page_cache_release(page);
+out_stop:
+	ext4_journal_stop(handle);
+out_brelse:
+	brelse(iloc.bh);
+	if (ret == -ENOSPC)
+		return ext4_convert_inline_data(inode);
+	return ret;
+}
+
+/*
+ * ->write_end() counterpart of ext4_try_to_write_inline_data(): copy what
+ * was written to the page back into the inode.  The page stays clean;
+ * the inode is what gets written out.
+ */
+int ext4_write_inline_data_end(struct inode *inode, loff_t pos, unsigned len,
+			       unsigned copied, struct page *page)
+{
+	handle_t *handle = ext4_journal_current_handle();
+	struct ext4_iloc iloc;
+	int ret, no_expand;
+	void *kaddr;
+
+	if (unlikely(copied < len) && !PageUptodate(page))
+		copied = 0;
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	ret = ext4_journal_get_write_access(handle, iloc.bh);
+	if (ret) {
+		brelse(iloc.bh);
+		return ret;
+	}
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	BUG_ON(!ext4_has_inline_data(inode));
+	kaddr = kmap(page);
+	ext4_write_inline_data(inode, &iloc, kaddr + pos, pos, copied);
+	kunmap(page);
+	ext4_write_unlock_xattr(inode, &no_expand);
+	SetPageUptodate(page);
+
+	ext4_update_inode_fsync_trans(handle, inode, 1);
+	ret = ext4_mark_iloc_dirty(handle, inode, &iloc);
+	return ret ? ret : copied;
+}
+
+/*
+ * Move the inline data of a regular file out to a data block through
+ * page 0 of the page cache.  Used whenever a write, fault or fallocate
+ * needs more room than the inode has; afterwards the file never goes
+ * back inline.
+ */
+int ext4_convert_inline_data(struct inode *inode)
+{
+	struct address_space *mapping = inode->i_mapping;
+	int ret, err, inline_size, no_expand, retries = 0;
+	struct ext4_iloc iloc;
+	struct page *page;
+	handle_t *handle;
+	void *buf;
+
+	if (!ext4_has_inline_data(inode)) {
+		ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+		return 0;
+	}
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+retry:
+	buf = NULL;
+	handle = ext4_journal_start(inode, ext4_writepage_trans_blocks(inode));
+	if (IS_ERR(handle)) {
+		ret = PTR_ERR(handle);
+		goto out_brelse;
+	}
+
+	page = grab_cache_page_write_begin(mapping, 0, AOP_FLAG_NOFS);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out_stop;
+	}
+
+	ret = ext4_journal_get_write_access(handle, iloc.bh);
+	if (ret)
+		goto out_release;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	if (!ext4_has_inline_data(inode)) {
+		ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+		goto out_unlock;
+	}
+
+	inline_size = EXT4_I(inode)->i_inline_size;
+	if (!PageUptodate(page)) {
+		ret = ext4_read_inline_page(inode, page);
+		if (ret < 0)
+			goto out_unlock;
+	}
+
+	/* Keep a copy to put back should the block allocation fail */
+	buf = kmalloc(inline_size, GFP_NOFS);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto out_unlock;
+	}
+	ret = ext4_read_inline_data(inode, buf, inline_size, &iloc);
+	if (ret < 0)
+		goto out_unlock;
+
+	ret = ext4_destroy_inline_data_nolock(handle, inode, &iloc);
+	if (ret)
+		goto out_unlock;
+
+	if (test_opt(inode->i_sb, DELALLOC) && !ext4_should_journal_data(inode))
+		ret = __block_write_begin(page, 0, inline_size,
+					  ext4_da_get_block_prep);
+	else
+		ret = __block_write_begin(page, 0, inline_size,
+					  ext4_get_block);
+	if (ret) {
+		/* __block_write_begin() may have zeroed part of the page */
+		memcpy(kmap(page), buf, inline_size);
+		kunmap(page);
+		ext4_restore_inline_data(handle, inode, &iloc, buf,
+					 inline_size);
+		goto out_unlock;
+	}
+
+	if (ext4_should_journal_data(inode)) {
+		/* ->writepage() journals the page */
+		ext4_set_inode_state(inode, EXT4_STATE_JDATA);
+		set_page_dirty(page);
+	} else {
+		if (ext4_should_order_data(inode))
+			ret = ext4_jbd2_file_inode(handle, inode);
+		block_commit_write(page, 0, inline_size);
+	}
+	ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+
+out_unlock:
+	ext4_write_unlock_xattr(inode, &no_expand);
+	get_bh(iloc.bh);
+	err = ext4_mark_iloc_dirty(handle, inode, &iloc);
+	if (!ret)
+		ret = err;
+out_release:
+	unlock_page(page);
+	page_cache_release(page);
+out_stop:
+	ext4_journal_stop(handle);
+	kfree(buf);
+	if (ret == -ENOSPC && ext4_should_retry_alloc(inode->i_sb, &retries))
+		goto retry;
+out_brelse:
+	brelse(iloc.bh);
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * ext4_truncate() for an inline inode: shrink the inline area to i_size.
+ */
+void ext4_inline_data_truncate(struct inode *inode, int *has_inline)
+{
+	unsigned int i_size, inline_size;
+	struct ext4_iloc iloc;
+	int err, no_expand;
+	handle_t *handle;
+
+	/* The inode, plus the superblock and a neighbour for the orphan list */
+	handle = ext4_journal_start(inode, 3);
+	if (IS_ERR(handle))
+		return;
+
+	err = ext4_get_inode_loc(inode, &iloc);
+	if (err)
+		goto out_stop;
+	err = ext4_journal_get_write_access(handle, iloc.bh);
+	if (err) {
+		brelse(iloc.bh);
+		goto out_stop;
+	}
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	if (!ext4_has_inline_data(inode)) {
+		ext4_write_unlock_xattr(inode, &no_expand);
+		brelse(iloc.bh);
+		*has_inline = 0;
+		goto out_stop;
+	}
+
+	i_size = inode->i_size;
+	inline_size = EXT4_I(inode)->i_inline_size;
+	if (i_size < inline_size) {
+		err = ext4_set_inline_value_size(handle, inode, &iloc,
+					max_t(unsigned int, i_size,
+					      EXT4_MIN_INLINE_DATA_SIZE));
+		if (!err && i_size < EXT4_MIN_INLINE_DATA_SIZE)
+			memset((void *)ext4_raw_inode(&iloc)->i_block + i_size,
+			       0, EXT4_MIN_INLINE_DATA_SIZE - i_size);
+	}
+	ext4_write_unlock_xattr(inode, &no_expand);
+
+	EXT4_I(inode)->i_disksize = inode->i_size;
+	err = ext4_mark_iloc_dirty(handle, inode, &iloc);
+	if (err)
+		ext4_std_error(inode->i_sb, err);
+
+	/*
+	 * If this was a simple ftruncate() and the file will remain alive,
+	 * then we need to clear up the orphan record which we created above.
+	 */
+	if (inode->i_nlink)
+		ext4_orphan_del(handle, inode);
+
+out_stop:
+	ext4_journal_stop(handle);
+}
+
+int ext4_inline_data_fiemap(struct inode *inode,
+			    struct fiemap_extent_info *fieinfo,
+			    int *has_inline)
+{
+	struct ext4_iloc iloc;
+	__u64 physical;
+	int error;
+
+	error = ext4_get_inode_loc(inode, &iloc);
+	if (error)
+		return error;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		*has_inline = 0;
+		goto out;
+	}
+
+	physical = (__u64)iloc.bh->b_blocknr << inode->i_sb->s_blocksize_bits;
+	physical += (char *)ext4_raw_inode(&iloc) - iloc.bh->b_data;
+	physical += offsetof(struct ext4_inode, i_block);
+
+	error = fiemap_fill_next_extent(fieinfo, 0, physical,
+					i_size_read(inode),
+					FIEMAP_EXTENT_DATA_INLINE |
+					FIEMAP_EXTENT_LAST);
+	if (error == 1)
+		error = 0;
+out:
+	up_read(&EXT4_I(inode)->xattr_sem);
+	brelse(iloc.bh);
+	return error;
+}
+
+/*
+ * Directories
+ *
+ * An inline directory has no "." and "..": the first four bytes of
+ * i_block hold the parent's inode number and the entries follow.  The
+ * i_block part and the system.data part are two separate runs of
+ * entries, each ending exactly at the end of its region.
+ */
+
+int ext4_try_create_inline_dir(handle_t *handle, struct inode *parent,
+			       struct inode *inode)
+{
+	int ret, no_expand, inline_size = EXT4_MIN_INLINE_DATA_SIZE;
+	struct ext4_dir_entry_2 *de;
+	struct ext4_inode *raw_inode;
+	struct ext4_iloc iloc;
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	ret = ext4_journal_get_write_access(handle, iloc.bh);
+	if (ret)
+		goto out;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	ret = ext4_prepare_inline_data(handle, inode, &iloc, inline_size);
+	if (ret) {
+		ext4_write_unlock_xattr(inode, &no_expand);
+		goto out;
+	}
+
+	raw_inode = ext4_raw_inode(&iloc);
+	raw_inode->i_block[0] = cpu_to_le32(parent->i_ino);
+	de = (struct ext4_dir_entry_2 *)
+		((void *)raw_inode->i_block + EXT4_INLINE_DOTDOT_SIZE);
+	de->inode = 0;
+	de->rec_len = ext4_rec_len_to_disk(
+		inline_size - EXT4_INLINE_DOTDOT_SIZE, inline_size);
+	ext4_write_unlock_xattr(inode, &no_expand);
+
+	inode->i_size = EXT4_I(inode)->i_disksize = inline_size;
+	get_bh(iloc.bh);
+	ret = ext4_mark_iloc_dirty(handle, inode, &iloc);
+out:
+	brelse(iloc.bh);
+	return ret;
+}
+
+struct buffer_head *ext4_find_inline_entry(struct inode *dir,
+					   const struct qstr *d_name,
+					   struct ext4_dir_entry_2 **res_dir,
+					   int *has_inline_data)
+{
+	struct ext4_inode *raw_inode;
+	struct ext4_iloc iloc;
+	void *inline_start;
+	int ret, inline_size;
+
+	if (ext4_get_inode_loc(dir, &iloc))
+		return NULL;
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	raw_inode = ext4_raw_inode(&iloc);
+	if (d_name->len == 2 && !memcmp(d_name->name, "..", 2)) {
+		/* Only ->inode is valid in the entry handed back for ".." */
+		*res_dir = (struct ext4_dir_entry_2 *)raw_inode->i_block;
+		goto out_find;
+	}
+
+	inline_start = (void *)raw_inode->i_block + EXT4_INLINE_DOTDOT_SIZE;
+	inline_size = EXT4_MIN_INLINE_DATA_SIZE - EXT4_INLINE_DOTDOT_SIZE;
+	ret = ext4_search_dir(iloc.bh, inline_start, inline_size,
+			      dir, d_name, 0, res_dir);
+	if (ret == 1)
+		goto out_find;
+	if (ret < 0)
+		goto out;
+
+	if (EXT4_I(dir)->i_inline_size <= EXT4_MIN_INLINE_DATA_SIZE)
+		goto out;
+
+	inline_start = ext4_get_inline_xattr_pos(dir, &iloc);
+	if (!inline_start)
+		goto out;
+	inline_size = EXT4_I(dir)->i_inline_size - EXT4_MIN_INLINE_DATA_SIZE;
+	ret = ext4_search_dir(iloc.bh, inline_start, inline_size,
+			      dir, d_name, 0, res_dir);
+	if (ret == 1)
+		goto out_find;
+
+out:
+	brelse(iloc.bh);
+	iloc.bh = NULL;
+out_find:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	return iloc.bh;
+}
+
+static int ext4_add_dirent_to_inline(struct dentry *dentry,
+				     struct inode *inode,
+				     struct ext4_iloc *iloc,
+				     void *inline_start, int inline_size)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	const char *name = dentry->d_name.name;
+	int namelen = dentry->d_name.len;
+	struct ext4_dir_entry_2 *de;
+	int err;
+
+	err = ext4_find_dest_de(dir, inode, iloc->bh, inline_start,
+				inline_size, name, namelen, &de);
+	if (err)
+		return err;
+
+	ext4_insert_dentry(dir, inode, de, inline_size, name, namelen);
+	dir->i_mtime = dir->i_ctime = ext4_current_time(dir);
+	dir->i_version++;
+	return 1;
+}
+
+/*
+ * Give the system.data value of a directory that so far only uses
+ * i_block all of the in-inode xattr space left, as one empty entry.
+ */
+static int ext4_expand_inline_dir(handle_t *handle, struct inode *dir,
+				  struct ext4_iloc *iloc)
+{
+	struct ext4_dir_entry_2 *de;
+	int ret, new_size;
+
+	new_size = get_max_inline_xattr_value_size(dir, iloc);
+	if (new_size < EXT4_DIR_REC_LEN(1))
+		return -ENOSPC;
+
+	ret = ext4_set_inline_value_size(handle, dir, iloc,
+					 EXT4_MIN_INLINE_DATA_SIZE + new_size);
+	if (ret)
+		return ret;
+
+	de = ext4_get_inline_xattr_pos(dir, iloc);
+	de->inode = 0;
+	de->rec_len = ext4_rec_len_to_disk(new_size, new_size);
+	dir->i_size = EXT4_I(dir)->i_disksize = EXT4_I(dir)->i_inline_size;
+	return 0;
+}
+
+/*
+ * Stretch the last entry of a run of old_size bytes to cover new_size.
+ */
+static void ext4_update_final_de(void *de_buf, int old_size, int new_size)
+{
+	struct ext4_dir_entry_2 *de, *prev_de = NULL;
+	void *limit = de_buf + old_size;
+	int de_len = 0;
+
+	de = (struct ext4_dir_entry_2 *)de_buf;
+	while ((void *)de < limit) {
+		prev_de = de;
+		de_len = ext4_rec_len_from_disk(de->rec_len, new_size);
+		if (de_len < EXT4_DIR_REC_LEN(1))
+			break;
+		de = (struct ext4_dir_entry_2 *)((void *)de + de_len);
+	}
+	if (prev_de)
+		prev_de->rec_len = ext4_rec_len_to_disk(
+			de_len + new_size - old_size, new_size);
+}
+
+/*
+ * The inline area of a directory is full: move its entries to a newly
+ * allocated first block, with real "." and ".." entries in front.  The
+ * entries keep their offsets relative to readdir positions.  Called with
+ * xattr_sem held for writing and write access to iloc->bh.
+ */
+static int ext4_convert_inline_dir(handle_t *handle, struct inode *dir,
+				   struct ext4_iloc *iloc)
+{
+	int error, inline_size, blocksize = dir->i_sb->s_blocksize;
+	int csum_size = 0;
+	struct buffer_head *dir_block;
+	struct ext4_dir_entry_2 *de;
+	void *buf;
+
+	if (ext4_has_metadata_csum(dir->i_sb))
+		csum_size = sizeof(struct ext4_dir_entry_tail);
+
+	inline_size = EXT4_I(dir)->i_inline_size;
+	buf = kmalloc(inline_size, GFP_NOFS);
+	if (!buf)
+		return -ENOMEM;
+
+	error = ext4_read_inline_data(dir, buf, inline_size, iloc);
+	if (error < 0)
+		goto out;
+
+	error = ext4_destroy_inline_data_nolock(handle, dir, iloc);
+	if (error)
+		goto out;
+
+	dir->i_size = EXT4_I(dir)->i_disksize = blocksize;
+	dir_block = ext4_bread(handle, dir, 0, 1, &error);
+	if (!dir_block)
+		goto out_restore;
+
+	BUFFER_TRACE(dir_block, "get_write_access");
+	error = ext4_journal_get_write_access(handle, dir_block);
+	if (error) {
+		brelse(dir_block);
+		goto out_restore;
+	}
+
+	de = ext4_init_dot_dotdot(dir, (struct ext4_dir_entry_2 *)
+				  dir_block->b_data, blocksize,
+				  le32_to_cpu(((__le32 *)buf)[0]), 1);
+	memcpy(de, buf + EXT4_INLINE_DOTDOT_SIZE,
+	       inline_size - EXT4_INLINE_DOTDOT_SIZE);
+	ext4_update_final_de(dir_block->b_data,
+			     (void *)de - (void *)dir_block->b_data +
+			     inline_size - EXT4_INLINE_DOTDOT_SIZE,
+			     blocksize - csum_size);
+	if (csum_size)
+		initialize_dirent_tail(EXT4_DIRENT_TAIL(dir_block->b_data,
+							blocksize),
+				       blocksize);
+
+	BUFFER_TRACE(dir_block, "call ext4_handle_dirty_dirent_node");
+	error = ext4_handle_dirty_dirent_node(handle, dir, dir_block);
+	brelse(dir_block);
+	goto out;
+
+out_restore:
+	ext4_restore_inline_data(handle, dir, iloc, buf, inline_size);
+	dir->i_size = EXT4_I(dir)->i_disksize = inline_size;
+out:
+	kfree(buf);
+	return error;
+}
+
+/*
+ * Add an entry to an inline directory.  Returns 1 if it was added, 0 if
+ * the directory is (now) block based and the caller should add it there,
+ * or a negative error.
+ */
+int ext4_try_add_inline_entry(handle_t *handle, struct dentry *dentry,
+			      struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	int ret, err, no_expand, inline_size;
+	struct ext4_iloc iloc;
+	void *inline_start;
+
+	ret = ext4_get_inode_loc(dir, &iloc);
+	if (ret)
+		return ret;
+
+	BUFFER_TRACE(iloc.bh, "get_write_access");
+	ret = ext4_journal_get_write_access(handle, iloc.bh);
+	if (ret)
+		goto out_brelse;
+
+	ext4_write_lock_xattr(dir, &no_expand);
+	if (!ext4_has_inline_data(dir))
+		goto out;
+
+	inline_start = (void *)ext4_raw_inode(&iloc)->i_block +
+		EXT4_INLINE_DOTDOT_SIZE;
+	inline_size = EXT4_MIN_INLINE_DATA_SIZE - EXT4_INLINE_DOTDOT_SIZE;
+	ret = ext4_add_dirent_to_inline(dentry, inode, &iloc, inline_start,
+					inline_size);
+	if (ret != -ENOSPC)
+		goto out;
+
+	if (EXT4_I(dir)->i_inline_size == EXT4_MIN_INLINE_DATA_SIZE) {
+		ret = ext4_expand_inline_dir(handle, dir, &iloc);
+		if (ret && ret != -ENOSPC)
+			goto out;
+	}
+
+	inline_size = EXT4_I(dir)->i_inline_size - EXT4_MIN_INLINE_DATA_SIZE;
+	if (inline_size) {
+		inline_start = ext4_get_inline_xattr_pos(dir, &iloc);
+		ret = ext4_add_dirent_to_inline(dentry, inode, &iloc,
+						inline_start, inline_size);
+		if (ret != -ENOSPC)
+			goto out;
+	}
+
+	/* The inline area is full, move the directory out to a block */
+	ret = ext4_convert_inline_dir(handle, dir, &iloc);
+
+out:
+	ext4_write_unlock_xattr(dir, &no_expand);
+	err = ext4_mark_inode_dirty(handle, dir);
+	if (ret >= 0 && err)
+		ret = err;
+out_brelse:
+	brelse(iloc.bh);
+	return ret;
+}
+
+int ext4_delete_inline_entry(handle_t *handle,
+			     struct inode *dir,
+			     struct ext4_dir_entry_2 *de_del,
+			     struct buffer_head *bh,
+			     int *has_inline_data)
+{
+	struct ext4_inode *raw_inode;
+	int err, no_expand, inline_size;
+	struct ext4_iloc iloc;
+	void *inline_start;
+
+	err = ext4_get_inode_loc(dir, &iloc);
+	if (err)
+		return err;
+
+	ext4_write_lock_xattr(dir, &no_expand);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	raw_inode = ext4_raw_inode(&iloc);
+	if ((void *)de_del >= (void *)raw_inode->i_block &&
+	    (void *)de_del < (void *)raw_inode->i_block +
+			     EXT4_MIN_INLINE_DATA_SIZE) {
+		inline_start = (void *)raw_inode->i_block +
+			EXT4_INLINE_DOTDOT_SIZE;
+		inline_size = EXT4_MIN_INLINE_DATA_SIZE -
+			EXT4_INLINE_DOTDOT_SIZE;
+	} else {
+		inline_start = ext4_get_inline_xattr_pos(dir, &iloc);
+		inline_size = EXT4_I(dir)->i_inline_size -
+			EXT4_MIN_INLINE_DATA_SIZE;
+		if (!inline_start) {
+			err = -ENOENT;
+			goto out;
+		}
+	}
+
+	BUFFER_TRACE(bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, bh);
+	if (err)
+		goto out_journal;
+
+	err = ext4_generic_delete_entry(handle, dir, de_del, bh,
+					inline_start, inline_size);
+	if (err)
+		goto out;
+
+	err = ext4_mark_inode_dirty(handle, dir);
+out_journal:
+	if (err)
+		ext4_std_error(dir->i_sb, err);
+out:
+	ext4_write_unlock_xattr(dir, &no_expand);
+	brelse(iloc.bh);
+	return err;
+}
+
+static int ext4_inline_region_empty(struct inode *dir, struct buffer_head *bh,
+				    void *start, int size)
+{
+	struct ext4_dir_entry_2 *de;
+	unsigned int offset = 0;
+
+	while (offset < size) {
+		de = (struct ext4_dir_entry_2 *)(start + offset);
+		if (ext4_check_dir_entry(dir, NULL, de, bh, start, size,
+					 offset))
+			return 1;
+		if (le32_to_cpu(de->inode))
+			return 0;
+		offset += ext4_rec_len_from_disk(de->rec_len,
+						 dir->i_sb->s_blocksize);
+	}
+	return 1;
+}
+
+/*
+ * empty_dir() for an inline directory.  As there, a damaged directory
+ * is reported empty so that it can be removed.
+ */
+int empty_inline_dir(struct inode *dir, int *has_inline_data)
+{
+	struct ext4_inode *raw_inode;
+	struct ext4_iloc iloc;
+	void *inline_start;
+	int err, ret = 1;
+
+	err = ext4_get_inode_loc(dir, &iloc);
+	if (err) {
+		EXT4_ERROR_INODE(dir, "error %d getting inode %lu block",
+				 err, dir->i_ino);
+		return 1;
+	}
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	raw_inode = ext4_raw_inode(&iloc);
+	if (!le32_to_cpu(raw_inode->i_block[0])) {
+		ext4_warning(dir->i_sb, "bad inline directory (dir #%lu) - "
+			     "no `..'", dir->i_ino);
+		goto out;
+	}
+
+	ret = ext4_inline_region_empty(dir, iloc.bh,
+			(void *)raw_inode->i_block + EXT4_INLINE_DOTDOT_SIZE,
+			EXT4_MIN_INLINE_DATA_SIZE - EXT4_INLINE_DOTDOT_SIZE);
+	if (!ret || EXT4_I(dir)->i_inline_size <= EXT4_MIN_INLINE_DATA_SIZE)
+		goto out;
+
+	inline_start = ext4_get_inline_xattr_pos(dir, &iloc);
+	if (inline_start)
+		ret = ext4_inline_region_empty(dir, iloc.bh, inline_start,
+			EXT4_I(dir)->i_inline_size -
+			EXT4_MIN_INLINE_DATA_SIZE);
+out:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	brelse(iloc.bh);
+	return ret;
+}
+
+/*
+ * readdir for an inline directory.  "." and ".." are made up at the
+ * positions they would have in a directory block, and every other entry
+ * is reported at the position it will have once the directory is moved
+ * out to a block, so that f_pos stays valid across the conversion.
+ */
+int ext4_read_inline_dir(struct file *filp,
+			 void *dirent, filldir_t filldir,
+			 int *has_inline_data)
+{
+	struct inode *inode = filp->f_path.dentry->d_inode;
+	struct super_block *sb = inode->i_sb;
+	int dotdot_offset, dotdot_size, extra_offset, extra_size;
+	int error = 0, ret, inline_size;
+	struct ext4_dir_entry_2 *de;
+	unsigned int parent_ino;
+	struct ext4_iloc iloc;
+	void *dir_buf = NULL;
+	loff_t i;
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	inline_size = EXT4_I(inode)->i_inline_size;
+	dir_buf = kmalloc(inline_size, GFP_NOFS);
+	if (!dir_buf) {
+		ret = -ENOMEM;
+		up_read(&EXT4_I(inode)->xattr_sem);
+		goto out;
+	}
+
+	ret = ext4_read_inline_data(inode, dir_buf, inline_size, &iloc);
+	up_read(&EXT4_I(inode)->xattr_sem);
+	if (ret < 0)
+		goto out;
+	ret = 0;
+
+	parent_ino = le32_to_cpu(((__le32 *)dir_buf)[0]);
+	dotdot_offset = EXT4_DIR_REC_LEN(1);
+	dotdot_size = dotdot_offset + EXT4_DIR_REC_LEN(2);
+	extra_offset = dotdot_size - EXT4_INLINE_DOTDOT_SIZE;
+	extra_size = extra_offset + inline_size;
+
+	/*
+	 * If the directory has changed since the last call to readdir(2),
+	 * we might be pointing into the middle of an entry.  Rescan from
+	 * the start to find the entry boundary at or before f_pos.
+	 */
+	if (filp->f_version != inode->i_version) {
+		for (i = 0; i < extra_size && i < filp->f_pos;) {
+			if (!i) {
+				i = dotdot_offset;
+				continue;
+			} else if (i == dotdot_offset) {
+				i = dotdot_size;
+				continue;
+			}
+			de = (struct ext4_dir_entry_2 *)
+				(dir_buf + i - extra_offset);
+			if (ext4_rec_len_from_disk(de->rec_len,
+				sb->s_blocksize) < EXT4_DIR_REC_LEN(1))
+				break;
+			i += ext4_rec_len_from_disk(de->rec_len,
+						    sb->s_blocksize);
+		}
+		filp->f_pos = i;
+		filp->f_version = inode->i_version;
+	}
+
+	while (!error && filp->f_pos < extra_size) {
+		if (filp->f_pos == 0) {
+			error = filldir(dirent, ".", 1, 0, inode->i_ino,
+					DT_DIR);
+			if (error)
+				break;
+			filp->f_pos = dotdot_offset;
+			continue;
+		}
+
+		if (filp->f_pos == dotdot_offset) {
+			error = filldir(dirent, "..", 2, dotdot_offset,
+					parent_ino, DT_DIR);
+			if (error)
+				break;
+			filp->f_pos = dotdot_size;
+			continue;
+		}
+
+		de = (struct ext4_dir_entry_2 *)
+			(dir_buf + filp->f_pos - extra_offset);
+		if (ext4_check_dir_entry(inode, filp, de, iloc.bh, dir_buf,
+					 inline_size,
+					 filp->f_pos - extra_offset))
+			goto out;
+		if (le32_to_cpu(de->inode)) {
+			error = filldir(dirent, de->name, de->name_len,
+					filp->f_pos, le32_to_cpu(de->inode),
+					get_dtype(sb, de->file_type));
+			if (error)
+				break;
+		}
+		filp->f_pos += ext4_rec_len_from_disk(de->rec_len,
+						      sb->s_blocksize);
+	}
+out:
+	kfree(dir_buf);
+	brelse(iloc.bh);
+	return ret;
+}
+
+/*
+ * Return the inode buffer and a fake entry whose ->inode is the parent,
+ * for rename of an inline directory.  Sets *retval to -EAGAIN if the
+ * directory is not inline any more.
+ */
+struct buffer_head *ext4_get_first_inline_block(struct inode *inode,
+					struct ext4_dir_entry_2 **parent_de,
+					int *retval)
+{
+	struct ext4_iloc iloc;
+
+	*retval = ext4_get_inode_loc(inode, &iloc);
+	if (*retval)
+		return NULL;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		brelse(iloc.bh);
+		*retval = -EAGAIN;
+		return NULL;
+	}
+	*parent_de = (struct ext4_dir_entry_2 *)ext4_raw_inode(&iloc)->i_block;
+	up_read(&EXT4_I(inode)->xattr_sem);
+
+	return iloc.bh;
+}
@@ -149,6 +149,10 @@ flags_out:
 		if (!inode_owner_or_capable(inode))
 			return -EPERM;
 
+		/* The inode checksum seed includes the generation */
+		if (ext4_has_metadata_csum(inode->i_sb))
+			return -ENOTTY;
+
 		err = mnt_want_write(filp->f_path.mnt);
 		if (err)
 			return err;
@@ -250,6 +254,14 @@ setversion_out:
 			goto mext_out;
 		}
 
+		if (EXT4_HAS_RO_COMPAT_FEATURE(inode->i_sb,
+			       EXT4_FEATURE_RO_COMPAT_BIGALLOC)) {
+			ext4_msg(inode->i_sb, KERN_ERR,
+				 "Online defrag not supported with bigalloc");
+			err = -EOPNOTSUPP;
+			goto mext_out;
+		}
+
 		err = mnt_want_write(filp->f_path.mnt);
 		if (err)
 			goto mext_out;
@@ -475,7 +475,8 @@ int ext4_ext_migrate(struct inode *inode)
 	 */
 	if (!EXT4_HAS_INCOMPAT_FEATURE(inode->i_sb,
 				       EXT4_FEATURE_INCOMPAT_EXTENTS) ||
-	    (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)))
+	    (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) ||
+	    ext4_has_inline_data(inode))
 		return -EINVAL;
 
 	if (S_ISLNK(inode->i_mode) && inode->i_blocks == 0)
@@ -508,6 +509,11 @@ int ext4_ext_migrate(struct inode *inode)
 	 * when we drop inode reference.
 	 */
 	tmp_inode->i_nlink = 0;
+	/*
+	 * The extent blocks built under tmp_inode end up owned by inode
+	 * after the swap, so checksum them with inode's seed.
+	 */
+	EXT4_I(tmp_inode)->i_csum_seed = EXT4_I(inode)->i_csum_seed;
 
 	ext4_ext_tree_init(handle, tmp_inode);
 	ext4_orphan_add(handle, tmp_inode);
@@ -19,21 +19,125 @@
 #include <linux/pipe_fs_i.h>
 #include <linux/swap.h>
 #include <linux/splice.h>
+#include <linux/hash.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 MODULE_ALIAS("devname:fuse");
 
 static struct kmem_cache *fuse_req_cachep;
 
-static struct fuse_conn *fuse_get_conn(struct file *file)
+static struct fuse_dev *fuse_get_dev(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount or clone and is valid until the file is
+	 * released.
 	 */
 	return file->private_data;
 }
 
+/*
+ * Recompute the CPU to channel map.  Channels are spread round-robin
+ * over the possible CPUs in the order they were added, so with as many
+ * channels as CPUs every CPU has a channel of its own.
+ *
+ * Called with fc->lock held
+ */
+static void fuse_dev_remap(struct fuse_conn *fc)
+{
+	struct fuse_dev *fud = NULL;
+	int cpu;
+
+	if (list_empty(&fc->devices))
+		return;
+
+	for_each_possible_cpu(cpu) {
+		if (!fud || fud->entry.next == &fc->devices)
+			fud = list_first_entry(&fc->devices, struct fuse_dev,
+					       entry);
+		else
+			fud = list_entry(fud->entry.next, struct fuse_dev,
+					 entry);
+		fc->dev_map[cpu] = fud;
+	}
+}
+
+/*
+ * Channel serving the current CPU.  Being migrated after the lookup is
+ * harmless, it just means a non-local channel is used for this request.
+ *
+ * Called with fc->lock held and at least one channel attached
+ */
+static struct fuse_dev *fuse_dispatch_dev(struct fuse_conn *fc)
+{
+	return fc->dev_map[raw_smp_processor_id()];
+}
+
+struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc)
+{
+	struct fuse_dev *fud;
+	struct fuse_dev **map = NULL;
+	int i;
+
+	fud = kzalloc(sizeof(struct fuse_dev), GFP_KERNEL);
+	if (!fud)
+		return NULL;
+
+	if (!fc->dev_map) {
+		map = kcalloc(nr_cpu_ids, sizeof(struct fuse_dev *),
+			      GFP_KERNEL);
+		if (!map) {
+			kfree(fud);
+			return NULL;
+		}
+	}
+
+	fud->fc = fuse_conn_get(fc);
+	init_waitqueue_head(&fud->waitq);
+	INIT_LIST_HEAD(&fud->pending);
+	INIT_LIST_HEAD(&fud->interrupts);
+	INIT_LIST_HEAD(&fud->io);
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&fud->processing[i]);
+
+	spin_lock(&fc->lock);
+	if (!fc->dev_map) {
+		fc->dev_map = map;
+		map = NULL;
+	}
+	list_add_tail(&fud->entry, &fc->devices);
+	fuse_dev_remap(fc);
+	spin_unlock(&fc->lock);
+	kfree(map);
+
+	return fud;
+}
+EXPORT_SYMBOL_GPL(fuse_dev_alloc);
+
+void fuse_dev_free(struct fuse_dev *fud)
+{
+	struct fuse_conn *fc = fud->fc;
+
+	spin_lock(&fc->lock);
+	list_del(&fud->entry);
+	fuse_dev_remap(fc);
+	spin_unlock(&fc->lock);
+
+	kfree(fud);
+	fuse_conn_put(fc);
+}
+EXPORT_SYMBOL_GPL(fuse_dev_free);
+
+void fuse_dev_wake_all(struct fuse_conn *fc)
+{
+	struct fuse_dev *fud;
+
+	list_for_each_entry(fud, &fc->devices, entry) {
+		wake_up_all(&fud->waitq);
+		kill_fasync(&fud->fasync, SIGIO, POLL_IN);
+	}
+}
+
 static void fuse_request_init(struct fuse_req *req)
 {
 	memset(req, 0, sizeof(*req));
@@ -227,28 +331,39 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 	return nbytes;
 }
 
+/*
+ * Unique IDs step by two, leaving the low bit for interrupt requests,
+ * which carry the ID of the interrupted request with the bit set.
+ */
 static u64 fuse_get_unique(struct fuse_conn *fc)
 {
-	fc->reqctr++;
+	fc->reqctr += FUSE_REQ_ID_STEP;
 	/* zero is special */
 	if (fc->reqctr == 0)
-		fc->reqctr = 1;
+		fc->reqctr = FUSE_REQ_ID_STEP;
 
 	return fc->reqctr;
 }
 
+static unsigned fuse_req_hash(u64 unique)
+{
+	return hash_long(unique & ~FUSE_INT_REQ_BIT, FUSE_PQ_HASH_BITS);
+}
+
 static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_dev *fud = fuse_dispatch_dev(fc);
+
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
+	list_add_tail(&req->list, &fud->pending);
 	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
 		atomic_inc(&fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	wake_up(&fud->waitq);
+	kill_fasync(&fud->fasync, SIGIO, POLL_IN);
 }
 
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
@@ -259,10 +374,12 @@ void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 
 	spin_lock(&fc->lock);
 	if (fc->connected) {
+		struct fuse_dev *fud = fuse_dispatch_dev(fc);
+
 		fc->forget_list_tail->next = forget;
 		fc->forget_list_tail = forget;
-		wake_up(&fc->waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+		wake_up(&fud->waitq);
+		kill_fasync(&fud->fasync, SIGIO, POLL_IN);
 	} else {
 		kfree(forget);
 	}
@@ -335,11 +452,12 @@ __acquires(fc->lock)
 	spin_lock(&fc->lock);
 }
 
-static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
+/* Interrupts go to the channel the request was read from */
+static void queue_interrupt(struct fuse_dev *fud, struct fuse_req *req)
 {
-	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	list_add_tail(&req->intr_entry, &fud->interrupts);
+	wake_up(&fud->waitq);
+	kill_fasync(&fud->fasync, SIGIO, POLL_IN);
 }
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
@@ -357,7 +475,7 @@ __acquires(fc->lock)
 
 		req->interrupted = 1;
 		if (req->state == FUSE_REQ_SENT)
-			queue_interrupt(fc, req);
+			queue_interrupt(req->fud, req);
 	}
 
 	if (!req->force) {
@@ -911,21 +1029,22 @@ static int forget_pending(struct fuse_conn *fc)
 	return fc->forget_list_head.next != NULL;
 }
 
-static int request_pending(struct fuse_conn *fc)
+static int request_pending(struct fuse_dev *fud)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+	return !list_empty(&fud->pending) || !list_empty(&fud->interrupts) ||
+		forget_pending(fud->fc);
 }
 
 /* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
+static void request_wait(struct fuse_dev *fud)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	struct fuse_conn *fc = fud->fc;
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	add_wait_queue_exclusive(&fud->waitq, &wait);
+	while (fc->connected && !request_pending(fud)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
 			break;
@@ -935,7 +1054,7 @@ __acquires(fc->lock)
 		spin_lock(&fc->lock);
 	}
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(&fud->waitq, &wait);
 }
 
 /*
@@ -956,7 +1075,7 @@ __releases(fc->lock)
 	int err;
 
 	list_del_init(&req->intr_entry);
-	req->intr_unique = fuse_get_unique(fc);
+	req->intr_unique = req->in.h.unique | FUSE_INT_REQ_BIT;
 	memset(&ih, 0, sizeof(ih));
 	memset(&arg, 0, sizeof(arg));
 	ih.len = reqsize;
@@ -1096,12 +1215,13 @@ __releases(fc->lock)
  * the pending list and copies request data to userspace buffer.  If
  * no reply is needed (FORGET) or request has been aborted or there
  * was an error during the copying then it's finished by calling
- * request_end().  Otherwise add it to the processing list, and set
- * the 'sent' flag.
+ * request_end().  Otherwise add it to the processing list of the
+ * channel, and set the 'sent' flag.
  */
-static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
+static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
+	struct fuse_conn *fc = fud->fc;
 	int err;
 	struct fuse_req *req;
 	struct fuse_in *in;
@@ -1111,34 +1231,35 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 	spin_lock(&fc->lock);
 	err = -EAGAIN;
 	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	    !request_pending(fud))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(fud);
 	err = -ENODEV;
 	if (!fc->connected)
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(fud))
 		goto err_unlock;
 
-	if (!list_empty(&fc->interrupts)) {
-		req = list_entry(fc->interrupts.next, struct fuse_req,
+	if (!list_empty(&fud->interrupts)) {
+		req = list_entry(fud->interrupts.next, struct fuse_req,
 				 intr_entry);
 		return fuse_read_interrupt(fc, cs, nbytes, req);
 	}
 
 	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
+		if (list_empty(&fud->pending) || fc->forget_batch-- > 0)
 			return fuse_read_forget(fc, cs, nbytes);
 
 		if (fc->forget_batch <= -8)
 			fc->forget_batch = 16;
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	req = list_entry(fud->pending.next, struct fuse_req, list);
 	req->state = FUSE_REQ_READING;
-	list_move(&req->list, &fc->io);
+	req->fud = fud;
+	list_move(&req->list, &fud->io);
 
 	in = &req->in;
 	reqsize = in->h.len;
@@ -1173,9 +1294,10 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		list_move_tail(&req->list,
+			       &fud->processing[fuse_req_hash(in->h.unique)]);
 		if (req->interrupted)
-			queue_interrupt(fc, req);
+			queue_interrupt(fud, req);
 		spin_unlock(&fc->lock);
 	}
 	return reqsize;
@@ -1190,13 +1312,13 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
 {
 	struct fuse_copy_state cs;
 	struct file *file = iocb->ki_filp;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_dev *fud = fuse_get_dev(file);
+	if (!fud)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 1, iov, nr_segs);
+	fuse_copy_init(&cs, fud->fc, 1, iov, nr_segs);
 
-	return fuse_dev_do_read(fc, file, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_read(fud, file, &cs, iov_length(iov, nr_segs));
 }
 
 static int fuse_dev_pipe_buf_steal(struct pipe_inode_info *pipe,
@@ -1224,18 +1346,18 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	int do_wakeup = 0;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(in);
-	if (!fc)
+	struct fuse_dev *fud = fuse_get_dev(in);
+	if (!fud)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
 		return -ENOMEM;
 
-	fuse_copy_init(&cs, fc, 1, NULL, 0);
+	fuse_copy_init(&cs, fud->fc, 1, NULL, 0);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fc, in, &cs, len);
+	ret = fuse_dev_do_read(fud, in, &cs, len);
 	if (ret < 0)
 		goto out;
 
@@ -1603,14 +1725,15 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 }
 
 /* Look up request on processing list by unique ID */
-static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
+static struct fuse_req *request_find(struct fuse_dev *fud, u64 unique)
 {
 	struct list_head *entry;
+	unsigned hash = fuse_req_hash(unique);
 
-	list_for_each(entry, &fc->processing) {
+	list_for_each(entry, &fud->processing[hash]) {
 		struct fuse_req *req;
 		req = list_entry(entry, struct fuse_req, list);
-		if (req->in.h.unique == unique || req->intr_unique == unique)
+		if (req->in.h.unique == unique)
 			return req;
 	}
 	return NULL;
@@ -1642,13 +1765,14 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
 /*
  * Write a single reply to a request.  First the header is copied from
  * the write buffer.  The request is then searched on the processing
- * list by the unique ID found in the header.  If found, then remove
- * it from the list and copy the rest of the buffer to the request.
- * The request is finished by calling request_end()
+ * list of the channel by the unique ID found in the header.  If found,
+ * then remove it from the list and copy the rest of the buffer to the
+ * request.  The request is finished by calling request_end()
  */
-static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
+static ssize_t fuse_dev_do_write(struct fuse_dev *fud,
 				 struct fuse_copy_state *cs, size_t nbytes)
 {
+	struct fuse_conn *fc = fud->fc;
 	int err;
 	struct fuse_req *req;
 	struct fuse_out_header oh;
@@ -1682,7 +1806,7 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	if (!fc->connected)
 		goto err_unlock;
 
-	req = request_find(fc, oh.unique);
+	req = request_find(fud, oh.unique & ~FUSE_INT_REQ_BIT);
 	if (!req)
 		goto err_unlock;
 
@@ -1694,15 +1818,17 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 		return -ENOENT;
 	}
 	/* Is it an interrupt reply? */
-	if (req->intr_unique == oh.unique) {
+	if (oh.unique & FUSE_INT_REQ_BIT) {
 		err = -EINVAL;
+		if (req->intr_unique != oh.unique)
+			goto err_unlock;
 		if (nbytes != sizeof(struct fuse_out_header))
 			goto err_unlock;
 
 		if (oh.error == -ENOSYS)
 			fc->no_interrupt = 1;
 		else if (oh.error == -EAGAIN)
-			queue_interrupt(fc, req);
+			queue_interrupt(fud, req);
 
 		spin_unlock(&fc->lock);
 		fuse_copy_finish(cs);
@@ -1710,7 +1836,7 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	}
 
 	req->state = FUSE_REQ_WRITING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &fud->io);
 	req->out.h = oh;
 	req->locked = 1;
 	cs->req = req;
@@ -1743,13 +1869,13 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 			      unsigned long nr_segs, loff_t pos)
 {
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(iocb->ki_filp);
-	if (!fc)
+	struct fuse_dev *fud = fuse_get_dev(iocb->ki_filp);
+	if (!fud)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 0, iov, nr_segs);
+	fuse_copy_init(&cs, fud->fc, 0, iov, nr_segs);
 
-	return fuse_dev_do_write(fc, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_write(fud, &cs, iov_length(iov, nr_segs));
 }
 
 static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
@@ -1760,12 +1886,12 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	unsigned idx;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc;
+	struct fuse_dev *fud;
 	size_t rem;
 	ssize_t ret;
 
-	fc = fuse_get_conn(out);
-	if (!fc)
+	fud = fuse_get_dev(out);
+	if (!fud)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
@@ -1812,14 +1938,14 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	}
 	pipe_unlock(pipe);
 
-	fuse_copy_init(&cs, fc, 0, NULL, nbuf);
+	fuse_copy_init(&cs, fud->fc, 0, NULL, nbuf);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
 
 	if (flags & SPLICE_F_MOVE)
 		cs.move_pages = 1;
 
-	ret = fuse_dev_do_write(fc, &cs, len);
+	ret = fuse_dev_do_write(fud, &cs, len);
 
 	for (idx = 0; idx < nbuf; idx++) {
 		struct pipe_buffer *buf = &bufs[idx];
@@ -1833,22 +1959,35 @@ out:
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_dev *fud = fuse_get_dev(file);
+	struct fuse_conn *fc;
+	if (!fud)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	fc = fud->fc;
+	poll_wait(file, &fud->waitq, wait);
 
 	spin_lock(&fc->lock);
 	if (!fc->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(fud))
 		mask |= POLLIN | POLLRDNORM;
 	spin_unlock(&fc->lock);
 
 	return mask;
 }
 
+/* Move the pending and processing requests of a channel to a list */
+static void collect_queued_requests(struct fuse_dev *fud,
+				    struct list_head *head)
+{
+	int i;
+
+	list_splice_tail_init(&fud->pending, head);
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+		list_splice_tail_init(&fud->processing[i], head);
+}
+
 /*
  * Abort all requests on the given list (pending or processing)
  *
@@ -1877,14 +2016,23 @@ __acquires(fc->lock)
  * If the request is asynchronous, then the end function needs to be
  * called after waiting for the request to be unlocked (if it was
  * locked).
+ *
+ * The io lists of all channels are collected first, since a channel
+ * may go away while fc->lock is dropped.
  */
 static void end_io_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
-	while (!list_empty(&fc->io)) {
+	struct fuse_dev *fud;
+	LIST_HEAD(io);
+
+	list_for_each_entry(fud, &fc->devices, entry)
+		list_splice_tail_init(&fud->io, &io);
+
+	while (!list_empty(&io)) {
 		struct fuse_req *req =
-			list_entry(fc->io.next, struct fuse_req, list);
+			list_entry(io.next, struct fuse_req, list);
 		void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
 
 		req->aborted = 1;
@@ -1908,10 +2056,14 @@ static void end_queued_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	struct fuse_dev *fud;
+	LIST_HEAD(head);
+
 	fc->max_background = UINT_MAX;
 	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
+	list_for_each_entry(fud, &fc->devices, entry)
+		collect_queued_requests(fud, &head);
+	end_requests(fc, &head);
 	while (forget_pending(fc))
 		kfree(dequeue_forget(fc, 1, NULL));
 }
@@ -1959,25 +2111,63 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		end_io_requests(fc);
 		end_queued_requests(fc);
 		end_polls(fc);
-		wake_up_all(&fc->waitq);
+		fuse_dev_wake_all(fc);
 		wake_up_all(&fc->blocked_waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 	}
 	spin_unlock(&fc->lock);
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+/*
+ * Release a channel other than the last one.  Pending requests are
+ * handed over to a remaining channel, requests already read from this
+ * one can't be answered any more and are aborted.
+ *
+ * Called with fc->lock held
+ */
+static void fuse_dev_release_one(struct fuse_dev *fud)
+__releases(fc->lock)
+__acquires(fc->lock)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_dev *next;
+	LIST_HEAD(head);
+	int i;
+
+	list_del(&fud->entry);
+	fuse_dev_remap(fc);
+
+	next = list_first_entry(&fc->devices, struct fuse_dev, entry);
+	if (!list_empty(&fud->pending)) {
+		list_splice_tail_init(&fud->pending, &next->pending);
+		wake_up(&next->waitq);
+		kill_fasync(&next->fasync, SIGIO, POLL_IN);
+	}
+
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+		list_splice_tail_init(&fud->processing[i], &head);
+	end_requests(fc, &head);
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
+	struct fuse_dev *fud = fuse_get_dev(file);
+	if (fud) {
+		struct fuse_conn *fc = fud->fc;
+
 		spin_lock(&fc->lock);
-		fc->connected = 0;
-		fc->blocked = 0;
-		end_queued_requests(fc);
-		end_polls(fc);
-		wake_up_all(&fc->blocked_waitq);
+		if (!list_is_singular(&fc->devices)) {
+			fuse_dev_release_one(fud);
+		} else {
+			fc->connected = 0;
+			fc->blocked = 0;
+			end_queued_requests(fc);
+			end_polls(fc);
+			wake_up_all(&fc->blocked_waitq);
+			list_del(&fud->entry);
+		}
 		spin_unlock(&fc->lock);
+		kfree(fud);
 		fuse_conn_put(fc);
 	}
 
@@ -1987,12 +2177,68 @@ EXPORT_SYMBOL_GPL(fuse_dev_release);
 
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_dev *fud = fuse_get_dev(file);
+	if (!fud)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fc->fasync);
+	return fasync_helper(fd, file, on, &fud->fasync);
+}
+
+/*
+ * Attach the file to the connection of an existing channel, making it
+ * a new channel of that connection
+ */
+static int fuse_dev_clone(struct file *file, int oldfd)
+{
+	struct file *old;
+	struct fuse_dev *fud;
+	int err;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EINVAL;
+
+	err = -EINVAL;
+	if (file->f_op != &fuse_dev_operations ||
+	    old->f_op != &fuse_dev_operations || !fuse_get_dev(old))
+		goto out_put;
+
+	fud = fuse_dev_alloc(fuse_get_dev(old)->fc);
+	err = -ENOMEM;
+	if (!fud)
+		goto out_put;
+
+	err = -EINVAL;
+	mutex_lock(&fuse_mutex);
+	if (!file->private_data) {
+		file->private_data = fud;
+		fud = NULL;
+		err = 0;
+	}
+	mutex_unlock(&fuse_mutex);
+	if (fud)
+		fuse_dev_free(fud);
+ out_put:
+	fput(old);
+	return err;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	switch (cmd) {
+	case FUSE_DEV_IOC_CLONE: {
+		int oldfd;
+
+		if (get_user(oldfd, (__u32 __user *) arg))
+			return -EFAULT;
+
+		return fuse_dev_clone(file, oldfd);
+	}
+	default:
+		return -ENOTTY;
+	}
 }
 
 const struct file_operations fuse_dev_operations = {
@@ -2007,6 +2253,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl = fuse_dev_ioctl,
+	.compat_ioctl   = fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
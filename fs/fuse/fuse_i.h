@@ -35,6 +35,14 @@
 /** Number of dentries for each connection in the control filesystem */
 #define FUSE_CTL_NUM_DENTRIES 5
 
+/** Size of the per-channel hash of requests being processed */
+#define FUSE_PQ_HASH_BITS 8
+#define FUSE_PQ_HASH_SIZE (1 << FUSE_PQ_HASH_BITS)
+
+/** Unique IDs of requests are even, interrupts use the odd ID above */
+#define FUSE_INT_REQ_BIT (1ULL << 0)
+#define FUSE_REQ_ID_STEP (1ULL << 1)
+
 /** If the FUSE_DEFAULT_PERMISSIONS flag is given, the filesystem
     module will check permissions based on the file mode.  Otherwise no
     permission checking is done in the kernel */
@@ -212,7 +220,7 @@ enum fuse_req_state {
  */
 struct fuse_req {
 	/** This can be on either pending processing or io lists in
-	    fuse_conn */
+	    fuse_dev */
 	struct list_head list;
 
 	/** Entry on the interrupts list  */
@@ -310,6 +318,47 @@ struct fuse_req {
 
 	/** Request is stolen from fuse_file->reserved_req */
 	struct file *stolen_file;
+
+	/** Channel the request was read from [fuse_conn->lock] */
+	struct fuse_dev *fud;
+};
+
+/**
+ * A channel of a fuse connection: an open /dev/fuse file.
+ *
+ * The file passed to mount is the first channel, further ones are
+ * created with the FUSE_DEV_IOC_CLONE ioctl.  Each channel has its own
+ * queues and wait queue, and requests are dispatched to the channel
+ * serving the submitting CPU, so that daemon threads reading separate
+ * channels don't contend for the same requests.  A reply must be
+ * written to the channel the request was read from.
+ *
+ * The lists are protected by fuse_conn->lock.
+ */
+struct fuse_dev {
+	/** Connection this channel belongs to */
+	struct fuse_conn *fc;
+
+	/** Entry on fc->devices */
+	struct list_head entry;
+
+	/** Readers of this channel are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** Pending interrupts of requests processed on this channel */
+	struct list_head interrupts;
+
+	/** The list of requests under I/O */
+	struct list_head io;
+
+	/** Requests being processed, hashed by unique ID */
+	struct list_head processing[FUSE_PQ_HASH_SIZE];
+
+	/** O_ASYNC requests */
+	struct fasync_struct *fasync;
 };
 
 /**
@@ -344,17 +393,11 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
-
-	/** The list of pending requests */
-	struct list_head pending;
+	/** Channels of this connection */
+	struct list_head devices;
 
-	/** The list of requests being processed */
-	struct list_head processing;
-
-	/** The list of requests under I/O */
-	struct list_head io;
+	/** Channel each CPU dispatches to, indexed by CPU number */
+	struct fuse_dev **dev_map;
 
 	/** The next unique kernel file handle */
 	u64 khctr;
@@ -377,9 +420,6 @@ struct fuse_conn {
 	/** The list of background requests set aside for later queuing */
 	struct list_head bg_queue;
 
-	/** Pending interrupts */
-	struct list_head interrupts;
-
 	/** Queue of pending forgets */
 	struct fuse_forget_link forget_list_head;
 	struct fuse_forget_link *forget_list_tail;
@@ -478,6 +518,10 @@ struct fuse_conn {
 	/** Are BSD file locking primitives not implemented by fs? */
 	unsigned no_flock:1;
 
+	/** Use writeback cache for buffered writes; the kernel then
+	    owns i_size and mtime of regular files */
+	unsigned writeback_cache:1;
+
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
@@ -499,9 +543,6 @@ struct fuse_conn {
 	/** number of dentries used in the above array */
 	int ctl_ndents;
 
-	/** O_ASYNC requests */
-	struct fasync_struct *fasync;
-
 	/** Key for lock owner ID scrambling */
 	u32 scramble_key[4];
 
@@ -744,6 +785,11 @@ void fuse_flush_writepages(struct inode *inode);
 void fuse_set_nowrite(struct inode *inode);
 void fuse_release_nowrite(struct inode *inode);
 
+/**
+ * Send the locally maintained mtime to the filesystem
+ */
+int fuse_flush_mtime(struct inode *inode);
+
 u64 fuse_get_attr_version(struct fuse_conn *fc);
 
 /**
@@ -768,6 +814,23 @@ long fuse_do_ioctl(struct file *file, unsigned int cmd, unsigned long arg,
 unsigned fuse_file_poll(struct file *file, poll_table *wait);
 int fuse_dev_release(struct inode *inode, struct file *file);
 
+/**
+ * Allocate a channel and attach it to the connection, taking a
+ * reference to the connection
+ */
+struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc);
+
+/**
+ * Detach a channel from its connection and free it, dropping the
+ * reference to the connection
+ */
+void fuse_dev_free(struct fuse_dev *fud);
+
+/**
+ * Wake up readers of all channels.  Called with fc->lock held
+ */
+void fuse_dev_wake_all(struct fuse_conn *fc);
+
 void fuse_write_update_size(struct inode *inode, loff_t pos);
 
 #endif /* _FS_FUSE_I_H */
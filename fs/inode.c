@@ -278,6 +278,7 @@ void address_space_init_once(struct address_space *mapping)
 	spin_lock_init(&mapping->private_lock);
 	INIT_RAW_PRIO_TREE_ROOT(&mapping->i_mmap);
 	INIT_LIST_HEAD(&mapping->i_mmap_nonlinear);
+	INIT_LIST_HEAD(&mapping->shadow_list);
 }
 EXPORT_SYMBOL(address_space_init_once);
 
@@ -426,6 +427,12 @@ void end_writeback(struct inode *inode)
 	spin_lock_irq(&inode->i_data.tree_lock);
 	BUG_ON(inode->i_data.nrpages);
 	spin_unlock_irq(&inode->i_data.tree_lock);
+	/*
+	 * Filesystems that skip truncate_inode_pages() when there are no
+	 * pages left may still have shadow entries of evicted pages.
+	 */
+	if (inode->i_data.nrshadows)
+		truncate_inode_pages(&inode->i_data, 0);
 	BUG_ON(!list_empty(&inode->i_data.private_list));
 	BUG_ON(!(inode->i_state & I_FREEING));
 	BUG_ON(inode->i_state & I_CLEAR);
@@ -460,6 +467,12 @@ static void evict(struct inode *inode)
 
 	inode_sb_list_del(inode);
 
+	/*
+	 * Tell reclaim not to leave shadow entries behind in a mapping
+	 * that is about to go away.
+	 */
+	mapping_set_exiting(&inode->i_data);
+
 	if (op->evict_inode) {
 		op->evict_inode(inode);
 	} else {
@@ -612,8 +625,11 @@ static int can_unuse(struct inode *inode)
  * the fact we are doing lazy LRU updates to minimise lock contention so the
  * LRU does not have strict ordering. Hence we don't want to reclaim inodes
  * with this flag set because they are the inodes that are out of order.
+ *
+ * If @memcg is set, only inodes charged to that memory cgroup are pruned.
  */
-void prune_icache_sb(struct super_block *sb, int nr_to_scan)
+void prune_icache_sb(struct super_block *sb, int nr_to_scan,
+		     struct mem_cgroup *memcg)
 {
 	LIST_HEAD(freeable);
 	int nr_scanned;
@@ -628,6 +644,12 @@ void prune_icache_sb(struct super_block *sb, int nr_to_scan)
 
 		inode = list_entry(sb->s_inode_lru.prev, struct inode, i_lru);
 
+		/* memcg reclaim leaves other cgroups' inodes alone */
+		if (!mem_cgroup_owns_kmem(memcg, inode)) {
+			list_move(&inode->i_lru, &sb->s_inode_lru);
+			continue;
+		}
+
 		/*
 		 * we are inverting the sb->s_inode_lru_lock/inode->i_lock here,
 		 * so use a trylock. If we fail to get the lock, just move the
@@ -1599,7 +1621,7 @@ void __init inode_init(void)
 					 sizeof(struct inode),
 					 0,
 					 (SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|
-					 SLAB_MEM_SPREAD),
+					 SLAB_MEM_SPREAD|SLAB_ACCOUNT),
 					 init_once);
 
 	/* Hash may have been set up in inode_init_early */
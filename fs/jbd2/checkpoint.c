@@ -179,6 +179,53 @@ void __jbd2_log_wait_for_space(journal_t *journal)
 	}
 }
 
+/*
+ * jbd2_checkpoint_work: background checkpointing
+ *
+ * Queued on jbd2_checkpoint_wq by the commit thread after each commit.
+ * Releases checkpoint buffers which writeback has already cleaned, and
+ * once free log space drops below j_checkpoint_low, writes back the
+ * oldest transactions so that jbd2_journal_start() callers rarely have to
+ * checkpoint synchronously in __jbd2_log_wait_for_space().
+ */
+void jbd2_checkpoint_work(struct work_struct *work)
+{
+	journal_t *journal = container_of(work, journal_t, j_checkpoint_work);
+	int space_left, empty;
+	tid_t tail;
+
+	spin_lock(&journal->j_list_lock);
+	__jbd2_journal_clean_checkpoint_list(journal);
+	spin_unlock(&journal->j_list_lock);
+
+	mutex_lock(&journal->j_checkpoint_mutex);
+	while (!is_journal_aborted(journal)) {
+		read_lock(&journal->j_state_lock);
+		space_left = __jbd2_log_space_left(journal);
+		tail = journal->j_tail_sequence;
+		read_unlock(&journal->j_state_lock);
+		if (space_left >= journal->j_checkpoint_low)
+			break;
+
+		spin_lock(&journal->j_list_lock);
+		empty = journal->j_checkpoint_transactions == NULL;
+		spin_unlock(&journal->j_list_lock);
+		if (empty)
+			break;
+
+		if (jbd2_log_do_checkpoint(journal))
+			break;
+		/* Stop rather than spin if the tail could not move */
+		read_lock(&journal->j_state_lock);
+		empty = journal->j_tail_sequence == tail;
+		read_unlock(&journal->j_state_lock);
+		if (empty)
+			break;
+		cond_resched();
+	}
+	mutex_unlock(&journal->j_checkpoint_mutex);
+}
+
 /*
  * We were unable to perform jbd_trylock_bh_state() inside j_list_lock.
  * The caller must restart a list walk.  Wait for someone else to run
@@ -548,7 +595,7 @@ int jbd2_cleanup_journal_tail(journal_t *journal)
 	 */
 	if ((journal->j_fs_dev != journal->j_dev) &&
 	    (journal->j_flags & JBD2_BARRIER))
-		blkdev_issue_flush(journal->j_fs_dev, GFP_KERNEL, NULL);
+		jbd2_journal_flush_fs_dev(journal);
 	if (!(journal->j_flags & JBD2_ABORT))
 		jbd2_journal_update_superblock(journal, 1);
 	return 0;
@@ -86,6 +86,24 @@ nope:
 	__brelse(bh);
 }
 
+static void jbd2_commit_block_csum_set(journal_t *j,
+				       struct journal_head *descriptor)
+{
+	struct commit_header *h;
+	__u32 csum;
+
+	if (!jbd2_journal_has_csum_v2(j))
+		return;
+
+	h = (struct commit_header *)(jh2bh(descriptor)->b_data);
+	h->h_chksum_type = 0;
+	h->h_chksum_size = 0;
+	h->h_chksum[0] = 0;
+	csum = jbd2_chksum(j, j->j_csum_seed, jh2bh(descriptor)->b_data,
+			   j->j_blocksize);
+	h->h_chksum[0] = cpu_to_be32(csum);
+}
+
 /*
  * Done it all: now submit the commit record.  We should have
  * cleaned up our previous buffers by now, so if we are in abort
@@ -129,6 +147,7 @@ static int journal_submit_commit_record(journal_t *journal,
 		tmp->h_chksum_size 	= JBD2_CRC32_CHKSUM_SIZE;
 		tmp->h_chksum[0] 	= cpu_to_be32(crc32_sum);
 	}
+	jbd2_commit_block_csum_set(journal, descriptor);
 
 	JBUFFER_TRACE(descriptor, "submit commit block");
 	lock_buffer(bh);
@@ -227,6 +246,53 @@ static int journal_submit_data_buffers(journal_t *journal,
 	return ret;
 }
 
+/*
+ * jbd2_journal_write_running_data: start the next commit's data writeout
+ *
+ * Queued on jbd2_checkpoint_wq by the commit thread once the commit record
+ * has been submitted.  While that record (usually a cache flush) is in
+ * flight, this starts writing out the ordered data of the running
+ * transaction, which is the first thing its own commit has to wait for.
+ *
+ * The commit thread cancels this work before it locks down the next
+ * transaction, so the transaction stays running while we walk its inode
+ * list, and JI_COMMIT_RUNNING is never set by both of us at once.
+ */
+void jbd2_journal_write_running_data(struct work_struct *work)
+{
+	journal_t *journal = container_of(work, journal_t, j_data_work);
+	transaction_t *transaction;
+	struct jbd2_inode *jinode;
+	struct address_space *mapping;
+
+	read_lock(&journal->j_state_lock);
+	transaction = journal->j_running_transaction;
+	read_unlock(&journal->j_state_lock);
+	if (!transaction)
+		return;
+
+	spin_lock(&journal->j_list_lock);
+	list_for_each_entry(jinode, &transaction->t_inode_list, i_list) {
+		struct writeback_control wbc = {
+			.sync_mode = WB_SYNC_NONE,
+			.range_start = 0,
+		};
+
+		mapping = jinode->i_vfs_inode->i_mapping;
+		set_bit(__JI_COMMIT_RUNNING, &jinode->i_flags);
+		spin_unlock(&journal->j_list_lock);
+		/* As in journal_submit_inode_data_buffers(): no allocation */
+		wbc.nr_to_write = mapping->nrpages * 2;
+		wbc.range_end = i_size_read(mapping->host);
+		generic_writepages(mapping, &wbc);
+		spin_lock(&journal->j_list_lock);
+		clear_bit(__JI_COMMIT_RUNNING, &jinode->i_flags);
+		smp_mb__after_clear_bit();
+		wake_up_bit(&jinode->i_flags, __JI_COMMIT_RUNNING);
+	}
+	spin_unlock(&journal->j_list_lock);
+}
+
 /*
  * Wait for data submitted for writeout, refile inodes to proper
  * transaction if needed.
@@ -302,6 +368,46 @@ static void write_tag_block(int tag_bytes, journal_block_tag_t *tag,
 		tag->t_blocknr_high = cpu_to_be32((block >> 31) >> 1);
 }
 
+void jbd2_descriptor_block_csum_set(journal_t *j, struct buffer_head *bh)
+{
+	struct jbd2_journal_block_tail *tail;
+	__u32 csum;
+
+	if (!jbd2_journal_has_csum_v2(j))
+		return;
+
+	tail = (struct jbd2_journal_block_tail *)(bh->b_data + j->j_blocksize -
+			sizeof(struct jbd2_journal_block_tail));
+	tail->t_checksum = 0;
+	csum = jbd2_chksum(j, j->j_csum_seed, bh->b_data, j->j_blocksize);
+	tail->t_checksum = cpu_to_be32(csum);
+}
+
+/*
+ * Each tag carries the low 16 bits of crc32c(uuid+sequence+block), computed
+ * over the block exactly as it is written to the log (i.e. escaped).
+ */
+static void jbd2_block_tag_csum_set(journal_t *j, journal_block_tag_t *tag,
+				    struct buffer_head *bh, __u32 sequence)
+{
+	struct page *page = bh->b_page;
+	__u8 *addr;
+	__u32 csum;
+	__be32 seq;
+
+	if (!jbd2_journal_has_csum_v2(j))
+		return;
+
+	seq = cpu_to_be32(sequence);
+	addr = kmap_atomic(page, KM_USER0);
+	csum = jbd2_chksum(j, j->j_csum_seed, (__u8 *)&seq, sizeof(seq));
+	csum = jbd2_chksum(j, csum, addr + offset_in_page(bh->b_data),
+			   bh->b_size);
+	kunmap_atomic(addr, KM_USER0);
+
+	tag->t_checksum = cpu_to_be16(csum);
+}
+
 /*
  * jbd2_journal_commit_transaction
  *
@@ -328,10 +434,17 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	int tag_flag;
 	int i, to_free = 0;
 	int tag_bytes = journal_tag_bytes(journal);
+	int csum_size = 0;
 	struct buffer_head *cbh = NULL; /* For transactional checksums */
 	__u32 crc32_sum = ~0;
 	struct blk_plug plug;
 
+	/*
+	 * The data writeout started early by the previous commit must be
+	 * done with the transaction's inode list before we take it over.
+	 */
+	cancel_work_sync(&journal->j_data_work);
+
 	/*
 	 * First job: lock down the current transaction and wait for
 	 * all outstanding updates to complete.
@@ -419,13 +532,10 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	}
 
 	/*
-	 * Now try to drop any written-back buffers from the journal's
-	 * checkpoint lists.  We do this *before* commit because it potentially
-	 * frees some memory
+	 * Dropping written-back buffers from the journal's checkpoint
+	 * lists is left to jbd2_checkpoint_work(): doing it here would
+	 * hold off every new handle while we still own j_state_lock.
 	 */
-	spin_lock(&journal->j_list_lock);
-	__jbd2_journal_clean_checkpoint_list(journal);
-	spin_unlock(&journal->j_list_lock);
 
 	jbd_debug (3, "JBD: commit phase 1\n");
 
@@ -484,6 +594,9 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	J_ASSERT(commit_transaction->t_nr_buffers <=
 		 atomic_read(&commit_transaction->t_outstanding_credits));
 
+	if (jbd2_journal_has_csum_v2(journal))
+		csum_size = sizeof(struct jbd2_journal_block_tail);
+
 	err = 0;
 	descriptor = NULL;
 	bufs = 0;
@@ -607,7 +720,9 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 
 		tag = (journal_block_tag_t *) tagp;
 		write_tag_block(tag_bytes, tag, jh2bh(jh)->b_blocknr);
-		tag->t_flags = cpu_to_be32(tag_flag);
+		tag->t_flags = cpu_to_be16(tag_flag);
+		jbd2_block_tag_csum_set(journal, tag, jh2bh(new_jh),
+					commit_transaction->t_tid);
 		tagp += tag_bytes;
 		space_left -= tag_bytes;
 
@@ -623,7 +738,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 
 		if (bufs == journal->j_wbufsize ||
 		    commit_transaction->t_buffers == NULL ||
-		    space_left < tag_bytes + 16) {
+		    space_left < tag_bytes + 16 + csum_size) {
 
 			jbd_debug(4, "JBD: Submit %d IOs\n", bufs);
 
@@ -631,8 +746,10 @@ void jbd2_journal_commit_transaction(journal_t *journal)
                            submitting the IOs.  "tag" still points to
                            the last tag we set up. */
 
-			tag->t_flags |= cpu_to_be32(JBD2_FLAG_LAST_TAG);
+			tag->t_flags |= cpu_to_be16(JBD2_FLAG_LAST_TAG);
 
+			jbd2_descriptor_block_csum_set(journal,
+						       jh2bh(descriptor));
 start_journal_io:
 			for (i = 0; i < bufs; i++) {
 				struct buffer_head *bh = wbuf[i];
@@ -683,7 +800,7 @@ start_journal_io:
 	if (commit_transaction->t_need_data_flush &&
 	    (journal->j_fs_dev != journal->j_dev) &&
 	    (journal->j_flags & JBD2_BARRIER))
-		blkdev_issue_flush(journal->j_fs_dev, GFP_KERNEL, NULL);
+		jbd2_journal_flush_fs_dev(journal);
 
 	/* Done it all: now write the commit record asynchronously. */
 	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
@@ -814,8 +931,16 @@ wait_for_iobuf:
 		if (err)
 			__jbd2_journal_abort_hard(journal);
 	}
-	if (cbh)
+	/*
+	 * Overlap the next commit with this one: its data goes out while
+	 * our commit record is in flight.  Its own commit record is only
+	 * written once this transaction is done, so the order of commit
+	 * records in the log is unchanged.
+	 */
+	if (cbh) {
+		queue_work(jbd2_checkpoint_wq, &journal->j_data_work);
 		err = journal_wait_on_commit_record(journal, cbh);
+	}
 	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
 				      JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT) &&
 	    journal->j_flags & JBD2_BARRIER) {
@@ -1045,4 +1170,7 @@ restart_loop:
 		kfree(commit_transaction);
 
 	wake_up(&journal->j_wait_done_commit);
+
+	/* Reclaim log space in the background, off the commit path */
+	queue_work(jbd2_checkpoint_wq, &journal->j_checkpoint_work);
 }
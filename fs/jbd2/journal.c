@@ -42,6 +42,7 @@
 #include <linux/log2.h>
 #include <linux/vmalloc.h>
 #include <linux/backing-dev.h>
+#include <linux/blkdev.h>
 #include <linux/bitops.h>
 #include <linux/ratelimit.h>
 
@@ -67,6 +68,7 @@ EXPORT_SYMBOL(jbd2_journal_forget);
 EXPORT_SYMBOL(journal_sync_buffer);
 #endif
 EXPORT_SYMBOL(jbd2_journal_flush);
+EXPORT_SYMBOL(jbd2_journal_flush_fs_dev);
 EXPORT_SYMBOL(jbd2_journal_revoke);
 
 EXPORT_SYMBOL(jbd2_journal_init_dev);
@@ -662,6 +664,57 @@ int jbd2_log_wait_commit(journal_t *journal, tid_t tid)
 	return err;
 }
 
+/**
+ * int jbd2_journal_flush_fs_dev() - flush the filesystem device's cache
+ * @journal: journal whose j_fs_dev is flushed
+ *
+ * Issue a cache flush to j_fs_dev, sharing it with concurrent callers.  A
+ * flush only covers writes which completed before it was issued, so we
+ * may piggy-back only on a flush which started after we got here: callers
+ * arriving while a flush is in flight all wait for it and then share a
+ * single follow-up flush, instead of issuing one each.
+ */
+int jbd2_journal_flush_fs_dev(journal_t *journal)
+{
+	unsigned long ticket, seq;
+	int err;
+
+	spin_lock(&journal->j_flush_lock);
+	/* The first flush which will start from now on */
+	ticket = journal->j_flush_started + 1;
+	for (;;) {
+		DEFINE_WAIT(wait);
+
+		if ((long)(journal->j_flush_done - ticket) >= 0) {
+			err = journal->j_flush_err;
+			spin_unlock(&journal->j_flush_lock);
+			return err;
+		}
+		if (!journal->j_flush_busy)
+			break;
+		prepare_to_wait(&journal->j_wait_flush, &wait,
+				TASK_UNINTERRUPTIBLE);
+		spin_unlock(&journal->j_flush_lock);
+		schedule();
+		finish_wait(&journal->j_wait_flush, &wait);
+		spin_lock(&journal->j_flush_lock);
+	}
+	journal->j_flush_busy = 1;
+	seq = ++journal->j_flush_started;
+	spin_unlock(&journal->j_flush_lock);
+
+	err = blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS, NULL);
+
+	spin_lock(&journal->j_flush_lock);
+	journal->j_flush_busy = 0;
+	journal->j_flush_done = seq;
+	journal->j_flush_err = err;
+	spin_unlock(&journal->j_flush_lock);
+	wake_up_all(&journal->j_wait_flush);
+
+	return err;
+}
+
 /*
  * Log buffer allocation routines:
  */
@@ -894,9 +947,13 @@ static journal_t * journal_init_common (void)
 	init_waitqueue_head(&journal->j_wait_checkpoint);
 	init_waitqueue_head(&journal->j_wait_commit);
 	init_waitqueue_head(&journal->j_wait_updates);
+	init_waitqueue_head(&journal->j_wait_flush);
 	mutex_init(&journal->j_barrier);
 	mutex_init(&journal->j_checkpoint_mutex);
+	INIT_WORK(&journal->j_checkpoint_work, jbd2_checkpoint_work);
+	INIT_WORK(&journal->j_data_work, jbd2_journal_write_running_data);
 	spin_lock_init(&journal->j_revoke_lock);
+	spin_lock_init(&journal->j_flush_lock);
 	spin_lock_init(&journal->j_list_lock);
 	rwlock_init(&journal->j_state_lock);
 
@@ -1066,6 +1123,43 @@ out_err:
 	return NULL;
 }
 
+static int jbd2_verify_csum_type(journal_t *j, journal_superblock_t *sb)
+{
+	if (!jbd2_journal_has_csum_v2(j))
+		return 1;
+
+	return sb->s_checksum_type == JBD2_CRC32C_CHKSUM;
+}
+
+static __be32 jbd2_superblock_csum(journal_t *j, journal_superblock_t *sb)
+{
+	__u32 csum;
+	__be32 old_csum;
+
+	old_csum = sb->s_checksum;
+	sb->s_checksum = 0;
+	csum = jbd2_chksum(j, ~0, (char *)sb, sizeof(journal_superblock_t));
+	sb->s_checksum = old_csum;
+
+	return cpu_to_be32(csum);
+}
+
+static int jbd2_superblock_csum_verify(journal_t *j, journal_superblock_t *sb)
+{
+	if (!jbd2_journal_has_csum_v2(j))
+		return 1;
+
+	return sb->s_checksum == jbd2_superblock_csum(j, sb);
+}
+
+static void jbd2_superblock_csum_set(journal_t *j, journal_superblock_t *sb)
+{
+	if (!jbd2_journal_has_csum_v2(j))
+		return;
+
+	sb->s_checksum = jbd2_superblock_csum(j, sb);
+}
+
 /*
  * If the journal init or create aborts, we need to mark the journal
  * superblock as being NULL to prevent the journal destroy from writing
@@ -1111,6 +1205,7 @@ static int journal_reset(journal_t *journal)
 	journal->j_commit_request = journal->j_commit_sequence;
 
 	journal->j_max_transaction_buffers = journal->j_maxlen / 4;
+	journal->j_checkpoint_low = journal->j_max_transaction_buffers * 2;
 
 	/* Add the dynamic fields and write it to disk. */
 	jbd2_journal_update_superblock(journal, 1);
@@ -1171,6 +1266,7 @@ void jbd2_journal_update_superblock(journal_t *journal, int wait)
 	sb->s_errno    = cpu_to_be32(journal->j_errno);
 	read_unlock(&journal->j_state_lock);
 
+	jbd2_superblock_csum_set(journal, sb);
 	BUFFER_TRACE(bh, "marking dirty");
 	mark_buffer_dirty(bh);
 	if (wait) {
@@ -1251,6 +1347,42 @@ static int journal_get_superblock(journal_t *journal)
 		goto out;
 	}
 
+	if (JBD2_HAS_COMPAT_FEATURE(journal, JBD2_FEATURE_COMPAT_CHECKSUM) &&
+	    jbd2_journal_has_csum_v2(journal)) {
+		/* Can't have checksum v1 and v2 on at the same time! */
+		printk(KERN_ERR "JBD: Can't enable checksumming v1 and v2 "
+		       "at the same time!\n");
+		goto out;
+	}
+
+	if (!jbd2_verify_csum_type(journal, sb)) {
+		printk(KERN_ERR "JBD: Unknown checksum type\n");
+		goto out;
+	}
+
+	/* Load the checksum driver */
+	if (jbd2_journal_has_csum_v2(journal) && !journal->j_chksum_driver) {
+		journal->j_chksum_driver = crypto_alloc_shash("crc32c", 0, 0);
+		if (IS_ERR(journal->j_chksum_driver)) {
+			printk(KERN_ERR "JBD: Cannot load crc32c driver.\n");
+			err = PTR_ERR(journal->j_chksum_driver);
+			journal->j_chksum_driver = NULL;
+			goto out;
+		}
+	}
+
+	/* Check superblock checksum */
+	if (!jbd2_superblock_csum_verify(journal, sb)) {
+		printk(KERN_ERR "JBD: journal checksum error\n");
+		err = -EIO;
+		goto out;
+	}
+
+	/* Precompute checksum seed for all metadata */
+	if (jbd2_journal_has_csum_v2(journal))
+		journal->j_csum_seed = jbd2_chksum(journal, ~0, sb->s_uuid,
+						   sizeof(sb->s_uuid));
+
 	return 0;
 
 out:
@@ -1369,6 +1501,10 @@ int jbd2_journal_destroy(journal_t *journal)
 	if (journal->j_running_transaction)
 		jbd2_journal_commit_transaction(journal);
 
+	/* No more commits, so nothing can queue background work */
+	cancel_work_sync(&journal->j_data_work);
+	cancel_work_sync(&journal->j_checkpoint_work);
+
 	/* Force any old transactions to disk */
 
 	/* Totally anal locking here... */
@@ -1405,6 +1541,8 @@ int jbd2_journal_destroy(journal_t *journal)
 		iput(journal->j_inode);
 	if (journal->j_revoke)
 		jbd2_journal_destroy_revoke(journal);
+	if (journal->j_chksum_driver)
+		crypto_free_shash(journal->j_chksum_driver);
 	kfree(journal->j_wbuf);
 	kfree(journal);
 
@@ -1502,11 +1640,44 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 	if (!jbd2_journal_check_available_features(journal, compat, ro, incompat))
 		return 0;
 
+	/* Asking for checksumming v2 and v1?  Only give them v2. */
+	if (incompat & JBD2_FEATURE_INCOMPAT_CSUM_V2 &&
+	    compat & JBD2_FEATURE_COMPAT_CHECKSUM)
+		compat &= ~JBD2_FEATURE_COMPAT_CHECKSUM;
+
 	jbd_debug(1, "Setting new features 0x%lx/0x%lx/0x%lx\n",
 		  compat, ro, incompat);
 
 	sb = journal->j_superblock;
 
+	/* If enabling v2 checksums, update superblock */
+	if (incompat & JBD2_FEATURE_INCOMPAT_CSUM_V2) {
+		sb->s_checksum_type = JBD2_CRC32C_CHKSUM;
+		sb->s_feature_compat &=
+			~cpu_to_be32(JBD2_FEATURE_COMPAT_CHECKSUM);
+
+		/* Load the checksum driver */
+		if (journal->j_chksum_driver == NULL) {
+			journal->j_chksum_driver = crypto_alloc_shash("crc32c",
+								      0, 0);
+			if (IS_ERR(journal->j_chksum_driver)) {
+				printk(KERN_ERR "JBD: Cannot load crc32c "
+				       "driver.\n");
+				journal->j_chksum_driver = NULL;
+				return 0;
+			}
+		}
+
+		/* Precompute checksum seed for all metadata */
+		journal->j_csum_seed = jbd2_chksum(journal, ~0, sb->s_uuid,
+						   sizeof(sb->s_uuid));
+	}
+
+	/* If enabling v1 checksums, downgrade superblock */
+	if (compat & JBD2_FEATURE_COMPAT_CHECKSUM)
+		sb->s_feature_incompat &=
+			~cpu_to_be32(JBD2_FEATURE_INCOMPAT_CSUM_V2);
+
 	sb->s_feature_compat    |= cpu_to_be32(compat);
 	sb->s_feature_ro_compat |= cpu_to_be32(ro);
 	sb->s_feature_incompat  |= cpu_to_be32(incompat);
@@ -2312,6 +2483,7 @@ static void __exit jbd2_remove_jbd_stats_proc_entry(void)
 #endif
 
 struct kmem_cache *jbd2_handle_cache, *jbd2_inode_cache;
+struct workqueue_struct *jbd2_checkpoint_wq;
 
 static int __init journal_init_handle_cache(void)
 {
@@ -2369,6 +2541,13 @@ static int __init journal_init(void)
 	BUILD_BUG_ON(sizeof(struct journal_superblock_s) != 1024);
 
 	ret = journal_init_caches();
+	if (ret == 0) {
+		jbd2_checkpoint_wq = alloc_workqueue("jbd2-checkpoint",
+						     WQ_MEM_RECLAIM | WQ_UNBOUND,
+						     0);
+		if (!jbd2_checkpoint_wq)
+			ret = -ENOMEM;
+	}
 	if (ret == 0) {
 		jbd2_create_debugfs_entry();
 		jbd2_create_jbd_stats_proc_entry();
@@ -2387,6 +2566,7 @@ static void __exit journal_exit(void)
 #endif
 	jbd2_remove_debugfs_entry();
 	jbd2_remove_jbd_stats_proc_entry();
+	destroy_workqueue(jbd2_checkpoint_wq);
 	jbd2_journal_destroy_caches();
 }
 
@@ -135,6 +135,7 @@ struct nfs_client_initdata {
 	const struct nfs_rpc_ops *rpc_ops;
 	int proto;
 	u32 minorversion;
+	unsigned int nconnect;
 };
 
 /*
@@ -171,6 +172,10 @@ static struct nfs_client *nfs_alloc_client(const struct nfs_client_initdata *cl_
 	clp->cl_rpcclient = ERR_PTR(-EINVAL);
 
 	clp->cl_proto = cl_init->proto;
+	/* Only TCP transports are ever cloned, see nfs_create_rpc_client() */
+	clp->cl_nconnect = 1;
+	if (cl_init->proto == XPRT_TRANSPORT_TCP && cl_init->nconnect)
+		clp->cl_nconnect = cl_init->nconnect;
 
 #ifdef CONFIG_NFS_V4
 	err = nfs_get_cb_ident_idr(clp, cl_init->minorversion);
@@ -651,6 +656,9 @@ static int nfs_create_rpc_client(struct nfs_client *clp,
 		args.flags |= RPC_CLNT_CREATE_DISCRTRY;
 	if (noresvport)
 		args.flags |= RPC_CLNT_CREATE_NONPRIVPORT;
+	/* Multiple connections only make sense for stream transports */
+	if (clp->cl_proto == XPRT_TRANSPORT_TCP)
+		args.nconnect = clp->cl_nconnect;
 
 	if (!IS_ERR(clp->cl_rpcclient))
 		return 0;
@@ -825,6 +833,7 @@ static int nfs_init_server(struct nfs_server *server,
 		.addrlen = data->nfs_server.addrlen,
 		.rpc_ops = &nfs_v2_clientops,
 		.proto = data->nfs_server.protocol,
+		.nconnect = data->nconnect,
 	};
 	struct rpc_timeout timeparms;
 	struct nfs_client *clp;
@@ -1386,7 +1395,7 @@ static int nfs4_set_client(struct nfs_server *server,
 		const char *ip_addr,
 		rpc_authflavor_t authflavour,
 		int proto, const struct rpc_timeout *timeparms,
-		u32 minorversion)
+		u32 minorversion, unsigned int nconnect)
 {
 	struct nfs_client_initdata cl_init = {
 		.hostname = hostname,
@@ -1395,6 +1404,7 @@ static int nfs4_set_client(struct nfs_server *server,
 		.rpc_ops = &nfs_v4_clientops,
 		.proto = proto,
 		.minorversion = minorversion,
+		.nconnect = nconnect,
 	};
 	struct nfs_client *clp;
 	int error;
@@ -1572,7 +1582,8 @@ static int nfs4_init_server(struct nfs_server *server,
 			data->auth_flavors[0],
 			data->nfs_server.protocol,
 			&timeparms,
-			data->minorversion);
+			data->minorversion,
+			data->nconnect);
 	if (error < 0)
 		goto error;
 
@@ -1669,7 +1680,8 @@ struct nfs_server *nfs4_create_referral_server(struct nfs_clone_mount *data,
 				data->authflavor,
 				parent_server->client->cl_xprt->prot,
 				parent_server->client->cl_timeout,
-				parent_client->cl_mvops->minor_version);
+				parent_client->cl_mvops->minor_version,
+				parent_client->cl_nconnect);
 	if (error < 0)
 		goto error;
 
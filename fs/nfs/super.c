@@ -92,6 +92,7 @@ enum {
 	Opt_port,
 	Opt_rsize, Opt_wsize, Opt_bsize,
 	Opt_timeo, Opt_retrans,
+	Opt_nconnect,
 	Opt_acregmin, Opt_acregmax,
 	Opt_acdirmin, Opt_acdirmax,
 	Opt_actimeo,
@@ -156,6 +157,7 @@ static const match_table_t nfs_mount_option_tokens = {
 	{ Opt_bsize, "bsize=%s" },
 	{ Opt_timeo, "timeo=%s" },
 	{ Opt_retrans, "retrans=%s" },
+	{ Opt_nconnect, "nconnect=%s" },
 	{ Opt_acregmin, "acregmin=%s" },
 	{ Opt_acregmax, "acregmax=%s" },
 	{ Opt_acdirmin, "acdirmin=%s" },
@@ -688,6 +690,8 @@ static void nfs_show_mount_options(struct seq_file *m, struct nfs_server *nfss,
 
 	seq_printf(m, ",timeo=%lu", 10U * nfss->client->cl_timeout->to_initval / HZ);
 	seq_printf(m, ",retrans=%u", nfss->client->cl_timeout->to_retries);
+	if (clp->cl_nconnect > 1)
+		seq_printf(m, ",nconnect=%u", clp->cl_nconnect);
 	seq_printf(m, ",sec=%s", nfs_pseudoflavour_to_name(nfss->client->cl_auth->au_flavor));
 
 	if (version != 4)
@@ -904,6 +908,7 @@ static struct nfs_parsed_mount_data *nfs_alloc_parsed_mount_data(unsigned int ve
 		data->auth_flavor_len	= 1;
 		data->version		= version;
 		data->minorversion	= 0;
+		data->nconnect		= 1;
 	}
 	return data;
 }
@@ -1233,6 +1238,12 @@ static int nfs_parse_mount_options(char *raw,
 				goto out_invalid_value;
 			mnt->retrans = option;
 			break;
+		case Opt_nconnect:
+			if (nfs_get_option_ul(args, &option) || option == 0 ||
+			    option > RPC_MAX_NCONNECT)
+				goto out_invalid_value;
+			mnt->nconnect = option;
+			break;
 		case Opt_acregmin:
 			if (nfs_get_option_ul(args, &option))
 				goto out_invalid_value;
@@ -1516,8 +1527,17 @@ static int nfs_parse_mount_options(char *raw,
 		}
 	}
 
+	/* Only TCP transports can be multiplied */
+	if (mnt->nconnect > 1 &&
+	    mnt->nfs_server.protocol != XPRT_TRANSPORT_TCP)
+		goto out_nconnect_proto;
+
 	return 1;
 
+out_nconnect_proto:
+	printk(KERN_INFO "NFS: nconnect= requires proto=tcp\n");
+	return 0;
+
 out_mountproto_mismatch:
 	printk(KERN_INFO "NFS: mount server address does not match mountproto= "
 			 "option\n");
@@ -1941,6 +1961,7 @@ nfs_compare_remount_data(struct nfs_server *nfss,
 	    data->rsize != nfss->rsize ||
 	    data->wsize != nfss->wsize ||
 	    data->retrans != nfss->client->cl_timeout->to_retries ||
+	    data->nconnect != nfss->nfs_client->cl_nconnect ||
 	    data->auth_flavors[0] != nfss->client->cl_auth->au_flavor ||
 	    data->acregmin != nfss->acregmin / HZ ||
 	    data->acregmax != nfss->acregmax / HZ ||
@@ -1986,6 +2007,7 @@ nfs_remount(struct super_block *sb, int *flags, char *raw_data)
 	data->rsize = nfss->rsize;
 	data->wsize = nfss->wsize;
 	data->retrans = nfss->client->cl_timeout->to_retries;
+	data->nconnect = nfss->nfs_client->cl_nconnect;
 	data->auth_flavors[0] = nfss->client->cl_auth->au_flavor;
 	data->acregmin = nfss->acregmin / HZ;
 	data->acregmax = nfss->acregmax / HZ;
@@ -1993,6 +2015,7 @@ nfs_remount(struct super_block *sb, int *flags, char *raw_data)
 	data->acdirmax = nfss->acdirmax / HZ;
 	data->timeo = 10U * nfss->client->cl_timeout->to_initval / HZ;
 	data->nfs_server.port = nfss->port;
+	data->nfs_server.protocol = nfss->nfs_client->cl_proto;
 	data->nfs_server.addrlen = nfss->nfs_client->cl_addrlen;
 	memcpy(&data->nfs_server.address, &nfss->nfs_client->cl_addr,
 		data->nfs_server.addrlen);
@@ -347,14 +347,13 @@ repeat:
 			spin_unlock_irq(&smap->tree_lock);
 
 			spin_lock_irq(&dmap->tree_lock);
-			err = radix_tree_insert(&dmap->page_tree, offset, page);
+			err = page_cache_tree_insert(dmap, page, NULL);
 			if (unlikely(err < 0)) {
 				WARN_ON(err == -EEXIST);
 				page->mapping = NULL;
 				page_cache_release(page); /* for cache */
 			} else {
 				page->mapping = dmap;
-				dmap->nrpages++;
 				if (PageDirty(page))
 					radix_tree_tag_set(&dmap->page_tree,
 							   offset,
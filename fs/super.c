@@ -85,8 +85,8 @@ static int prune_super(struct shrinker *shrink, struct shrink_control *sc)
 		 * prune the dcache first as the icache is pinned by it, then
 		 * prune the icache, followed by the filesystem specific caches
 		 */
-		prune_dcache_sb(sb, dentries);
-		prune_icache_sb(sb, inodes);
+		prune_dcache_sb(sb, dentries, sc->mem_cgroup);
+		prune_icache_sb(sb, inodes, sc->mem_cgroup);
 
 		if (fs_objects && sb->s_op->free_cached_objects) {
 			sb->s_op->free_cached_objects(sb, fs_objects);
@@ -183,6 +183,7 @@ static struct super_block *alloc_super(struct file_system_type *type)
 		s->s_shrink.seeks = DEFAULT_SEEKS;
 		s->s_shrink.shrink = prune_super;
 		s->s_shrink.batch = 1024;
+		s->s_shrink.flags = SHRINKER_MEMCG_AWARE;
 	}
 out:
 	return s;
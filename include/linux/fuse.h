@@ -56,6 +56,7 @@
 #define _LINUX_FUSE_H
 
 #include <linux/types.h>
+#include <linux/ioctl.h>
 
 /*
  * Version negotiation:
@@ -160,6 +161,7 @@ struct fuse_file_lock {
  * FUSE_EXPORT_SUPPORT: filesystem handles lookups of "." and ".."
  * FUSE_DONT_MASK: don't apply umask to file mode on create operations
  * FUSE_FLOCK_LOCKS: remote locking for BSD style file locks
+ * FUSE_WRITEBACK_CACHE: use writeback cache for buffered writes
  */
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
@@ -169,6 +171,7 @@ struct fuse_file_lock {
 #define FUSE_BIG_WRITES		(1 << 5)
 #define FUSE_DONT_MASK		(1 << 6)
 #define FUSE_FLOCK_LOCKS	(1 << 10)
+#define FUSE_WRITEBACK_CACHE	(1 << 16)
 
 /**
  * CUSE INIT request/reply flags
@@ -631,4 +634,15 @@ struct fuse_notify_retrieve_in {
 	__u64	dummy4;
 };
 
+/*
+ * Device ioctls
+ *
+ * FUSE_DEV_IOC_CLONE: attach a newly opened /dev/fuse file to the
+ * connection of the /dev/fuse file descriptor passed as argument.
+ * Each such file is a separate channel with its own request queue;
+ * requests are dispatched to channels by submitting CPU and replies
+ * must be written to the channel the request was read from.
+ */
+#define FUSE_DEV_IOC_CLONE	_IOR(229, 0, __u32)
+
 #endif /* _LINUX_FUSE_H */
@@ -36,6 +36,7 @@ struct vm_area_struct;
 #endif
 #define ___GFP_NO_KSWAPD	0x400000u
 #define ___GFP_OTHER_NODE	0x800000u
+#define ___GFP_KMEMCG		0x1000000u
 
 /*
  * GFP bitmasks..
@@ -85,6 +86,7 @@ struct vm_area_struct;
 
 #define __GFP_NO_KSWAPD	((__force gfp_t)___GFP_NO_KSWAPD)
 #define __GFP_OTHER_NODE ((__force gfp_t)___GFP_OTHER_NODE) /* On behalf of other node */
+#define __GFP_KMEMCG	((__force gfp_t)___GFP_KMEMCG) /* Charge to the kmem of current's memcg */
 
 /*
  * This may seem redundant, but it's a way of annotating false positives vs.
@@ -92,7 +94,7 @@ struct vm_area_struct;
  */
 #define __GFP_NOTRACK_FALSE_POSITIVE (__GFP_NOTRACK)
 
-#define __GFP_BITS_SHIFT 24	/* Room for N __GFP_FOO bits */
+#define __GFP_BITS_SHIFT 25	/* Room for N __GFP_FOO bits */
 #define __GFP_BITS_MASK ((__force gfp_t)((1 << __GFP_BITS_SHIFT) - 1))
 
 /* This equals 0, but use constants in case they ever change */
@@ -300,6 +302,47 @@ __alloc_pages(gfp_t gfp_mask, unsigned int order,
 	return __alloc_pages_nodemask(gfp_mask, order, zonelist, NULL);
 }
 
+unsigned long __alloc_pages_bulk(gfp_t gfp_mask, struct zonelist *zonelist,
+				 nodemask_t *nodemask, unsigned long nr_pages,
+				 struct list_head *page_list,
+				 struct page **page_array);
+
+/*
+ * Allocate up to @nr_pages 0-order pages on the local node in one go,
+ * adding them to @list: returns how many were added.
+ */
+static inline unsigned long
+alloc_pages_bulk_list(gfp_t gfp_mask, unsigned long nr_pages,
+		      struct list_head *list)
+{
+	return __alloc_pages_bulk(gfp_mask,
+				  node_zonelist(numa_node_id(), gfp_mask),
+				  NULL, nr_pages, list, NULL);
+}
+
+/*
+ * Fill in the NULL entries of @page_array with 0-order pages from node
+ * @nid (or the local node if @nid is negative): returns the number of
+ * leading entries populated, which is @nr_pages unless memory ran short.
+ */
+static inline unsigned long
+alloc_pages_bulk_array_node(gfp_t gfp_mask, int nid, unsigned long nr_pages,
+			    struct page **page_array)
+{
+	if (nid < 0)
+		nid = numa_node_id();
+
+	return __alloc_pages_bulk(gfp_mask, node_zonelist(nid, gfp_mask),
+				  NULL, nr_pages, NULL, page_array);
+}
+
+static inline unsigned long
+alloc_pages_bulk_array(gfp_t gfp_mask, unsigned long nr_pages,
+		       struct page **page_array)
+{
+	return alloc_pages_bulk_array_node(gfp_mask, -1, nr_pages, page_array);
+}
+
 static inline struct page *alloc_pages_node(int nid, gfp_t gfp_mask,
 						unsigned int order)
 {
@@ -358,6 +401,9 @@ void *alloc_pages_exact_nid(int nid, size_t size, gfp_t gfp_mask);
 extern void __free_pages(struct page *page, unsigned int order);
 extern void free_pages(unsigned long addr, unsigned int order);
 extern void free_hot_cold_page(struct page *page, int cold);
+extern void free_hot_cold_page_list(struct list_head *list, int cold);
+extern void free_pages_bulk_array(struct page **pages, unsigned long nr_pages);
+extern void free_pages_bulk_list(struct list_head *list);
 
 #define __free_page(page) __free_pages((page), 0)
 #define free_page(addr) free_pages((addr), 0)
@@ -31,6 +31,8 @@
 #include <linux/mutex.h>
 #include <linux/timer.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <crypto/hash.h>
 #endif
 
 #define journal_oom_retry 1
@@ -148,6 +150,8 @@ typedef struct journal_header_s
 #define JBD2_MD5_CHKSUM     2
 #define JBD2_SHA1_CHKSUM    3
 
+#define JBD2_CRC32C_CHKSUM  4
+
 #define JBD2_CRC32_CHKSUM_SIZE 4
 
 #define JBD2_CHECKSUM_BYTES (32 / sizeof(u32))
@@ -175,13 +179,19 @@ struct commit_header {
 typedef struct journal_block_tag_s
 {
 	__be32		t_blocknr;	/* The on-disk block number */
-	__be32		t_flags;	/* See below */
+	__be16		t_checksum;	/* truncated crc32c(uuid+seq+block) */
+	__be16		t_flags;	/* See below */
 	__be32		t_blocknr_high; /* most-significant high 32bits. */
 } journal_block_tag_t;
 
 #define JBD2_TAG_SIZE32 (offsetof(journal_block_tag_t, t_blocknr_high))
 #define JBD2_TAG_SIZE64 (sizeof(journal_block_tag_t))
 
+/* Tail of descriptor and revoke blocks, for checksumming */
+struct jbd2_journal_block_tail {
+	__be32		t_checksum;	/* crc32c(uuid+descr_block) */
+};
+
 /*
  * The revoke descriptor: used on disk to describe a series of blocks to
  * be revoked from the log
@@ -241,7 +251,10 @@ typedef struct journal_superblock_s
 	__be32	s_max_trans_data;	/* Limit of data blocks per trans. */
 
 /* 0x0050 */
-	__u32	s_padding[44];
+	__u8	s_checksum_type;	/* checksum type */
+	__u8	s_padding2[3];
+	__u32	s_padding[42];
+	__be32	s_checksum;		/* crc32c(superblock) */
 
 /* 0x0100 */
 	__u8	s_users[16*48];		/* ids of all fs'es sharing the log */
@@ -263,13 +276,15 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_REVOKE		0x00000001
 #define JBD2_FEATURE_INCOMPAT_64BIT		0x00000002
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
+#define JBD2_FEATURE_INCOMPAT_CSUM_V2		0x00000008
 
 /* Features known to this kernel version: */
 #define JBD2_KNOWN_COMPAT_FEATURES	JBD2_FEATURE_COMPAT_CHECKSUM
 #define JBD2_KNOWN_ROCOMPAT_FEATURES	0
 #define JBD2_KNOWN_INCOMPAT_FEATURES	(JBD2_FEATURE_INCOMPAT_REVOKE | \
 					JBD2_FEATURE_INCOMPAT_64BIT | \
-					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT)
+					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
+					JBD2_FEATURE_INCOMPAT_CSUM_V2)
 
 #ifdef __KERNEL__
 
@@ -722,6 +737,11 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_wait_commit: Wait queue to trigger commit
  * @j_wait_updates: Wait queue to wait for updates to complete
  * @j_checkpoint_mutex: Mutex for locking against concurrent checkpoints
+ * @j_checkpoint_work: Background checkpointing, queued after each commit
+ * @j_checkpoint_low: Free log space below which background checkpointing
+ *  starts writing back the oldest transactions
+ * @j_data_work: Writes out the running transaction's ordered data while
+ *  the commit record of the previous one is in flight
  * @j_head: Journal head - identifies the first unused block in the journal
  * @j_tail: Journal tail - identifies the oldest still-used block in the
  *  journal.
@@ -759,6 +779,12 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_wbufsize: maximum number of buffer_heads allowed in j_wbuf, the
  *	number that will fit in j_blocksize
  * @j_last_sync_writer: most recent pid which did a synchronous write
+ * @j_flush_lock: Protects the j_flush_* state
+ * @j_wait_flush: Wait queue for waiting on a shared j_fs_dev cache flush
+ * @j_flush_started: Number of j_fs_dev cache flushes issued
+ * @j_flush_done: Sequence number of the last completed cache flush
+ * @j_flush_busy: A cache flush of j_fs_dev is in flight
+ * @j_flush_err: Result of the last completed cache flush
  * @j_history: Buffer storing the transactions statistics history
  * @j_history_max: Maximum number of transactions in the statistics history
  * @j_history_cur: Current number of transactions in the statistics history
@@ -766,6 +792,8 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_proc_entry: procfs entry for the jbd statistics directory
  * @j_stats: Overall statistics
  * @j_private: An opaque pointer to fs-private information.
+ * @j_chksum_driver: crc32c transform used for CSUM_V2 checksums
+ * @j_csum_seed: crc32c(uuid), precomputed seed for all log checksums
  */
 
 struct journal_s
@@ -848,6 +876,19 @@ struct journal_s
 	 * j_checkpoint_mutex.  [j_checkpoint_mutex]
 	 */
 	struct buffer_head	*j_chkpt_bhs[JBD2_NR_BATCH];
+
+	/*
+	 * Background checkpointing, so that log space is usually reclaimed
+	 * before jbd2_journal_start() callers have to wait for it.
+	 */
+	struct work_struct	j_checkpoint_work;
+	int			j_checkpoint_low;
+
+	/*
+	 * Ordered data writeout of the running transaction, overlapped
+	 * with the previous commit's commit record.
+	 */
+	struct work_struct	j_data_work;
 	
 	/*
 	 * Journal head: identifies the first unused block in the journal.
@@ -983,6 +1024,19 @@ struct journal_s
 	u32			j_min_batch_time;
 	u32			j_max_batch_time;
 
+	/*
+	 * Cache flushes of j_fs_dev issued through
+	 * jbd2_journal_flush_fs_dev() are shared between concurrent
+	 * callers: j_flush_started and j_flush_done count flushes issued
+	 * and completed.  [j_flush_lock]
+	 */
+	spinlock_t		j_flush_lock;
+	wait_queue_head_t	j_wait_flush;
+	unsigned long		j_flush_started;
+	unsigned long		j_flush_done;
+	int			j_flush_busy;
+	int			j_flush_err;
+
 	/* This function is called when a transaction is closed */
 	void			(*j_commit_callback)(journal_t *,
 						     transaction_t *);
@@ -1002,6 +1056,12 @@ struct journal_s
 	 * superblock pointer here
 	 */
 	void *j_private;
+
+	/* Reference to checksum algorithm driver via cryptoapi */
+	struct crypto_shash *j_chksum_driver;
+
+	/* Precomputed journal UUID checksum for seeding other checksums */
+	__u32 j_csum_seed;
 };
 
 /*
@@ -1037,8 +1097,12 @@ int jbd2_journal_next_log_block(journal_t *, unsigned long long *);
 
 /* Commit management */
 extern void jbd2_journal_commit_transaction(journal_t *);
+void jbd2_journal_write_running_data(struct work_struct *work);
+extern void jbd2_descriptor_block_csum_set(journal_t *, struct buffer_head *);
 
 /* Checkpoint list management */
+extern struct workqueue_struct *jbd2_checkpoint_wq;
+void jbd2_checkpoint_work(struct work_struct *work);
 int __jbd2_journal_clean_checkpoint_list(journal_t *journal);
 int __jbd2_journal_remove_checkpoint(struct journal_head *);
 void __jbd2_journal_insert_checkpoint(struct journal_head *, transaction_t *);
@@ -1124,6 +1188,7 @@ extern void	 jbd2_journal_invalidatepage(journal_t *,
 extern int	 jbd2_journal_try_to_free_buffers(journal_t *, struct page *, gfp_t);
 extern int	 jbd2_journal_stop(handle_t *);
 extern int	 jbd2_journal_flush (journal_t *);
+extern int	 jbd2_journal_flush_fs_dev(journal_t *);
 extern void	 jbd2_journal_lock_updates (journal_t *);
 extern void	 jbd2_journal_unlock_updates (journal_t *);
 
@@ -1271,6 +1336,34 @@ static inline void jbd2_journal_abort_handle(handle_t *handle)
 	handle->h_aborted = 1;
 }
 
+static inline int jbd2_journal_has_csum_v2(journal_t *journal)
+{
+	return JBD2_HAS_INCOMPAT_FEATURE(journal,
+					 JBD2_FEATURE_INCOMPAT_CSUM_V2);
+}
+
+static inline u32 jbd2_chksum(journal_t *journal, u32 crc,
+			      const void *address, unsigned int length)
+{
+	struct {
+		struct shash_desc shash;
+		char ctx[4];
+	} desc;
+	int err;
+
+	BUG_ON(crypto_shash_descsize(journal->j_chksum_driver) !=
+	       sizeof(desc.ctx));
+
+	desc.shash.tfm = journal->j_chksum_driver;
+	desc.shash.flags = 0;
+	*(u32 *)desc.ctx = crc;
+
+	err = crypto_shash_update(&desc.shash, address, length);
+	BUG_ON(err);
+
+	return *(u32 *)desc.ctx;
+}
+
 #endif /* __KERNEL__   */
 
 /* Comparison functions for transaction IDs: perform comparisons using
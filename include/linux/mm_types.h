@@ -9,6 +9,7 @@
 #include <linux/prio_tree.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/page-debug-flags.h>
@@ -24,6 +25,17 @@ struct address_space;
 
 #define USE_SPLIT_PTLOCKS	(NR_CPUS >= CONFIG_SPLIT_PTLOCK_CPUS)
 
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR
+/*
+ * Memory controller state of a page: the address of the mem_cgroup the
+ * page is charged to, with the PCG_* flags in its low bits.  See
+ * include/linux/page_cgroup.h for the accessors.
+ */
+struct page_cgroup {
+	unsigned long flags;
+};
+#endif
+
 /*
  * Each physical page in the system has a struct page associated with
  * it to keep track of whatever it is we are using the page for at the
@@ -109,6 +121,10 @@ struct page {
 	 * Architectures with slow multiplication can define
 	 * WANT_PAGE_VIRTUAL in asm/page.h
 	 */
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR
+	struct page_cgroup page_cgroup;	/* Owning memcg and PCG_* flags */
+#endif
+
 #if defined(WANT_PAGE_VIRTUAL)
 	void *virtual;			/* Kernel virtual address (NULL if
 					   not kmapped, ie. highmem) */
@@ -217,6 +233,13 @@ struct vm_area_struct {
 #ifdef CONFIG_NUMA
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
+#ifdef CONFIG_SWAP
+	atomic_long_t swap_readahead_info; /* Last swap fault, window, hits */
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_t vm_sequence;		/* Odd while the vma is changing */
+	atomic_t vm_ref_count;		/* Speculative faults using the vma */
+#endif
 };
 
 struct core_thread {
@@ -253,6 +276,9 @@ struct mm_rss_stat {
 struct mm_struct {
 	struct vm_area_struct * mmap;		/* list of VMAs */
 	struct rb_root mm_rb;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	rwlock_t mm_rb_lock;			/* mm_rb vs. speculative faults */
+#endif
 	struct vm_area_struct * mmap_cache;	/* last find_vma result */
 #ifdef CONFIG_MMU
 	unsigned long (*get_unmapped_area) (struct file *filp,
@@ -349,8 +375,20 @@ struct mm_struct {
 #ifdef CONFIG_CPUMASK_OFFSTACK
 	struct cpumask cpumask_allocation;
 #endif
+#ifdef CONFIG_NUMA_BALANCING
+	/*
+	 * numa_next_scan is the jiffy after which the next NUMA hinting
+	 * scan may start; numa_scan_offset is where that scan resumes.
+	 * numa_scan_seq is bumped every time a full pass completes.
+	 */
+	unsigned long numa_next_scan;
+	unsigned long numa_scan_offset;
+	int numa_scan_seq;
+#endif
 };
 
+extern struct mm_struct init_mm;
+
 static inline void mm_init_cpumask(struct mm_struct *mm)
 {
 #ifdef CONFIG_CPUMASK_OFFSTACK
@@ -3,15 +3,14 @@
 
 enum {
 	/* flags for mem_cgroup */
-	PCG_LOCK,  /* Lock for pc->mem_cgroup and following bits. */
+	PCG_LOCK,  /* Lock for the mem_cgroup pointer and following bits. */
 	PCG_CACHE, /* charged as cache */
 	PCG_USED, /* this object is in use. */
 	PCG_MIGRATION, /* under page migration */
+	PCG_KMEM, /* page charged as kernel memory */
 	/* flags for mem_cgroup and file and I/O status */
 	PCG_MOVE_LOCK, /* For race between move_account v.s. following bits */
 	PCG_FILE_MAPPED, /* page is accounted as "mapped" */
-	/* No lock in page_cgroup */
-	PCG_ACCT_LRU, /* page has been accounted for (under lru_lock) */
 	__NR_PCG_FLAGS,
 };
 
@@ -20,36 +19,53 @@ enum {
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR
 #include <linux/bit_spinlock.h>
+#include <linux/mm_types.h>
 
 /*
  * Page Cgroup can be considered as an extended mem_map.
- * A page_cgroup page is associated with every page descriptor. The
- * page_cgroup helps us identify information about the cgroup
- * All page cgroups are allocated at boot or memory hotplug event,
- * then the page cgroup for pfn always exists.
+ * The page_cgroup of a page lives in its page descriptor and helps us
+ * identify the cgroup the page is charged to.  It is a single word:
+ * the mem_cgroup pointer with the PCG_* flags stored in its low bits,
+ * which is why struct mem_cgroup is aligned to MEM_CGROUP_ALIGN.
  */
-struct page_cgroup {
-	unsigned long flags;
-	struct mem_cgroup *mem_cgroup;
-	struct list_head lru;		/* per cgroup LRU list */
-};
+#define PCG_FLAGS_MASK		((1UL << NR_PCG_FLAGS) - 1)
+#define MEM_CGROUP_ALIGN	(1UL << NR_PCG_FLAGS)
 
-void __meminit pgdat_page_cgroup_init(struct pglist_data *pgdat);
+static inline void __meminit init_page_cgroup(struct page *page)
+{
+	page->page_cgroup.flags = 0;
+}
 
-#ifdef CONFIG_SPARSEMEM
-static inline void __init page_cgroup_init_flatmem(void)
+static inline struct page_cgroup *lookup_page_cgroup(struct page *page)
 {
+	return &page->page_cgroup;
 }
-extern void __init page_cgroup_init(void);
-#else
-void __init page_cgroup_init_flatmem(void);
-static inline void __init page_cgroup_init(void)
+
+static inline struct page *lookup_cgroup_page(struct page_cgroup *pc)
 {
+	return container_of(pc, struct page, page_cgroup);
 }
-#endif
 
-struct page_cgroup *lookup_page_cgroup(struct page *page);
-struct page *lookup_cgroup_page(struct page_cgroup *pc);
+static inline struct mem_cgroup *page_cgroup_memcg(struct page_cgroup *pc)
+{
+	return (struct mem_cgroup *)(ACCESS_ONCE(pc->flags) & ~PCG_FLAGS_MASK);
+}
+
+/*
+ * The flag bits can change under us (PCG_MOVE_LOCK is taken from IRQ
+ * context, for example), so replace the pointer bits atomically.
+ */
+static inline void set_page_cgroup_memcg(struct page_cgroup *pc,
+					 struct mem_cgroup *mem)
+{
+	unsigned long old, new;
+
+	VM_BUG_ON((unsigned long)mem & PCG_FLAGS_MASK);
+	do {
+		old = ACCESS_ONCE(pc->flags);
+		new = (old & PCG_FLAGS_MASK) | (unsigned long)mem;
+	} while (cmpxchg(&pc->flags, old, new) != old);
+}
 
 #define TESTPCGFLAG(uname, lname)			\
 static inline int PageCgroup##uname(struct page_cgroup *pc)	\
@@ -76,12 +92,6 @@ TESTPCGFLAG(Used, USED)
 CLEARPCGFLAG(Used, USED)
 SETPCGFLAG(Used, USED)
 
-SETPCGFLAG(AcctLRU, ACCT_LRU)
-CLEARPCGFLAG(AcctLRU, ACCT_LRU)
-TESTPCGFLAG(AcctLRU, ACCT_LRU)
-TESTCLEARPCGFLAG(AcctLRU, ACCT_LRU)
-
-
 SETPCGFLAG(FileMapped, FILE_MAPPED)
 CLEARPCGFLAG(FileMapped, FILE_MAPPED)
 TESTPCGFLAG(FileMapped, FILE_MAPPED)
@@ -90,11 +100,15 @@ SETPCGFLAG(Migration, MIGRATION)
 CLEARPCGFLAG(Migration, MIGRATION)
 TESTPCGFLAG(Migration, MIGRATION)
 
+SETPCGFLAG(Kmem, KMEM)
+CLEARPCGFLAG(Kmem, KMEM)
+TESTPCGFLAG(Kmem, KMEM)
+
 static inline void lock_page_cgroup(struct page_cgroup *pc)
 {
 	/*
 	 * Don't take this lock in IRQ context.
-	 * This lock is for pc->mem_cgroup, USED, CACHE, MIGRATION
+	 * This lock is for the mem_cgroup pointer, USED, CACHE, MIGRATION
 	 */
 	bit_spin_lock(PCG_LOCK, &pc->flags);
 }
@@ -122,43 +136,10 @@ static inline void move_unlock_page_cgroup(struct page_cgroup *pc,
 	local_irq_restore(*flags);
 }
 
-#ifdef CONFIG_SPARSEMEM
-#define PCG_ARRAYID_WIDTH	SECTIONS_SHIFT
-#else
-#define PCG_ARRAYID_WIDTH	NODES_SHIFT
-#endif
-
-#if (PCG_ARRAYID_WIDTH > BITS_PER_LONG - NR_PCG_FLAGS)
-#error Not enough space left in pc->flags to store page_cgroup array IDs
-#endif
-
-/* pc->flags: ARRAY-ID | FLAGS */
-
-#define PCG_ARRAYID_MASK	((1UL << PCG_ARRAYID_WIDTH) - 1)
-
-#define PCG_ARRAYID_OFFSET	(BITS_PER_LONG - PCG_ARRAYID_WIDTH)
-/*
- * Zero the shift count for non-existent fields, to prevent compiler
- * warnings and ensure references are optimized away.
- */
-#define PCG_ARRAYID_SHIFT	(PCG_ARRAYID_OFFSET * (PCG_ARRAYID_WIDTH != 0))
-
-static inline void set_page_cgroup_array_id(struct page_cgroup *pc,
-					    unsigned long id)
-{
-	pc->flags &= ~(PCG_ARRAYID_MASK << PCG_ARRAYID_SHIFT);
-	pc->flags |= (id & PCG_ARRAYID_MASK) << PCG_ARRAYID_SHIFT;
-}
-
-static inline unsigned long page_cgroup_array_id(struct page_cgroup *pc)
-{
-	return (pc->flags >> PCG_ARRAYID_SHIFT) & PCG_ARRAYID_MASK;
-}
-
 #else /* CONFIG_CGROUP_MEM_RES_CTLR */
 struct page_cgroup;
 
-static inline void __meminit pgdat_page_cgroup_init(struct pglist_data *pgdat)
+static inline void __meminit init_page_cgroup(struct page *page)
 {
 }
 
@@ -167,14 +148,6 @@ static inline struct page_cgroup *lookup_page_cgroup(struct page *page)
 	return NULL;
 }
 
-static inline void page_cgroup_init(void)
-{
-}
-
-static inline void __init page_cgroup_init_flatmem(void)
-{
-}
-
 #endif /* CONFIG_CGROUP_MEM_RES_CTLR */
 
 #include <linux/swap.h>
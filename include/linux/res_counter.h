@@ -116,6 +116,15 @@ int __must_check res_counter_charge_locked(struct res_counter *counter,
 int __must_check res_counter_charge(struct res_counter *counter,
 		unsigned long val, struct res_counter **limit_fail_at);
 
+/*
+ * charge_nofail - like charge, but the resource is consumed even when
+ * it exceeds the limit of @counter or of one of its parents.  Returns
+ * -ENOMEM, and reports the first such counter in @limit_fail_at, when
+ * that happened.
+ */
+int res_counter_charge_nofail(struct res_counter *counter,
+		unsigned long val, struct res_counter **limit_fail_at);
+
 /*
  * uncharge - tell that some portion of the resource is released
  *
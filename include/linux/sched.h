@@ -76,7 +76,6 @@ struct sched_param {
 #include <linux/pid.h>
 #include <linux/percpu.h>
 #include <linux/topology.h>
-#include <linux/proportions.h>
 #include <linux/seccomp.h>
 #include <linux/rcupdate.h>
 #include <linux/rculist.h>
@@ -1511,6 +1510,14 @@ struct task_struct {
 	struct mempolicy *mempolicy;	/* Protected by alloc_lock */
 	short il_next;
 	short pref_node_fork;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	int numa_scan_seq;		/* last mm->numa_scan_seq seen */
+	int numa_preferred_nid;		/* node holding most of our memory */
+	int numa_work_pending;		/* task_numa_work() due on resume */
+	unsigned int numa_scan_period;	/* ms between scans of our mm */
+	u64 node_stamp;			/* runtime at which the scan was due */
+	unsigned long *numa_faults;	/* per-node hinting fault counts */
 #endif
 	struct rcu_head rcu;
 
@@ -1524,7 +1531,13 @@ struct task_struct {
 #ifdef CONFIG_FAULT_INJECTION
 	int make_it_fail;
 #endif
-	struct prop_local_single dirties;
+	/*
+	 * when (nr_dirtied >= nr_dirtied_pause), it's time to call
+	 * balance_dirty_pages() for some dirty throttling pause
+	 */
+	int nr_dirtied;
+	int nr_dirtied_pause;
+
 #ifdef CONFIG_LATENCYTOP
 	int latency_record_count;
 	struct latency_record latency_record[LT_SAVECOUNT];
@@ -1993,6 +2006,28 @@ enum sched_tunable_scaling {
 };
 extern enum sched_tunable_scaling sysctl_sched_tunable_scaling;
 
+#ifdef CONFIG_NUMA_BALANCING
+extern unsigned int sysctl_numa_balancing;
+extern unsigned int sysctl_numa_balancing_scan_delay;
+extern unsigned int sysctl_numa_balancing_scan_period_min;
+extern unsigned int sysctl_numa_balancing_scan_period_max;
+extern unsigned int sysctl_numa_balancing_scan_size;
+
+extern void task_numa_fault(int node, int pages, bool migrated);
+extern void task_numa_work(struct task_struct *p);
+extern void task_numa_free(struct task_struct *p);
+#else
+static inline void task_numa_fault(int node, int pages, bool migrated)
+{
+}
+static inline void task_numa_work(struct task_struct *p)
+{
+}
+static inline void task_numa_free(struct task_struct *p)
+{
+}
+#endif
+
 #ifdef CONFIG_SCHED_DEBUG
 extern unsigned int sysctl_sched_migration_cost;
 extern unsigned int sysctl_sched_nr_migrate;
@@ -2092,8 +2127,6 @@ static inline int kstack_end(void *addr)
 extern union thread_union init_thread_union;
 extern struct task_struct init_task;
 
-extern struct   mm_struct init_mm;
-
 extern struct pid_namespace init_pid_ns;
 
 /*
@@ -10,6 +10,9 @@ struct shrink_control {
 
 	/* How many slab objects shrinker() should scan and try to reclaim */
 	unsigned long nr_to_scan;
+
+	/* Only reclaim objects charged to this memory cgroup, if set */
+	struct mem_cgroup *mem_cgroup;
 };
 
 /*
@@ -31,12 +34,17 @@ struct shrinker {
 	int (*shrink)(struct shrinker *, struct shrink_control *sc);
 	int seeks;	/* seeks to recreate an obj */
 	long batch;	/* reclaim batch size, 0 = default */
+	int flags;
 
 	/* These are for internal use */
 	struct list_head list;
 	long nr;	/* objs pending delete */
 };
 #define DEFAULT_SEEKS 2 /* A good number if you don't know better. */
+
+/* Honours shrink_control->mem_cgroup, is called for memcg reclaim */
+#define SHRINKER_MEMCG_AWARE	(1 << 0)
+
 extern void register_shrinker(struct shrinker *);
 extern void unregister_shrinker(struct shrinker *);
 #endif
@@ -76,6 +76,16 @@
 # define SLAB_FAILSLAB		0x00000000UL
 #endif
 
+/*
+ * Charge the objects to the kernel memory of the memory cgroup of the
+ * allocating task.  Each memory cgroup gets its own copy of the cache.
+ */
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+# define SLAB_ACCOUNT		0x04000000UL
+#else
+# define SLAB_ACCOUNT		0x00000000UL
+#endif
+
 /* The following flags affect the page allocator grouping pages by mobility */
 #define SLAB_RECLAIM_ACCOUNT	0x00020000UL		/* Objects are reclaimable */
 #define SLAB_TEMPORARY		SLAB_RECLAIM_ACCOUNT	/* Objects are short-lived */
@@ -92,6 +102,38 @@
 #define ZERO_OR_NULL_PTR(x) ((unsigned long)(x) <= \
 				(unsigned long)ZERO_SIZE_PTR)
 
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+#include <linux/workqueue.h>
+
+struct mem_cgroup;
+
+/*
+ * Memory cgroup state of a slab cache.
+ *
+ * A cache created with SLAB_ACCOUNT is a root cache and gets a slot
+ * @id in every memory cgroup's table of caches.  The per-cgroup copies
+ * are created on first use and point back to the root cache and to the
+ * cgroup that is charged for their pages.
+ */
+struct memcg_cache_params {
+	/* root caches */
+	int id;
+	struct list_head children;
+	size_t size;
+	size_t align;
+	unsigned long flags;
+	void (*ctor)(void *);
+	/* per-cgroup caches */
+	struct mem_cgroup *memcg;
+	struct kmem_cache *root_cache;
+	struct list_head sibling;
+	char *name;
+	atomic_t nr_pages;
+	unsigned long state;		/* MEMCG_CACHE_DEAD, ... */
+	struct work_struct destroy;
+};
+#endif
+
 /*
  * struct kmem_cache related prototypes
  */
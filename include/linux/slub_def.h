@@ -92,6 +92,9 @@ struct kmem_cache {
 	int reserved;		/* Reserved bytes at the end of slabs */
 	const char *name;	/* Name (only for display!) */
 	struct list_head list;	/* List of slab caches */
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	struct memcg_cache_params memcg_params;
+#endif
 #ifdef CONFIG_SYSFS
 	struct kobject kobj;	/* For sysfs */
 #endif
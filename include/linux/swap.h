@@ -8,6 +8,7 @@
 #include <linux/memcontrol.h>
 #include <linux/sched.h>
 #include <linux/node.h>
+#include <linux/workqueue.h>
 
 #include <linux/atomic.h>
 #include <asm/page.h>
@@ -144,7 +145,6 @@ enum {
 	SWP_USED	= (1 << 0),	/* is slot in swap_info[] used? */
 	SWP_WRITEOK	= (1 << 1),	/* ok to write to this swap?	*/
 	SWP_DISCARDABLE = (1 << 2),	/* swapon+blkdev support discard */
-	SWP_DISCARDING	= (1 << 3),	/* now discarding a free cluster */
 	SWP_SOLIDSTATE	= (1 << 4),	/* blkdev seeks are cheap */
 	SWP_CONTINUED	= (1 << 5),	/* swap_map has count continuation */
 	SWP_BLKDEV	= (1 << 6),	/* its a block device */
@@ -171,6 +171,25 @@ enum {
 #define COUNT_CONTINUED	0x80	/* See swap_map continuation for full count */
 #define SWAP_MAP_SHMEM	0xbf	/* Owned by shmem/tmpfs, in first swap_map */
 
+/*
+ * On solid state devices the swap_map is divided into clusters of
+ * SWAPFILE_CLUSTER slots.  Clusters with no slot in use are kept on a
+ * free list, from which each cpu takes a cluster to allocate from
+ * sequentially; a cluster freed on a discardable device is discarded
+ * before it goes back on the free list.
+ */
+struct swap_cluster_info {
+	struct list_head list;		/* on free_clusters or discard_clusters */
+	unsigned int count;		/* slots in use, including bad ones */
+	unsigned int flags;		/* CLUSTER_FLAG_* */
+};
+#define CLUSTER_FLAG_FREE	1	/* on the free_clusters list */
+#define CLUSTER_FLAG_DISCARD	2	/* on the discard_clusters list */
+
+struct percpu_cluster {
+	unsigned int next;		/* next slot to try, 0 if no cluster */
+};
+
 /*
  * The in-memory structure used to track swap areas.
  */
@@ -187,8 +206,12 @@ struct swap_info_struct {
 	unsigned int inuse_pages;	/* number of those currently in use */
 	unsigned int cluster_next;	/* likely index for next allocation */
 	unsigned int cluster_nr;	/* countdown to next cluster search */
-	unsigned int lowest_alloc;	/* while preparing discard cluster */
-	unsigned int highest_alloc;	/* while preparing discard cluster */
+	struct swap_cluster_info *cluster_info;	/* solid state devices only */
+	struct list_head free_clusters;	/* clusters with no slot in use */
+	struct list_head discard_clusters; /* freed clusters to discard */
+	struct percpu_cluster __percpu *percpu_cluster;
+	struct work_struct discard_work; /* discards discard_clusters */
+	spinlock_t lock;		/* protects swap_map and the above */
 	struct swap_extent *curr_swap_extent;
 	struct swap_extent first_swap_extent;
 	struct block_device *bdev;	/* swap device or bdev of swap file */
@@ -202,7 +225,15 @@ struct swap_list_t {
 };
 
 /* Swap 50% full? Release swapcache more aggressively.. */
-#define vm_swap_full() (nr_swap_pages*2 < total_swap_pages)
+#define vm_swap_full() (get_nr_swap_pages()*2 < total_swap_pages)
+
+/* linux/mm/workingset.c */
+extern void *workingset_eviction(struct address_space *mapping,
+				 struct page *page);
+extern bool workingset_refault(void *shadow);
+extern void workingset_activation(struct page *page);
+extern void workingset_shadow_inc(struct address_space *mapping);
+extern void workingset_shadow_dec(struct address_space *mapping);
 
 /* linux/mm/page_alloc.c */
 extern unsigned long totalram_pages;
@@ -254,10 +285,8 @@ extern unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 extern int __isolate_lru_page(struct page *page, int mode, int file);
 extern unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *mem,
 						  gfp_t gfp_mask, bool noswap);
-extern unsigned long mem_cgroup_shrink_node_zone(struct mem_cgroup *mem,
-						gfp_t gfp_mask, bool noswap,
-						struct zone *zone,
-						unsigned long *nr_scanned);
+extern unsigned long try_to_free_mem_cgroup_kmem(struct mem_cgroup *mem,
+						 gfp_t gfp_mask);
 extern unsigned long shrink_all_memory(unsigned long nr_pages);
 extern int vm_swappiness;
 extern int remove_mapping(struct address_space *mapping, struct page *page);
@@ -321,15 +350,28 @@ extern void __delete_from_swap_cache(struct page *);
 extern void delete_from_swap_cache(struct page *);
 extern void free_page_and_swap_cache(struct page *);
 extern void free_pages_and_swap_cache(struct page **, int);
-extern struct page *lookup_swap_cache(swp_entry_t);
+extern struct page *lookup_swap_cache(swp_entry_t,
+			struct vm_area_struct *vma, unsigned long addr);
 extern struct page *read_swap_cache_async(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
 extern struct page *swapin_readahead(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
+extern bool swap_use_vma_readahead(void);
+extern struct page *swap_vma_readahead(swp_entry_t, gfp_t,
+			struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd);
 
 /* linux/mm/swapfile.c */
-extern long nr_swap_pages;
+extern atomic_long_t nr_swap_pages;
+extern atomic_t nr_rotate_swap;
 extern long total_swap_pages;
+
+/* Swap slots free for allocation */
+static inline long get_nr_swap_pages(void)
+{
+	return atomic_long_read(&nr_swap_pages);
+}
+
 extern void si_swapinfo(struct sysinfo *);
 extern swp_entry_t get_swap_page(void);
 extern swp_entry_t get_swap_page_of_type(int);
@@ -386,7 +428,7 @@ static inline void mem_cgroup_uncharge_swap(swp_entry_t ent)
 
 #else /* CONFIG_SWAP */
 
-#define nr_swap_pages				0L
+#define get_nr_swap_pages()			0L
 #define total_swap_pages			0L
 #define total_swapcache_pages			0UL
 
@@ -434,12 +476,25 @@ static inline struct page *swapin_readahead(swp_entry_t swp, gfp_t gfp_mask,
 	return NULL;
 }
 
+static inline bool swap_use_vma_readahead(void)
+{
+	return false;
+}
+
+static inline struct page *swap_vma_readahead(swp_entry_t swp, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd)
+{
+	return NULL;
+}
+
 static inline int swap_writepage(struct page *p, struct writeback_control *wbc)
 {
 	return 0;
 }
 
-static inline struct page *lookup_swap_cache(swp_entry_t swp)
+static inline struct page *lookup_swap_cache(swp_entry_t swp,
+			struct vm_area_struct *vma, unsigned long addr)
 {
 	return NULL;
 }
@@ -67,6 +67,30 @@ TRACE_EVENT(mm_compaction_migratepages,
 		__entry->nr_failed)
 );
 
+TRACE_EVENT(mm_compaction_wakeup_kcompactd,
+
+	TP_PROTO(int nid, int order, int classzone_idx),
+
+	TP_ARGS(nid, order, classzone_idx),
+
+	TP_STRUCT__entry(
+		__field(int, nid)
+		__field(int, order)
+		__field(int, classzone_idx)
+	),
+
+	TP_fast_assign(
+		__entry->nid = nid;
+		__entry->order = order;
+		__entry->classzone_idx = classzone_idx;
+	),
+
+	TP_printk("nid=%d order=%d classzone_idx=%d",
+		__entry->nid,
+		__entry->order,
+		__entry->classzone_idx)
+);
+
 
 #endif /* _TRACE_COMPACTION_H */
 
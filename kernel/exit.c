@@ -974,6 +974,7 @@ NORET_TYPE void do_exit(long code)
 	taskstats_exit(tsk, group_dead);
 
 	exit_mm(tsk);
+	task_numa_free(tsk);
 
 	if (group_dead)
 		acct_process();
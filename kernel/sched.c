@@ -2829,6 +2829,15 @@ static void __sched_fork(struct task_struct *p)
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
 #endif
+
+#ifdef CONFIG_NUMA_BALANCING
+	p->node_stamp = 0ULL;
+	p->numa_scan_seq = p->mm ? p->mm->numa_scan_seq : 0;
+	p->numa_preferred_nid = -1;
+	p->numa_work_pending = 0;
+	p->numa_scan_period = sysctl_numa_balancing_scan_delay;
+	p->numa_faults = NULL;
+#endif /* CONFIG_NUMA_BALANCING */
 }
 
 /*
@@ -23,6 +23,9 @@
 #include <linux/latencytop.h>
 #include <linux/sched.h>
 #include <linux/cpumask.h>
+#include <linux/slab.h>
+#include <linux/mempolicy.h>
+#include <linux/tracehook.h>
 
 /*
  * Targeted preemption latency for CPU-bound tasks:
@@ -644,6 +647,259 @@ update_stats_curr_start(struct cfs_rq *cfs_rq, struct sched_entity *se)
 	se->exec_start = rq_of(cfs_rq)->clock_task;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Automatic NUMA balancing: every scan period a task's mm has a window
+ * of its address space made PROT_NONE.  The resulting hinting faults
+ * (see do_numa_page()) migrate misplaced pages towards the node the task
+ * runs on and record on which nodes the task's memory lives, so that
+ * the load balancer can prefer keeping the task near its memory.
+ */
+unsigned int sysctl_numa_balancing = 1;
+
+/* Amount of address space, in MB, to mark for hinting faults per scan */
+unsigned int sysctl_numa_balancing_scan_size = 256;
+
+/*
+ * Scan @scan_size MB every @scan_period ms, after an initial delay of
+ * @scan_delay ms of task runtime.  The period backs off towards the
+ * maximum while the task's memory is found to be well placed.
+ */
+unsigned int sysctl_numa_balancing_scan_period_min = 100;
+unsigned int sysctl_numa_balancing_scan_period_max = 100*50;
+unsigned int sysctl_numa_balancing_scan_delay = 1000;
+
+static void task_numa_placement(struct task_struct *p)
+{
+	int seq = ACCESS_ONCE(p->mm->numa_scan_seq);
+	unsigned long faults, max_faults = 0;
+	int nid, max_nid = -1;
+
+	if (p->numa_scan_seq == seq)
+		return;
+	p->numa_scan_seq = seq;
+
+	for_each_online_node(nid) {
+		faults = p->numa_faults[nid];
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+		/* Decay, so that recent behaviour outweighs the old */
+		p->numa_faults[nid] = faults >> 1;
+	}
+
+	if (max_nid != -1)
+		p->numa_preferred_nid = max_nid;
+}
+
+/*
+ * Got a NUMA hinting fault for @pages pages which now live on @node.
+ */
+void task_numa_fault(int node, int pages, bool migrated)
+{
+	struct task_struct *p = current;
+
+	if (!sysctl_numa_balancing || node < 0 || !p->mm)
+		return;
+
+	if (unlikely(!p->numa_faults)) {
+		p->numa_faults = kzalloc(sizeof(*p->numa_faults) * nr_node_ids,
+					 GFP_KERNEL);
+		if (!p->numa_faults)
+			return;
+	}
+
+	/*
+	 * Pages that did not need to move are well placed already, so
+	 * scan more slowly.  A migration means the workload moved, so
+	 * go back to scanning at the fastest rate.
+	 */
+	if (migrated)
+		p->numa_scan_period = sysctl_numa_balancing_scan_period_min;
+	else
+		p->numa_scan_period = min(sysctl_numa_balancing_scan_period_max,
+					  p->numa_scan_period + 10);
+
+	task_numa_placement(p);
+
+	p->numa_faults[node] += pages;
+}
+
+void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+	p->numa_faults = NULL;
+}
+
+static void reset_ptenuma_scan(struct task_struct *p)
+{
+	ACCESS_ONCE(p->mm->numa_scan_seq)++;
+	p->mm->numa_scan_offset = 0;
+}
+
+/*
+ * The expensive part of NUMA balancing: mark the next window of the
+ * address space for hinting faults.  Queued from the scheduler tick by
+ * task_tick_numa() and run by @p itself on its way back to user mode.
+ */
+void task_numa_work(struct task_struct *p)
+{
+	unsigned long migrate, next_scan, now = jiffies;
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma;
+	unsigned long start, end;
+	long pages, virtpages;
+
+	if (!p->numa_work_pending)
+		return;
+	p->numa_work_pending = 0;
+
+	WARN_ON_ONCE(p != current);
+	if (!mm || (p->flags & PF_EXITING) || !sysctl_numa_balancing)
+		return;
+
+	/*
+	 * All threads of a process share the scan state; only one of
+	 * them gets to scan each period.
+	 */
+	migrate = mm->numa_next_scan;
+	if (time_before(now, migrate))
+		return;
+
+	next_scan = now + msecs_to_jiffies(p->numa_scan_period);
+	if (cmpxchg(&mm->numa_next_scan, migrate, next_scan) != migrate)
+		return;
+
+	pages = sysctl_numa_balancing_scan_size;
+	pages <<= 20 - PAGE_SHIFT;	/* MB in pages */
+	if (!pages)
+		return;
+	/* Bound the walk over sparsely populated address space too */
+	virtpages = pages * 8;
+
+	start = mm->numa_scan_offset;
+
+	down_read(&mm->mmap_sem);
+	vma = find_vma(mm, start);
+	if (!vma) {
+		reset_ptenuma_scan(p);
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma; vma = vma->vm_next) {
+		if (!vma_migratable(vma))
+			continue;
+
+		do {
+			start = max(start, vma->vm_start);
+			end = ALIGN(start + (pages << PAGE_SHIFT), PMD_SIZE);
+			end = min(end, vma->vm_end);
+			pages -= change_prot_numa(vma, start, end);
+			virtpages -= (end - start) >> PAGE_SHIFT;
+
+			start = end;
+			if (pages <= 0 || virtpages <= 0)
+				goto out;
+		} while (end != vma->vm_end);
+	}
+
+out:
+	/*
+	 * It is possible to reach the end of the VMA list but the last
+	 * few VMAs are not guaranteed to be migratable.  If they are not,
+	 * we would find the !migratable VMA on the next scan but not reset
+	 * the scanner to the start so check it now.
+	 */
+	if (vma)
+		mm->numa_scan_offset = start;
+	else
+		reset_ptenuma_scan(p);
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Called from the scheduler tick: once @curr has run for its scan
+ * period, arrange for task_numa_work() to run on return to user mode.
+ */
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+	u64 period, now;
+
+	if (!sysctl_numa_balancing || !curr->mm ||
+	    (curr->flags & (PF_EXITING | PF_KTHREAD)) ||
+	    curr->numa_work_pending)
+		return;
+
+	/*
+	 * Using runtime rather than walltime has the dual advantage that
+	 * we (mostly) drive the scanning from busy threads and that the
+	 * task needs to have done some actual work before we bother with
+	 * NUMA placement.
+	 */
+	now = curr->se.sum_exec_runtime;
+	period = (u64)curr->numa_scan_period * NSEC_PER_MSEC;
+
+	if (now - curr->node_stamp > period) {
+		if (!curr->node_stamp)
+			curr->numa_scan_period =
+				sysctl_numa_balancing_scan_period_min;
+		curr->node_stamp = now;
+
+		if (!time_before(jiffies, curr->mm->numa_next_scan)) {
+			curr->numa_work_pending = 1;
+			set_notify_resume(curr);
+		}
+	}
+}
+
+/*
+ * Moving @p from @src_cpu to @dst_cpu takes it to the node holding most
+ * of its memory.
+ */
+static bool migrate_improves_locality(struct task_struct *p,
+				      int src_cpu, int dst_cpu)
+{
+	int src_nid = cpu_to_node(src_cpu), dst_nid = cpu_to_node(dst_cpu);
+
+	if (!sysctl_numa_balancing || p->numa_preferred_nid == -1)
+		return false;
+
+	return src_nid != dst_nid && dst_nid == p->numa_preferred_nid;
+}
+
+/*
+ * Moving @p from @src_cpu to @dst_cpu takes it away from the node
+ * holding most of its memory.
+ */
+static bool migrate_degrades_locality(struct task_struct *p,
+				      int src_cpu, int dst_cpu)
+{
+	int src_nid = cpu_to_node(src_cpu), dst_nid = cpu_to_node(dst_cpu);
+
+	if (!sysctl_numa_balancing || p->numa_preferred_nid == -1)
+		return false;
+
+	return src_nid != dst_nid && src_nid == p->numa_preferred_nid;
+}
+#else
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+}
+
+static inline bool migrate_improves_locality(struct task_struct *p,
+					     int src_cpu, int dst_cpu)
+{
+	return false;
+}
+
+static inline bool migrate_degrades_locality(struct task_struct *p,
+					     int src_cpu, int dst_cpu)
+{
+	return false;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /**************************************************
  * Scheduling class queueing methods:
  */
@@ -2067,7 +2323,12 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 	 */
 
 	tsk_cache_hot = task_hot(p, rq->clock_task, sd);
+	/* Pulling a task away from its memory is as bad as cache-hot */
+	if (!tsk_cache_hot)
+		tsk_cache_hot = migrate_degrades_locality(p, cpu_of(rq),
+							  this_cpu);
 	if (!tsk_cache_hot ||
+		migrate_improves_locality(p, cpu_of(rq), this_cpu) ||
 		sd->nr_balance_failed > sd->cache_nice_tries) {
 #ifdef CONFIG_SCHEDSTATS
 		if (tsk_cache_hot) {
@@ -4132,6 +4393,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	task_tick_numa(rq, curr);
 }
 
 /*
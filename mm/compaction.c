@@ -14,6 +14,9 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/cpu.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -724,6 +727,241 @@ int sysctl_extfrag_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * kcompactd: background compaction
+ *
+ * kswapd reclaims until the watermarks are met at order-0, but free
+ * memory can be plentiful and still too fragmented for the high-order
+ * allocations it was woken for.  Rather than leaving those to compact
+ * from the allocation slow path, kswapd hands them to the per-node
+ * kcompactd thread before going to sleep.  kcompactd only does work
+ * where compaction_suitable() says a failure would be due to
+ * fragmentation (see sysctl_extfrag_threshold) and respects the
+ * deferral state shared with direct compaction.
+ */
+static bool kcompactd_work_requested(pg_data_t *pgdat)
+{
+	return pgdat->kcompactd_max_order > 0 || kthread_should_stop();
+}
+
+static bool kcompactd_node_suitable(pg_data_t *pgdat)
+{
+	int zoneid;
+	struct zone *zone;
+	enum zone_type classzone_idx = pgdat->kcompactd_classzone_idx;
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		zone = &pgdat->node_zones[zoneid];
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_suitable(zone, pgdat->kcompactd_max_order) ==
+							COMPACT_CONTINUE)
+			return true;
+	}
+
+	return false;
+}
+
+static void kcompactd_do_work(pg_data_t *pgdat)
+{
+	int zoneid;
+	struct zone *zone;
+	struct compact_control cc = {
+		.order = pgdat->kcompactd_max_order,
+		.migratetype = MIGRATE_MOVABLE,
+		.sync = true,
+	};
+	enum zone_type classzone_idx = pgdat->kcompactd_classzone_idx;
+	bool success = false;
+
+	count_vm_event(KCOMPACTD_WAKE);
+	pgdat->kcompactd_wake++;
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		int status;
+
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_deferred(zone) ||
+		    compaction_suitable(zone, cc.order) != COMPACT_CONTINUE)
+			continue;
+
+		cc.nr_freepages = 0;
+		cc.nr_migratepages = 0;
+		cc.zone = zone;
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		if (kthread_should_stop())
+			return;
+		status = compact_zone(zone, &cc);
+
+		if (zone_watermark_ok(zone, cc.order, low_wmark_pages(zone),
+				      0, 0)) {
+			zone->compact_considered = 0;
+			zone->compact_defer_shift = 0;
+			success = true;
+		} else if (status == COMPACT_COMPLETE) {
+			/*
+			 * The whole zone was scanned without result, back
+			 * off just like direct compaction does.
+			 */
+			defer_compaction(zone);
+		}
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+	}
+
+	if (success)
+		pgdat->kcompactd_success++;
+	else
+		pgdat->kcompactd_fail++;
+
+	/*
+	 * Regardless of success, we are done until woken up again, unless
+	 * a harder request came in meanwhile.
+	 */
+	if (pgdat->kcompactd_max_order <= cc.order)
+		pgdat->kcompactd_max_order = 0;
+	if (pgdat->kcompactd_classzone_idx >= classzone_idx)
+		pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+}
+
+/**
+ * wakeup_kcompactd - ask for background compaction of a node
+ * @pgdat: the node to compact
+ * @order: the order the allocation that triggered reclaim wanted
+ * @classzone_idx: the highest zone that allocation could use
+ *
+ * Called by kswapd when it is about to go to sleep.
+ */
+void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx)
+{
+	if (!order)
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+
+	if (pgdat->kcompactd_classzone_idx > classzone_idx)
+		pgdat->kcompactd_classzone_idx = classzone_idx;
+
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+
+	if (!kcompactd_node_suitable(pgdat))
+		return;
+
+	trace_mm_compaction_wakeup_kcompactd(pgdat->node_id, order,
+					     classzone_idx);
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * The background compaction daemon, started as a kernel thread
+ * from the init process.
+ */
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = (pg_data_t *)p;
+	struct task_struct *tsk = current;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(tsk, cpumask);
+
+	set_freezable();
+
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(pgdat->kcompactd_wait,
+				kcompactd_work_requested(pgdat));
+
+		kcompactd_do_work(pgdat);
+	}
+
+	return 0;
+}
+
+/*
+ * This kcompactd start function will be called by init and node-hot-add.
+ * On node-hot-add, kcompactd will moved to proper cpus if cpus are hot-added.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	int ret = 0;
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		printk(KERN_ERR "Failed to start kcompactd on node %d\n", nid);
+		ret = PTR_ERR(pgdat->kcompactd);
+		pgdat->kcompactd = NULL;
+	}
+	return ret;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+/*
+ * It's optimal to keep kcompactd on the same CPUs as their memory, but
+ * not required for correctness. So if the last cpu in a node goes
+ * away, we get changed to run anywhere: as the first one comes back,
+ * restore their cpu bindings.
+ */
+static int __cpuinit kcompactd_cpu_callback(struct notifier_block *nfb,
+					    unsigned long action, void *hcpu)
+{
+	int nid;
+
+	if (action == CPU_ONLINE || action == CPU_ONLINE_FROZEN) {
+		for_each_node_state(nid, N_HIGH_MEMORY) {
+			pg_data_t *pgdat = NODE_DATA(nid);
+			const struct cpumask *mask;
+
+			mask = cpumask_of_node(pgdat->node_id);
+
+			if (pgdat->kcompactd &&
+			    cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids)
+				/* One of our CPUs online: restore mask */
+				set_cpus_allowed_ptr(pgdat->kcompactd, mask);
+		}
+	}
+	return NOTIFY_OK;
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	hotcpu_notifier(kcompactd_cpu_callback, 0);
+	return 0;
+}
+subsys_initcall(kcompactd_init);
+
 #if defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
 ssize_t sysfs_compact_node(struct sys_device *dev,
 			struct sysdev_attribute *attr,
@@ -735,13 +973,30 @@ ssize_t sysfs_compact_node(struct sys_device *dev,
 }
 static SYSDEV_ATTR(compact, S_IWUSR, NULL, sysfs_compact_node);
 
+static ssize_t sysfs_kcompactd_node(struct sys_device *dev,
+			struct sysdev_attribute *attr, char *buf)
+{
+	pg_data_t *pgdat = NODE_DATA(dev->id);
+
+	return sprintf(buf, "wake %lu\nsuccess %lu\nfail %lu\n",
+		       pgdat->kcompactd_wake, pgdat->kcompactd_success,
+		       pgdat->kcompactd_fail);
+}
+static SYSDEV_ATTR(kcompactd, S_IRUGO, sysfs_kcompactd_node, NULL);
+
 int compaction_register_node(struct node *node)
 {
-	return sysdev_create_file(&node->sysdev, &attr_compact);
+	int ret;
+
+	ret = sysdev_create_file(&node->sysdev, &attr_compact);
+	if (!ret)
+		ret = sysdev_create_file(&node->sysdev, &attr_kcompactd);
+	return ret;
 }
 
 void compaction_unregister_node(struct node *node)
 {
-	return sysdev_remove_file(&node->sysdev, &attr_compact);
+	sysdev_remove_file(&node->sysdev, &attr_kcompactd);
+	sysdev_remove_file(&node->sysdev, &attr_compact);
 }
 #endif /* CONFIG_SYSFS && CONFIG_NUMA */
@@ -106,12 +106,36 @@
  *    ->i_mmap_mutex
  */
 
+static void page_cache_tree_delete(struct address_space *mapping,
+				   struct page *page, void *shadow)
+{
+	if (shadow) {
+		void **slot;
+		int tag;
+
+		slot = radix_tree_lookup_slot(&mapping->page_tree, page->index);
+		/*
+		 * The shadow entry takes over the slot: make sure it does
+		 * not inherit any of the page's tags.
+		 */
+		for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++)
+			radix_tree_tag_clear(&mapping->page_tree, page->index,
+					     tag);
+		radix_tree_replace_slot(slot, shadow);
+		workingset_shadow_inc(mapping);
+	} else
+		radix_tree_delete(&mapping->page_tree, page->index);
+}
+
 /*
  * Delete a page from the page cache and free it. Caller has to make
  * sure the page is locked and that nobody else uses it - or that usage
  * is safe.  The caller must hold the mapping's tree_lock.
+ *
+ * If @shadow is not NULL, it is stored in the page's slot in place of
+ * the page to remember the eviction for refault detection.
  */
-void __delete_from_page_cache(struct page *page)
+void __delete_from_page_cache(struct page *page, void *shadow)
 {
 	struct address_space *mapping = page->mapping;
 
@@ -125,7 +149,7 @@ void __delete_from_page_cache(struct page *page)
 	else
 		cleancache_flush_page(mapping, page);
 
-	radix_tree_delete(&mapping->page_tree, page->index);
+	page_cache_tree_delete(mapping, page, shadow);
 	page->mapping = NULL;
 	/* Leave page->index set: truncation lookup relies upon it */
 	mapping->nrpages--;
@@ -164,7 +188,7 @@ void delete_from_page_cache(struct page *page)
 
 	freepage = mapping->a_ops->freepage;
 	spin_lock_irq(&mapping->tree_lock);
-	__delete_from_page_cache(page);
+	__delete_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
@@ -424,10 +448,9 @@ int replace_page_cache_page(struct page *old, struct page *new, gfp_t gfp_mask)
 		new->index = offset;
 
 		spin_lock_irq(&mapping->tree_lock);
-		__delete_from_page_cache(old);
-		error = radix_tree_insert(&mapping->page_tree, offset, new);
+		__delete_from_page_cache(old, NULL);
+		error = page_cache_tree_insert(mapping, new, NULL);
 		BUG_ON(error);
-		mapping->nrpages++;
 		__inc_zone_page_state(new, NR_FILE_PAGES);
 		if (PageSwapBacked(new))
 			__inc_zone_page_state(new, NR_SHMEM);
@@ -446,17 +469,48 @@ int replace_page_cache_page(struct page *old, struct page *new, gfp_t gfp_mask)
 EXPORT_SYMBOL_GPL(replace_page_cache_page);
 
 /**
- * add_to_page_cache_locked - add a locked page to the pagecache
- * @page:	page to add
+ * page_cache_tree_insert - insert a page into the page cache radix tree
  * @mapping:	the page's address_space
- * @offset:	page index
- * @gfp_mask:	page allocation mode
+ * @page:	page to insert, with ->index set up
+ * @shadowp:	returns the shadow entry the page replaced, if any
  *
- * This function is used to add a page to the pagecache. It must be locked.
- * This function does not add the page to the LRU.  The caller must do that.
+ * Inserts @page at @page->index, replacing a shadow entry of a
+ * previously evicted page if there is one.  Fails with -EEXIST if
+ * there is a page already.  The caller must hold the mapping's
+ * tree_lock and have preloaded the radix tree.
  */
-int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
-		pgoff_t offset, gfp_t gfp_mask)
+int page_cache_tree_insert(struct address_space *mapping, struct page *page,
+			   void **shadowp)
+{
+	void **slot;
+	int error;
+
+	slot = radix_tree_lookup_slot(&mapping->page_tree, page->index);
+	if (slot) {
+		void *p;
+
+		p = radix_tree_deref_slot_protected(slot, &mapping->tree_lock);
+		if (!radix_tree_exceptional_entry(p))
+			return -EEXIST;
+		radix_tree_replace_slot(slot, page);
+		workingset_shadow_dec(mapping);
+		if (shadowp)
+			*shadowp = p;
+	} else {
+		error = radix_tree_insert(&mapping->page_tree,
+					  page->index, page);
+		if (error)
+			return error;
+	}
+	mapping->nrpages++;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(page_cache_tree_insert);
+
+static int __add_to_page_cache_locked(struct page *page,
+				      struct address_space *mapping,
+				      pgoff_t offset, gfp_t gfp_mask,
+				      void **shadowp)
 {
 	int error;
 
@@ -475,9 +529,8 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 		page->index = offset;
 
 		spin_lock_irq(&mapping->tree_lock);
-		error = radix_tree_insert(&mapping->page_tree, offset, page);
+		error = page_cache_tree_insert(mapping, page, shadowp);
 		if (likely(!error)) {
-			mapping->nrpages++;
 			__inc_zone_page_state(page, NR_FILE_PAGES);
 			spin_unlock_irq(&mapping->tree_lock);
 		} else {
@@ -493,16 +546,49 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 out:
 	return error;
 }
+
+/**
+ * add_to_page_cache_locked - add a locked page to the pagecache
+ * @page:	page to add
+ * @mapping:	the page's address_space
+ * @offset:	page index
+ * @gfp_mask:	page allocation mode
+ *
+ * This function is used to add a page to the pagecache. It must be locked.
+ * This function does not add the page to the LRU.  The caller must do that.
+ */
+int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
+		pgoff_t offset, gfp_t gfp_mask)
+{
+	return __add_to_page_cache_locked(page, mapping, offset,
+					  gfp_mask, NULL);
+}
 EXPORT_SYMBOL(add_to_page_cache_locked);
 
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t offset, gfp_t gfp_mask)
 {
+	void *shadow = NULL;
 	int ret;
 
-	ret = add_to_page_cache(page, mapping, offset, gfp_mask);
-	if (ret == 0)
-		lru_cache_add_file(page);
+	__set_page_locked(page);
+	ret = __add_to_page_cache_locked(page, mapping, offset,
+					 gfp_mask, &shadow);
+	if (unlikely(ret))
+		__clear_page_locked(page);
+	else {
+		/*
+		 * The page might have been evicted from the active list
+		 * only a short while ago.  If the refault distance says
+		 * it belongs to the working set, put it straight back
+		 * onto the active list.
+		 */
+		if (shadow && workingset_refault(shadow)) {
+			lru_cache_add_lru(page, LRU_ACTIVE_FILE);
+			workingset_activation(page);
+		} else
+			lru_cache_add_file(page);
+	}
 	return ret;
 }
 EXPORT_SYMBOL_GPL(add_to_page_cache_lru);
@@ -679,14 +765,96 @@ int __lock_page_or_retry(struct page *page, struct mm_struct *mm,
 }
 
 /**
- * find_get_page - find and get a page reference
+ * page_cache_next_hole - find the next hole (not-present entry)
+ * @mapping: mapping
+ * @index: index
+ * @max_scan: maximum range to search
+ *
+ * Search the set [index, min(index+max_scan-1, MAX_INDEX)] for the
+ * lowest indexed hole.  Shadow entries of evicted pages count as
+ * holes.
+ *
+ * Returns: the index of the hole if found, otherwise returns an index
+ * outside of the set specified (in which case 'return - index >=
+ * max_scan' will be true). In rare cases of index wrap-around, 0 will
+ * be returned.
+ *
+ * page_cache_next_hole may be called under rcu_read_lock.  Like
+ * radix_tree_next_hole, it does not search a snapshot of the tree at a
+ * single point in time.
+ */
+pgoff_t page_cache_next_hole(struct address_space *mapping,
+			     pgoff_t index, unsigned long max_scan)
+{
+	unsigned long i;
+
+	for (i = 0; i < max_scan; i++) {
+		struct page *page;
+
+		page = radix_tree_lookup(&mapping->page_tree, index);
+		if (!page || radix_tree_exceptional_entry(page))
+			break;
+		index++;
+		if (index == 0)
+			break;
+	}
+
+	return index;
+}
+EXPORT_SYMBOL(page_cache_next_hole);
+
+/**
+ * page_cache_prev_hole - find the prev hole (not-present entry)
+ * @mapping: mapping
+ * @index: index
+ * @max_scan: maximum range to search
+ *
+ * Search backwards in the range [max(index-max_scan+1, 0), index] for
+ * the first hole.  Shadow entries of evicted pages count as holes.
+ *
+ * Returns: the index of the hole if found, otherwise returns an index
+ * outside of the set specified (in which case 'index - return >=
+ * max_scan' will be true). In rare cases of wrap-around, ULONG_MAX
+ * will be returned.
+ *
+ * page_cache_prev_hole may be called under rcu_read_lock.  Like
+ * radix_tree_prev_hole, it does not search a snapshot of the tree at a
+ * single point in time.
+ */
+pgoff_t page_cache_prev_hole(struct address_space *mapping,
+			     pgoff_t index, unsigned long max_scan)
+{
+	unsigned long i;
+
+	for (i = 0; i < max_scan; i++) {
+		struct page *page;
+
+		page = radix_tree_lookup(&mapping->page_tree, index);
+		if (!page || radix_tree_exceptional_entry(page))
+			break;
+		index--;
+		if (index == ULONG_MAX)
+			break;
+	}
+
+	return index;
+}
+EXPORT_SYMBOL(page_cache_prev_hole);
+
+/**
+ * find_get_entry - find and get a page cache entry
  * @mapping: the address_space to search
- * @offset: the page index
+ * @offset: the page cache index
  *
- * Is there a pagecache struct page at the given (mapping, offset) tuple?
- * If yes, increment its refcount and return it; if no, return NULL.
+ * Looks up the page cache slot at @mapping & @offset.  If there is a
+ * page cache page, it is returned with an increased refcount.
+ *
+ * If the slot holds a shadow entry of a previously evicted page, or a
+ * swap entry from shmem/tmpfs, it is returned.
+ *
+ * Otherwise, %NULL is returned.
  */
-struct page *find_get_page(struct address_space *mapping, pgoff_t offset)
+struct page *find_get_entry(struct address_space *mapping, pgoff_t offset)
 {
 	void **pagep;
 	struct page *page;
@@ -703,9 +871,10 @@ repeat:
 			if (radix_tree_deref_retry(page))
 				goto repeat;
 			/*
-			 * Otherwise, shmem/tmpfs must be storing a swap entry
-			 * here as an exceptional entry: so return it without
-			 * attempting to raise page count.
+			 * Otherwise, the page cache slot holds a shadow
+			 * entry or shmem/tmpfs is storing a swap entry
+			 * here as an exceptional entry: so return it
+			 * without attempting to raise page count.
 			 */
 			goto out;
 		}
@@ -727,24 +896,49 @@ out:
 
 	return page;
 }
-EXPORT_SYMBOL(find_get_page);
+EXPORT_SYMBOL(find_get_entry);
 
 /**
- * find_lock_page - locate, pin and lock a pagecache page
+ * find_get_page - find and get a page reference
  * @mapping: the address_space to search
  * @offset: the page index
  *
- * Locates the desired pagecache page, locks it, increments its reference
- * count and returns its address.
+ * Is there a pagecache struct page at the given (mapping, offset) tuple?
+ * If yes, increment its refcount and return it; if no, return NULL.
+ * Shadow and swap entries are treated as not-present.
+ */
+struct page *find_get_page(struct address_space *mapping, pgoff_t offset)
+{
+	struct page *page = find_get_entry(mapping, offset);
+
+	if (radix_tree_exceptional_entry(page))
+		page = NULL;
+	return page;
+}
+EXPORT_SYMBOL(find_get_page);
+
+/**
+ * find_lock_entry - locate, pin and lock a page cache entry
+ * @mapping: the address_space to search
+ * @offset: the page cache index
  *
- * Returns zero if the page was not present. find_lock_page() may sleep.
+ * Looks up the page cache slot at @mapping & @offset.  If there is a
+ * page cache page, it is returned locked and with an increased
+ * refcount.
+ *
+ * If the slot holds a shadow entry of a previously evicted page, or a
+ * swap entry from shmem/tmpfs, it is returned.
+ *
+ * Otherwise, %NULL is returned.
+ *
+ * find_lock_entry() may sleep.
  */
-struct page *find_lock_page(struct address_space *mapping, pgoff_t offset)
+struct page *find_lock_entry(struct address_space *mapping, pgoff_t offset)
 {
 	struct page *page;
 
 repeat:
-	page = find_get_page(mapping, offset);
+	page = find_get_entry(mapping, offset);
 	if (page && !radix_tree_exception(page)) {
 		lock_page(page);
 		/* Has the page been truncated? */
@@ -757,6 +951,26 @@ repeat:
 	}
 	return page;
 }
+EXPORT_SYMBOL(find_lock_entry);
+
+/**
+ * find_lock_page - locate, pin and lock a pagecache page
+ * @mapping: the address_space to search
+ * @offset: the page index
+ *
+ * Locates the desired pagecache page, locks it, increments its reference
+ * count and returns its address.
+ *
+ * Returns zero if the page was not present. find_lock_page() may sleep.
+ */
+struct page *find_lock_page(struct address_space *mapping, pgoff_t offset)
+{
+	struct page *page = find_lock_entry(mapping, offset);
+
+	if (radix_tree_exceptional_entry(page))
+		page = NULL;
+	return page;
+}
 EXPORT_SYMBOL(find_lock_page);
 
 /**
@@ -806,6 +1020,39 @@ repeat:
 }
 EXPORT_SYMBOL(find_or_create_page);
 
+/*
+ * Find the index of the first entry at or after @index that is not a
+ * shadow or swap entry, so that a gang lookup that only came back with
+ * exceptional entries does not end the caller's walk prematurely.
+ * Must be called under rcu_read_lock.  Returns false if there is none.
+ */
+static bool page_cache_skip_exceptional(struct address_space *mapping,
+					pgoff_t *index)
+{
+	void **slots[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
+	unsigned long start = *index;
+	unsigned int nr_found, i;
+
+	for (;;) {
+		nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+					slots, indices, start, PAGEVEC_SIZE);
+		if (!nr_found)
+			return false;
+		for (i = 0; i < nr_found; i++) {
+			void *entry = radix_tree_deref_slot(slots[i]);
+
+			if (entry && !radix_tree_exceptional_entry(entry)) {
+				*index = indices[i];
+				return true;
+			}
+		}
+		start = indices[nr_found - 1] + 1;
+		if (!start)
+			return false;
+	}
+}
+
 /**
  * find_get_pages - gang pagecache lookup
  * @mapping:	The address_space to search
@@ -853,9 +1100,10 @@ repeat:
 				goto restart;
 			}
 			/*
-			 * Otherwise, shmem/tmpfs must be storing a swap entry
-			 * here as an exceptional entry: so skip over it -
-			 * we only reach this from invalidate_mapping_pages().
+			 * Otherwise, the slot holds a shadow entry of an
+			 * evicted page, or shmem/tmpfs is storing a swap
+			 * entry here as an exceptional entry: so skip
+			 * over it.
 			 */
 			nr_skip++;
 			continue;
@@ -880,6 +1128,13 @@ repeat:
 	 */
 	if (unlikely(!ret && nr_found > nr_skip))
 		goto restart;
+	/*
+	 * Likewise, if the gang only held shadow or swap entries, look
+	 * for pages beyond them.
+	 */
+	if (unlikely(!ret && nr_found) &&
+	    page_cache_skip_exceptional(mapping, &start))
+		goto restart;
 	rcu_read_unlock();
 	return ret;
 }
@@ -925,9 +1180,10 @@ repeat:
 				goto restart;
 			}
 			/*
-			 * Otherwise, shmem/tmpfs must be storing a swap entry
-			 * here as an exceptional entry: so stop looking for
-			 * contiguous pages.
+			 * Otherwise, the slot holds a shadow entry of an
+			 * evicted page, or shmem/tmpfs is storing a swap
+			 * entry here as an exceptional entry: so stop
+			 * looking for contiguous pages.
 			 */
 			break;
 		}
@@ -1001,7 +1257,8 @@ repeat:
 			}
 			/*
 			 * This function is never used on a shmem/tmpfs
-			 * mapping, so a swap entry won't be found here.
+			 * mapping, so a swap entry won't be found here,
+			 * and shadow entries never carry tags.
 			 */
 			BUG();
 		}
@@ -1773,8 +2030,81 @@ page_not_uptodate:
 }
 EXPORT_SYMBOL(filemap_fault);
 
+/**
+ * filemap_map_pages - map the cached pages around a read fault
+ * @vma:	vma in which the fault was taken
+ * @vmf:	the window of ptes to fill, from @vmf->pgoff to @vmf->max_pgoff
+ *
+ * filemap_map_pages() is invoked via the vma operations vector with the
+ * page table lock held.  It maps every page in the window that is
+ * already uptodate in the page cache and can be locked without waiting;
+ * everything else, including pages that would kick off readahead, is
+ * left for filemap_fault() to deal with.
+ */
+void filemap_map_pages(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct file *file = vma->vm_file;
+	struct address_space *mapping = file->f_mapping;
+	unsigned long address = (unsigned long) vmf->virtual_address;
+	struct page *pages[PAGEVEC_SIZE];
+	pgoff_t index = vmf->pgoff;
+	pgoff_t next, size;
+	unsigned int i, nr;
+	pte_t *pte;
+
+	while (index <= vmf->max_pgoff) {
+		nr = find_get_pages(mapping, index,
+				    min_t(pgoff_t, PAGEVEC_SIZE,
+					  vmf->max_pgoff - index + 1),
+				    pages);
+		if (!nr)
+			break;
+
+		next = index;
+		for (i = 0; i < nr; i++) {
+			struct page *page = pages[i];
+
+			next = max(next, page->index + 1);
+			if (page->index > vmf->max_pgoff)
+				goto skip;
+			if (!PageUptodate(page) || PageReadahead(page) ||
+			    PageHWPoison(page))
+				goto skip;
+			if (!trylock_page(page))
+				goto skip;
+
+			if (page->mapping != mapping || !PageUptodate(page))
+				goto unlock;
+
+			size = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1)
+							>> PAGE_CACHE_SHIFT;
+			if (page->index >= size)
+				goto unlock;
+
+			pte = vmf->pte + page->index - vmf->pgoff;
+			if (!pte_none(*pte))
+				goto unlock;
+
+			if (file->f_ra.mmap_miss > 0)
+				file->f_ra.mmap_miss--;
+			do_set_pte(vma, address +
+				   ((page->index - vmf->pgoff) << PAGE_SHIFT),
+				   page, pte);
+			unlock_page(page);
+			continue;
+unlock:
+			unlock_page(page);
+skip:
+			page_cache_release(page);
+		}
+		index = next;
+	}
+}
+EXPORT_SYMBOL(filemap_map_pages);
+
 const struct vm_operations_struct generic_file_vm_ops = {
 	.fault		= filemap_fault,
+	.map_pages	= filemap_map_pages,
 };
 
 /* This is used for a general mmap of a disk file */
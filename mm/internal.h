@@ -37,6 +37,10 @@ static inline void __put_page(struct page *page)
 	atomic_dec(&page->_count);
 }
 
+/* mm/truncate.c */
+extern void clear_shadow_entries(struct address_space *mapping,
+				 pgoff_t start, pgoff_t end);
+
 extern unsigned long highest_memmap_pfn;
 
 /*
@@ -23,7 +23,7 @@
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
-#include <linux/jhash.h>
+#include <linux/crc32c.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -36,6 +36,7 @@
 #include <linux/hash.h>
 #include <linux/freezer.h>
 #include <linux/oom.h>
+#include <linux/topology.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -78,6 +79,14 @@
  *    take 10 attempts to find a page in the unstable tree, once it is found,
  *    it is secured in the stable tree.  (When we scan a new page, we first
  *    compare it against the stable tree, and then against the unstable tree.)
+ *
+ * Both trees are split into shards, each with its own stable and unstable
+ * tree.  A page goes to the shard picked by the checksum of its contents,
+ * so identical pages always meet in the same shard; or, when merging across
+ * NUMA nodes is disabled, to the shard of the node it lives on.  ksmd walks
+ * the mm_slots and queues the pages it finds in batches.  The shard threads
+ * then checksum a batch between them, and each shard's pages are merged by
+ * a thread of its own, in parallel with the others.
  */
 
 /**
@@ -110,16 +119,57 @@ struct ksm_scan {
 	unsigned long seqnr;
 };
 
+/**
+ * struct ksm_shard - a slice of the stable and unstable trees
+ * @root_stable_tree: stable tree of the pages that belong to this shard
+ * @root_unstable_tree: unstable tree of the pages that belong to this shard
+ * @pages_shared: the number of nodes in the stable tree
+ * @pages_sharing: the number of page slots additionally sharing those nodes
+ * @pages_unshared: the number of nodes in the unstable tree
+ * @nr_queued: the number of pages of the current batch for this shard
+ * @thread: the thread merging this shard's pages (shard 0 is merged by ksmd)
+ * @busy: set by ksmd when it hands a batch to @thread
+ *
+ * A shard's trees and counters are only modified by the thread merging its
+ * pages, or by whoever holds ksm_thread_mutex while ksmd is not merging.
+ */
+struct ksm_shard {
+	struct rb_root root_stable_tree;
+	struct rb_root root_unstable_tree;
+	unsigned long pages_shared;
+	unsigned long pages_sharing;
+	unsigned long pages_unshared;
+	unsigned int nr_queued;
+	struct task_struct *thread;
+	bool busy;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * struct ksm_batch_item - a page queued by ksmd to be merged
+ * @rmap_item: the reverse mapping of the page
+ * @page: the page, pinned until it has been merged
+ * @checksum: checksum of the page's contents when the batch was merged
+ * @shard: index of the shard that the page is merged into
+ */
+struct ksm_batch_item {
+	struct rmap_item *rmap_item;
+	struct page *page;
+	unsigned int checksum;
+	unsigned int shard;
+};
+
 /**
  * struct stable_node - node of the stable rbtree
  * @node: rb node of this ksm page in the stable tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page
+ * @shard: index of the shard whose stable tree holds this node
  */
 struct stable_node {
 	struct rb_node node;
 	struct hlist_head hlist;
 	unsigned long kpfn;
+	unsigned int shard;
 };
 
 /**
@@ -129,6 +179,7 @@ struct stable_node {
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @shard: index of the shard whose unstable tree holds this rmap_item
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -139,6 +190,7 @@ struct rmap_item {
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	unsigned int shard;		/* when unstable */
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -152,9 +204,24 @@ struct rmap_item {
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root root_stable_tree = RB_ROOT;
-static struct rb_root root_unstable_tree = RB_ROOT;
+/* The stable and unstable tree heads, ksm_max_shards of each */
+static struct ksm_shard *ksm_shards;
+static unsigned int ksm_max_shards;
+
+/* The number of shards pages are currently spread over */
+static unsigned int ksm_nr_shards = 1;
+
+/* Pages queued by ksmd for the shards to merge */
+#define KSM_BATCH_SIZE	256
+static struct ksm_batch_item ksm_batch[KSM_BATCH_SIZE];
+static unsigned int ksm_batch_nr;
+static atomic_t ksm_batch_pending;
+static DECLARE_COMPLETION(ksm_batch_done);
+
+/* What the shards do with the current batch */
+#define KSM_BATCH_CHECKSUM	0
+#define KSM_BATCH_MERGE		1
+static int ksm_batch_phase;
 
 #define MM_SLOTS_HASH_SHIFT 10
 #define MM_SLOTS_HASH_HEADS (1 << MM_SLOTS_HASH_SHIFT)
@@ -171,15 +238,6 @@ static struct kmem_cache *rmap_item_cache;
 static struct kmem_cache *stable_node_cache;
 static struct kmem_cache *mm_slot_cache;
 
-/* The number of nodes in the stable tree */
-static unsigned long ksm_pages_shared;
-
-/* The number of page slots additionally sharing those nodes */
-static unsigned long ksm_pages_sharing;
-
-/* The number of nodes in the unstable tree */
-static unsigned long ksm_pages_unshared;
-
 /* The number of rmap_items in use: to calculate pages_volatile */
 static unsigned long ksm_rmap_items;
 
@@ -189,6 +247,18 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* Number of shards, each merged by its own thread, pages are hashed to */
+static unsigned int ksm_scan_threads = 1;
+
+/* Zero to only merge pages within a node, with a shard per node */
+static unsigned int ksm_merge_across_nodes = 1;
+
+/* Whether to map the zero page in place of empty pages */
+static bool ksm_use_zero_pages;
+
+/* Checksum of an empty page */
+static unsigned int zero_checksum;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -445,20 +515,21 @@ out:		page = NULL;
 
 static void remove_node_from_stable_tree(struct stable_node *stable_node)
 {
+	struct ksm_shard *shard = &ksm_shards[stable_node->shard];
 	struct rmap_item *rmap_item;
 	struct hlist_node *hlist;
 
 	hlist_for_each_entry(rmap_item, hlist, &stable_node->hlist, hlist) {
 		if (rmap_item->hlist.next)
-			ksm_pages_sharing--;
+			shard->pages_sharing--;
 		else
-			ksm_pages_shared--;
+			shard->pages_shared--;
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
 		cond_resched();
 	}
 
-	rb_erase(&stable_node->node, &root_stable_tree);
+	rb_erase(&stable_node->node, &shard->root_stable_tree);
 	free_stable_node(stable_node);
 }
 
@@ -480,7 +551,8 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
  * a page to put something that might look like our key in page->mapping.
  *
  * include/linux/pagemap.h page_cache_get_speculative() is a good reference,
- * but this is different - made simpler by ksm_thread_mutex being held, but
+ * but this is different - made simpler by the stable tree being modified only
+ * by the thread merging its shard or under ksm_thread_mutex, but
  * interesting for assuming that no other use of the struct page could ever
  * put our expected_mapping into page->mapping (or a field of the union which
  * coincides with page->mapping).  The RCU calls are not for KSM at all, but
@@ -537,18 +609,19 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		put_page(page);
 
 		if (stable_node->hlist.first)
-			ksm_pages_sharing--;
+			ksm_shards[stable_node->shard].pages_sharing--;
 		else
-			ksm_pages_shared--;
+			ksm_shards[stable_node->shard].pages_shared--;
 
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
 
 	} else if (rmap_item->address & UNSTABLE_FLAG) {
+		struct ksm_shard *shard = &ksm_shards[rmap_item->shard];
 		unsigned char age;
 		/*
 		 * Usually ksmd can and must skip the rb_erase, because
-		 * root_unstable_tree was already reset to RB_ROOT.
+		 * the unstable trees were already reset to RB_ROOT.
 		 * But be careful when an mm is exiting: do the rb_erase
 		 * if this rmap_item was inserted by this scan, rather
 		 * than left over from before.
@@ -556,9 +629,9 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
-			rb_erase(&rmap_item->node, &root_unstable_tree);
+			rb_erase(&rmap_item->node, &shard->root_unstable_tree);
 
-		ksm_pages_unshared--;
+		shard->pages_unshared--;
 		rmap_item->address &= PAGE_MASK;
 	}
 out:
@@ -669,11 +742,15 @@ error:
 }
 #endif /* CONFIG_SYSFS */
 
+/*
+ * crc32c picks up the CPU's crc32 instruction where there is one, which
+ * is several times faster than hashing the page in software.
+ */
 static u32 calc_checksum(struct page *page)
 {
 	u32 checksum;
 	void *addr = kmap_atomic(page, KM_USER0);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	checksum = crc32c(~0, addr, PAGE_SIZE);
 	kunmap_atomic(addr, KM_USER0);
 	return checksum;
 }
@@ -771,6 +848,7 @@ static int replace_page(struct vm_area_struct *vma, struct page *page,
 	pte_t *ptep;
 	spinlock_t *ptl;
 	unsigned long addr;
+	pte_t newpte;
 	int err = -EFAULT;
 
 	addr = page_address_in_vma(page, vma);
@@ -796,12 +874,23 @@ static int replace_page(struct vm_area_struct *vma, struct page *page,
 		goto out;
 	}
 
-	get_page(kpage);
-	page_add_anon_rmap(kpage, vma, addr);
+	/*
+	 * The zero page is not refcounted or on any rmap: it is mapped
+	 * with a special pte, just as a read fault would have mapped it.
+	 */
+	if (!is_zero_pfn(page_to_pfn(kpage))) {
+		get_page(kpage);
+		page_add_anon_rmap(kpage, vma, addr);
+		newpte = mk_pte(kpage, vma->vm_page_prot);
+	} else {
+		newpte = pte_mkspecial(pfn_pte(page_to_pfn(kpage),
+					       vma->vm_page_prot));
+		dec_mm_counter(mm, MM_ANONPAGES);
+	}
 
 	flush_cache_page(vma, addr, pte_pfn(*ptep));
 	ptep_clear_flush(vma, addr, ptep);
-	set_pte_at_notify(mm, addr, ptep, mk_pte(kpage, vma->vm_page_prot));
+	set_pte_at_notify(mm, addr, ptep, newpte);
 
 	page_remove_rmap(page);
 	if (!page_mapped(page))
@@ -846,7 +935,8 @@ static int page_trans_compound_anon_split(struct page *page)
  * @vma: the vma that holds the pte pointing to page
  * @page: the PageAnon page that we want to replace with kpage
  * @kpage: the PageKsm page that we want to map instead of page,
- *         or NULL the first time when we want to use page as kpage.
+ *         or NULL the first time when we want to use page as kpage,
+ *         or the zero page when page is empty.
  *
  * This function returns 0 if the pages were merged, -EFAULT otherwise.
  */
@@ -898,7 +988,7 @@ static int try_to_merge_one_page(struct vm_area_struct *vma,
 
 	if ((vma->vm_flags & VM_LOCKED) && kpage && !err) {
 		munlock_vma_page(page);
-		if (!PageMlocked(kpage)) {
+		if (!PageMlocked(kpage) && !is_zero_pfn(page_to_pfn(kpage))) {
 			unlock_page(page);
 			lock_page(kpage);
 			mlock_vma_page(kpage);
@@ -943,6 +1033,35 @@ out:
 	return err;
 }
 
+/*
+ * try_to_merge_with_zero_page - map the zero page in place of an empty page.
+ *
+ * The rmap_item is left out of both trees: later scans pass the zero page
+ * by, and its rmap_item is then freed like that of any unmapped address.
+ *
+ * This function returns 0 if the page was replaced, -EFAULT otherwise.
+ */
+static int try_to_merge_with_zero_page(struct rmap_item *rmap_item,
+				       struct page *page)
+{
+	struct mm_struct *mm = rmap_item->mm;
+	struct vm_area_struct *vma;
+	int err = -EFAULT;
+
+	down_read(&mm->mmap_sem);
+	if (ksm_test_exit(mm))
+		goto out;
+	vma = find_vma(mm, rmap_item->address);
+	if (!vma || vma->vm_start > rmap_item->address)
+		goto out;
+
+	err = try_to_merge_one_page(vma, page,
+				    ZERO_PAGE(rmap_item->address));
+out:
+	up_read(&mm->mmap_sem);
+	return err;
+}
+
 /*
  * try_to_merge_two_pages - take two identical pages and prepare them
  * to be merged into one page.
@@ -983,9 +1102,10 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  * This function returns the stable tree node of identical content if found,
  * NULL otherwise.
  */
-static struct page *stable_tree_search(struct page *page)
+static struct page *stable_tree_search(struct page *page,
+					struct ksm_shard *shard)
 {
-	struct rb_node *node = root_stable_tree.rb_node;
+	struct rb_node *node = shard->root_stable_tree.rb_node;
 	struct stable_node *stable_node;
 
 	stable_node = page_stable_node(page);
@@ -1026,9 +1146,10 @@ static struct page *stable_tree_search(struct page *page)
  * This function returns the stable tree node just allocated on success,
  * NULL otherwise.
  */
-static struct stable_node *stable_tree_insert(struct page *kpage)
+static struct stable_node *stable_tree_insert(struct page *kpage,
+					      struct ksm_shard *shard)
 {
-	struct rb_node **new = &root_stable_tree.rb_node;
+	struct rb_node **new = &shard->root_stable_tree.rb_node;
 	struct rb_node *parent = NULL;
 	struct stable_node *stable_node;
 
@@ -1065,11 +1186,12 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 		return NULL;
 
 	rb_link_node(&stable_node->node, parent, new);
-	rb_insert_color(&stable_node->node, &root_stable_tree);
+	rb_insert_color(&stable_node->node, &shard->root_stable_tree);
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
 
 	stable_node->kpfn = page_to_pfn(kpage);
+	stable_node->shard = shard - ksm_shards;
 	set_page_stable_node(kpage, stable_node);
 
 	return stable_node;
@@ -1092,10 +1214,11 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 static
 struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 					      struct page *page,
-					      struct page **tree_pagep)
+					      struct page **tree_pagep,
+					      struct ksm_shard *shard)
 
 {
-	struct rb_node **new = &root_unstable_tree.rb_node;
+	struct rb_node **new = &shard->root_unstable_tree.rb_node;
 	struct rb_node *parent = NULL;
 
 	while (*new) {
@@ -1117,6 +1240,16 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 			return NULL;
 		}
 
+		/*
+		 * Don't merge with a page that has been migrated off the
+		 * node since it was inserted, if merging is node-local.
+		 */
+		if (!ksm_merge_across_nodes &&
+		    page_to_nid(tree_page) != shard - ksm_shards) {
+			put_page(tree_page);
+			return NULL;
+		}
+
 		ret = memcmp_pages(page, tree_page);
 
 		parent = *new;
@@ -1134,10 +1267,11 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 
 	rmap_item->address |= UNSTABLE_FLAG;
 	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	rmap_item->shard = shard - ksm_shards;
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_unstable_tree);
+	rb_insert_color(&rmap_item->node, &shard->root_unstable_tree);
 
-	ksm_pages_unshared++;
+	shard->pages_unshared++;
 	return NULL;
 }
 
@@ -1154,9 +1288,9 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 	hlist_add_head(&rmap_item->hlist, &stable_node->hlist);
 
 	if (rmap_item->hlist.next)
-		ksm_pages_sharing++;
+		ksm_shards[stable_node->shard].pages_sharing++;
 	else
-		ksm_pages_shared++;
+		ksm_shards[stable_node->shard].pages_shared++;
 }
 
 /*
@@ -1166,21 +1300,32 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  * both transferred to the stable tree.
  *
  * @page: the page that we are searching identical page to.
- * @rmap_item: the reverse mapping into the virtual address of this page
+ * @rmap_item: the reverse mapping into the virtual address of this page,
+ *             already removed from the trees by ksmd
+ * @checksum: the checksum of the page when it was queued
+ * @shard: the shard whose trees the page is merged into
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item,
+			       unsigned int checksum, struct ksm_shard *shard)
 {
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
-	unsigned int checksum;
 	int err;
 
-	remove_rmap_item_from_tree(rmap_item);
+	/*
+	 * An empty page that has stayed empty since the last scan goes
+	 * straight to the zero page, without searching the trees.
+	 */
+	if (ksm_use_zero_pages && checksum == zero_checksum &&
+	    rmap_item->oldchecksum == checksum) {
+		if (!try_to_merge_with_zero_page(rmap_item, page))
+			return;
+	}
 
 	/* We first start with searching the page inside the stable tree */
-	kpage = stable_tree_search(page);
+	kpage = stable_tree_search(page, shard);
 	if (kpage) {
 		err = try_to_merge_with_ksm_page(rmap_item, page, kpage);
 		if (!err) {
@@ -1202,14 +1347,13 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
 		return;
 	}
 
 	tree_rmap_item =
-		unstable_tree_search_insert(rmap_item, page, &tree_page);
+		unstable_tree_search_insert(rmap_item, page, &tree_page, shard);
 	if (tree_rmap_item) {
 		kpage = try_to_merge_two_pages(rmap_item, page,
 						tree_rmap_item, tree_page);
@@ -1223,7 +1367,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			remove_rmap_item_from_tree(tree_rmap_item);
 
 			lock_page(kpage);
-			stable_node = stable_tree_insert(kpage);
+			stable_node = stable_tree_insert(kpage, shard);
 			if (stable_node) {
 				stable_tree_append(tree_rmap_item, stable_node);
 				stable_tree_append(rmap_item, stable_node);
@@ -1244,6 +1388,141 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	}
 }
 
+/*
+ * Merge the pages of the current batch that belong to @shard.
+ */
+static void merge_shard_batch(struct ksm_shard *shard)
+{
+	unsigned int index = shard - ksm_shards;
+	unsigned int i;
+
+	for (i = 0; i < ksm_batch_nr; i++) {
+		struct ksm_batch_item *item = &ksm_batch[i];
+
+		if (item->shard != index)
+			continue;
+		cmp_and_merge_page(item->page, item->rmap_item,
+				   item->checksum, shard);
+		put_page(item->page);
+	}
+	shard->nr_queued = 0;
+}
+
+/*
+ * Checksum every ksm_nr_shards'th page of the current batch, starting at
+ * the index of @shard, so that the shards share the work evenly.
+ */
+static void checksum_shard_batch(struct ksm_shard *shard)
+{
+	unsigned int i;
+
+	for (i = shard - ksm_shards; i < ksm_batch_nr; i += ksm_nr_shards)
+		ksm_batch[i].checksum = calc_checksum(ksm_batch[i].page);
+}
+
+static bool shard_batch_pending(struct ksm_shard *shard)
+{
+	if (ksm_batch_phase == KSM_BATCH_CHECKSUM)
+		return shard - ksm_shards < ksm_batch_nr;
+	return shard->nr_queued;
+}
+
+static void run_shard_batch(struct ksm_shard *shard)
+{
+	if (ksm_batch_phase == KSM_BATCH_CHECKSUM)
+		checksum_shard_batch(shard);
+	else
+		merge_shard_batch(shard);
+}
+
+/*
+ * Have every shard do @phase of the current batch: shards with a thread of
+ * their own run in parallel, ksmd runs the others itself, then waits for
+ * all of them to finish.
+ */
+static void ksm_run_batch_phase(int phase)
+{
+	unsigned int i;
+
+	INIT_COMPLETION(ksm_batch_done);
+	atomic_set(&ksm_batch_pending, 1);
+	ksm_batch_phase = phase;
+	for (i = 0; i < ksm_nr_shards; i++) {
+		struct ksm_shard *shard = &ksm_shards[i];
+
+		if (!shard->thread || !shard_batch_pending(shard))
+			continue;
+		atomic_inc(&ksm_batch_pending);
+		shard->busy = true;
+		wake_up_process(shard->thread);
+	}
+
+	for (i = 0; i < ksm_nr_shards; i++) {
+		struct ksm_shard *shard = &ksm_shards[i];
+
+		if (!shard->thread && shard_batch_pending(shard))
+			run_shard_batch(shard);
+	}
+
+	if (!atomic_dec_and_test(&ksm_batch_pending))
+		wait_for_completion(&ksm_batch_done);
+}
+
+/*
+ * ksm_merge_batch - merge the pages queued by ksmd.
+ *
+ * The pages are checksummed by all the shards first, since the checksum
+ * picks the shard a page is merged into; then each shard merges its own.
+ * Queueing and merging never overlap, so ksmd can modify any tree while
+ * it queues.
+ */
+static void ksm_merge_batch(void)
+{
+	unsigned int i;
+
+	if (!ksm_batch_nr)
+		return;
+
+	ksm_run_batch_phase(KSM_BATCH_CHECKSUM);
+
+	for (i = 0; i < ksm_batch_nr; i++) {
+		struct ksm_batch_item *item = &ksm_batch[i];
+		struct stable_node *stable_node;
+
+		stable_node = page_stable_node(item->page);
+		if (stable_node)		/* ksm page forked */
+			item->shard = stable_node->shard;
+		else if (!ksm_merge_across_nodes)
+			item->shard = page_to_nid(item->page);
+		else
+			item->shard = item->checksum % ksm_nr_shards;
+		ksm_shards[item->shard].nr_queued++;
+	}
+
+	ksm_run_batch_phase(KSM_BATCH_MERGE);
+	ksm_batch_nr = 0;
+}
+
+/*
+ * ksm_queue_page - queue a page found by the scan to be merged.
+ *
+ * The rmap_item is taken out of the trees here, while no shard is being
+ * merged: it may still be listed in the stable tree of another shard than
+ * the one its page goes to now.
+ */
+static void ksm_queue_page(struct page *page, struct rmap_item *rmap_item)
+{
+	struct ksm_batch_item *item = &ksm_batch[ksm_batch_nr++];
+
+	remove_rmap_item_from_tree(rmap_item);
+
+	item->rmap_item = rmap_item;
+	item->page = page;
+
+	if (ksm_batch_nr == KSM_BATCH_SIZE)
+		ksm_merge_batch();
+}
+
 static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 					    struct rmap_item **rmap_list,
 					    unsigned long addr)
@@ -1278,6 +1557,7 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 	struct mm_slot *slot;
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
+	unsigned int i;
 
 	if (list_empty(&ksm_mm_head.mm_list))
 		return NULL;
@@ -1296,7 +1576,8 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		 */
 		lru_add_drain_all();
 
-		root_unstable_tree = RB_ROOT;
+		for (i = 0; i < ksm_max_shards; i++)
+			ksm_shards[i].root_unstable_tree = RB_ROOT;
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
@@ -1314,6 +1595,7 @@ next_mm:
 	}
 
 	mm = slot->mm;
+again:
 	down_read(&mm->mmap_sem);
 	if (ksm_test_exit(mm))
 		vma = NULL;
@@ -1358,6 +1640,17 @@ next_mm:
 		}
 	}
 
+	/*
+	 * Before moving on from this mm, merge the pages queued from it:
+	 * their rmap_items may be freed below.  Not under mmap_sem, which
+	 * the merging threads need to take for read themselves.
+	 */
+	if (ksm_batch_nr) {
+		up_read(&mm->mmap_sem);
+		ksm_merge_batch();
+		goto again;
+	}
+
 	if (ksm_test_exit(mm)) {
 		ksm_scan.address = 0;
 		ksm_scan.rmap_list = &slot->rmap_list;
@@ -1416,11 +1709,13 @@ static void ksm_do_scan(unsigned int scan_npages)
 		cond_resched();
 		rmap_item = scan_get_next_rmap_item(&page);
 		if (!rmap_item)
-			return;
+			break;
 		if (!PageKsm(page) || !in_stable_tree(rmap_item))
-			cmp_and_merge_page(page, rmap_item);
-		put_page(page);
+			ksm_queue_page(page, rmap_item);
+		else
+			put_page(page);
 	}
+	ksm_merge_batch();
 }
 
 static int ksmd_should_run(void)
@@ -1764,14 +2059,19 @@ static struct stable_node *ksm_check_stable_tree(unsigned long start_pfn,
 						 unsigned long end_pfn)
 {
 	struct rb_node *node;
+	unsigned int i;
 
-	for (node = rb_first(&root_stable_tree); node; node = rb_next(node)) {
-		struct stable_node *stable_node;
+	for (i = 0; i < ksm_max_shards; i++) {
+		struct rb_root *root = &ksm_shards[i].root_stable_tree;
 
-		stable_node = rb_entry(node, struct stable_node, node);
-		if (stable_node->kpfn >= start_pfn &&
-		    stable_node->kpfn < end_pfn)
-			return stable_node;
+		for (node = rb_first(root); node; node = rb_next(node)) {
+			struct stable_node *stable_node;
+
+			stable_node = rb_entry(node, struct stable_node, node);
+			if (stable_node->kpfn >= start_pfn &&
+			    stable_node->kpfn < end_pfn)
+				return stable_node;
+		}
 	}
 	return NULL;
 }
@@ -1820,12 +2120,127 @@ static int ksm_memory_callback(struct notifier_block *self,
  * This all compiles without CONFIG_SYSFS, but is a waste of space.
  */
 
+static int ksm_merge_thread(void *data)
+{
+	struct ksm_shard *shard = data;
+
+	set_user_nice(current, 5);
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		if (!shard->busy) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		run_shard_batch(shard);
+		shard->busy = false;
+		if (atomic_dec_and_test(&ksm_batch_pending))
+			complete(&ksm_batch_done);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+/*
+ * A page merged into one shard must not be looked for in another: so the
+ * shards can only be rearranged while none of their stable trees holds a
+ * live ksm page.  Stale nodes are pruned on the way.
+ */
+static bool ksm_stable_trees_empty(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ksm_max_shards; i++) {
+		struct rb_node *node;
+
+		while ((node = rb_first(&ksm_shards[i].root_stable_tree))) {
+			struct page *page;
+
+			page = get_ksm_page(rb_entry(node, struct stable_node,
+						     node));
+			if (page) {
+				put_page(page);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * ksm_set_shards - spread pages over @nr shards, starting a thread to merge
+ * each shard but the first, which ksmd merges itself.  With @per_node, the
+ * shards are the NUMA nodes and each thread runs on its node.
+ *
+ * Called with ksm_thread_mutex held, so no batch is being merged.
+ */
+static int ksm_set_shards(unsigned int nr, bool per_node)
+{
+	unsigned int i;
+
+	if (!ksm_stable_trees_empty())
+		return -EBUSY;
+
+	for (i = 1; i < ksm_max_shards; i++) {
+		struct ksm_shard *shard = &ksm_shards[i];
+
+		if (shard->thread) {
+			kthread_stop(shard->thread);
+			shard->thread = NULL;
+		}
+	}
+
+	for (i = 1; i < nr; i++) {
+		struct ksm_shard *shard = &ksm_shards[i];
+		struct task_struct *thread;
+
+		if (per_node && !node_state(i, N_HIGH_MEMORY))
+			continue;
+		thread = kthread_create_on_node(ksm_merge_thread, shard,
+						per_node ? i : -1, "ksmd/%u", i);
+		if (IS_ERR(thread)) {
+			/* ksmd will merge this shard as well */
+			printk(KERN_WARNING "ksm: creating kthread failed\n");
+			continue;
+		}
+		if (per_node && nr_cpus_node(i))
+			set_cpus_allowed_ptr(thread, cpumask_of_node(i));
+		shard->thread = thread;
+		wake_up_process(thread);
+	}
+
+	ksm_nr_shards = nr;
+	return 0;
+}
+
+
 #define KSM_ATTR_RO(_name) \
 	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
 #define KSM_ATTR(_name) \
 	static struct kobj_attribute _name##_attr = \
 		__ATTR(_name, 0644, _name##_show, _name##_store)
 
+/* Sum up one of the page counters of all shards */
+static unsigned long ksm_shards_sum(size_t offset)
+{
+	unsigned long sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < ksm_max_shards; i++)
+		sum += *(unsigned long *)((char *)&ksm_shards[i] + offset);
+	return sum;
+}
+#define ksm_pages_shared() \
+	ksm_shards_sum(offsetof(struct ksm_shard, pages_shared))
+#define ksm_pages_sharing() \
+	ksm_shards_sum(offsetof(struct ksm_shard, pages_sharing))
+#define ksm_pages_unshared() \
+	ksm_shards_sum(offsetof(struct ksm_shard, pages_unshared))
+
 static ssize_t sleep_millisecs_show(struct kobject *kobj,
 				    struct kobj_attribute *attr, char *buf)
 {
@@ -1921,24 +2336,115 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 }
 KSM_ATTR(run);
 
+static ssize_t scan_threads_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_scan_threads);
+}
+
+static ssize_t scan_threads_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	int err;
+	unsigned long nr;
+
+	err = strict_strtoul(buf, 10, &nr);
+	if (err || nr < 1 || nr > nr_cpu_ids)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	if (ksm_scan_threads != nr) {
+		if (ksm_merge_across_nodes)
+			err = ksm_set_shards(nr, false);
+		if (!err)
+			ksm_scan_threads = nr;
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	return err ? err : count;
+}
+KSM_ATTR(scan_threads);
+
+#ifdef CONFIG_NUMA
+static ssize_t merge_across_nodes_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_merge_across_nodes);
+}
+
+static ssize_t merge_across_nodes_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err;
+	unsigned long knob;
+
+	err = strict_strtoul(buf, 10, &knob);
+	if (err || knob > 1)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	if (ksm_merge_across_nodes != knob) {
+		if (knob)
+			err = ksm_set_shards(ksm_scan_threads, false);
+		else
+			err = ksm_set_shards(nr_node_ids, true);
+		if (!err)
+			ksm_merge_across_nodes = knob;
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	return err ? err : count;
+}
+KSM_ATTR(merge_across_nodes);
+#endif
+
+static ssize_t use_zero_pages_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_use_zero_pages);
+}
+
+static ssize_t use_zero_pages_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	int err;
+	unsigned long knob;
+
+	err = strict_strtoul(buf, 10, &knob);
+	if (err || knob > 1)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	if (knob)
+		zero_checksum = calc_checksum(ZERO_PAGE(0));
+	ksm_use_zero_pages = knob;
+	mutex_unlock(&ksm_thread_mutex);
+
+	return count;
+}
+KSM_ATTR(use_zero_pages);
+
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_shared);
+	return sprintf(buf, "%lu\n", ksm_pages_shared());
 }
 KSM_ATTR_RO(pages_shared);
 
 static ssize_t pages_sharing_show(struct kobject *kobj,
 				  struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_sharing);
+	return sprintf(buf, "%lu\n", ksm_pages_sharing());
 }
 KSM_ATTR_RO(pages_sharing);
 
 static ssize_t pages_unshared_show(struct kobject *kobj,
 				   struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_unshared);
+	return sprintf(buf, "%lu\n", ksm_pages_unshared());
 }
 KSM_ATTR_RO(pages_unshared);
 
@@ -1947,8 +2453,8 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
-				- ksm_pages_sharing - ksm_pages_unshared;
+	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared()
+				- ksm_pages_sharing() - ksm_pages_unshared();
 	/*
 	 * It was not worth any locking to calculate that statistic,
 	 * but it might therefore sometimes be negative: conceal that.
@@ -1970,6 +2476,11 @@ static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
 	&run_attr.attr,
+	&scan_threads_attr.attr,
+#ifdef CONFIG_NUMA
+	&merge_across_nodes_attr.attr,
+#endif
+	&use_zero_pages_attr.attr,
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
 	&pages_unshared_attr.attr,
@@ -1987,17 +2498,28 @@ static struct attribute_group ksm_attr_group = {
 static int __init ksm_init(void)
 {
 	struct task_struct *ksm_thread;
+	unsigned int i;
 	int err;
 
 	err = ksm_slab_init();
 	if (err)
 		goto out;
 
+	err = -ENOMEM;
+	ksm_max_shards = max(nr_node_ids, nr_cpu_ids);
+	ksm_shards = kcalloc(ksm_max_shards, sizeof(*ksm_shards), GFP_KERNEL);
+	if (!ksm_shards)
+		goto out_free;
+	for (i = 0; i < ksm_max_shards; i++) {
+		ksm_shards[i].root_stable_tree = RB_ROOT;
+		ksm_shards[i].root_unstable_tree = RB_ROOT;
+	}
+
 	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
 	if (IS_ERR(ksm_thread)) {
 		printk(KERN_ERR "ksm: creating kthread failed\n");
 		err = PTR_ERR(ksm_thread);
-		goto out_free;
+		goto out_free_shards;
 	}
 
 #ifdef CONFIG_SYSFS
@@ -2005,7 +2527,7 @@ static int __init ksm_init(void)
 	if (err) {
 		printk(KERN_ERR "ksm: register sysfs failed\n");
 		kthread_stop(ksm_thread);
-		goto out_free;
+		goto out_free_shards;
 	}
 #else
 	ksm_run = KSM_RUN_MERGE;	/* no way for user to start it */
@@ -2021,6 +2543,8 @@ static int __init ksm_init(void)
 #endif
 	return 0;
 
+out_free_shards:
+	kfree(ksm_shards);
 out_free:
 	ksm_slab_free();
 out:
@@ -38,6 +38,7 @@
 #include <linux/slab.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
+#include <linux/shmem_fs.h>
 #include <linux/spinlock.h>
 #include <linux/eventfd.h>
 #include <linux/sort.h>
@@ -48,7 +49,10 @@
 #include <linux/page_cgroup.h>
 #include <linux/cpu.h>
 #include <linux/oom.h>
+#include <linux/idr.h>
+#include <linux/workqueue.h>
 #include "internal.h"
+#include "slab.h"
 
 #include <asm/uaccess.h>
 
@@ -56,6 +60,8 @@
 
 struct cgroup_subsys mem_cgroup_subsys __read_mostly;
 #define MEM_CGROUP_RECLAIM_RETRIES	5
+/* Number of SLAB_ACCOUNT caches that can have per-cgroup copies */
+#define MEMCG_CACHES_MAX		64
 struct mem_cgroup *root_mem_cgroup __read_mostly;
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR_SWAP
@@ -106,12 +112,10 @@ enum mem_cgroup_events_index {
  */
 enum mem_cgroup_events_target {
 	MEM_CGROUP_TARGET_THRESH,
-	MEM_CGROUP_TARGET_SOFTLIMIT,
 	MEM_CGROUP_TARGET_NUMAINFO,
 	MEM_CGROUP_NTARGETS,
 };
 #define THRESHOLDS_EVENTS_TARGET (128)
-#define SOFTLIMIT_EVENTS_TARGET (1024)
 #define NUMAINFO_EVENTS_TARGET	(1024)
 
 struct mem_cgroup_stat_cpu {
@@ -120,21 +124,23 @@ struct mem_cgroup_stat_cpu {
 	unsigned long targets[MEM_CGROUP_NTARGETS];
 };
 
+struct mem_cgroup_reclaim_iter {
+	/* css_id of the last scanned hierarchy member */
+	int position;
+	/* scan generation, increased every round-trip */
+	unsigned int generation;
+};
+
 /*
  * per-zone information in memory controller.
  */
 struct mem_cgroup_per_zone {
-	/*
-	 * spin_lock to protect the per cgroup LRU
-	 */
-	struct list_head	lists[NR_LRU_LISTS];
+	struct lruvec		lruvec;
 	unsigned long		count[NR_LRU_LISTS];
 
+	struct mem_cgroup_reclaim_iter reclaim_iter[DEF_PRIORITY + 1];
+
 	struct zone_reclaim_stat reclaim_stat;
-	struct rb_node		tree_node;	/* RB tree node */
-	unsigned long long	usage_in_excess;/* Set to the value by which */
-						/* the soft limit is exceeded*/
-	bool			on_tree;
 	struct mem_cgroup	*mem;		/* Back pointer, we cannot */
 						/* use container_of	   */
 };
@@ -150,24 +156,11 @@ struct mem_cgroup_lru_info {
 };
 
 /*
- * Cgroups above their limits are maintained in a RB-Tree, independent of
- * their hierarchy representation
+ * Number of groups with a soft limit configured.  Global reclaim only
+ * bothers to look for groups in excess of their soft limit when there
+ * are any.
  */
-
-struct mem_cgroup_tree_per_zone {
-	struct rb_root rb_root;
-	spinlock_t lock;
-};
-
-struct mem_cgroup_tree_per_node {
-	struct mem_cgroup_tree_per_zone rb_tree_per_zone[MAX_NR_ZONES];
-};
-
-struct mem_cgroup_tree {
-	struct mem_cgroup_tree_per_node *rb_tree_per_node[MAX_NUMNODES];
-};
-
-static struct mem_cgroup_tree soft_limit_tree __read_mostly;
+static atomic_t nr_soft_limited __read_mostly;
 
 struct mem_cgroup_threshold {
 	struct eventfd_ctx *eventfd;
@@ -230,11 +223,6 @@ struct mem_cgroup {
 	 * per zone LRU lists.
 	 */
 	struct mem_cgroup_lru_info info;
-	/*
-	 * While reclaiming in a hierarchy, we cache the last child we
-	 * reclaimed from.
-	 */
-	int last_scanned_child;
 	int last_scanned_node;
 #if MAX_NUMNODES > 1
 	nodemask_t	scan_nodes;
@@ -285,6 +273,19 @@ struct mem_cgroup {
 	 */
 	struct mem_cgroup_stat_cpu nocpu_base;
 	spinlock_t pcp_counter_lock;
+
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	/*
+	 * the counter to account for kernel memory usage, which is
+	 * also charged to res and memsw.
+	 */
+	struct res_counter kmem;
+	unsigned long kmem_account_flags;
+	/* per-cgroup copies of the accounted slab caches, by root id */
+	struct kmem_cache *slab_caches[MEMCG_CACHES_MAX];
+	DECLARE_BITMAP(slab_caches_pending, MEMCG_CACHES_MAX);
+	struct work_struct kmem_release_work;
+#endif
 };
 
 /* Stuffs for move charges at task migration. */
@@ -326,11 +327,10 @@ static bool move_file(void)
 }
 
 /*
- * Maximum loops in mem_cgroup_hierarchical_reclaim(), used for soft
- * limit reclaim to prevent infinite loops, if they ever occur.
+ * Maximum loops in mem_cgroup_reclaim(), to prevent infinite loops, if
+ * they ever occur.
  */
 #define	MEM_CGROUP_MAX_RECLAIM_LOOPS		(100)
-#define	MEM_CGROUP_MAX_SOFT_LIMIT_RECLAIM_LOOPS	(2)
 
 enum charge_type {
 	MEM_CGROUP_CHARGE_TYPE_CACHE = 0,
@@ -346,6 +346,7 @@ enum charge_type {
 #define _MEM			(0)
 #define _MEMSWAP		(1)
 #define _OOM_TYPE		(2)
+#define _KMEM			(3)
 #define MEMFILE_PRIVATE(x, val)	(((x) << 16) | (val))
 #define MEMFILE_TYPE(val)	(((val) >> 16) & 0xffff)
 #define MEMFILE_ATTR(val)	((val) & 0xffff)
@@ -353,14 +354,12 @@ enum charge_type {
 #define OOM_CONTROL		(0)
 
 /*
- * Reclaim flags for mem_cgroup_hierarchical_reclaim
+ * Reclaim flags for mem_cgroup_reclaim
  */
 #define MEM_CGROUP_RECLAIM_NOSWAP_BIT	0x0
 #define MEM_CGROUP_RECLAIM_NOSWAP	(1 << MEM_CGROUP_RECLAIM_NOSWAP_BIT)
 #define MEM_CGROUP_RECLAIM_SHRINK_BIT	0x1
 #define MEM_CGROUP_RECLAIM_SHRINK	(1 << MEM_CGROUP_RECLAIM_SHRINK_BIT)
-#define MEM_CGROUP_RECLAIM_SOFT_BIT	0x2
-#define MEM_CGROUP_RECLAIM_SOFT		(1 << MEM_CGROUP_RECLAIM_SOFT_BIT)
 
 static void mem_cgroup_get(struct mem_cgroup *mem);
 static void mem_cgroup_put(struct mem_cgroup *mem);
@@ -387,164 +386,6 @@ page_cgroup_zoneinfo(struct mem_cgroup *mem, struct page *page)
 	return mem_cgroup_zoneinfo(mem, nid, zid);
 }
 
-static struct mem_cgroup_tree_per_zone *
-soft_limit_tree_node_zone(int nid, int zid)
-{
-	return &soft_limit_tree.rb_tree_per_node[nid]->rb_tree_per_zone[zid];
-}
-
-static struct mem_cgroup_tree_per_zone *
-soft_limit_tree_from_page(struct page *page)
-{
-	int nid = page_to_nid(page);
-	int zid = page_zonenum(page);
-
-	return &soft_limit_tree.rb_tree_per_node[nid]->rb_tree_per_zone[zid];
-}
-
-static void
-__mem_cgroup_insert_exceeded(struct mem_cgroup *mem,
-				struct mem_cgroup_per_zone *mz,
-				struct mem_cgroup_tree_per_zone *mctz,
-				unsigned long long new_usage_in_excess)
-{
-	struct rb_node **p = &mctz->rb_root.rb_node;
-	struct rb_node *parent = NULL;
-	struct mem_cgroup_per_zone *mz_node;
-
-	if (mz->on_tree)
-		return;
-
-	mz->usage_in_excess = new_usage_in_excess;
-	if (!mz->usage_in_excess)
-		return;
-	while (*p) {
-		parent = *p;
-		mz_node = rb_entry(parent, struct mem_cgroup_per_zone,
-					tree_node);
-		if (mz->usage_in_excess < mz_node->usage_in_excess)
-			p = &(*p)->rb_left;
-		/*
-		 * We can't avoid mem cgroups that are over their soft
-		 * limit by the same amount
-		 */
-		else if (mz->usage_in_excess >= mz_node->usage_in_excess)
-			p = &(*p)->rb_right;
-	}
-	rb_link_node(&mz->tree_node, parent, p);
-	rb_insert_color(&mz->tree_node, &mctz->rb_root);
-	mz->on_tree = true;
-}
-
-static void
-__mem_cgroup_remove_exceeded(struct mem_cgroup *mem,
-				struct mem_cgroup_per_zone *mz,
-				struct mem_cgroup_tree_per_zone *mctz)
-{
-	if (!mz->on_tree)
-		return;
-	rb_erase(&mz->tree_node, &mctz->rb_root);
-	mz->on_tree = false;
-}
-
-static void
-mem_cgroup_remove_exceeded(struct mem_cgroup *mem,
-				struct mem_cgroup_per_zone *mz,
-				struct mem_cgroup_tree_per_zone *mctz)
-{
-	spin_lock(&mctz->lock);
-	__mem_cgroup_remove_exceeded(mem, mz, mctz);
-	spin_unlock(&mctz->lock);
-}
-
-
-static void mem_cgroup_update_tree(struct mem_cgroup *mem, struct page *page)
-{
-	unsigned long long excess;
-	struct mem_cgroup_per_zone *mz;
-	struct mem_cgroup_tree_per_zone *mctz;
-	int nid = page_to_nid(page);
-	int zid = page_zonenum(page);
-	mctz = soft_limit_tree_from_page(page);
-
-	/*
-	 * Necessary to update all ancestors when hierarchy is used.
-	 * because their event counter is not touched.
-	 */
-	for (; mem; mem = parent_mem_cgroup(mem)) {
-		mz = mem_cgroup_zoneinfo(mem, nid, zid);
-		excess = res_counter_soft_limit_excess(&mem->res);
-		/*
-		 * We have to update the tree if mz is on RB-tree or
-		 * mem is over its softlimit.
-		 */
-		if (excess || mz->on_tree) {
-			spin_lock(&mctz->lock);
-			/* if on-tree, remove it */
-			if (mz->on_tree)
-				__mem_cgroup_remove_exceeded(mem, mz, mctz);
-			/*
-			 * Insert again. mz->usage_in_excess will be updated.
-			 * If excess is 0, no tree ops.
-			 */
-			__mem_cgroup_insert_exceeded(mem, mz, mctz, excess);
-			spin_unlock(&mctz->lock);
-		}
-	}
-}
-
-static void mem_cgroup_remove_from_trees(struct mem_cgroup *mem)
-{
-	int node, zone;
-	struct mem_cgroup_per_zone *mz;
-	struct mem_cgroup_tree_per_zone *mctz;
-
-	for_each_node_state(node, N_POSSIBLE) {
-		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
-			mz = mem_cgroup_zoneinfo(mem, node, zone);
-			mctz = soft_limit_tree_node_zone(node, zone);
-			mem_cgroup_remove_exceeded(mem, mz, mctz);
-		}
-	}
-}
-
-static struct mem_cgroup_per_zone *
-__mem_cgroup_largest_soft_limit_node(struct mem_cgroup_tree_per_zone *mctz)
-{
-	struct rb_node *rightmost = NULL;
-	struct mem_cgroup_per_zone *mz;
-
-retry:
-	mz = NULL;
-	rightmost = rb_last(&mctz->rb_root);
-	if (!rightmost)
-		goto done;		/* Nothing to reclaim from */
-
-	mz = rb_entry(rightmost, struct mem_cgroup_per_zone, tree_node);
-	/*
-	 * Remove the node now but someone else can add it back,
-	 * we will to add it back at the end of reclaim to its correct
-	 * position in the tree.
-	 */
-	__mem_cgroup_remove_exceeded(mz->mem, mz, mctz);
-	if (!res_counter_soft_limit_excess(&mz->mem->res) ||
-		!css_tryget(&mz->mem->css))
-		goto retry;
-done:
-	return mz;
-}
-
-static struct mem_cgroup_per_zone *
-mem_cgroup_largest_soft_limit_node(struct mem_cgroup_tree_per_zone *mctz)
-{
-	struct mem_cgroup_per_zone *mz;
-
-	spin_lock(&mctz->lock);
-	mz = __mem_cgroup_largest_soft_limit_node(mctz);
-	spin_unlock(&mctz->lock);
-	return mz;
-}
-
 /*
  * Implementation Note: reading percpu statistics for memcg.
  *
@@ -699,9 +540,6 @@ static void __mem_cgroup_target_update(struct mem_cgroup *mem, int target)
 	case MEM_CGROUP_TARGET_THRESH:
 		next = val + THRESHOLDS_EVENTS_TARGET;
 		break;
-	case MEM_CGROUP_TARGET_SOFTLIMIT:
-		next = val + SOFTLIMIT_EVENTS_TARGET;
-		break;
 	case MEM_CGROUP_TARGET_NUMAINFO:
 		next = val + NUMAINFO_EVENTS_TARGET;
 		break;
@@ -718,16 +556,10 @@ static void __mem_cgroup_target_update(struct mem_cgroup *mem, int target)
  */
 static void memcg_check_events(struct mem_cgroup *mem, struct page *page)
 {
-	/* threshold event is triggered in finer grain than soft limit */
+	/* threshold event is triggered in finer grain than numainfo */
 	if (unlikely(__memcg_event_check(mem, MEM_CGROUP_TARGET_THRESH))) {
 		mem_cgroup_threshold(mem);
 		__mem_cgroup_target_update(mem, MEM_CGROUP_TARGET_THRESH);
-		if (unlikely(__memcg_event_check(mem,
-			     MEM_CGROUP_TARGET_SOFTLIMIT))) {
-			mem_cgroup_update_tree(mem, page);
-			__mem_cgroup_target_update(mem,
-						   MEM_CGROUP_TARGET_SOFTLIMIT);
-		}
 #if MAX_NUMNODES > 1
 		if (unlikely(__memcg_event_check(mem,
 			MEM_CGROUP_TARGET_NUMAINFO))) {
@@ -858,6 +690,101 @@ static struct mem_cgroup *mem_cgroup_get_next(struct mem_cgroup *iter,
 #define for_each_mem_cgroup_all(iter) \
 	for_each_mem_cgroup_tree_cond(iter, NULL, true)
 
+/**
+ * mem_cgroup_iter - iterate over memory cgroup hierarchy
+ * @root: hierarchy root
+ * @prev: previously returned memcg, NULL on first invocation
+ * @reclaim: cookie for shared reclaim walks, NULL for full walks
+ *
+ * Returns references to children of the hierarchy below @root, or
+ * @root itself, or %NULL after a full round-trip.
+ *
+ * Caller must pass the return value in @prev on subsequent
+ * invocations for reference counting, or use mem_cgroup_iter_break()
+ * to cancel a hierarchy walk before the round-trip is complete.
+ *
+ * Reclaimers can specify a zone and a priority level in @reclaim to
+ * divide up the memcgs in the hierarchy among all concurrent
+ * reclaimers operating on the same zone and priority.
+ */
+struct mem_cgroup *mem_cgroup_iter(struct mem_cgroup *root,
+				   struct mem_cgroup *prev,
+				   struct mem_cgroup_reclaim_cookie *reclaim)
+{
+	struct mem_cgroup *mem = NULL;
+	int id = 0;
+
+	if (mem_cgroup_disabled())
+		return NULL;
+
+	if (!root)
+		root = root_mem_cgroup;
+
+	if (prev && !reclaim)
+		id = css_id(&prev->css);
+
+	if (prev && prev != root)
+		css_put(&prev->css);
+
+	if (!root->use_hierarchy && root != root_mem_cgroup) {
+		if (prev)
+			return NULL;
+		return root;
+	}
+
+	while (!mem) {
+		struct mem_cgroup_reclaim_iter *uninitialized_var(iter);
+		struct cgroup_subsys_state *css;
+
+		if (reclaim) {
+			int nid = zone_to_nid(reclaim->zone);
+			int zid = zone_idx(reclaim->zone);
+			struct mem_cgroup_per_zone *mz;
+
+			mz = mem_cgroup_zoneinfo(root, nid, zid);
+			iter = &mz->reclaim_iter[reclaim->priority];
+			if (prev && reclaim->generation != iter->generation)
+				return NULL;
+			id = iter->position;
+		}
+
+		rcu_read_lock();
+		css = css_get_next(&mem_cgroup_subsys, id + 1, &root->css, &id);
+		if (css) {
+			if (css == &root->css || css_tryget(css))
+				mem = container_of(css, struct mem_cgroup, css);
+		} else
+			id = 0;
+		rcu_read_unlock();
+
+		if (reclaim) {
+			iter->position = id;
+			if (!css)
+				iter->generation++;
+			else if (!prev && mem)
+				reclaim->generation = iter->generation;
+		}
+
+		if (prev && !css)
+			return NULL;
+	}
+	return mem;
+}
+
+/**
+ * mem_cgroup_iter_break - abort a hierarchy walk prematurely
+ * @root: hierarchy root
+ * @prev: last visited hierarchy member as returned by mem_cgroup_iter()
+ */
+void mem_cgroup_iter_break(struct mem_cgroup *root,
+			   struct mem_cgroup *prev)
+{
+	if (!root)
+		root = root_mem_cgroup;
+	if (prev && prev != root)
+		css_put(&prev->css);
+}
+
 
 static inline bool mem_cgroup_is_root(struct mem_cgroup *mem)
 {
@@ -905,161 +832,127 @@ EXPORT_SYMBOL(mem_cgroup_count_vm_event);
  * When moving account, the page is not on LRU. It's isolated.
  */
 
-void mem_cgroup_del_lru_list(struct page *page, enum lru_list lru)
+/**
+ * mem_cgroup_zone_lruvec - get the lru list vector for a zone and memcg
+ * @zone: zone of the wanted lruvec
+ * @mem: memcg of the wanted lruvec
+ *
+ * Returns the lru list vector holding pages for the given @zone and
+ * @mem.  This can be the global zone lruvec, if the memory controller
+ * is disabled.
+ */
+struct lruvec *mem_cgroup_zone_lruvec(struct zone *zone,
+				      struct mem_cgroup *mem)
 {
-	struct page_cgroup *pc;
 	struct mem_cgroup_per_zone *mz;
 
 	if (mem_cgroup_disabled())
-		return;
-	pc = lookup_page_cgroup(page);
-	/* can happen while we handle swapcache. */
-	if (!TestClearPageCgroupAcctLRU(pc))
-		return;
-	VM_BUG_ON(!pc->mem_cgroup);
-	/*
-	 * We don't check PCG_USED bit. It's cleared when the "page" is finally
-	 * removed from global LRU.
-	 */
-	mz = page_cgroup_zoneinfo(pc->mem_cgroup, page);
-	/* huge page split is done under lru_lock. so, we have no races. */
-	MEM_CGROUP_ZSTAT(mz, lru) -= 1 << compound_order(page);
-	if (mem_cgroup_is_root(pc->mem_cgroup))
-		return;
-	VM_BUG_ON(list_empty(&pc->lru));
-	list_del_init(&pc->lru);
-}
+		return &zone->lruvec;
 
-void mem_cgroup_del_lru(struct page *page)
-{
-	mem_cgroup_del_lru_list(page, page_lru(page));
+	mz = mem_cgroup_zoneinfo(mem, zone_to_nid(zone), zone_idx(zone));
+	return &mz->lruvec;
 }
 
-/*
- * Writeback is about to end against a page which has been marked for immediate
- * reclaim.  If it still appears to be reclaimable, move it to the tail of the
- * inactive list.
+/**
+ * mem_cgroup_lru_add_list - account for adding an lru page and return lruvec
+ * @zone: zone of the page
+ * @page: the page
+ * @lru: current lru
+ *
+ * This function accounts for @page being added to @lru, and returns
+ * the lruvec for the given @zone and the memcg @page is charged to.
+ *
+ * The callsite is then responsible for physically linking the page to
+ * the returned lruvec->lists[@lru].
  */
-void mem_cgroup_rotate_reclaimable_page(struct page *page)
+struct lruvec *mem_cgroup_lru_add_list(struct zone *zone, struct page *page,
+				       enum lru_list lru)
 {
 	struct mem_cgroup_per_zone *mz;
+	struct mem_cgroup *mem;
 	struct page_cgroup *pc;
-	enum lru_list lru = page_lru(page);
 
 	if (mem_cgroup_disabled())
-		return;
+		return &zone->lruvec;
 
 	pc = lookup_page_cgroup(page);
-	/* unused or root page is not rotated. */
-	if (!PageCgroupUsed(pc))
-		return;
-	/* Ensure pc->mem_cgroup is visible after reading PCG_USED. */
-	smp_rmb();
-	if (mem_cgroup_is_root(pc->mem_cgroup))
-		return;
-	mz = page_cgroup_zoneinfo(pc->mem_cgroup, page);
-	list_move_tail(&pc->lru, &mz->lists[lru]);
-}
-
-void mem_cgroup_rotate_lru_list(struct page *page, enum lru_list lru)
-{
-	struct mem_cgroup_per_zone *mz;
-	struct page_cgroup *pc;
+	mem = page_cgroup_memcg(pc);
 
-	if (mem_cgroup_disabled())
-		return;
+	/*
+	 * Surreptitiously switch any uncharged page to root:
+	 * an uncharged page off lru does nothing to secure
+	 * its former mem_cgroup from sudden removal.
+	 *
+	 * Our caller holds lru_lock, and PageCgroupUsed is updated
+	 * under page_cgroup lock: between them, they make all uses
+	 * of pc->mem_cgroup safe.
+	 */
+	if (!PageCgroupUsed(pc) && mem != root_mem_cgroup) {
+		mem = root_mem_cgroup;
+		set_page_cgroup_memcg(pc, mem);
+	}
 
-	pc = lookup_page_cgroup(page);
-	/* unused or root page is not rotated. */
-	if (!PageCgroupUsed(pc))
-		return;
-	/* Ensure pc->mem_cgroup is visible after reading PCG_USED. */
-	smp_rmb();
-	if (mem_cgroup_is_root(pc->mem_cgroup))
-		return;
-	mz = page_cgroup_zoneinfo(pc->mem_cgroup, page);
-	list_move(&pc->lru, &mz->lists[lru]);
+	mz = page_cgroup_zoneinfo(mem, page);
+	/* compound_order() is stabilized through lru_lock */
+	MEM_CGROUP_ZSTAT(mz, lru) += 1 << compound_order(page);
+	return &mz->lruvec;
 }
 
-void mem_cgroup_add_lru_list(struct page *page, enum lru_list lru)
+/**
+ * mem_cgroup_lru_del_list - account for removing an lru page
+ * @page: the page
+ * @lru: target lru
+ *
+ * This function accounts for @page being removed from @lru.
+ *
+ * The callsite is then responsible for physically unlinking
+ * @page->lru.
+ */
+void mem_cgroup_lru_del_list(struct page *page, enum lru_list lru)
 {
-	struct page_cgroup *pc;
 	struct mem_cgroup_per_zone *mz;
+	struct mem_cgroup *mem;
+	struct page_cgroup *pc;
 
 	if (mem_cgroup_disabled())
 		return;
+
 	pc = lookup_page_cgroup(page);
-	VM_BUG_ON(PageCgroupAcctLRU(pc));
-	if (!PageCgroupUsed(pc))
-		return;
-	/* Ensure pc->mem_cgroup is visible after reading PCG_USED. */
-	smp_rmb();
-	mz = page_cgroup_zoneinfo(pc->mem_cgroup, page);
+	mem = page_cgroup_memcg(pc);
+	VM_BUG_ON(!mem);
+	mz = page_cgroup_zoneinfo(mem, page);
 	/* huge page split is done under lru_lock. so, we have no races. */
-	MEM_CGROUP_ZSTAT(mz, lru) += 1 << compound_order(page);
-	SetPageCgroupAcctLRU(pc);
-	if (mem_cgroup_is_root(pc->mem_cgroup))
-		return;
-	list_add(&pc->lru, &mz->lists[lru]);
-}
-
-/*
- * At handling SwapCache and other FUSE stuff, pc->mem_cgroup may be changed
- * while it's linked to lru because the page may be reused after it's fully
- * uncharged. To handle that, unlink page_cgroup from LRU when charge it again.
- * It's done under lock_page and expected that zone->lru_lock isnever held.
- */
-static void mem_cgroup_lru_del_before_commit(struct page *page)
-{
-	unsigned long flags;
-	struct zone *zone = page_zone(page);
-	struct page_cgroup *pc = lookup_page_cgroup(page);
-
-	/*
-	 * Doing this check without taking ->lru_lock seems wrong but this
-	 * is safe. Because if page_cgroup's USED bit is unset, the page
-	 * will not be added to any memcg's LRU. If page_cgroup's USED bit is
-	 * set, the commit after this will fail, anyway.
-	 * This all charge/uncharge is done under some mutual execustion.
-	 * So, we don't need to taking care of changes in USED bit.
-	 */
-	if (likely(!PageLRU(page)))
-		return;
-
-	spin_lock_irqsave(&zone->lru_lock, flags);
-	/*
-	 * Forget old LRU when this page_cgroup is *not* used. This Used bit
-	 * is guarded by lock_page() because the page is SwapCache.
-	 */
-	if (!PageCgroupUsed(pc))
-		mem_cgroup_del_lru_list(page, page_lru(page));
-	spin_unlock_irqrestore(&zone->lru_lock, flags);
+	VM_BUG_ON(MEM_CGROUP_ZSTAT(mz, lru) < (1 << compound_order(page)));
+	MEM_CGROUP_ZSTAT(mz, lru) -= 1 << compound_order(page);
 }
 
-static void mem_cgroup_lru_add_after_commit(struct page *page)
+void mem_cgroup_lru_del(struct page *page)
 {
-	unsigned long flags;
-	struct zone *zone = page_zone(page);
-	struct page_cgroup *pc = lookup_page_cgroup(page);
-
-	/* taking care of that the page is added to LRU while we commit it */
-	if (likely(!PageLRU(page)))
-		return;
-	spin_lock_irqsave(&zone->lru_lock, flags);
-	/* link when the page is linked to LRU but page_cgroup isn't */
-	if (PageLRU(page) && !PageCgroupAcctLRU(pc))
-		mem_cgroup_add_lru_list(page, page_lru(page));
-	spin_unlock_irqrestore(&zone->lru_lock, flags);
+	mem_cgroup_lru_del_list(page, page_lru(page));
 }
 
-
-void mem_cgroup_move_lists(struct page *page,
-			   enum lru_list from, enum lru_list to)
+/**
+ * mem_cgroup_lru_move_lists - account for moving a page between lrus
+ * @zone: zone of the page
+ * @page: the page
+ * @from: current lru
+ * @to: target lru
+ *
+ * This function accounts for @page being moved between the lrus @from
+ * and @to, and returns the lruvec for the given @zone and the memcg
+ * @page is charged to.
+ *
+ * The callsite is then responsible for physically relinking
+ * @page->lru to the returned lruvec->lists[@to].
+ */
+struct lruvec *mem_cgroup_lru_move_lists(struct zone *zone,
+					 struct page *page,
+					 enum lru_list from,
+					 enum lru_list to)
 {
-	if (mem_cgroup_disabled())
-		return;
-	mem_cgroup_del_lru_list(page, from);
-	mem_cgroup_add_lru_list(page, to);
+	/* XXX: Optimize this, especially for @from == @to */
+	mem_cgroup_lru_del_list(page, from);
+	return mem_cgroup_lru_add_list(zone, page, to);
 }
 
 /*
@@ -1101,15 +994,19 @@ int task_in_mem_cgroup(struct task_struct *task, const struct mem_cgroup *mem)
 	return ret;
 }
 
-static int calc_inactive_ratio(struct mem_cgroup *memcg, unsigned long *present_pages)
+int mem_cgroup_inactive_anon_is_low(struct mem_cgroup *memcg, struct zone *zone)
 {
-	unsigned long active;
+	unsigned long inactive_ratio;
+	int nid = zone_to_nid(zone);
+	int zid = zone_idx(zone);
 	unsigned long inactive;
+	unsigned long active;
 	unsigned long gb;
-	unsigned long inactive_ratio;
 
-	inactive = mem_cgroup_nr_lru_pages(memcg, BIT(LRU_INACTIVE_ANON));
-	active = mem_cgroup_nr_lru_pages(memcg, BIT(LRU_ACTIVE_ANON));
+	inactive = mem_cgroup_zone_nr_lru_pages(memcg, nid, zid,
+						BIT(LRU_INACTIVE_ANON));
+	active = mem_cgroup_zone_nr_lru_pages(memcg, nid, zid,
+					      BIT(LRU_ACTIVE_ANON));
 
 	gb = (inactive + active) >> (30 - PAGE_SHIFT);
 	if (gb)
@@ -1117,39 +1014,20 @@ static int calc_inactive_ratio(struct mem_cgroup *memcg, unsigned long *present_
 	else
 		inactive_ratio = 1;
 
-	if (present_pages) {
-		present_pages[0] = inactive;
-		present_pages[1] = active;
-	}
-
-	return inactive_ratio;
-}
-
-int mem_cgroup_inactive_anon_is_low(struct mem_cgroup *memcg)
-{
-	unsigned long active;
-	unsigned long inactive;
-	unsigned long present_pages[2];
-	unsigned long inactive_ratio;
-
-	inactive_ratio = calc_inactive_ratio(memcg, present_pages);
-
-	inactive = present_pages[0];
-	active = present_pages[1];
-
-	if (inactive * inactive_ratio < active)
-		return 1;
-
-	return 0;
+	return inactive * inactive_ratio < active;
 }
 
-int mem_cgroup_inactive_file_is_low(struct mem_cgroup *memcg)
+int mem_cgroup_inactive_file_is_low(struct mem_cgroup *memcg, struct zone *zone)
 {
 	unsigned long active;
 	unsigned long inactive;
+	int nid = zone_to_nid(zone);
+	int zid = zone_idx(zone);
 
-	inactive = mem_cgroup_nr_lru_pages(memcg, BIT(LRU_INACTIVE_FILE));
-	active = mem_cgroup_nr_lru_pages(memcg, BIT(LRU_ACTIVE_FILE));
+	inactive = mem_cgroup_zone_nr_lru_pages(memcg, nid, zid,
+						BIT(LRU_INACTIVE_FILE));
+	active = mem_cgroup_zone_nr_lru_pages(memcg, nid, zid,
+					      BIT(LRU_ACTIVE_FILE));
 
 	return (active > inactive);
 }
@@ -1178,71 +1056,10 @@ mem_cgroup_get_reclaim_stat_from_page(struct page *page)
 		return NULL;
 	/* Ensure pc->mem_cgroup is visible after reading PCG_USED. */
 	smp_rmb();
-	mz = page_cgroup_zoneinfo(pc->mem_cgroup, page);
+	mz = page_cgroup_zoneinfo(page_cgroup_memcg(pc), page);
 	return &mz->reclaim_stat;
 }
 
-unsigned long mem_cgroup_isolate_pages(unsigned long nr_to_scan,
-					struct list_head *dst,
-					unsigned long *scanned, int order,
-					int mode, struct zone *z,
-					struct mem_cgroup *mem_cont,
-					int active, int file)
-{
-	unsigned long nr_taken = 0;
-	struct page *page;
-	unsigned long scan;
-	LIST_HEAD(pc_list);
-	struct list_head *src;
-	struct page_cgroup *pc, *tmp;
-	int nid = zone_to_nid(z);
-	int zid = zone_idx(z);
-	struct mem_cgroup_per_zone *mz;
-	int lru = LRU_FILE * file + active;
-	int ret;
-
-	BUG_ON(!mem_cont);
-	mz = mem_cgroup_zoneinfo(mem_cont, nid, zid);
-	src = &mz->lists[lru];
-
-	scan = 0;
-	list_for_each_entry_safe_reverse(pc, tmp, src, lru) {
-		if (scan >= nr_to_scan)
-			break;
-
-		if (unlikely(!PageCgroupUsed(pc)))
-			continue;
-
-		page = lookup_cgroup_page(pc);
-
-		if (unlikely(!PageLRU(page)))
-			continue;
-
-		scan++;
-		ret = __isolate_lru_page(page, mode, file);
-		switch (ret) {
-		case 0:
-			list_move(&page->lru, dst);
-			mem_cgroup_del_lru(page);
-			nr_taken += hpage_nr_pages(page);
-			break;
-		case -EBUSY:
-			/* we don't affect global LRU but rotate in our LRU */
-			mem_cgroup_rotate_lru_list(page, page_lru(page));
-			break;
-		default:
-			break;
-		}
-	}
-
-	*scanned = scan;
-
-	trace_mm_vmscan_memcg_isolate(0, nr_to_scan, scan, nr_taken,
-				      0, 0, 0, mode);
-
-	return nr_taken;
-}
-
 #define mem_cgroup_from_res_counter(counter, member)	\
 	container_of(counter, struct mem_cgroup, member)
 
@@ -1459,43 +1276,6 @@ u64 mem_cgroup_get_limit(struct mem_cgroup *memcg)
 	return min(limit, memsw);
 }
 
-/*
- * Visit the first child (need not be the first child as per the ordering
- * of the cgroup list, since we track last_scanned_child) of @mem and use
- * that to reclaim free pages from.
- */
-static struct mem_cgroup *
-mem_cgroup_select_victim(struct mem_cgroup *root_mem)
-{
-	struct mem_cgroup *ret = NULL;
-	struct cgroup_subsys_state *css;
-	int nextid, found;
-
-	if (!root_mem->use_hierarchy) {
-		css_get(&root_mem->css);
-		ret = root_mem;
-	}
-
-	while (!ret) {
-		rcu_read_lock();
-		nextid = root_mem->last_scanned_child + 1;
-		css = css_get_next(&mem_cgroup_subsys, nextid, &root_mem->css,
-				   &found);
-		if (css && css_tryget(css))
-			ret = container_of(css, struct mem_cgroup, css);
-
-		rcu_read_unlock();
-		/* Updates scanning parameter */
-		if (!css) {
-			/* this means start scan from ID:1 */
-			root_mem->last_scanned_child = 0;
-		} else
-			root_mem->last_scanned_child = found;
-	}
-
-	return ret;
-}
-
 /**
  * test_mem_cgroup_node_reclaimable
  * @mem: the target memcg
@@ -1586,148 +1366,54 @@ int mem_cgroup_select_victim_node(struct mem_cgroup *mem)
 	return node;
 }
 
-/*
- * Check all nodes whether it contains reclaimable pages or not.
- * For quick scan, we make use of scan_nodes. This will allow us to skip
- * unused nodes. But scan_nodes is lazily updated and may not cotain
- * enough new information. We need to do double check.
- */
-bool mem_cgroup_reclaimable(struct mem_cgroup *mem, bool noswap)
-{
-	int nid;
-
-	/*
-	 * quick check...making use of scan_node.
-	 * We can skip unused nodes.
-	 */
-	if (!nodes_empty(mem->scan_nodes)) {
-		for (nid = first_node(mem->scan_nodes);
-		     nid < MAX_NUMNODES;
-		     nid = next_node(nid, mem->scan_nodes)) {
-
-			if (test_mem_cgroup_node_reclaimable(mem, nid, noswap))
-				return true;
-		}
-	}
-	/*
-	 * Check rest of nodes.
-	 */
-	for_each_node_state(nid, N_HIGH_MEMORY) {
-		if (node_isset(nid, mem->scan_nodes))
-			continue;
-		if (test_mem_cgroup_node_reclaimable(mem, nid, noswap))
-			return true;
-	}
-	return false;
-}
-
 #else
 int mem_cgroup_select_victim_node(struct mem_cgroup *mem)
 {
 	return 0;
 }
 
-bool mem_cgroup_reclaimable(struct mem_cgroup *mem, bool noswap)
-{
-	return test_mem_cgroup_node_reclaimable(mem, 0, noswap);
-}
 #endif
 
 /*
- * Scan the hierarchy if needed to reclaim memory. We remember the last child
- * we reclaimed from, so that we don't end up penalizing one child extensively
- * based on its position in the children list.
- *
- * root_mem is the original ancestor that we've been reclaim from.
- *
- * We give up and return to the caller when we visit root_mem twice.
- * (other groups can be removed while we're walking....)
+ * Reclaim from the hierarchy below @mem until it is back under its
+ * limit.  The walk over the hierarchy members is done by the page
+ * reclaim code, which remembers its position per zone and priority so
+ * that no child is penalized based on its position in the tree.
  *
  * If shrink==true, for avoiding to free too much, this returns immedieately.
  */
-static int mem_cgroup_hierarchical_reclaim(struct mem_cgroup *root_mem,
-						struct zone *zone,
-						gfp_t gfp_mask,
-						unsigned long reclaim_options,
-						unsigned long *total_scanned)
-{
-	struct mem_cgroup *victim;
-	int ret, total = 0;
-	int loop = 0;
-	bool noswap = reclaim_options & MEM_CGROUP_RECLAIM_NOSWAP;
-	bool shrink = reclaim_options & MEM_CGROUP_RECLAIM_SHRINK;
-	bool check_soft = reclaim_options & MEM_CGROUP_RECLAIM_SOFT;
-	unsigned long excess;
-	unsigned long nr_scanned;
-
-	excess = res_counter_soft_limit_excess(&root_mem->res) >> PAGE_SHIFT;
+static unsigned long mem_cgroup_reclaim(struct mem_cgroup *mem,
+					gfp_t gfp_mask,
+					unsigned long flags)
+{
+	unsigned long total = 0;
+	bool noswap = false;
+	int loop;
 
+	if (flags & MEM_CGROUP_RECLAIM_NOSWAP)
+		noswap = true;
 	/* If memsw_is_minimum==1, swap-out is of-no-use. */
-	if (!check_soft && !shrink && root_mem->memsw_is_minimum)
+	if (!(flags & MEM_CGROUP_RECLAIM_SHRINK) && mem->memsw_is_minimum)
 		noswap = true;
 
-	while (1) {
-		victim = mem_cgroup_select_victim(root_mem);
-		if (victim == root_mem) {
-			loop++;
-			/*
-			 * We are not draining per cpu cached charges during
-			 * soft limit reclaim  because global reclaim doesn't
-			 * care about charges. It tries to free some memory and
-			 * charges will not give any.
-			 */
-			if (!check_soft && loop >= 1)
-				drain_all_stock_async(root_mem);
-			if (loop >= 2) {
-				/*
-				 * If we have not been able to reclaim
-				 * anything, it might because there are
-				 * no reclaimable pages under this hierarchy
-				 */
-				if (!check_soft || !total) {
-					css_put(&victim->css);
-					break;
-				}
-				/*
-				 * We want to do more targeted reclaim.
-				 * excess >> 2 is not to excessive so as to
-				 * reclaim too much, nor too less that we keep
-				 * coming back to reclaim from this cgroup
-				 */
-				if (total >= (excess >> 2) ||
-					(loop > MEM_CGROUP_MAX_RECLAIM_LOOPS)) {
-					css_put(&victim->css);
-					break;
-				}
-			}
-		}
-		if (!mem_cgroup_reclaimable(victim, noswap)) {
-			/* this cgroup's local usage == 0 */
-			css_put(&victim->css);
-			continue;
-		}
-		/* we use swappiness of local cgroup */
-		if (check_soft) {
-			ret = mem_cgroup_shrink_node_zone(victim, gfp_mask,
-				noswap, zone, &nr_scanned);
-			*total_scanned += nr_scanned;
-		} else
-			ret = try_to_free_mem_cgroup_pages(victim, gfp_mask,
-						noswap);
-		css_put(&victim->css);
+	for (loop = 0; loop < MEM_CGROUP_MAX_RECLAIM_LOOPS; loop++) {
+		if (loop)
+			drain_all_stock_async(mem);
+		total += try_to_free_mem_cgroup_pages(mem, gfp_mask, noswap);
 		/*
-		 * At shrinking usage, we can't check we should stop here or
-		 * reclaim more. It's depends on callers. last_scanned_child
-		 * will work enough for keeping fairness under tree.
+		 * Avoid freeing too much when shrinking to resize the
+		 * limit.  XXX: Shouldn't the margin check be enough?
 		 */
-		if (shrink)
-			return ret;
-		total += ret;
-		if (check_soft) {
-			if (!res_counter_soft_limit_excess(&root_mem->res))
-				return total;
-		} else if (mem_cgroup_margin(root_mem))
-			return total;
+		if (total && (flags & MEM_CGROUP_RECLAIM_SHRINK))
+			break;
+		if (mem_cgroup_margin(mem))
+			break;
+		/*
+		 * If nothing was reclaimed after two attempts, there
+		 * may be no reclaimable pages in this hierarchy.
+		 */
+		if (loop && !total)
+			break;
 	}
 	return total;
 }
@@ -1934,7 +1620,7 @@ void mem_cgroup_update_page_stat(struct page *page,
 		return;
 
 	rcu_read_lock();
-	mem = pc->mem_cgroup;
+	mem = page_cgroup_memcg(pc);
 	if (unlikely(!mem || !PageCgroupUsed(pc)))
 		goto out;
 	/* pc->mem_cgroup is unstable ? */
@@ -1942,7 +1628,7 @@ void mem_cgroup_update_page_stat(struct page *page,
 		/* take a lock against to access pc->mem_cgroup */
 		move_lock_page_cgroup(pc, &flags);
 		need_unlock = true;
-		mem = pc->mem_cgroup;
+		mem = page_cgroup_memcg(pc);
 		if (!mem || !PageCgroupUsed(pc))
 			goto out;
 	}
@@ -2223,8 +1909,7 @@ static int mem_cgroup_do_charge(struct mem_cgroup *mem, gfp_t gfp_mask,
 	if (!(gfp_mask & __GFP_WAIT))
 		return CHARGE_WOULDBLOCK;
 
-	ret = mem_cgroup_hierarchical_reclaim(mem_over_limit, NULL,
-					      gfp_mask, flags, NULL);
+	ret = mem_cgroup_reclaim(mem_over_limit, gfp_mask, flags);
 	if (mem_cgroup_margin(mem_over_limit) >= nr_pages)
 		return CHARGE_RETRY;
 	/*
@@ -2337,78 +2022,592 @@ again:
 		rcu_read_unlock();
 	}
 
-	do {
-		bool oom_check;
+	do {
+		bool oom_check;
+
+		/* If killed, bypass charge */
+		if (fatal_signal_pending(current)) {
+			css_put(&mem->css);
+			goto bypass;
+		}
+
+		oom_check = false;
+		if (oom && !nr_oom_retries) {
+			oom_check = true;
+			nr_oom_retries = MEM_CGROUP_RECLAIM_RETRIES;
+		}
+
+		ret = mem_cgroup_do_charge(mem, gfp_mask, batch, oom_check);
+		switch (ret) {
+		case CHARGE_OK:
+			break;
+		case CHARGE_RETRY: /* not in OOM situation but retry */
+			batch = nr_pages;
+			css_put(&mem->css);
+			mem = NULL;
+			goto again;
+		case CHARGE_WOULDBLOCK: /* !__GFP_WAIT */
+			css_put(&mem->css);
+			goto nomem;
+		case CHARGE_NOMEM: /* OOM routine works */
+			if (!oom) {
+				css_put(&mem->css);
+				goto nomem;
+			}
+			/* If oom, we never return -ENOMEM */
+			nr_oom_retries--;
+			break;
+		case CHARGE_OOM_DIE: /* Killed by OOM Killer */
+			css_put(&mem->css);
+			goto bypass;
+		}
+	} while (ret != CHARGE_OK);
+
+	if (batch > nr_pages)
+		refill_stock(mem, batch - nr_pages);
+	css_put(&mem->css);
+done:
+	*memcg = mem;
+	return 0;
+nomem:
+	*memcg = NULL;
+	return -ENOMEM;
+bypass:
+	*memcg = NULL;
+	return 0;
+}
+
+/*
+ * Somemtimes we have to undo a charge we got by try_charge().
+ * This function is for that and do uncharge, put css's refcnt.
+ * gotten by try_charge().
+ */
+static void __mem_cgroup_cancel_charge(struct mem_cgroup *mem,
+				       unsigned int nr_pages)
+{
+	if (!mem_cgroup_is_root(mem)) {
+		unsigned long bytes = nr_pages * PAGE_SIZE;
+
+		res_counter_uncharge(&mem->res, bytes);
+		if (do_swap_account)
+			res_counter_uncharge(&mem->memsw, bytes);
+	}
+}
+
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+/*
+ * Kernel memory accounting.
+ *
+ * Kernel memory is charged to res and memsw like user memory, and also
+ * to the kmem counter, which has a limit of its own.  A cgroup starts
+ * accounting when a kmem limit is written to it; with use_hierarchy,
+ * children created after that account as well.
+ *
+ * Each slab cache created with SLAB_ACCOUNT gets a copy per cgroup.  The
+ * copy is created from a workqueue on the first allocation by a task in
+ * that cgroup, and its pages are charged to that cgroup.  Other pages
+ * are charged when they are allocated with __GFP_KMEMCG.
+ *
+ * Kernel objects cannot be moved to the parent, so a removed cgroup
+ * stays around until all of its kernel memory is freed.  Its slab copies
+ * are destroyed once they are empty.  The reference taken at activation
+ * is dropped when kmem usage reaches zero.
+ */
+struct jump_label_key memcg_kmem_enabled_key;
+
+/* memcg->kmem_account_flags */
+#define KMEM_ACCOUNTED_ACTIVE	0	/* accounting is on */
+#define KMEM_ACCOUNTED_DEAD	1	/* removed with kernel memory charged */
+
+static DEFINE_MUTEX(memcg_cache_mutex);	/* slab_caches[], children lists */
+static DEFINE_IDA(memcg_cache_ida);
+static struct workqueue_struct *memcg_cache_wq;
+
+bool mem_cgroup_kmem_active(struct mem_cgroup *memcg)
+{
+	return memcg &&
+		test_bit(KMEM_ACCOUNTED_ACTIVE, &memcg->kmem_account_flags);
+}
+
+static void memcg_activate_kmem(struct mem_cgroup *memcg)
+{
+	if (test_and_set_bit(KMEM_ACCOUNTED_ACTIVE,
+			     &memcg->kmem_account_flags))
+		return;
+	/* Dropped by memcg_kmem_release() */
+	mem_cgroup_get(memcg);
+	jump_label_inc(&memcg_kmem_enabled_key);
+}
+
+static void memcg_kmem_release(struct mem_cgroup *memcg)
+{
+	jump_label_dec(&memcg_kmem_enabled_key);
+	mem_cgroup_put(memcg);
+}
+
+static void memcg_kmem_release_func(struct work_struct *work)
+{
+	struct mem_cgroup *memcg = container_of(work, struct mem_cgroup,
+						kmem_release_work);
+
+	memcg_kmem_release(memcg);
+}
+
+static void memcg_init_kmem(struct mem_cgroup *memcg,
+			    struct mem_cgroup *parent)
+{
+	INIT_WORK(&memcg->kmem_release_work, memcg_kmem_release_func);
+	if (parent && parent->use_hierarchy) {
+		res_counter_init(&memcg->kmem, &parent->kmem);
+		if (mem_cgroup_kmem_active(parent))
+			memcg_activate_kmem(memcg);
+	} else
+		res_counter_init(&memcg->kmem, NULL);
+}
+
+static int memcg_update_kmem_limit(struct mem_cgroup *memcg, u64 val)
+{
+	int ret;
+
+	ret = res_counter_set_limit(&memcg->kmem, val);
+	if (!ret)
+		memcg_activate_kmem(memcg);
+	return ret;
+}
+
+static u64 memcg_kmem_usage(struct mem_cgroup *memcg)
+{
+	return res_counter_read_u64(&memcg->kmem, RES_USAGE);
+}
+
+static int memcg_charge_kmem(struct mem_cgroup *memcg, gfp_t gfp, u64 size)
+{
+	int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
+	struct res_counter *fail_res;
+	struct mem_cgroup *_memcg;
+	int ret;
+
+	while ((ret = res_counter_charge(&memcg->kmem, size, &fail_res))) {
+		if (!(gfp & __GFP_WAIT) || !nr_retries--)
+			return ret;
+		/* Only slab objects count against the kmem limit alone */
+		try_to_free_mem_cgroup_kmem(
+			mem_cgroup_from_res_counter(fail_res, kmem), gfp);
+	}
+
+	_memcg = memcg;
+	ret = __mem_cgroup_try_charge(NULL, gfp, size >> PAGE_SHIFT,
+				      &_memcg, false);
+	if (ret) {
+		res_counter_uncharge(&memcg->kmem, size);
+		return ret;
+	}
+	if (!_memcg) {
+		/*
+		 * A dying task was let through.  Its memory is about to
+		 * go away, so charge it regardless of the limit rather
+		 * than failing the allocation, which has to be uncharged
+		 * from all counters later on.
+		 */
+		res_counter_charge_nofail(&memcg->res, size, &fail_res);
+		if (do_swap_account)
+			res_counter_charge_nofail(&memcg->memsw, size,
+						  &fail_res);
+	}
+	return 0;
+}
+
+static void memcg_uncharge_kmem(struct mem_cgroup *memcg, u64 size)
+{
+	res_counter_uncharge(&memcg->res, size);
+	if (do_swap_account)
+		res_counter_uncharge(&memcg->memsw, size);
+	res_counter_uncharge(&memcg->kmem, size);
+
+	if (memcg_kmem_usage(memcg))
+		return;
+	/* We may be in interrupt context, put the cgroup from a worker */
+	if (test_and_clear_bit(KMEM_ACCOUNTED_DEAD, &memcg->kmem_account_flags))
+		schedule_work(&memcg->kmem_release_work);
+}
+
+int __memcg_kmem_charge_pages(struct page *page, gfp_t gfp, int order)
+{
+	struct mem_cgroup *memcg;
+	struct page_cgroup *pc;
+	int ret = 0;
+
+	if (in_interrupt() || !current->mm || (current->flags & PF_KTHREAD))
+		return 0;
+	if (gfp & __GFP_NOFAIL)
+		return 0;
+
+	memcg = try_get_mem_cgroup_from_mm(current->mm);
+	if (!memcg)
+		return 0;
+	if (mem_cgroup_kmem_active(memcg)) {
+		ret = memcg_charge_kmem(memcg, gfp, PAGE_SIZE << order);
+		if (!ret) {
+			pc = lookup_page_cgroup(page);
+			lock_page_cgroup(pc);
+			set_page_cgroup_memcg(pc, memcg);
+			SetPageCgroupKmem(pc);
+			unlock_page_cgroup(pc);
+		}
+	}
+	css_put(&memcg->css);
+	return ret;
+}
+
+void __memcg_kmem_uncharge_pages(struct page *page, int order)
+{
+	struct mem_cgroup *memcg;
+	struct page_cgroup *pc;
+
+	pc = lookup_page_cgroup(page);
+	if (unlikely(!pc) || !PageCgroupKmem(pc))
+		return;
+
+	lock_page_cgroup(pc);
+	memcg = page_cgroup_memcg(pc);
+	ClearPageCgroupKmem(pc);
+	unlock_page_cgroup(pc);
+
+	memcg_uncharge_kmem(memcg, PAGE_SIZE << order);
+}
+
+bool __mem_cgroup_owns_kmem(struct mem_cgroup *memcg, const void *obj)
+{
+	struct mem_cgroup *owner = mem_cgroup_from_kmem(obj);
+	bool ret;
+
+	if (!owner)
+		return false;
+	rcu_read_lock();
+	ret = mem_cgroup_same_or_subtree(memcg, owner);
+	rcu_read_unlock();
+	return ret;
+}
+
+/*
+ * Slab accounting.  The first cache created with SLAB_ACCOUNT and every
+ * later one gets an id, which is its slot in each cgroup's slab_caches[].
+ */
+void memcg_register_cache(struct kmem_cache *s, size_t size, size_t align,
+			  unsigned long flags, void (*ctor)(void *))
+{
+	int id;
+
+	id = ida_simple_get(&memcg_cache_ida, 0, MEMCG_CACHES_MAX, GFP_KERNEL);
+	if (id < 0) {
+		/* Out of slots: everybody allocates from the root cache */
+		s->flags &= ~SLAB_ACCOUNT;
+		return;
+	}
+	s->memcg_params.id = id;
+	INIT_LIST_HEAD(&s->memcg_params.children);
+	s->memcg_params.size = size;
+	s->memcg_params.align = align;
+	s->memcg_params.flags = flags;
+	s->memcg_params.ctor = ctor;
+}
+
+static void memcg_cache_destroy_func(struct work_struct *work);
+
+void memcg_init_cache(struct kmem_cache *s, struct mem_cgroup *memcg,
+		      struct kmem_cache *root_cache)
+{
+	s->memcg_params.memcg = memcg;
+	s->memcg_params.root_cache = root_cache;
+	INIT_WORK(&s->memcg_params.destroy, memcg_cache_destroy_func);
+}
+
+static void memcg_schedule_cache_destroy(struct kmem_cache *s)
+{
+	if (!test_and_set_bit(MEMCG_CACHE_DESTROY, &s->memcg_params.state))
+		queue_work(memcg_cache_wq, &s->memcg_params.destroy);
+}
+
+static void memcg_cache_destroy_func(struct work_struct *work)
+{
+	struct memcg_cache_params *params;
+	struct mem_cgroup *memcg;
+	struct kmem_cache *s;
+	char *name;
+
+	params = container_of(work, struct memcg_cache_params, destroy);
+	s = container_of(params, struct kmem_cache, memcg_params);
+	memcg = params->memcg;
+	name = params->name;
+
+	mutex_lock(&memcg_cache_mutex);
+	if (atomic_read(&params->nr_pages)) {
+		/*
+		 * An allocation raced with the removal of the cgroup.
+		 * The free of its last page schedules us again.
+		 */
+		clear_bit(MEMCG_CACHE_DESTROY, &params->state);
+		smp_mb__after_clear_bit();
+		if (!atomic_read(&params->nr_pages))
+			memcg_schedule_cache_destroy(s);
+		mutex_unlock(&memcg_cache_mutex);
+		return;
+	}
+	list_del(&params->sibling);
+	mutex_unlock(&memcg_cache_mutex);
+
+	kmem_cache_destroy(s);
+	kfree(name);
+	mem_cgroup_put(memcg);
+}
+
+int __memcg_charge_slab(struct kmem_cache *s, gfp_t gfp, int order)
+{
+	int ret;
+
+	ret = memcg_charge_kmem(s->memcg_params.memcg, gfp, PAGE_SIZE << order);
+	if (!ret)
+		atomic_add(1 << order, &s->memcg_params.nr_pages);
+	return ret;
+}
+
+void __memcg_uncharge_slab(struct kmem_cache *s, int order)
+{
+	memcg_uncharge_kmem(s->memcg_params.memcg, PAGE_SIZE << order);
+	if (atomic_sub_and_test(1 << order, &s->memcg_params.nr_pages) &&
+	    test_bit(MEMCG_CACHE_DEAD, &s->memcg_params.state))
+		memcg_schedule_cache_destroy(s);
+}
+
+static void memcg_create_cache(struct mem_cgroup *memcg,
+			       struct kmem_cache *root)
+{
+	struct memcg_cache_params *params = &root->memcg_params;
+	struct kmem_cache *s;
+	char *name;
+
+	name = kasprintf(GFP_KERNEL, "%s(%d)", root->name,
+			 css_id(&memcg->css));
+	if (!name)
+		return;
+	s = kmem_cache_create_memcg(memcg, name, params->size, params->align,
+				    params->flags & ~SLAB_PANIC, params->ctor,
+				    root);
+	if (!s) {
+		kfree(name);
+		return;
+	}
+	s->memcg_params.name = name;
+	/* Dropped when the copy is destroyed */
+	mem_cgroup_get(memcg);
+	list_add(&s->memcg_params.sibling, &params->children);
+	/* Pairs with the lockless lookup in __memcg_kmem_get_cache() */
+	smp_wmb();
+	memcg->slab_caches[params->id] = s;
+}
+
+struct create_work {
+	struct mem_cgroup *memcg;
+	struct kmem_cache *cachep;
+	struct work_struct work;
+};
+
+static void memcg_create_cache_work_func(struct work_struct *work)
+{
+	struct create_work *cw = container_of(work, struct create_work, work);
+	struct mem_cgroup *memcg = cw->memcg;
+	struct kmem_cache *root = cw->cachep;
+	int id = root->memcg_params.id;
+
+	mutex_lock(&memcg_cache_mutex);
+	/* mem_cgroup_destroy() cleans up the copies under the mutex */
+	if (!css_is_removed(&memcg->css) && !memcg->slab_caches[id])
+		memcg_create_cache(memcg, root);
+	clear_bit(id, memcg->slab_caches_pending);
+	mutex_unlock(&memcg_cache_mutex);
+
+	css_put(&memcg->css);
+	kfree(cw);
+}
+
+/*
+ * Called with rcu_read_lock() held and a reference on @memcg, which
+ * the work item drops.
+ */
+static void memcg_create_cache_enqueue(struct mem_cgroup *memcg,
+				       struct kmem_cache *root)
+{
+	struct create_work *cw;
+
+	cw = kmalloc(sizeof(*cw), GFP_NOWAIT | __GFP_NOWARN);
+	if (!cw) {
+		clear_bit(root->memcg_params.id, memcg->slab_caches_pending);
+		css_put(&memcg->css);
+		return;
+	}
+	cw->memcg = memcg;
+	cw->cachep = root;
+	INIT_WORK(&cw->work, memcg_create_cache_work_func);
+	queue_work(memcg_cache_wq, &cw->work);
+}
+
+struct kmem_cache *__memcg_kmem_get_cache(struct kmem_cache *s)
+{
+	struct mem_cgroup *memcg;
+	struct kmem_cache *cachep;
+	int id;
+
+	VM_BUG_ON(!is_root_cache(s));
+	id = s->memcg_params.id;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(rcu_dereference(current->mm->owner));
+	if (!mem_cgroup_kmem_active(memcg))
+		goto out;
+
+	cachep = memcg->slab_caches[id];
+	if (likely(cachep)) {
+		smp_read_barrier_depends();
+		/*
+		 * The copy is only destroyed after the cgroup is removed,
+		 * which waits for css references.  Pin the cgroup until
+		 * the allocation is done; __memcg_kmem_put_cache() drops it.
+		 */
+		if (unlikely(!css_tryget(&memcg->css)))
+			goto out;
+		rcu_read_unlock();
+		return cachep;
+	}
+
+	/*
+	 * The copy does not exist yet.  Creating it may sleep, so it is
+	 * done asynchronously and this allocation is served, and left
+	 * unaccounted, by the root cache.
+	 */
+	if (!test_and_set_bit(id, memcg->slab_caches_pending)) {
+		if (css_tryget(&memcg->css))
+			memcg_create_cache_enqueue(memcg, s);
+		else
+			clear_bit(id, memcg->slab_caches_pending);
+	}
+out:
+	rcu_read_unlock();
+	return s;
+}
 
-		/* If killed, bypass charge */
-		if (fatal_signal_pending(current)) {
-			css_put(&mem->css);
-			goto bypass;
-		}
+void __memcg_kmem_put_cache(struct kmem_cache *s)
+{
+	css_put(&s->memcg_params.memcg->css);
+}
 
-		oom_check = false;
-		if (oom && !nr_oom_retries) {
-			oom_check = true;
-			nr_oom_retries = MEM_CGROUP_RECLAIM_RETRIES;
-		}
+/*
+ * The root cache @s is going away, and with it all of its copies.  There
+ * must not be any objects left in any of them.
+ */
+void memcg_unregister_cache(struct kmem_cache *s)
+{
+	struct memcg_cache_params *params, *tmp;
+	int id = s->memcg_params.id;
+	LIST_HEAD(copies);
 
-		ret = mem_cgroup_do_charge(mem, gfp_mask, batch, oom_check);
-		switch (ret) {
-		case CHARGE_OK:
-			break;
-		case CHARGE_RETRY: /* not in OOM situation but retry */
-			batch = nr_pages;
-			css_put(&mem->css);
-			mem = NULL;
-			goto again;
-		case CHARGE_WOULDBLOCK: /* !__GFP_WAIT */
-			css_put(&mem->css);
-			goto nomem;
-		case CHARGE_NOMEM: /* OOM routine works */
-			if (!oom) {
-				css_put(&mem->css);
-				goto nomem;
-			}
-			/* If oom, we never return -ENOMEM */
-			nr_oom_retries--;
-			break;
-		case CHARGE_OOM_DIE: /* Killed by OOM Killer */
-			css_put(&mem->css);
-			goto bypass;
-		}
-	} while (ret != CHARGE_OK);
+	if (!is_root_cache(s) || !(s->flags & SLAB_ACCOUNT))
+		return;
 
-	if (batch > nr_pages)
-		refill_stock(mem, batch - nr_pages);
-	css_put(&mem->css);
-done:
-	*memcg = mem;
-	return 0;
-nomem:
-	*memcg = NULL;
-	return -ENOMEM;
-bypass:
-	*memcg = NULL;
-	return 0;
+	if (memcg_cache_wq)
+		flush_workqueue(memcg_cache_wq);
+
+	mutex_lock(&memcg_cache_mutex);
+	list_for_each_entry_safe(params, tmp, &s->memcg_params.children,
+				 sibling) {
+		/* Keep the copy from being scheduled for destruction */
+		set_bit(MEMCG_CACHE_DESTROY, &params->state);
+		if (params->memcg->slab_caches[id] ==
+		    container_of(params, struct kmem_cache, memcg_params))
+			params->memcg->slab_caches[id] = NULL;
+		list_move(&params->sibling, &copies);
+	}
+	mutex_unlock(&memcg_cache_mutex);
+
+	/* Let destructions that were already scheduled finish */
+	if (memcg_cache_wq)
+		flush_workqueue(memcg_cache_wq);
+
+	list_for_each_entry_safe(params, tmp, &copies, sibling) {
+		struct mem_cgroup *memcg = params->memcg;
+		char *name = params->name;
+
+		list_del(&params->sibling);
+		kmem_cache_destroy(container_of(params, struct kmem_cache,
+						memcg_params));
+		kfree(name);
+		mem_cgroup_put(memcg);
+	}
+
+	ida_simple_remove(&memcg_cache_ida, id);
 }
 
 /*
- * Somemtimes we have to undo a charge we got by try_charge().
- * This function is for that and do uncharge, put css's refcnt.
- * gotten by try_charge().
+ * The cgroup is being removed.  Its slab copies get no new allocations
+ * and are destroyed once empty; the cgroup itself is released once its
+ * kmem usage drops to zero.
  */
-static void __mem_cgroup_cancel_charge(struct mem_cgroup *mem,
-				       unsigned int nr_pages)
+static void memcg_destroy_kmem(struct mem_cgroup *memcg)
 {
-	if (!mem_cgroup_is_root(mem)) {
-		unsigned long bytes = nr_pages * PAGE_SIZE;
+	struct kmem_cache *s;
+	int i;
 
-		res_counter_uncharge(&mem->res, bytes);
-		if (do_swap_account)
-			res_counter_uncharge(&mem->memsw, bytes);
+	if (!mem_cgroup_kmem_active(memcg))
+		return;
+
+	mutex_lock(&memcg_cache_mutex);
+	for (i = 0; i < MEMCG_CACHES_MAX; i++) {
+		s = memcg->slab_caches[i];
+		if (!s)
+			continue;
+		memcg->slab_caches[i] = NULL;
+		set_bit(MEMCG_CACHE_DEAD, &s->memcg_params.state);
+		smp_mb();
+		kmem_cache_shrink_dead(s);
+		if (!atomic_read(&s->memcg_params.nr_pages))
+			memcg_schedule_cache_destroy(s);
 	}
+	mutex_unlock(&memcg_cache_mutex);
+
+	set_bit(KMEM_ACCOUNTED_DEAD, &memcg->kmem_account_flags);
+	smp_mb();
+	if (!memcg_kmem_usage(memcg) &&
+	    test_and_clear_bit(KMEM_ACCOUNTED_DEAD, &memcg->kmem_account_flags))
+		memcg_kmem_release(memcg);
+}
+
+static int __init memcg_kmem_init(void)
+{
+	memcg_cache_wq = alloc_workqueue("memcg_cache", 0, 0);
+	BUG_ON(!memcg_cache_wq);
+	return 0;
+}
+subsys_initcall(memcg_kmem_init);
+#else
+static void memcg_init_kmem(struct mem_cgroup *memcg,
+			    struct mem_cgroup *parent)
+{
+}
+
+static int memcg_update_kmem_limit(struct mem_cgroup *memcg, u64 val)
+{
+	return -EINVAL;
 }
 
+static u64 memcg_kmem_usage(struct mem_cgroup *memcg)
+{
+	return 0;
+}
+
+static void memcg_destroy_kmem(struct mem_cgroup *memcg)
+{
+}
+#endif /* CONFIG_CGROUP_MEM_RES_CTLR_KMEM */
+
 /*
  * A helper function to get mem_cgroup from ID. must be called under
  * rcu_read_lock(). The caller must check css_is_removed() or some if
@@ -2440,7 +2639,7 @@ struct mem_cgroup *try_get_mem_cgroup_from_page(struct page *page)
 	pc = lookup_page_cgroup(page);
 	lock_page_cgroup(pc);
 	if (PageCgroupUsed(pc)) {
-		mem = pc->mem_cgroup;
+		mem = page_cgroup_memcg(pc);
 		if (mem && !css_tryget(&mem->css))
 			mem = NULL;
 	} else if (PageSwapCache(page)) {
@@ -2472,7 +2671,7 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *mem,
 	 * we don't need page_cgroup_lock about tail pages, becase they are not
 	 * accessed by any other context at this point.
 	 */
-	pc->mem_cgroup = mem;
+	set_page_cgroup_memcg(pc, mem);
 	/*
 	 * We access a page_cgroup asynchronously without lock_page_cgroup().
 	 * Especially when a page_cgroup is taken from a page, pc->mem_cgroup
@@ -2499,8 +2698,6 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *mem,
 	unlock_page_cgroup(pc);
 	/*
 	 * "charge_statistics" updated event counter. Then, check it.
-	 * Insert ancestor (and ancestor's ancestors), to softlimit RB-tree.
-	 * if they exceeds softlimit.
 	 */
 	memcg_check_events(mem, page);
 }
@@ -2508,7 +2705,7 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *mem,
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 
 #define PCGF_NOCOPY_AT_SPLIT ((1 << PCG_LOCK) | (1 << PCG_MOVE_LOCK) |\
-			(1 << PCG_ACCT_LRU) | (1 << PCG_MIGRATION))
+			(1 << PCG_MIGRATION))
 /*
  * Because tail pages are not marked as "used", set it. We're under
  * zone->lru_lock, 'splitting on pmd' and compund_lock.
@@ -2527,9 +2724,7 @@ void mem_cgroup_split_huge_fixup(struct page *head, struct page *tail)
 	 */
 	move_lock_page_cgroup(head_pc, &flags);
 
-	tail_pc->mem_cgroup = head_pc->mem_cgroup;
-	smp_wmb(); /* see __commit_charge() */
-	if (PageCgroupAcctLRU(head_pc)) {
+	if (PageLRU(head)) {
 		enum lru_list lru;
 		struct mem_cgroup_per_zone *mz;
 
@@ -2539,9 +2734,10 @@ void mem_cgroup_split_huge_fixup(struct page *head, struct page *tail)
 		 * We hold lru_lock, then, reduce counter directly.
 		 */
 		lru = page_lru(head);
-		mz = page_cgroup_zoneinfo(head_pc->mem_cgroup, head);
+		mz = page_cgroup_zoneinfo(page_cgroup_memcg(head_pc), head);
 		MEM_CGROUP_ZSTAT(mz, lru) -= 1;
 	}
+	/* The owner and the USED bit become visible with a single store */
 	tail_pc->flags = head_pc->flags & ~PCGF_NOCOPY_AT_SPLIT;
 	move_unlock_page_cgroup(head_pc, &flags);
 }
@@ -2590,7 +2786,7 @@ static int mem_cgroup_move_account(struct page *page,
 	lock_page_cgroup(pc);
 
 	ret = -EINVAL;
-	if (!PageCgroupUsed(pc) || pc->mem_cgroup != from)
+	if (!PageCgroupUsed(pc) || page_cgroup_memcg(pc) != from)
 		goto unlock;
 
 	move_lock_page_cgroup(pc, &flags);
@@ -2608,7 +2804,7 @@ static int mem_cgroup_move_account(struct page *page,
 		__mem_cgroup_cancel_charge(from, nr_pages);
 
 	/* caller should have done css_get */
-	pc->mem_cgroup = to;
+	set_page_cgroup_memcg(pc, to);
 	mem_cgroup_charge_statistics(to, PageCgroupCache(pc), nr_pages);
 	/*
 	 * We charges against "to" which may not have any tasks. Then, "to"
@@ -2745,15 +2941,27 @@ __mem_cgroup_commit_charge_lrucare(struct page *page, struct mem_cgroup *mem,
 					enum charge_type ctype)
 {
 	struct page_cgroup *pc = lookup_page_cgroup(page);
+	struct zone *zone = page_zone(page);
+	unsigned long flags;
+	bool removed = false;
+
 	/*
 	 * In some case, SwapCache, FUSE(splice_buf->radixtree), the page
 	 * is already on LRU. It means the page may on some other page_cgroup's
 	 * LRU. Take care of it.
 	 */
-	mem_cgroup_lru_del_before_commit(page);
+	spin_lock_irqsave(&zone->lru_lock, flags);
+	if (PageLRU(page)) {
+		del_page_from_lru_list(zone, page, page_lru(page));
+		ClearPageLRU(page);
+		removed = true;
+	}
 	__mem_cgroup_commit_charge(mem, page, 1, pc, ctype);
-	mem_cgroup_lru_add_after_commit(page);
-	return;
+	if (removed) {
+		add_page_to_lru_list(zone, page, page_lru(page));
+		SetPageLRU(page);
+	}
+	spin_unlock_irqrestore(&zone->lru_lock, flags);
 }
 
 int mem_cgroup_cache_charge(struct page *page, struct mm_struct *mm,
@@ -2982,7 +3190,7 @@ __mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype)
 
 	lock_page_cgroup(pc);
 
-	mem = pc->mem_cgroup;
+	mem = page_cgroup_memcg(pc);
 
 	if (!PageCgroupUsed(pc))
 		goto unlock_out;
@@ -3232,7 +3440,7 @@ int mem_cgroup_prepare_migration(struct page *page,
 	pc = lookup_page_cgroup(page);
 	lock_page_cgroup(pc);
 	if (PageCgroupUsed(pc)) {
-		mem = pc->mem_cgroup;
+		mem = page_cgroup_memcg(pc);
 		css_get(&mem->css);
 		/*
 		 * At migrating an anonymous page, its mapcount goes down
@@ -3383,13 +3591,13 @@ void mem_cgroup_print_bad_page(struct page *page)
 		int ret = -1;
 		char *path;
 
-		printk(KERN_ALERT "pc:%p pc->flags:%lx pc->mem_cgroup:%p",
-		       pc, pc->flags, pc->mem_cgroup);
+		printk(KERN_ALERT "pc:%p pc->flags:%lx mem_cgroup:%p",
+		       pc, pc->flags & PCG_FLAGS_MASK, page_cgroup_memcg(pc));
 
 		path = kmalloc(PATH_MAX, GFP_KERNEL);
 		if (path) {
 			rcu_read_lock();
-			ret = cgroup_path(pc->mem_cgroup->css.cgroup,
+			ret = cgroup_path(page_cgroup_memcg(pc)->css.cgroup,
 							path, PATH_MAX);
 			rcu_read_unlock();
 		}
@@ -3457,9 +3665,8 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 		if (!ret)
 			break;
 
-		mem_cgroup_hierarchical_reclaim(memcg, NULL, GFP_KERNEL,
-						MEM_CGROUP_RECLAIM_SHRINK,
-						NULL);
+		mem_cgroup_reclaim(memcg, GFP_KERNEL,
+				   MEM_CGROUP_RECLAIM_SHRINK);
 		curusage = res_counter_read_u64(&memcg->res, RES_USAGE);
 		/* Usage is reduced ? */
   		if (curusage >= oldusage)
@@ -3517,10 +3724,9 @@ static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
 		if (!ret)
 			break;
 
-		mem_cgroup_hierarchical_reclaim(memcg, NULL, GFP_KERNEL,
-						MEM_CGROUP_RECLAIM_NOSWAP |
-						MEM_CGROUP_RECLAIM_SHRINK,
-						NULL);
+		mem_cgroup_reclaim(memcg, GFP_KERNEL,
+				   MEM_CGROUP_RECLAIM_NOSWAP |
+				   MEM_CGROUP_RECLAIM_SHRINK);
 		curusage = res_counter_read_u64(&memcg->memsw, RES_USAGE);
 		/* Usage is reduced ? */
 		if (curusage >= oldusage)
@@ -3533,98 +3739,47 @@ static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
 	return ret;
 }
 
-unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
-					    gfp_t gfp_mask,
-					    unsigned long *total_scanned)
+/*
+ * Global reclaim first goes after groups that are in excess of their
+ * soft limit; this tells it whether any group has one configured.
+ */
+bool mem_cgroup_soft_limit_active(void)
 {
-	unsigned long nr_reclaimed = 0;
-	struct mem_cgroup_per_zone *mz, *next_mz = NULL;
-	unsigned long reclaimed;
-	int loop = 0;
-	struct mem_cgroup_tree_per_zone *mctz;
-	unsigned long long excess;
-	unsigned long nr_scanned;
-
-	if (order > 0)
-		return 0;
+	return atomic_read(&nr_soft_limited) > 0;
+}
 
-	mctz = soft_limit_tree_node_zone(zone_to_nid(zone), zone_idx(zone));
-	/*
-	 * This loop can run a while, specially if mem_cgroup's continuously
-	 * keep exceeding their soft limit and putting the system under
-	 * pressure
-	 */
-	do {
-		if (next_mz)
-			mz = next_mz;
-		else
-			mz = mem_cgroup_largest_soft_limit_node(mctz);
-		if (!mz)
-			break;
+/**
+ * mem_cgroup_soft_reclaim_eligible - check for soft limit excess
+ * @mem: the memcg to check
+ *
+ * Returns true if @mem or any of its ancestors exceeds its soft
+ * limit, so that its pages should be reclaimed during the soft limit
+ * pass of global reclaim.
+ */
+bool mem_cgroup_soft_reclaim_eligible(struct mem_cgroup *mem)
+{
+	for (; mem; mem = parent_mem_cgroup(mem)) {
+		if (res_counter_soft_limit_excess(&mem->res))
+			return true;
+	}
+	return false;
+}
 
-		nr_scanned = 0;
-		reclaimed = mem_cgroup_hierarchical_reclaim(mz->mem, zone,
-						gfp_mask,
-						MEM_CGROUP_RECLAIM_SOFT,
-						&nr_scanned);
-		nr_reclaimed += reclaimed;
-		*total_scanned += nr_scanned;
-		spin_lock(&mctz->lock);
+static int mem_cgroup_set_soft_limit(struct mem_cgroup *mem,
+				     unsigned long long val)
+{
+	unsigned long long old;
+	int ret;
 
-		/*
-		 * If we failed to reclaim anything from this memory cgroup
-		 * it is time to move on to the next cgroup
-		 */
-		next_mz = NULL;
-		if (!reclaimed) {
-			do {
-				/*
-				 * Loop until we find yet another one.
-				 *
-				 * By the time we get the soft_limit lock
-				 * again, someone might have aded the
-				 * group back on the RB tree. Iterate to
-				 * make sure we get a different mem.
-				 * mem_cgroup_largest_soft_limit_node returns
-				 * NULL if no other cgroup is present on
-				 * the tree
-				 */
-				next_mz =
-				__mem_cgroup_largest_soft_limit_node(mctz);
-				if (next_mz == mz)
-					css_put(&next_mz->mem->css);
-				else /* next_mz == NULL or other memcg */
-					break;
-			} while (1);
-		}
-		__mem_cgroup_remove_exceeded(mz->mem, mz, mctz);
-		excess = res_counter_soft_limit_excess(&mz->mem->res);
-		/*
-		 * One school of thought says that we should not add
-		 * back the node to the tree if reclaim returns 0.
-		 * But our reclaim could return 0, simply because due
-		 * to priority we are exposing a smaller subset of
-		 * memory to reclaim from. Consider this as a longer
-		 * term TODO.
-		 */
-		/* If excess == 0, no tree ops */
-		__mem_cgroup_insert_exceeded(mz->mem, mz, mctz, excess);
-		spin_unlock(&mctz->lock);
-		css_put(&mz->mem->css);
-		loop++;
-		/*
-		 * Could not reclaim anything and there are no more
-		 * mem cgroups to try or we seem to be looping without
-		 * reclaiming anything.
-		 */
-		if (!nr_reclaimed &&
-			(next_mz == NULL ||
-			loop > MEM_CGROUP_MAX_SOFT_LIMIT_RECLAIM_LOOPS))
-			break;
-	} while (!nr_reclaimed);
-	if (next_mz)
-		css_put(&next_mz->mem->css);
-	return nr_reclaimed;
+	mutex_lock(&set_limit_mutex);
+	old = res_counter_read_u64(&mem->res, RES_SOFT_LIMIT);
+	ret = res_counter_set_soft_limit(&mem->res, val);
+	if (!ret && old == RESOURCE_MAX && val != RESOURCE_MAX)
+		atomic_inc(&nr_soft_limited);
+	else if (!ret && old != RESOURCE_MAX && val == RESOURCE_MAX)
+		atomic_dec(&nr_soft_limited);
+	mutex_unlock(&set_limit_mutex);
+	return ret;
 }
 
 /*
@@ -3634,22 +3789,23 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 static int mem_cgroup_force_empty_list(struct mem_cgroup *mem,
 				int node, int zid, enum lru_list lru)
 {
-	struct zone *zone;
 	struct mem_cgroup_per_zone *mz;
-	struct page_cgroup *pc, *busy;
 	unsigned long flags, loop;
 	struct list_head *list;
+	struct page *busy;
+	struct zone *zone;
 	int ret = 0;
 
 	zone = &NODE_DATA(node)->node_zones[zid];
 	mz = mem_cgroup_zoneinfo(mem, node, zid);
-	list = &mz->lists[lru];
+	list = &mz->lruvec.lists[lru];
 
 	loop = MEM_CGROUP_ZSTAT(mz, lru);
 	/* give some margin against EBUSY etc...*/
 	loop += 256;
 	busy = NULL;
 	while (loop--) {
+		struct page_cgroup *pc;
 		struct page *page;
 
 		ret = 0;
@@ -3658,16 +3814,28 @@ static int mem_cgroup_force_empty_list(struct mem_cgroup *mem,
 			spin_unlock_irqrestore(&zone->lru_lock, flags);
 			break;
 		}
-		pc = list_entry(list->prev, struct page_cgroup, lru);
-		if (busy == pc) {
-			list_move(&pc->lru, list);
+		page = list_entry(list->prev, struct page, lru);
+		if (busy == page) {
+			list_move(&page->lru, list);
 			busy = NULL;
 			spin_unlock_irqrestore(&zone->lru_lock, flags);
 			continue;
 		}
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		pc = lookup_page_cgroup(page);
+		/*
+		 * An uncharged page still sitting on this list: hand it
+		 * over to the root group, like mem_cgroup_lru_add_list()
+		 * would have done.
+		 */
+		if (!PageCgroupUsed(pc)) {
+			struct lruvec *lruvec;
 
-		page = lookup_cgroup_page(pc);
+			lruvec = mem_cgroup_lru_move_lists(zone, page, lru, lru);
+			list_move(&page->lru, &lruvec->lists[lru]);
+			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			continue;
+		}
+		spin_unlock_irqrestore(&zone->lru_lock, flags);
 
 		ret = mem_cgroup_move_parent(page, pc, mem, GFP_KERNEL);
 		if (ret == -ENOMEM)
@@ -3675,7 +3843,7 @@ static int mem_cgroup_force_empty_list(struct mem_cgroup *mem,
 
 		if (ret == -EBUSY || ret == -EINVAL) {
 			/* found lock contention or "pc" is obsolete. */
-			busy = pc;
+			busy = page;
 			cond_resched();
 		} else
 			busy = NULL;
@@ -3686,6 +3854,18 @@ static int mem_cgroup_force_empty_list(struct mem_cgroup *mem,
 	return ret;
 }
 
+/*
+ * The part of the usage that force_empty can move or reclaim: charged
+ * kernel memory stays with the cgroup until it is freed.
+ */
+static u64 mem_cgroup_user_usage(struct mem_cgroup *mem)
+{
+	u64 usage = res_counter_read_u64(&mem->res, RES_USAGE);
+	u64 kmem = memcg_kmem_usage(mem);
+
+	return usage > kmem ? usage - kmem : 0;
+}
+
 /*
  * make mem_cgroup's charge to be 0 if there is no task.
  * This enables deleting this mem_cgroup.
@@ -3736,7 +3916,7 @@ move_account:
 			goto try_to_free;
 		cond_resched();
 	/* "ret" should also be checked to ensure all lists are empty. */
-	} while (mem->res.usage > 0 || ret);
+	} while (mem_cgroup_user_usage(mem) > 0 || ret);
 out:
 	css_put(&mem->css);
 	return ret;
@@ -3751,7 +3931,7 @@ try_to_free:
 	lru_add_drain_all();
 	/* try to free all pages in this cgroup */
 	shrink = 1;
-	while (nr_retries && mem->res.usage > 0) {
+	while (nr_retries && mem_cgroup_user_usage(mem) > 0) {
 		int progress;
 
 		if (signal_pending(current)) {
@@ -3873,6 +4053,11 @@ static u64 mem_cgroup_read(struct cgroup *cont, struct cftype *cft)
 		else
 			val = res_counter_read_u64(&mem->memsw, name);
 		break;
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	case _KMEM:
+		val = res_counter_read_u64(&mem->kmem, name);
+		break;
+#endif
 	default:
 		BUG();
 		break;
@@ -3905,8 +4090,10 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 			break;
 		if (type == _MEM)
 			ret = mem_cgroup_resize_limit(memcg, val);
-		else
+		else if (type == _MEMSWAP)
 			ret = mem_cgroup_resize_memsw_limit(memcg, val);
+		else
+			ret = memcg_update_kmem_limit(memcg, val);
 		break;
 	case RES_SOFT_LIMIT:
 		ret = res_counter_memparse_write_strategy(buffer, &val);
@@ -3918,7 +4105,7 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 		 * control without swap
 		 */
 		if (type == _MEM)
-			ret = res_counter_set_soft_limit(&memcg->res, val);
+			ret = mem_cgroup_set_soft_limit(memcg, val);
 		else
 			ret = -EINVAL;
 		break;
@@ -3969,12 +4156,20 @@ static int mem_cgroup_reset(struct cgroup *cont, unsigned int event)
 	case RES_MAX_USAGE:
 		if (type == _MEM)
 			res_counter_reset_max(&mem->res);
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+		else if (type == _KMEM)
+			res_counter_reset_max(&mem->kmem);
+#endif
 		else
 			res_counter_reset_max(&mem->memsw);
 		break;
 	case RES_FAILCNT:
 		if (type == _MEM)
 			res_counter_reset_failcnt(&mem->res);
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+		else if (type == _KMEM)
+			res_counter_reset_failcnt(&mem->kmem);
+#endif
 		else
 			res_counter_reset_failcnt(&mem->memsw);
 		break;
@@ -4153,6 +4348,32 @@ static int mem_control_numa_stat_show(struct seq_file *m, void *arg)
 }
 #endif /* CONFIG_NUMA */
 
+#ifdef CONFIG_DEBUG_VM
+static int calc_inactive_ratio(struct mem_cgroup *memcg, unsigned long *present_pages)
+{
+	unsigned long active;
+	unsigned long inactive;
+	unsigned long gb;
+	unsigned long inactive_ratio;
+
+	inactive = mem_cgroup_nr_lru_pages(memcg, BIT(LRU_INACTIVE_ANON));
+	active = mem_cgroup_nr_lru_pages(memcg, BIT(LRU_ACTIVE_ANON));
+
+	gb = (inactive + active) >> (30 - PAGE_SHIFT);
+	if (gb)
+		inactive_ratio = int_sqrt(10 * gb);
+	else
+		inactive_ratio = 1;
+
+	if (present_pages) {
+		present_pages[0] = inactive;
+		present_pages[1] = active;
+	}
+
+	return inactive_ratio;
+}
+#endif
+
 static int mem_control_stat_show(struct cgroup *cont, struct cftype *cft,
 				 struct cgroup_map_cb *cb)
 {
@@ -4718,6 +4939,45 @@ static int register_memsw_files(struct cgroup *cont, struct cgroup_subsys *ss)
 }
 #endif
 
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+static struct cftype kmem_cgroup_files[] = {
+	{
+		.name = "kmem.usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_USAGE),
+		.read_u64 = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.max_usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_MAX_USAGE),
+		.trigger = mem_cgroup_reset,
+		.read_u64 = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.limit_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_LIMIT),
+		.write_string = mem_cgroup_write,
+		.read_u64 = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.failcnt",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_FAILCNT),
+		.trigger = mem_cgroup_reset,
+		.read_u64 = mem_cgroup_read,
+	},
+};
+
+static int register_kmem_files(struct cgroup *cont, struct cgroup_subsys *ss)
+{
+	return cgroup_add_files(cont, ss, kmem_cgroup_files,
+				ARRAY_SIZE(kmem_cgroup_files));
+}
+#else
+static int register_kmem_files(struct cgroup *cont, struct cgroup_subsys *ss)
+{
+	return 0;
+}
+#endif
+
 static int alloc_mem_cgroup_per_zone_info(struct mem_cgroup *mem, int node)
 {
 	struct mem_cgroup_per_node *pn;
@@ -4742,9 +5002,7 @@ static int alloc_mem_cgroup_per_zone_info(struct mem_cgroup *mem, int node)
 	for (zone = 0; zone < MAX_NR_ZONES; zone++) {
 		mz = &pn->zoneinfo[zone];
 		for_each_lru(l)
-			INIT_LIST_HEAD(&mz->lists[l]);
-		mz->usage_in_excess = 0;
-		mz->on_tree = false;
+			INIT_LIST_HEAD(&mz->lruvec.lists[l]);
 		mz->mem = mem;
 	}
 	return 0;
@@ -4755,15 +5013,26 @@ static void free_mem_cgroup_per_zone_info(struct mem_cgroup *mem, int node)
 	kfree(mem->info.nodeinfo[node]);
 }
 
+/*
+ * The PCG_* flags live in the low bits of the mem_cgroup pointer kept in
+ * struct page, so mem_cgroups must be aligned to MEM_CGROUP_ALIGN.  Big
+ * ones come from vmalloc and are page aligned anyway.
+ */
+static struct kmem_cache *mem_cgroup_cachep;
+
 static struct mem_cgroup *mem_cgroup_alloc(void)
 {
 	struct mem_cgroup *mem;
 	int size = sizeof(struct mem_cgroup);
 
 	/* Can be very big if MAX_NUMNODES is very big */
-	if (size < PAGE_SIZE)
-		mem = kzalloc(size, GFP_KERNEL);
-	else
+	if (size < PAGE_SIZE) {
+		/* The root cgroup is created first, during boot */
+		if (!mem_cgroup_cachep)
+			mem_cgroup_cachep = kmem_cache_create("mem_cgroup",
+					size, MEM_CGROUP_ALIGN, SLAB_PANIC, NULL);
+		mem = kmem_cache_zalloc(mem_cgroup_cachep, GFP_KERNEL);
+	} else
 		mem = vzalloc(size);
 
 	if (!mem)
@@ -4777,7 +5046,7 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 
 out_free:
 	if (size < PAGE_SIZE)
-		kfree(mem);
+		kmem_cache_free(mem_cgroup_cachep, mem);
 	else
 		vfree(mem);
 	return NULL;
@@ -4798,7 +5067,6 @@ static void __mem_cgroup_free(struct mem_cgroup *mem)
 {
 	int node;
 
-	mem_cgroup_remove_from_trees(mem);
 	free_css_id(&mem_cgroup_subsys, &mem->css);
 
 	for_each_node_state(node, N_POSSIBLE)
@@ -4806,7 +5074,7 @@ static void __mem_cgroup_free(struct mem_cgroup *mem)
 
 	free_percpu(mem->stat);
 	if (sizeof(struct mem_cgroup) < PAGE_SIZE)
-		kfree(mem);
+		kmem_cache_free(mem_cgroup_cachep, mem);
 	else
 		vfree(mem);
 }
@@ -4853,31 +5121,6 @@ static void __init enable_swap_cgroup(void)
 }
 #endif
 
-static int mem_cgroup_soft_limit_tree_init(void)
-{
-	struct mem_cgroup_tree_per_node *rtpn;
-	struct mem_cgroup_tree_per_zone *rtpz;
-	int tmp, node, zone;
-
-	for_each_node_state(node, N_POSSIBLE) {
-		tmp = node;
-		if (!node_state(node, N_NORMAL_MEMORY))
-			tmp = -1;
-		rtpn = kzalloc_node(sizeof(*rtpn), GFP_KERNEL, tmp);
-		if (!rtpn)
-			return 1;
-
-		soft_limit_tree.rb_tree_per_node[node] = rtpn;
-
-		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
-			rtpz = &rtpn->rb_tree_per_zone[zone];
-			rtpz->rb_root = RB_ROOT;
-			spin_lock_init(&rtpz->lock);
-		}
-	}
-	return 0;
-}
-
 static struct cgroup_subsys_state * __ref
 mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 {
@@ -4899,8 +5142,6 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 		enable_swap_cgroup();
 		parent = NULL;
 		root_mem_cgroup = mem;
-		if (mem_cgroup_soft_limit_tree_init())
-			goto free_out;
 		for_each_possible_cpu(cpu) {
 			struct memcg_stock_pcp *stock =
 						&per_cpu(memcg_stock, cpu);
@@ -4927,7 +5168,6 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 		res_counter_init(&mem->res, NULL);
 		res_counter_init(&mem->memsw, NULL);
 	}
-	mem->last_scanned_child = 0;
 	mem->last_scanned_node = MAX_NUMNODES;
 	INIT_LIST_HEAD(&mem->oom_notify);
 
@@ -4936,6 +5176,7 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	atomic_set(&mem->refcnt, 1);
 	mem->move_charge_at_immigrate = 0;
 	mutex_init(&mem->thresholds_lock);
+	memcg_init_kmem(mem, parent);
 	return &mem->css;
 free_out:
 	__mem_cgroup_free(mem);
@@ -4956,6 +5197,12 @@ static void mem_cgroup_destroy(struct cgroup_subsys *ss,
 {
 	struct mem_cgroup *mem = mem_cgroup_from_cont(cont);
 
+	/*
+	 * Clearing the soft limit drops the group from nr_soft_limited,
+	 * so a removed group cannot keep soft limit reclaim active.
+	 */
+	mem_cgroup_set_soft_limit(mem, RESOURCE_MAX);
+	memcg_destroy_kmem(mem);
 	mem_cgroup_put(mem);
 }
 
@@ -4969,6 +5216,8 @@ static int mem_cgroup_populate(struct cgroup_subsys *ss,
 
 	if (!ret)
 		ret = register_memsw_files(cont, ss);
+	if (!ret)
+		ret = register_kmem_files(cont, ss);
 	return ret;
 }
 
@@ -5116,17 +5365,20 @@ static struct page *mc_handle_file_pte(struct vm_area_struct *vma,
 		pgoff = pte_to_pgoff(ptent);
 
 	/* page is moved even if it's not RSS of this task(page-faulted). */
-	page = find_get_page(mapping, pgoff);
+	page = find_get_entry(mapping, pgoff);
 
-#ifdef CONFIG_SWAP
-	/* shmem/tmpfs may report page out on swap: account for that too. */
 	if (radix_tree_exceptional_entry(page)) {
-		swp_entry_t swap = radix_to_swp_entry(page);
-		if (do_swap_account)
-			*entry = swap;
-		page = find_get_page(&swapper_space, swap.val);
-	}
+#ifdef CONFIG_SWAP
+		/* shmem/tmpfs may report page out on swap: account for that too. */
+		if (shmem_mapping(mapping)) {
+			swp_entry_t swap = radix_to_swp_entry(page);
+			if (do_swap_account)
+				*entry = swap;
+			page = find_get_page(&swapper_space, swap.val);
+		} else
 #endif
+			page = NULL;	/* shadow entry of an evicted page */
+	}
 	return page;
 }
 
@@ -5154,7 +5406,7 @@ static int is_target_pte_for_mc(struct vm_area_struct *vma,
 		 * mem_cgroup_move_account() checks the pc is valid or not under
 		 * the lock.
 		 */
-		if (PageCgroupUsed(pc) && pc->mem_cgroup == mc.from) {
+		if (PageCgroupUsed(pc) && page_cgroup_memcg(pc) == mc.from) {
 			ret = MC_TARGET_PAGE;
 			if (target)
 				target->page = page;
@@ -5180,7 +5432,7 @@ static int mem_cgroup_count_precharge_pte_range(pmd_t *pmd,
 	pte_t *pte;
 	spinlock_t *ptl;
 
-	split_huge_page_pmd(walk->mm, pmd);
+	split_huge_page_pmd(vma, addr, pmd);
 
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE)
@@ -5341,7 +5593,7 @@ static int mem_cgroup_move_charge_pte_range(pmd_t *pmd,
 	pte_t *pte;
 	spinlock_t *ptl;
 
-	split_huge_page_pmd(walk->mm, pmd);
+	split_huge_page_pmd(vma, addr, pmd);
 retry:
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; addr += PAGE_SIZE) {
@@ -53,10 +53,12 @@
 #include <linux/writeback.h>
 #include <linux/memcontrol.h>
 #include <linux/mmu_notifier.h>
+#include <linux/migrate.h>
 #include <linux/kallsyms.h>
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/log2.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -736,20 +738,6 @@ static inline int is_cow_mapping(vm_flags_t flags)
 	return (flags & (VM_SHARED | VM_MAYWRITE)) == VM_MAYWRITE;
 }
 
-#ifndef is_zero_pfn
-static inline int is_zero_pfn(unsigned long pfn)
-{
-	return pfn == zero_pfn;
-}
-#endif
-
-#ifndef my_zero_pfn
-static inline unsigned long my_zero_pfn(unsigned long addr)
-{
-	return zero_pfn;
-}
-#endif
-
 /*
  * vm_normal_page -- This function gets the "struct page" associated with a pte.
  *
@@ -1230,7 +1218,7 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		if (pmd_trans_huge(*pmd)) {
 			if (next-addr != HPAGE_PMD_SIZE) {
 				VM_BUG_ON(!rwsem_is_locked(&tlb->mm->mmap_sem));
-				split_huge_page_pmd(vma->vm_mm, pmd);
+				split_huge_page_pmd(vma, addr, pmd);
 			} else if (zap_huge_pmd(tlb, vma, pmd))
 				continue;
 			/* fall through */
@@ -1464,7 +1452,7 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 	}
 	if (pmd_trans_huge(*pmd)) {
 		if (flags & FOLL_SPLIT) {
-			split_huge_page_pmd(mm, pmd);
+			split_huge_page_pmd(vma, address, pmd);
 			goto split_fallthrough;
 		}
 		spin_lock(&mm->page_table_lock);
@@ -2878,11 +2866,15 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		goto out;
 	}
 	delayacct_set_flag(DELAYACCT_PF_SWAPIN);
-	page = lookup_swap_cache(entry);
+	page = lookup_swap_cache(entry, vma, address);
 	if (!page) {
 		grab_swap_token(mm); /* Contend for token _before_ read-in */
-		page = swapin_readahead(entry,
-					GFP_HIGHUSER_MOVABLE, vma, address);
+		if (swap_use_vma_readahead())
+			page = swap_vma_readahead(entry, GFP_HIGHUSER_MOVABLE,
+						  vma, address, pmd);
+		else
+			page = swapin_readahead(entry, GFP_HIGHUSER_MOVABLE,
+						vma, address);
 		if (!page) {
 			/*
 			 * Back out if somebody else faulted in this pte
@@ -3129,6 +3121,94 @@ oom:
 	return VM_FAULT_OOM;
 }
 
+/**
+ * do_set_pte - map a page cache page read-only at @address
+ * @vma: the vma the page is mapped into
+ * @address: user virtual address to map @page at
+ * @page: an uptodate page cache page, locked, with a reference that the
+ *        new pte takes over
+ * @pte: the (none) pte for @address, mapped and locked
+ *
+ * Used by ->map_pages() implementations to install the pages they find.
+ */
+void do_set_pte(struct vm_area_struct *vma, unsigned long address,
+		struct page *page, pte_t *pte)
+{
+	pte_t entry;
+
+	flush_icache_page(vma, page);
+	entry = mk_pte(page, vma->vm_page_prot);
+	inc_mm_counter_fast(vma->vm_mm, MM_FILEPAGES);
+	page_add_file_rmap(page);
+	set_pte_at(vma->vm_mm, address, pte, entry);
+
+	/* no need to invalidate: a not-present page won't be cached */
+	update_mmu_cache(vma, address, pte);
+}
+
+/*
+ * Amount of address space around a read fault on a file mapping that
+ * ->map_pages() tries to populate from the page cache.  Rounded down to
+ * a power of two and capped at one page table; one page disables it.
+ */
+unsigned long sysctl_fault_around_bytes __read_mostly = 65536;
+
+static inline unsigned long fault_around_pages(void)
+{
+	unsigned long bytes = ACCESS_ONCE(sysctl_fault_around_bytes);
+
+	return min_t(unsigned long, rounddown_pow_of_two(bytes) >> PAGE_SHIFT,
+		     PTRS_PER_PTE);
+}
+
+/*
+ * Map the cached pages in the naturally aligned window of @nr_pages
+ * pages around @address, clipped to the vma and to the page table that
+ * @pte lives in.  Called with the page table lock held.
+ */
+static void do_fault_around(struct vm_area_struct *vma, unsigned long address,
+		pte_t *pte, pgoff_t pgoff, unsigned int flags,
+		unsigned long nr_pages)
+{
+	unsigned long start_addr;
+	pgoff_t max_pgoff;
+	struct vm_fault vmf;
+	int off;
+
+	start_addr = max(address & ~((nr_pages << PAGE_SHIFT) - 1),
+			 vma->vm_start);
+	off = ((address - start_addr) >> PAGE_SHIFT) & (PTRS_PER_PTE - 1);
+	pte -= off;
+	pgoff -= off;
+
+	/*
+	 * max_pgoff is either the end of the page table, the end of the
+	 * vma or nr_pages from pgoff, whichever is nearest.
+	 */
+	max_pgoff = pgoff - ((start_addr >> PAGE_SHIFT) & (PTRS_PER_PTE - 1)) +
+		PTRS_PER_PTE - 1;
+	max_pgoff = min3(max_pgoff, vma_pages(vma) + vma->vm_pgoff - 1,
+			 pgoff + nr_pages - 1);
+
+	/* Skip over what is already mapped; nothing to do if that is all */
+	while (!pte_none(*pte)) {
+		if (++pgoff > max_pgoff)
+			return;
+		start_addr += PAGE_SIZE;
+		if (start_addr >= vma->vm_end)
+			return;
+		pte++;
+	}
+
+	vmf.virtual_address = (void __user *) start_addr;
+	vmf.pte = pte;
+	vmf.pgoff = pgoff;
+	vmf.max_pgoff = max_pgoff;
+	vmf.flags = flags;
+	vmf.page = NULL;
+	vma->vm_ops->map_pages(vma, &vmf);
+}
+
 /*
  * __do_fault() tries to create a new page mapping. It aggressively
  * tries to share with existing pages, but makes a separate copy if
@@ -3156,6 +3236,23 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	struct vm_fault vmf;
 	int ret;
 	int page_mkwrite = 0;
+	unsigned long nr_pages = fault_around_pages();
+
+	/*
+	 * On a read fault, first map whatever is already cached around
+	 * the faulting address: that is cheap, and likely to satisfy this
+	 * fault as well as save us the next few.
+	 */
+	if (!(flags & (FAULT_FLAG_WRITE | FAULT_FLAG_NONLINEAR)) &&
+	    vma->vm_ops->map_pages && nr_pages > 1) {
+		page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
+		do_fault_around(vma, address, page_table, pgoff, flags,
+				nr_pages);
+		ret = !pte_same(*page_table, orig_pte);
+		pte_unmap_unlock(page_table, ptl);
+		if (ret)
+			return 0;
+	}
 
 	/*
 	 * If we do COW later, allocate page befor taking lock_page()
@@ -3370,6 +3467,85 @@ static int do_nonlinear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * NUMA hinting faults are taken on PROT_NONE ptes in vmas whose own
+ * protection is not PROT_NONE, see change_prot_numa().  Genuine PROT_NONE
+ * vmas never get this far, as the arch fault code rejects accesses that
+ * the vma does not allow.
+ */
+static inline int pte_numa(struct vm_area_struct *vma, pte_t pte)
+{
+	if (pte_same(pte, pte_modify(pte, vma->vm_page_prot)))
+		return 0;
+
+	return pte_same(pte, pte_modify(pte, vma_prot_none(vma)));
+}
+
+static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			unsigned long address, pte_t *ptep, pmd_t *pmd,
+			pte_t entry)
+{
+	struct page *page;
+	spinlock_t *ptl;
+	int current_nid = -1;
+	int target_nid;
+	int migrated = 0;
+
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (unlikely(!pte_same(*ptep, entry))) {
+		pte_unmap_unlock(ptep, ptl);
+		return 0;
+	}
+
+	/* Make the page accessible again before anything else */
+	entry = pte_mkyoung(pte_modify(entry, vma->vm_page_prot));
+	set_pte_at(mm, address, ptep, entry);
+	update_mmu_cache(vma, address, ptep);
+
+	page = vm_normal_page(vma, address, entry);
+	if (!page) {
+		pte_unmap_unlock(ptep, ptl);
+		return 0;
+	}
+
+	get_page(page);
+	current_nid = page_to_nid(page);
+	count_vm_event(NUMA_HINT_FAULTS);
+	if (current_nid == numa_node_id())
+		count_vm_event(NUMA_HINT_FAULTS_LOCAL);
+	target_nid = mpol_misplaced(page, vma, address);
+	pte_unmap_unlock(ptep, ptl);
+
+	if (target_nid == -1) {
+		put_page(page);
+		goto out;
+	}
+
+	/* migrate_misplaced_page() drops our page reference */
+	migrated = migrate_misplaced_page(page, target_nid);
+	if (migrated)
+		current_nid = target_nid;
+out:
+	task_numa_fault(current_nid, 1, migrated);
+	return 0;
+}
+#else
+static inline int pte_numa(struct vm_area_struct *vma, pte_t pte)
+{
+	return 0;
+}
+
+static inline int do_numa_page(struct mm_struct *mm,
+			struct vm_area_struct *vma, unsigned long address,
+			pte_t *ptep, pmd_t *pmd, pte_t entry)
+{
+	BUG();
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /*
  * These routines also need to handle stuff like marking pages dirty
  * and/or accessed for architectures that don't do it in hardware (most
@@ -3408,6 +3584,9 @@ int handle_pte_fault(struct mm_struct *mm,
 					pte, pmd, flags, entry);
 	}
 
+	if (pte_numa(vma, entry))
+		return do_numa_page(mm, vma, address, pte, pmd, entry);
+
 	ptl = pte_lockptr(mm, pmd);
 	spin_lock(ptl);
 	if (unlikely(!pte_same(*pte, entry)))
@@ -3503,6 +3682,181 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative page faults: resolve the first touch of private anonymous
+ * memory without mmap_sem, so that threads faulting in fresh memory do
+ * not queue up behind another thread's mmap(), munmap() or mprotect().
+ *
+ * The vma is looked up under mm->mm_rb_lock and pinned by get_vma(),
+ * and the fault is handled against a copy of it taken inside a read
+ * section of vma->vm_sequence.  Everything that changes a vma under
+ * mmap_sem raises its sequence count first, and takes the page table
+ * lock of any pte it then changes; so if the count is unchanged once we
+ * hold the page table lock, the copy still describes the vma and it
+ * cannot change under us until the lock is dropped.  Detached vmas keep
+ * an odd count until they are freed.
+ *
+ * Page tables are only freed after a TLB flush, which has to wait for
+ * us while interrupts are disabled, so the page table walk and the
+ * final checks are done with interrupts off, as in get_user_pages_fast.
+ * For the same reason the page table lock can only be trylocked there:
+ * its holder may be waiting for us to acknowledge a TLB flush.
+ *
+ * Whatever is not the plain case returns VM_FAULT_RETRY, and the caller
+ * then falls back to handle_mm_fault() under mmap_sem.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma, vmf_vma;
+	struct page *page = NULL;
+	unsigned int seq;
+	spinlock_t *ptl;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, pmdval;
+	pte_t *pte, entry;
+
+	/* do counter updates before entering really critical section. */
+	check_sync_rss_stat(current);
+
+	vma = get_vma(mm, address);
+	if (!vma)
+		return VM_FAULT_RETRY;
+
+	/* Odd: being changed, or detached for good - don't wait */
+	seq = ACCESS_ONCE(vma->vm_sequence.sequence);
+	if (seq & 1)
+		goto out_put;
+	smp_rmb();
+	vmf_vma = *vma;
+	if (read_seqcount_retry(&vma->vm_sequence, seq))
+		goto out_put;
+
+	if (vmf_vma.vm_ops || vmf_vma.vm_file)
+		goto out_put;
+	if (vmf_vma.vm_flags & (VM_SHARED | VM_LOCKED | VM_SPECIAL))
+		goto out_put;
+	if (address < vmf_vma.vm_start || address >= vmf_vma.vm_end)
+		goto out_put;
+	/* Stack guard pages may need to expand the stack */
+	if ((vmf_vma.vm_flags & VM_GROWSDOWN) &&
+	    (address & PAGE_MASK) == vmf_vma.vm_start)
+		goto out_put;
+	if ((vmf_vma.vm_flags & VM_GROWSUP) &&
+	    (address & PAGE_MASK) + PAGE_SIZE == vmf_vma.vm_end)
+		goto out_put;
+#ifdef CONFIG_NUMA
+	/* A vma policy could be freed under us */
+	if (vmf_vma.vm_policy)
+		goto out_put;
+#endif
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vmf_vma.vm_flags & VM_WRITE))
+			goto out_put;
+		/* anon_vma_prepare() needs mmap_sem */
+		if (!vmf_vma.anon_vma)
+			goto out_put;
+	} else if (!(vmf_vma.vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		goto out_put;
+
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out_walk;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto out_walk;
+	pmd = pmd_offset(pud, address);
+	/*
+	 * Empty pmds need a page table allocated, or may become huge;
+	 * leave both to handle_mm_fault().
+	 */
+	pmdval = ACCESS_ONCE(*pmd);
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval) ||
+	    unlikely(pmd_bad(pmdval)))
+		goto out_walk;
+	pte = pte_offset_map(&pmdval, address);
+	entry = *pte;
+	pte_unmap(pte);
+	local_irq_enable();
+
+	if (!pte_none(entry))
+		goto out_put;
+
+	if (!(flags & FAULT_FLAG_WRITE)) {
+		/* Use the zero-page for reads */
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+						vmf_vma.vm_page_prot));
+	} else {
+		page = alloc_zeroed_user_highpage_movable(&vmf_vma, address);
+		if (!page)
+			goto out_put;
+		__SetPageUptodate(page);
+
+		if (mem_cgroup_newpage_charge(page, mm, GFP_KERNEL)) {
+			page_cache_release(page);
+			goto out_put;
+		}
+
+		entry = mk_pte(page, vmf_vma.vm_page_prot);
+		entry = pte_mkwrite(pte_mkdirty(entry));
+	}
+
+	local_irq_disable();
+	if (read_seqcount_retry(&vma->vm_sequence, seq) ||
+	    !pmd_same(*pmd, pmdval))
+		goto out_walk;
+	ptl = pte_lockptr(mm, &pmdval);
+	pte = pte_offset_map(&pmdval, address);
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto out_walk;
+	}
+	/* Anybody changing the vma now has to get past our ptl */
+	if (read_seqcount_retry(&vma->vm_sequence, seq)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out_walk;
+	}
+	local_irq_enable();
+
+	count_vm_event(PGFAULT);
+	mem_cgroup_count_vm_event(mm, PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+
+	if (!pte_none(*pte))
+		goto unlock;
+	if (page) {
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, &vmf_vma, address);
+		page = NULL;
+	}
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(&vmf_vma, address, pte);
+unlock:
+	pte_unmap_unlock(pte, ptl);
+	if (page) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+	}
+	put_vma(vma);
+	return 0;
+
+out_walk:
+	local_irq_enable();
+	if (page) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+	}
+out_put:
+	put_vma(vma);
+	return VM_FAULT_RETRY;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
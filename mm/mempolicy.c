@@ -90,6 +90,7 @@
 #include <linux/syscalls.h>
 #include <linux/ctype.h>
 #include <linux/mm_inline.h>
+#include <linux/mmu_notifier.h>
 
 #include <asm/tlbflush.h>
 #include <asm/uaccess.h>
@@ -511,7 +512,7 @@ static inline int check_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		split_huge_page_pmd(vma->vm_mm, pmd);
+		split_huge_page_pmd(vma, addr, pmd);
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		if (check_pte_range(vma, pmd, addr, next, nodes,
@@ -622,7 +623,9 @@ static int policy_vma(struct vm_area_struct *vma, struct mempolicy *new)
 		err = vma->vm_ops->set_policy(vma, new);
 	if (!err) {
 		mpol_get(new);
+		vm_write_begin(vma);
 		vma->vm_policy = new;
+		vm_write_end(vma);
 		mpol_put(old);
 	}
 	return err;
@@ -2247,6 +2250,96 @@ void mpol_free_shared_policy(struct shared_policy *p)
 	spin_unlock(&p->lock);
 }
 
+/**
+ * mpol_misplaced - check whether a page's node is valid under the policy
+ * @page: page to be checked
+ * @vma: vm area where the page is mapped
+ * @addr: virtual address where the page is mapped
+ *
+ * Look up the policy in effect for @vma at @addr and compare the node it
+ * would allocate from against the node @page currently lives on.  The
+ * policy determination mimics alloc_page_vma(); the default policy
+ * resolves to the node the current task is running on.
+ *
+ * Returns -1 if the page is correctly placed, or the node id it should
+ * be moved to.  Called from the fault path with mmap_sem held.
+ */
+int mpol_misplaced(struct page *page, struct vm_area_struct *vma,
+		   unsigned long addr)
+{
+	struct mempolicy *pol;
+	struct zone *zone;
+	int curnid = page_to_nid(page);
+	unsigned long pgoff;
+	int polnid = -1;
+	int ret = -1;
+
+	pol = get_vma_policy(current, vma, addr);
+
+	switch (pol->mode) {
+	case MPOL_INTERLEAVE:
+		pgoff = vma->vm_pgoff;
+		pgoff += (addr - vma->vm_start) >> PAGE_SHIFT;
+		polnid = offset_il_node(pol, vma, pgoff);
+		break;
+
+	case MPOL_PREFERRED:
+		if (pol->flags & MPOL_F_LOCAL)
+			polnid = numa_node_id();
+		else
+			polnid = pol->v.preferred_node;
+		break;
+
+	case MPOL_BIND:
+		/*
+		 * A page already on one of the bound nodes stays where it
+		 * is, otherwise pick the allowed node nearest to us.
+		 */
+		if (node_isset(curnid, pol->v.nodes))
+			goto out;
+		(void)first_zones_zonelist(
+				node_zonelist(numa_node_id(), GFP_HIGHUSER),
+				gfp_zone(GFP_HIGHUSER),
+				&pol->v.nodes, &zone);
+		if (zone)
+			polnid = zone->node;
+		break;
+
+	default:
+		BUG();
+	}
+
+	if (polnid != -1 && curnid != polnid &&
+	    node_isset(polnid, cpuset_current_mems_allowed))
+		ret = polnid;
+out:
+	mpol_cond_put(pol);
+
+	return ret;
+}
+
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Make the present ptes in [addr, end) of @vma inaccessible, so that
+ * the next access to each page takes a NUMA hinting fault which is
+ * handled by do_numa_page().  Returns the number of ptes updated.
+ */
+unsigned long change_prot_numa(struct vm_area_struct *vma,
+			unsigned long addr, unsigned long end)
+{
+	unsigned long nr_updated;
+
+	mmu_notifier_invalidate_range_start(vma->vm_mm, addr, end);
+	nr_updated = change_protection(vma, addr, end, vma_prot_none(vma),
+				       0, 1);
+	mmu_notifier_invalidate_range_end(vma->vm_mm, addr, end);
+	if (nr_updated)
+		count_vm_events(NUMA_PTE_UPDATES, nr_updated);
+
+	return nr_updated;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /* assumes fs == KERNEL_DS */
 void __init numa_policy_init(void)
 {
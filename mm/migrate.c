@@ -1361,4 +1361,92 @@ int migrate_vmas(struct mm_struct *mm, const nodemask_t *to,
  	}
  	return err;
 }
+
+#ifdef CONFIG_NUMA_BALANCING
+static struct page *alloc_misplaced_dst_page(struct page *page,
+					     unsigned long data,
+					     int **result)
+{
+	int nid = (int) data;
+
+	return alloc_pages_exact_node(nid,
+				      (GFP_HIGHUSER_MOVABLE | GFP_THISNODE |
+				       __GFP_NOMEMALLOC | __GFP_NORETRY |
+				       __GFP_NOWARN) & ~GFP_IOFS, 0);
+}
+
+/*
+ * Returns true if @pgdat has enough free memory above its high
+ * watermarks to take another @nr_migrate_pages pages.
+ */
+static bool migrate_balanced_pgdat(struct pglist_data *pgdat,
+				   int nr_migrate_pages)
+{
+	int z;
+
+	for (z = pgdat->nr_zones - 1; z >= 0; z--) {
+		struct zone *zone = pgdat->node_zones + z;
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (zone->all_unreclaimable)
+			continue;
+
+		if (!zone_watermark_ok(zone, 0,
+				       high_wmark_pages(zone) +
+				       nr_migrate_pages,
+				       0, 0))
+			continue;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Attempt to move a page found by a NUMA hinting fault to @node.  The
+ * caller holds a reference on @page which is dropped here.  Pages that
+ * are mapped by more than one process are left where they are, as are
+ * pages whose target node is short on memory.
+ *
+ * Returns 1 if the page was migrated, 0 otherwise.
+ */
+int migrate_misplaced_page(struct page *page, int node)
+{
+	LIST_HEAD(migratepages);
+	int isolated = 0;
+	int nr_remaining;
+
+	if (page_mapcount(page) != 1 || PageKsm(page))
+		goto out;
+
+	if (!migrate_balanced_pgdat(NODE_DATA(node), 1))
+		goto out;
+
+	if (isolate_lru_page(page))
+		goto out;
+
+	isolated = 1;
+	inc_zone_page_state(page, NR_ISOLATED_ANON + page_is_file_cache(page));
+	list_add(&page->lru, &migratepages);
+out:
+	/*
+	 * Either drop the fault's reference, leaving the one taken by
+	 * isolate_lru_page(), or release the page altogether.
+	 */
+	put_page(page);
+
+	if (isolated) {
+		nr_remaining = migrate_pages(&migratepages,
+					     alloc_misplaced_dst_page,
+					     node, false, false);
+		if (nr_remaining) {
+			putback_lru_pages(&migratepages);
+			isolated = 0;
+		} else
+			count_vm_event(NUMA_PAGE_MIGRATE);
+	}
+	return isolated;
+}
+#endif /* CONFIG_NUMA_BALANCING */
 #endif
@@ -133,7 +133,7 @@ int __vm_enough_memory(struct mm_struct *mm, long pages, int cap_sys_admin)
 		 */
 		free -= global_page_state(NR_SHMEM);
 
-		free += nr_swap_pages;
+		free += get_nr_swap_pages();
 
 		/*
 		 * Any slabs which are created with the
@@ -236,7 +236,7 @@ static struct vm_area_struct *remove_vma(struct vm_area_struct *vma)
 			removed_exe_file_vma(vma->vm_mm);
 	}
 	mpol_put(vma_policy(vma));
-	kmem_cache_free(vm_area_cachep, vma);
+	put_vma(vma);
 	return next;
 }
 
@@ -390,11 +390,33 @@ find_vma_prepare(struct mm_struct *mm, unsigned long addr,
 	return vma;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static inline void mm_rb_write_lock(struct mm_struct *mm)
+{
+	write_lock(&mm->mm_rb_lock);
+}
+
+static inline void mm_rb_write_unlock(struct mm_struct *mm)
+{
+	write_unlock(&mm->mm_rb_lock);
+}
+#else
+static inline void mm_rb_write_lock(struct mm_struct *mm)
+{
+}
+
+static inline void mm_rb_write_unlock(struct mm_struct *mm)
+{
+}
+#endif
+
 void __vma_link_rb(struct mm_struct *mm, struct vm_area_struct *vma,
 		struct rb_node **rb_link, struct rb_node *rb_parent)
 {
+	mm_rb_write_lock(mm);
 	rb_link_node(&vma->vm_rb, rb_parent, rb_link);
 	rb_insert_color(&vma->vm_rb, &mm->mm_rb);
+	mm_rb_write_unlock(mm);
 }
 
 static void __vma_link_file(struct vm_area_struct *vma)
@@ -475,7 +497,9 @@ __vma_unlink(struct mm_struct *mm, struct vm_area_struct *vma,
 	prev->vm_next = next;
 	if (next)
 		next->vm_prev = prev;
+	mm_rb_write_lock(mm);
 	rb_erase(&vma->vm_rb, &mm->mm_rb);
+	mm_rb_write_unlock(mm);
 	if (mm->mmap_cache == vma)
 		mm->mmap_cache = prev;
 }
@@ -486,9 +510,13 @@ __vma_unlink(struct mm_struct *mm, struct vm_area_struct *vma,
  * The following helper function should be used when such adjustments
  * are necessary.  The "insert" vma (if any) is to be inserted
  * before we drop the necessary locks.
+ *
+ * With keep_locked, vma is returned still inside its vm_write_begin()
+ * section, and the caller has to vm_write_end() it.
  */
-int vma_adjust(struct vm_area_struct *vma, unsigned long start,
-	unsigned long end, pgoff_t pgoff, struct vm_area_struct *insert)
+int __vma_adjust(struct vm_area_struct *vma, unsigned long start,
+	unsigned long end, pgoff_t pgoff, struct vm_area_struct *insert,
+	bool keep_locked)
 {
 	struct mm_struct *mm = vma->vm_mm;
 	struct vm_area_struct *next = vma->vm_next;
@@ -499,6 +527,7 @@ int vma_adjust(struct vm_area_struct *vma, unsigned long start,
 	struct file *file = vma->vm_file;
 	long adjust_next = 0;
 	int remove_next = 0;
+	bool vma_locked = false;
 
 	if (next && !insert) {
 		struct vm_area_struct *exporter = NULL;
@@ -537,8 +566,11 @@ again:			remove_next = 1 + (end > next->vm_end);
 		 * shrinking vma had, to cover any anon pages imported.
 		 */
 		if (exporter && exporter->anon_vma && !importer->anon_vma) {
-			if (anon_vma_clone(importer, exporter))
+			if (anon_vma_clone(importer, exporter)) {
+				if (vma_locked)
+					vm_write_end(vma);
 				return -ENOMEM;
+			}
 			importer->anon_vma = exporter->anon_vma;
 		}
 	}
@@ -561,6 +593,17 @@ again:			remove_next = 1 + (end > next->vm_end);
 
 	vma_adjust_trans_huge(vma, start, end, adjust_next);
 
+	/*
+	 * Keep speculative faults off the vmas we are changing.  A next
+	 * that gets removed is left marked: it is about to be freed.
+	 */
+	if (!vma_locked) {
+		vm_write_begin(vma);
+		vma_locked = true;
+	}
+	if (adjust_next || remove_next)
+		vm_write_begin(next);
+
 	/*
 	 * When changing only vma->vm_end, we don't really need anon_vma
 	 * lock. This is a fairly rare case by itself, but the anon_vma
@@ -616,6 +659,9 @@ again:			remove_next = 1 + (end > next->vm_end);
 	if (mapping)
 		mutex_unlock(&mapping->i_mmap_mutex);
 
+	if (adjust_next)
+		vm_write_end(next);
+
 	if (remove_next) {
 		if (file) {
 			fput(file);
@@ -626,7 +672,7 @@ again:			remove_next = 1 + (end > next->vm_end);
 			anon_vma_merge(vma, next);
 		mm->map_count--;
 		mpol_put(vma_policy(next));
-		kmem_cache_free(vm_area_cachep, next);
+		put_vma(next);
 		/*
 		 * In mprotect's case 6 (see comments on vma_merge),
 		 * we must remove another next too. It would clutter
@@ -638,6 +684,9 @@ again:			remove_next = 1 + (end > next->vm_end);
 		}
 	}
 
+	if (!keep_locked)
+		vm_write_end(vma);
+
 	validate_mm(mm);
 
 	return 0;
@@ -746,12 +795,17 @@ can_vma_merge_after(struct vm_area_struct *vma, unsigned long vm_flags,
  *
  * Odd one out? Case 8, because it extends NNNN but needs flags of XXXX:
  * mprotect_fixup updates vm_flags & vm_page_prot on successful return.
+ *
+ * With keep_locked, the vma returned is left inside its vm_write_begin()
+ * section, see __vma_adjust().  That does not work for case 4, where the
+ * vma adjusted is not the one returned, but copy_vma() never gets there.
  */
-struct vm_area_struct *vma_merge(struct mm_struct *mm,
+struct vm_area_struct *__vma_merge(struct mm_struct *mm,
 			struct vm_area_struct *prev, unsigned long addr,
 			unsigned long end, unsigned long vm_flags,
 		     	struct anon_vma *anon_vma, struct file *file,
-			pgoff_t pgoff, struct mempolicy *policy)
+			pgoff_t pgoff, struct mempolicy *policy,
+			bool keep_locked)
 {
 	pgoff_t pglen = (end - addr) >> PAGE_SHIFT;
 	struct vm_area_struct *area, *next;
@@ -789,11 +843,12 @@ struct vm_area_struct *vma_merge(struct mm_struct *mm,
 				is_mergeable_anon_vma(prev->anon_vma,
 						      next->anon_vma, NULL)) {
 							/* cases 1, 6 */
-			err = vma_adjust(prev, prev->vm_start,
-				next->vm_end, prev->vm_pgoff, NULL);
+			err = __vma_adjust(prev, prev->vm_start,
+				next->vm_end, prev->vm_pgoff, NULL,
+				keep_locked);
 		} else					/* cases 2, 5, 7 */
-			err = vma_adjust(prev, prev->vm_start,
-				end, prev->vm_pgoff, NULL);
+			err = __vma_adjust(prev, prev->vm_start,
+				end, prev->vm_pgoff, NULL, keep_locked);
 		if (err)
 			return NULL;
 		khugepaged_enter_vma_merge(prev);
@@ -808,11 +863,11 @@ struct vm_area_struct *vma_merge(struct mm_struct *mm,
 			can_vma_merge_before(next, vm_flags,
 					anon_vma, file, pgoff+pglen)) {
 		if (prev && addr < prev->vm_end)	/* case 4 */
-			err = vma_adjust(prev, prev->vm_start,
-				addr, prev->vm_pgoff, NULL);
+			err = __vma_adjust(prev, prev->vm_start,
+				addr, prev->vm_pgoff, NULL, keep_locked);
 		else					/* cases 3, 8 */
-			err = vma_adjust(area, addr, next->vm_end,
-				next->vm_pgoff - pglen, NULL);
+			err = __vma_adjust(area, addr, next->vm_end,
+				next->vm_pgoff - pglen, NULL, keep_locked);
 		if (err)
 			return NULL;
 		khugepaged_enter_vma_merge(area);
@@ -1603,6 +1658,55 @@ struct vm_area_struct *find_vma(struct mm_struct *mm, unsigned long addr)
 
 EXPORT_SYMBOL(find_vma);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Look up the vma containing addr without mmap_sem, for a speculative
+ * page fault.  The vma returned is pinned until put_vma(), but may be
+ * changed or detached concurrently: its vm_sequence tells.
+ */
+struct vm_area_struct *get_vma(struct mm_struct *mm, unsigned long addr)
+{
+	struct vm_area_struct *vma = NULL;
+	struct rb_node *rb_node;
+
+	read_lock(&mm->mm_rb_lock);
+	rb_node = mm->mm_rb.rb_node;
+	while (rb_node) {
+		struct vm_area_struct *vma_tmp;
+
+		vma_tmp = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+		if (vma_tmp->vm_end > addr) {
+			vma = vma_tmp;
+			if (vma_tmp->vm_start <= addr)
+				break;
+			rb_node = rb_node->rb_left;
+		} else
+			rb_node = rb_node->rb_right;
+	}
+	if (vma && vma->vm_start <= addr)
+		atomic_inc(&vma->vm_ref_count);
+	else
+		vma = NULL;
+	read_unlock(&mm->mm_rb_lock);
+
+	return vma;
+}
+#endif
+
+/*
+ * Free a vma once its last user is gone.  The reference owned by the
+ * mm is dropped when the vma is removed; with speculative page faults,
+ * vm_ref_count counts the additional references taken by get_vma().
+ */
+void put_vma(struct vm_area_struct *vma)
+{
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	if (!atomic_add_negative(-1, &vma->vm_ref_count))
+		return;
+#endif
+	kmem_cache_free(vm_area_cachep, vma);
+}
+
 /* Same as find_vma, but also return a pointer to the previous VMA in *pprev. */
 struct vm_area_struct *
 find_vma_prev(struct mm_struct *mm, unsigned long addr,
@@ -1734,7 +1838,9 @@ int expand_upwards(struct vm_area_struct *vma, unsigned long address)
 		if (vma->vm_pgoff + (size >> PAGE_SHIFT) >= vma->vm_pgoff) {
 			error = acct_stack_growth(vma, size, grow);
 			if (!error) {
+				vm_write_begin(vma);
 				vma->vm_end = address;
+				vm_write_end(vma);
 				perf_event_mmap(vma);
 			}
 		}
@@ -1784,8 +1890,10 @@ int expand_downwards(struct vm_area_struct *vma,
 		if (grow <= vma->vm_pgoff) {
 			error = acct_stack_growth(vma, size, grow);
 			if (!error) {
+				vm_write_begin(vma);
 				vma->vm_start = address;
 				vma->vm_pgoff -= grow;
+				vm_write_end(vma);
 				perf_event_mmap(vma);
 			}
 		}
@@ -1904,12 +2012,19 @@ detach_vmas_to_be_unmapped(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	insertion_point = (prev ? &prev->vm_next : &mm->mmap);
 	vma->vm_prev = NULL;
+	mm_rb_write_lock(mm);
 	do {
 		rb_erase(&vma->vm_rb, &mm->mm_rb);
+		/*
+		 * Never ended: speculative faults still holding a
+		 * reference must back off from the vma from now on.
+		 */
+		vm_write_begin(vma);
 		mm->map_count--;
 		tail_vma = vma;
 		vma = vma->vm_next;
 	} while (vma && vma->vm_start < end);
+	mm_rb_write_unlock(mm);
 	*insertion_point = vma;
 	if (vma)
 		vma->vm_prev = prev;
@@ -1945,6 +2060,7 @@ static int __split_vma(struct mm_struct * mm, struct vm_area_struct * vma,
 	*new = *vma;
 
 	INIT_LIST_HEAD(&new->anon_vma_chain);
+	vma_init_speculative(new);
 
 	if (new_below)
 		new->vm_end = addr;
@@ -2312,6 +2428,10 @@ int insert_vm_struct(struct mm_struct * mm, struct vm_area_struct * vma)
 /*
  * Copy the vma structure to a new location in the same mm,
  * prior to moving page table entries, to effect an mremap move.
+ *
+ * The new vma is returned inside a vm_write_begin() section, so that
+ * no speculative fault can populate the new range before the page
+ * table entries are moved there; the caller has to vm_write_end() it.
  */
 struct vm_area_struct *copy_vma(struct vm_area_struct **vmap,
 	unsigned long addr, unsigned long len, pgoff_t pgoff)
@@ -2331,8 +2451,9 @@ struct vm_area_struct *copy_vma(struct vm_area_struct **vmap,
 		pgoff = addr >> PAGE_SHIFT;
 
 	find_vma_prepare(mm, addr, &prev, &rb_link, &rb_parent);
-	new_vma = vma_merge(mm, prev, addr, addr + len, vma->vm_flags,
-			vma->anon_vma, vma->vm_file, pgoff, vma_policy(vma));
+	new_vma = __vma_merge(mm, prev, addr, addr + len, vma->vm_flags,
+			vma->anon_vma, vma->vm_file, pgoff, vma_policy(vma),
+			true);
 	if (new_vma) {
 		/*
 		 * Source vma may have been merged into new_vma
@@ -2348,6 +2469,8 @@ struct vm_area_struct *copy_vma(struct vm_area_struct **vmap,
 			if (IS_ERR(pol))
 				goto out_free_vma;
 			INIT_LIST_HEAD(&new_vma->anon_vma_chain);
+			vma_init_speculative(new_vma);
+			vm_write_begin(new_vma);
 			if (anon_vma_clone(new_vma, vma))
 				goto out_free_mempol;
 			vma_set_policy(new_vma, pol);
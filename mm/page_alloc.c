@@ -655,6 +655,7 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 
 	trace_mm_page_free_direct(page, order);
 	kmemcheck_free_shadow(page, order);
+	memcg_kmem_uncharge_pages(page, order);
 
 	if (PageAnon(page))
 		page->mapping = NULL;
@@ -1158,25 +1159,36 @@ void mark_free_pages(struct zone *zone)
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
- * cold == 1 ? free a cold page : free a hot page
+ * Prepare a 0-order page for the per-cpu lists, which can be done with
+ * interrupts enabled.  Returns false if the page must not be freed.
  */
-void free_hot_cold_page(struct page *page, int cold)
+static bool free_pcp_prepare(struct page *page)
 {
-	struct zone *zone = page_zone(page);
-	struct per_cpu_pages *pcp;
-	unsigned long flags;
-	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
+	unsigned long flags;
 
 	if (!free_pages_prepare(page, 0))
-		return;
+		return false;
 
-	migratetype = get_pageblock_migratetype(page);
-	set_page_private(page, migratetype);
-	local_irq_save(flags);
-	if (unlikely(wasMlocked))
+	if (unlikely(wasMlocked)) {
+		local_irq_save(flags);
 		free_page_mlock(page);
+		local_irq_restore(flags);
+	}
+	set_page_private(page, get_pageblock_migratetype(page));
+	return true;
+}
+
+/*
+ * Put a page prepared by free_pcp_prepare() on this cpu's lists.
+ * Must be called with interrupts disabled.
+ */
+static void free_pcp_page(struct page *page, int cold)
+{
+	struct zone *zone = page_zone(page);
+	struct per_cpu_pages *pcp;
+	int migratetype = page_private(page);
+
 	__count_vm_event(PGFREE);
 
 	/*
@@ -1189,7 +1201,7 @@ void free_hot_cold_page(struct page *page, int cold)
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
 			free_one_page(zone, page, 0, migratetype);
-			goto out;
+			return;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
@@ -1204,9 +1216,44 @@ void free_hot_cold_page(struct page *page, int cold)
 		free_pcppages_bulk(zone, pcp->batch, pcp);
 		pcp->count -= pcp->batch;
 	}
+}
 
-out:
+/*
+ * Free a 0-order page
+ * cold == 1 ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, int cold)
+{
+	unsigned long flags;
+
+	if (!free_pcp_prepare(page))
+		return;
+
+	local_irq_save(flags);
+	free_pcp_page(page, cold);
+	local_irq_restore(flags);
+}
+
+/*
+ * Free a list of 0-order pages whose last reference has been dropped,
+ * disabling interrupts only once for all of them.
+ */
+void free_hot_cold_page_list(struct list_head *list, int cold)
+{
+	struct page *page, *next;
+	unsigned long flags;
+
+	list_for_each_entry_safe(page, next, list, lru) {
+		if (!free_pcp_prepare(page))
+			list_del(&page->lru);
+	}
+
+	local_irq_save(flags);
+	list_for_each_entry_safe(page, next, list, lru)
+		free_pcp_page(page, cold);
 	local_irq_restore(flags);
+
+	INIT_LIST_HEAD(list);
 }
 
 /*
@@ -2290,11 +2337,168 @@ __alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
 				preferred_zone, migratetype);
 	put_mems_allowed();
 
+	if (page && memcg_kmem_charge_pages(page, gfp_mask, order)) {
+		__free_pages(page, order);
+		page = NULL;
+	}
+
 	trace_mm_page_alloc(page, order, gfp_mask, migratetype);
 	return page;
 }
 EXPORT_SYMBOL(__alloc_pages_nodemask);
 
+/**
+ * __alloc_pages_bulk - allocate a number of 0-order pages at once
+ * @gfp_mask: GFP flags for the allocation
+ * @zonelist: zonelist to allocate from
+ * @nodemask: nodes to allocate from, NULL for all allowed
+ * @nr_pages: number of pages wanted
+ * @page_list: list to add the pages to, or NULL if @page_array is used
+ * @page_array: array to fill in, or NULL if @page_list is used
+ *
+ * The pages are all taken from the per-cpu list of the first zone which
+ * has enough free pages for them above its low watermark, refilling the
+ * list from the buddy lists as needed, with interrupts disabled only once.
+ * Otherwise, and for a single page, one page is allocated the usual way,
+ * with reclaim if the gfp_mask allows: the caller may retry for the rest.
+ *
+ * Only the NULL entries of @page_array are filled in, and the number of
+ * leading entries that are now populated is returned.  With @page_list,
+ * the number of pages added to the list is returned.
+ */
+unsigned long __alloc_pages_bulk(gfp_t gfp_mask, struct zonelist *zonelist,
+				 nodemask_t *nodemask, unsigned long nr_pages,
+				 struct list_head *page_list,
+				 struct page **page_array)
+{
+	enum zone_type high_zoneidx = gfp_zone(gfp_mask);
+	int migratetype = allocflags_to_migratetype(gfp_mask);
+	int cold = !!(gfp_mask & __GFP_COLD);
+	struct zone *preferred_zone, *zone;
+	struct per_cpu_pages *pcp;
+	struct list_head *list;
+	struct zoneref *z;
+	struct page *page, *next;
+	unsigned long flags;
+	unsigned long nr_populated = 0, nr_wanted, nr_taken = 0;
+	unsigned long i;
+	LIST_HEAD(pages);
+
+	if (page_array) {
+		while (nr_populated < nr_pages && page_array[nr_populated])
+			nr_populated++;
+		for (nr_wanted = 0, i = nr_populated; i < nr_pages; i++)
+			nr_wanted += !page_array[i];
+	} else
+		nr_wanted = nr_pages;
+
+	if (!nr_wanted)
+		return nr_populated;
+	if (nr_wanted == 1)
+		goto failed;
+	/* Charging to the memory cgroup is done page by page */
+	if (gfp_mask & __GFP_KMEMCG)
+		goto failed;
+
+	gfp_mask &= gfp_allowed_mask;
+	lockdep_trace_alloc(gfp_mask);
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+
+	if (should_fail_alloc_page(gfp_mask, 0))
+		goto failed;
+	if (unlikely(!zonelist->_zonerefs->zone))
+		goto failed;
+
+	get_mems_allowed();
+	first_zones_zonelist(zonelist, high_zoneidx,
+				nodemask ? : &cpuset_current_mems_allowed,
+				&preferred_zone);
+	if (!preferred_zone) {
+		put_mems_allowed();
+		goto failed;
+	}
+	for_each_zone_zonelist_nodemask(zone, z, zonelist,
+						high_zoneidx, nodemask) {
+		unsigned long mark;
+
+		if (!cpuset_zone_allowed_softwall(zone,
+						  gfp_mask | __GFP_HARDWALL))
+			continue;
+		mark = low_wmark_pages(zone) + nr_wanted;
+		if (zone_watermark_ok(zone, 0, mark, zone_idx(preferred_zone),
+				      ALLOC_WMARK_LOW | ALLOC_CPUSET))
+			break;
+	}
+	put_mems_allowed();
+	if (!zone)
+		goto failed;
+
+	local_irq_save(flags);
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list = &pcp->lists[migratetype];
+	while (nr_taken < nr_wanted) {
+		if (list_empty(list)) {
+			pcp->count += rmqueue_bulk(zone, 0,
+					max_t(unsigned long, pcp->batch,
+					      min_t(unsigned long, pcp->high,
+						    nr_wanted - nr_taken)),
+					list, migratetype, cold);
+			if (unlikely(list_empty(list)))
+				break;
+		}
+
+		if (cold)
+			page = list_entry(list->prev, struct page, lru);
+		else
+			page = list_entry(list->next, struct page, lru);
+
+		list_move_tail(&page->lru, &pages);
+		pcp->count--;
+		nr_taken++;
+		zone_statistics(preferred_zone, zone, gfp_mask);
+	}
+	__count_zone_vm_events(PGALLOC, zone, nr_taken);
+	local_irq_restore(flags);
+
+	if (!nr_taken)
+		goto failed;
+
+	/* Zeroing and checking the pages is done with interrupts enabled */
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		list_del(&page->lru);
+		VM_BUG_ON(bad_range(zone, page));
+		if (prep_new_page(page, 0, gfp_mask))
+			continue;
+		trace_mm_page_alloc(page, 0, gfp_mask, migratetype);
+
+		if (page_list) {
+			list_add_tail(&page->lru, page_list);
+			nr_populated++;
+		} else {
+			while (page_array[nr_populated])
+				nr_populated++;
+			page_array[nr_populated++] = page;
+		}
+	}
+	if (page_array) {
+		while (nr_populated < nr_pages && page_array[nr_populated])
+			nr_populated++;
+	}
+	return nr_populated;
+
+failed:
+	page = __alloc_pages_nodemask(gfp_mask, 0, zonelist, nodemask);
+	if (page) {
+		if (page_list)
+			list_add(&page->lru, page_list);
+		else
+			page_array[nr_populated] = page;
+		nr_populated++;
+	}
+	return nr_populated;
+}
+EXPORT_SYMBOL(__alloc_pages_bulk);
+
 /*
  * Common helper functions.
  */
@@ -2323,12 +2527,14 @@ EXPORT_SYMBOL(get_zeroed_page);
 
 void __pagevec_free(struct pagevec *pvec)
 {
+	LIST_HEAD(pages_to_free);
 	int i = pagevec_count(pvec);
 
 	while (--i >= 0) {
 		trace_mm_pagevec_free(pvec->pages[i], pvec->cold);
-		free_hot_cold_page(pvec->pages[i], pvec->cold);
+		list_add_tail(&pvec->pages[i]->lru, &pages_to_free);
 	}
+	free_hot_cold_page_list(&pages_to_free, pvec->cold);
 }
 
 void __free_pages(struct page *page, unsigned int order)
@@ -2343,6 +2549,49 @@ void __free_pages(struct page *page, unsigned int order)
 
 EXPORT_SYMBOL(__free_pages);
 
+/**
+ * free_pages_bulk_array - drop a reference to each of an array of pages
+ * @pages: the 0-order pages, NULL entries are skipped
+ * @nr_pages: number of entries in @pages
+ *
+ * Like calling __free_page() on each page, but the pages freed go back to
+ * the per-cpu lists with interrupts disabled only once.
+ */
+void free_pages_bulk_array(struct page **pages, unsigned long nr_pages)
+{
+	LIST_HEAD(pages_to_free);
+	unsigned long i;
+
+	for (i = 0; i < nr_pages; i++) {
+		struct page *page = pages[i];
+
+		if (page && put_page_testzero(page))
+			list_add_tail(&page->lru, &pages_to_free);
+	}
+	free_hot_cold_page_list(&pages_to_free, 0);
+}
+EXPORT_SYMBOL(free_pages_bulk_array);
+
+/**
+ * free_pages_bulk_list - drop a reference to each page on a list
+ * @list: the 0-order pages, linked through page->lru
+ *
+ * The list is left empty.  See free_pages_bulk_array().
+ */
+void free_pages_bulk_list(struct list_head *list)
+{
+	LIST_HEAD(pages_to_free);
+	struct page *page, *next;
+
+	list_for_each_entry_safe(page, next, list, lru) {
+		list_del(&page->lru);
+		if (put_page_testzero(page))
+			list_add_tail(&page->lru, &pages_to_free);
+	}
+	free_hot_cold_page_list(&pages_to_free, 0);
+}
+EXPORT_SYMBOL(free_pages_bulk_list);
+
 void free_pages(unsigned long addr, unsigned int order)
 {
 	if (addr != 0) {
@@ -3460,6 +3709,7 @@ void __meminit memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 		mminit_verify_page_links(page, zone, nid, pfn);
 		init_page_count(page);
 		reset_page_mapcount(page);
+		init_page_cgroup(page);
 		SetPageReserved(page);
 		/*
 		 * Mark the block movable so that blocks are reserved for
@@ -4278,7 +4528,9 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	pgdat->kswapd_max_order = 0;
-	pgdat_page_cgroup_init(pgdat);
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+#endif
 	
 	for (j = 0; j < MAX_NR_ZONES; j++) {
 		struct zone *zone = pgdat->node_zones + j;
@@ -4334,7 +4586,7 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 
 		zone_pcp_init(zone);
 		for_each_lru(l)
-			INIT_LIST_HEAD(&zone->lru[l].list);
+			INIT_LIST_HEAD(&zone->lruvec.lists[l]);
 		zone->reclaim_stat.recent_rotated[0] = 0;
 		zone->reclaim_stat.recent_rotated[1] = 0;
 		zone->reclaim_stat.recent_scanned[0] = 0;
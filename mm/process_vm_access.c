@@ -0,0 +1,342 @@
+/*
+ * linux/mm/process_vm_access.c
+ *
+ * Cross memory attach: copy data directly between the address space
+ * of the calling process and that of another process, without going
+ * through a pipe or a shared memory segment and without stopping the
+ * other process the way ptrace(PTRACE_PEEKDATA) would.
+ *
+ * The pages of the remote process are pinned with get_user_pages()
+ * and mapped into the kernel one at a time, so the data is copied
+ * exactly once.  Access is granted under the same rules as attaching
+ * to the target with ptrace.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/ptrace.h>
+#include <linux/slab.h>
+#include <linux/syscalls.h>
+
+#ifdef CONFIG_COMPAT
+#include <linux/compat.h>
+#endif
+
+#include <asm/uaccess.h>
+
+/*
+ * Number of remote pages pinned at a time.  The page array lives on
+ * the stack, and mmap_sem of the target is dropped between batches.
+ */
+#define PVM_MAX_PP_ARRAY_COUNT 16
+
+/* Position in the local iovec array */
+struct pvm_iter {
+	const struct iovec *iov;
+	unsigned long nr_segs;
+	unsigned long seg;
+	size_t offset;
+};
+
+/*
+ * Copy up to @len bytes between @page, starting at @offset, and the
+ * local iovecs described by @it.  Returns the number of bytes copied,
+ * or -EFAULT if a local buffer turned out to be inaccessible.
+ */
+static ssize_t process_vm_copy_page(struct page *page, unsigned long offset,
+				    size_t len, struct pvm_iter *it,
+				    int vm_write)
+{
+	char *kaddr;
+	ssize_t copied = 0;
+
+	kaddr = kmap(page) + offset;
+	while (len && it->seg < it->nr_segs) {
+		const struct iovec *iov = it->iov + it->seg;
+		void __user *ubuf = iov->iov_base + it->offset;
+		size_t n = min(len, iov->iov_len - it->offset);
+		unsigned long left;
+
+		if (vm_write)
+			left = __copy_from_user(kaddr, ubuf, n);
+		else
+			left = __copy_to_user(ubuf, kaddr, n);
+
+		copied += n - left;
+		if (left) {
+			copied = copied ? copied : -EFAULT;
+			break;
+		}
+		kaddr += n;
+		len -= n;
+		it->offset += n;
+		if (it->offset == iov->iov_len) {
+			it->seg++;
+			it->offset = 0;
+		}
+	}
+	kunmap(page);
+
+	return copied;
+}
+
+/*
+ * Transfer data between one remote range and the local iovecs, until
+ * either side is exhausted.  Returns the number of bytes copied, or an
+ * error if nothing could be copied at all.
+ */
+static ssize_t process_vm_rw_single_vec(struct task_struct *task,
+					struct mm_struct *mm,
+					const struct iovec *rvec,
+					struct pvm_iter *it, int vm_write)
+{
+	struct page *pages[PVM_MAX_PP_ARRAY_COUNT];
+	unsigned long start = (unsigned long)rvec->iov_base;
+	size_t len = rvec->iov_len;
+	ssize_t copied = 0;
+
+	while (len && it->seg < it->nr_segs) {
+		unsigned long offset = start & ~PAGE_MASK;
+		int nr_pages, pinned, i;
+		ssize_t ret = 0;
+
+		nr_pages = (offset + len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+		nr_pages = min(nr_pages, PVM_MAX_PP_ARRAY_COUNT);
+
+		down_read(&mm->mmap_sem);
+		pinned = get_user_pages(task, mm, start & PAGE_MASK, nr_pages,
+					vm_write, 0, pages, NULL);
+		up_read(&mm->mmap_sem);
+		if (pinned <= 0)
+			return copied ? copied : -EFAULT;
+
+		for (i = 0; i < pinned; i++) {
+			size_t n = min_t(size_t, len, PAGE_SIZE - offset);
+
+			if (ret >= 0 && len && it->seg < it->nr_segs) {
+				ret = process_vm_copy_page(pages[i], offset, n,
+							   it, vm_write);
+				if (ret > 0) {
+					copied += ret;
+					start += ret;
+					len -= ret;
+					if (ret < n &&
+					    it->seg < it->nr_segs)
+						ret = -EFAULT;
+				}
+				offset = 0;
+			}
+			if (vm_write)
+				set_page_dirty_lock(pages[i]);
+			put_page(pages[i]);
+		}
+
+		if (ret < 0)
+			return copied ? copied : ret;
+		if (pinned < nr_pages && len && it->seg < it->nr_segs)
+			return copied ? copied : -EFAULT;
+	}
+
+	return copied;
+}
+
+/*
+ * Look up the target by @pid, check that the caller may access its
+ * memory, and copy between the already validated iovec arrays.
+ */
+static ssize_t process_vm_rw_core(pid_t pid, const struct iovec *lvec,
+				  unsigned long liovcnt,
+				  const struct iovec *rvec,
+				  unsigned long riovcnt, int vm_write)
+{
+	struct pvm_iter it = { .iov = lvec, .nr_segs = liovcnt };
+	struct task_struct *task;
+	struct mm_struct *mm;
+	ssize_t copied = 0;
+	ssize_t ret;
+	unsigned long i;
+
+	rcu_read_lock();
+	task = find_task_by_vpid(pid);
+	if (task)
+		get_task_struct(task);
+	rcu_read_unlock();
+	if (!task)
+		return -ESRCH;
+
+	/*
+	 * Hold cred_guard_mutex over the check so the target cannot
+	 * exec a setuid binary between the check and get_task_mm().
+	 */
+	ret = mutex_lock_killable(&task->signal->cred_guard_mutex);
+	if (ret)
+		goto put_task;
+	mm = get_task_mm(task);
+	if (mm && mm != current->mm &&
+	    !ptrace_may_access(task, PTRACE_MODE_ATTACH)) {
+		mmput(mm);
+		mm = ERR_PTR(-EPERM);
+	}
+	mutex_unlock(&task->signal->cred_guard_mutex);
+
+	if (!mm) {
+		/* Kernel threads and zombies have no address space */
+		ret = -EINVAL;
+		goto put_task;
+	}
+	if (IS_ERR(mm)) {
+		ret = PTR_ERR(mm);
+		goto put_task;
+	}
+
+	for (i = 0; i < riovcnt && it.seg < it.nr_segs; i++) {
+		ret = process_vm_rw_single_vec(task, mm, rvec + i, &it,
+					       vm_write);
+		if (ret < 0)
+			break;
+		copied += ret;
+		if (ret < rvec[i].iov_len && it.seg < it.nr_segs) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+	/* Report a partial transfer rather than the error that ended it */
+	if (copied)
+		ret = copied;
+	else if (ret > 0)
+		ret = 0;
+
+	mmput(mm);
+put_task:
+	put_task_struct(task);
+	return ret;
+}
+
+static ssize_t process_vm_rw(pid_t pid,
+			     const struct iovec __user *lvec,
+			     unsigned long liovcnt,
+			     const struct iovec __user *rvec,
+			     unsigned long riovcnt,
+			     unsigned long flags, int vm_write)
+{
+	struct iovec iovstack_l[UIO_FASTIOV];
+	struct iovec iovstack_r[UIO_FASTIOV];
+	struct iovec *iov_l = iovstack_l;
+	struct iovec *iov_r = iovstack_r;
+	ssize_t ret;
+
+	if (flags != 0)
+		return -EINVAL;
+
+	/* The local buffers are checked here, the remote ones by gup */
+	ret = rw_copy_check_uvector(vm_write ? WRITE : READ, lvec, liovcnt,
+				    UIO_FASTIOV, iovstack_l, &iov_l, 1);
+	if (ret <= 0)
+		goto free_iovecs;
+	ret = rw_copy_check_uvector(READ, rvec, riovcnt, UIO_FASTIOV,
+				    iovstack_r, &iov_r, 0);
+	if (ret <= 0)
+		goto free_iovecs;
+
+	ret = process_vm_rw_core(pid, iov_l, liovcnt, iov_r, riovcnt,
+				 vm_write);
+
+free_iovecs:
+	if (iov_r != iovstack_r)
+		kfree(iov_r);
+	if (iov_l != iovstack_l)
+		kfree(iov_l);
+	return ret;
+}
+
+SYSCALL_DEFINE6(process_vm_readv, pid_t, pid, const struct iovec __user *, lvec,
+		unsigned long, liovcnt, const struct iovec __user *, rvec,
+		unsigned long, riovcnt,	unsigned long, flags)
+{
+	return process_vm_rw(pid, lvec, liovcnt, rvec, riovcnt, flags, 0);
+}
+
+SYSCALL_DEFINE6(process_vm_writev, pid_t, pid,
+		const struct iovec __user *, lvec,
+		unsigned long, liovcnt, const struct iovec __user *, rvec,
+		unsigned long, riovcnt,	unsigned long, flags)
+{
+	return process_vm_rw(pid, lvec, liovcnt, rvec, riovcnt, flags, 1);
+}
+
+#ifdef CONFIG_COMPAT
+
+static ssize_t compat_process_vm_rw(compat_pid_t pid,
+				    const struct compat_iovec __user *lvec,
+				    unsigned long liovcnt,
+				    const struct compat_iovec __user *rvec,
+				    unsigned long riovcnt,
+				    unsigned long flags, int vm_write)
+{
+	struct iovec iovstack_l[UIO_FASTIOV];
+	struct iovec iovstack_r[UIO_FASTIOV];
+	struct iovec *iov_l = iovstack_l;
+	struct iovec *iov_r = iovstack_r;
+	ssize_t ret = -EFAULT;
+
+	if (flags != 0)
+		return -EINVAL;
+
+	if (!access_ok(VERIFY_READ, lvec, liovcnt * sizeof(*lvec)))
+		goto free_iovecs;
+	if (!access_ok(VERIFY_READ, rvec, riovcnt * sizeof(*rvec)))
+		goto free_iovecs;
+
+	ret = compat_rw_copy_check_uvector(vm_write ? WRITE : READ, lvec,
+					   liovcnt, UIO_FASTIOV, iovstack_l,
+					   &iov_l, 1);
+	if (ret <= 0)
+		goto free_iovecs;
+	ret = compat_rw_copy_check_uvector(READ, rvec, riovcnt, UIO_FASTIOV,
+					   iovstack_r, &iov_r, 0);
+	if (ret <= 0)
+		goto free_iovecs;
+
+	ret = process_vm_rw_core(pid, iov_l, liovcnt, iov_r, riovcnt,
+				 vm_write);
+
+free_iovecs:
+	if (iov_r != iovstack_r)
+		kfree(iov_r);
+	if (iov_l != iovstack_l)
+		kfree(iov_l);
+	return ret;
+}
+
+asmlinkage ssize_t
+compat_sys_process_vm_readv(compat_pid_t pid,
+			    const struct compat_iovec __user *lvec,
+			    unsigned long liovcnt,
+			    const struct compat_iovec __user *rvec,
+			    unsigned long riovcnt,
+			    unsigned long flags)
+{
+	return compat_process_vm_rw(pid, lvec, liovcnt, rvec,
+				    riovcnt, flags, 0);
+}
+
+asmlinkage ssize_t
+compat_sys_process_vm_writev(compat_pid_t pid,
+			     const struct compat_iovec __user *lvec,
+			     unsigned long liovcnt,
+			     const struct compat_iovec __user *rvec,
+			     unsigned long riovcnt,
+			     unsigned long flags)
+{
+	return compat_process_vm_rw(pid, lvec, liovcnt, rvec,
+				    riovcnt, flags, 1);
+}
+
+#endif
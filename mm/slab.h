@@ -0,0 +1,153 @@
+#ifndef MM_SLAB_H
+#define MM_SLAB_H
+/*
+ * Internal slab definitions shared between the slab allocators and the
+ * memory controller.
+ */
+
+struct mem_cgroup;
+
+struct kmem_cache *kmem_cache_create_memcg(struct mem_cgroup *memcg,
+		const char *name, size_t size, size_t align,
+		unsigned long flags, void (*ctor)(void *),
+		struct kmem_cache *root_cache);
+
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+#include <linux/memcontrol.h>
+
+/* memcg_params.state */
+#define MEMCG_CACHE_DEAD	0	/* the cgroup is gone */
+#define MEMCG_CACHE_DESTROY	1	/* destruction is scheduled */
+
+/* Provided by the allocator */
+void kmem_cache_shrink_dead(struct kmem_cache *s);
+struct mem_cgroup *mem_cgroup_from_kmem(const void *obj);
+
+/* Provided by the memory controller */
+void memcg_register_cache(struct kmem_cache *s, size_t size, size_t align,
+			  unsigned long flags, void (*ctor)(void *));
+void memcg_unregister_cache(struct kmem_cache *s);
+void memcg_init_cache(struct kmem_cache *s, struct mem_cgroup *memcg,
+		      struct kmem_cache *root_cache);
+struct kmem_cache *__memcg_kmem_get_cache(struct kmem_cache *s);
+void __memcg_kmem_put_cache(struct kmem_cache *s);
+int __memcg_charge_slab(struct kmem_cache *s, gfp_t gfp, int order);
+void __memcg_uncharge_slab(struct kmem_cache *s, int order);
+
+static inline bool is_root_cache(struct kmem_cache *s)
+{
+	return !s->memcg_params.root_cache;
+}
+
+/*
+ * Called by kmem_cache_create_memcg() before @s becomes visible: link a
+ * per-cgroup copy to its root, or give a new accounted cache its slot.
+ */
+static inline void memcg_cache_setup(struct kmem_cache *s,
+		struct mem_cgroup *memcg, struct kmem_cache *root_cache,
+		size_t size, size_t align, unsigned long flags,
+		void (*ctor)(void *))
+{
+	if (root_cache)
+		memcg_init_cache(s, memcg, root_cache);
+	else if (flags & SLAB_ACCOUNT)
+		memcg_register_cache(s, size, align, flags, ctor);
+}
+
+/*
+ * Pick the cache an allocation from @s is served from: the copy that
+ * belongs to the memory cgroup of the current task, if @s is accounted.
+ * Interrupts, kernel threads and allocations that must not fail are
+ * always served from @s itself.  A copy stays pinned until it is handed
+ * back with memcg_kmem_put_cache().
+ */
+static __always_inline struct kmem_cache *
+memcg_kmem_get_cache(struct kmem_cache *s, gfp_t gfp)
+{
+	if (!memcg_kmem_enabled())
+		return s;
+	if (!(s->flags & SLAB_ACCOUNT) || (gfp & __GFP_NOFAIL))
+		return s;
+	if (in_interrupt() || !current->mm || (current->flags & PF_KTHREAD))
+		return s;
+	return __memcg_kmem_get_cache(s);
+}
+
+static __always_inline void memcg_kmem_put_cache(struct kmem_cache *s)
+{
+	if (!is_root_cache(s))
+		__memcg_kmem_put_cache(s);
+}
+
+/*
+ * An object is freed to the cache it came from, which may be a copy of
+ * the cache the caller passed in.
+ */
+static inline struct kmem_cache *
+cache_from_obj(struct kmem_cache *s, struct kmem_cache *obj_cache)
+{
+	if (likely(obj_cache == s))
+		return s;
+	if (obj_cache && obj_cache->memcg_params.root_cache == s)
+		return obj_cache;
+	return s;
+}
+
+static inline int memcg_charge_slab(struct kmem_cache *s, gfp_t gfp,
+				    int order)
+{
+	if (!s->memcg_params.memcg)
+		return 0;
+	return __memcg_charge_slab(s, gfp, order);
+}
+
+static inline void memcg_uncharge_slab(struct kmem_cache *s, int order)
+{
+	if (s->memcg_params.memcg)
+		__memcg_uncharge_slab(s, order);
+}
+#else
+static inline bool is_root_cache(struct kmem_cache *s)
+{
+	return true;
+}
+
+static inline void memcg_cache_setup(struct kmem_cache *s,
+		struct mem_cgroup *memcg, struct kmem_cache *root_cache,
+		size_t size, size_t align, unsigned long flags,
+		void (*ctor)(void *))
+{
+}
+
+static inline void memcg_unregister_cache(struct kmem_cache *s)
+{
+}
+
+static inline struct kmem_cache *
+memcg_kmem_get_cache(struct kmem_cache *s, gfp_t gfp)
+{
+	return s;
+}
+
+static inline void memcg_kmem_put_cache(struct kmem_cache *s)
+{
+}
+
+static inline struct kmem_cache *
+cache_from_obj(struct kmem_cache *s, struct kmem_cache *obj_cache)
+{
+	return s;
+}
+
+static inline int memcg_charge_slab(struct kmem_cache *s, gfp_t gfp,
+				    int order)
+{
+	return 0;
+}
+
+static inline void memcg_uncharge_slab(struct kmem_cache *s, int order)
+{
+}
+#endif /* CONFIG_CGROUP_MEM_RES_CTLR_KMEM */
+
+#endif /* MM_SLAB_H */
@@ -32,6 +32,8 @@
 
 #include <trace/events/kmem.h>
 
+#include "slab.h"
+
 /*
  * Lock order:
  *   1. slub_lock (Global Semaphore)
@@ -162,7 +164,7 @@ static inline int kmem_cache_debug(struct kmem_cache *s)
  */
 #define SLUB_NEVER_MERGE (SLAB_RED_ZONE | SLAB_POISON | SLAB_STORE_USER | \
 		SLAB_TRACE | SLAB_DESTROY_BY_RCU | SLAB_NOLEAKTRACE | \
-		SLAB_FAILSLAB)
+		SLAB_FAILSLAB | SLAB_ACCOUNT)
 
 #define SLUB_MERGE_SAME (SLAB_DEBUG_FREE | SLAB_RECLAIM_ACCOUNT | \
 		SLAB_CACHE_DMA | SLAB_NOTRACK)
@@ -1375,6 +1377,11 @@ static struct page *allocate_slab(struct kmem_cache *s, gfp_t flags, int node)
 			stat(s, ORDER_FALLBACK);
 	}
 
+	if (page && memcg_charge_slab(s, flags, oo_order(oo))) {
+		__free_pages(page, oo_order(oo));
+		page = NULL;
+	}
+
 	if (flags & __GFP_WAIT)
 		local_irq_disable();
 
@@ -1479,6 +1486,7 @@ static void __free_slab(struct kmem_cache *s, struct page *page)
 	if (current->reclaim_state)
 		current->reclaim_state->reclaimed_slab += pages;
 	__free_pages(page, order);
+	memcg_uncharge_slab(s, order);
 }
 
 #define need_reserve_slab_rcu						\
@@ -2189,6 +2197,7 @@ static __always_inline void *slab_alloc(struct kmem_cache *s,
 	if (slab_pre_alloc_hook(s, gfpflags))
 		return NULL;
 
+	s = memcg_kmem_get_cache(s, gfpflags);
 redo:
 
 	/*
@@ -2241,6 +2250,7 @@ redo:
 		memset(object, 0, s->objsize);
 
 	slab_post_alloc_hook(s, gfpflags, object);
+	memcg_kmem_put_cache(s);
 
 	return object;
 }
@@ -2456,7 +2466,7 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 
 	page = virt_to_head_page(x);
 
-	slab_free(s, page, x, _RET_IP_);
+	slab_free(cache_from_obj(s, page->slab), page, x, _RET_IP_);
 
 	trace_kmem_cache_free(_RET_IP_, x);
 }
@@ -3016,6 +3026,8 @@ static inline int kmem_cache_close(struct kmem_cache *s)
  */
 void kmem_cache_destroy(struct kmem_cache *s)
 {
+	memcg_unregister_cache(s);
+
 	down_write(&slub_lock);
 	s->refcount--;
 	if (!s->refcount) {
@@ -3371,6 +3383,28 @@ int kmem_cache_shrink(struct kmem_cache *s)
 }
 EXPORT_SYMBOL(kmem_cache_shrink);
 
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+/*
+ * The cgroup of @s is gone and no new objects will be allocated from it:
+ * give back every slab that becomes empty right away instead of keeping
+ * partial slabs around.
+ */
+void kmem_cache_shrink_dead(struct kmem_cache *s)
+{
+	s->min_partial = 0;
+	kmem_cache_shrink(s);
+}
+
+struct mem_cgroup *mem_cgroup_from_kmem(const void *obj)
+{
+	struct page *page = virt_to_head_page(obj);
+
+	if (!PageSlab(page))
+		return NULL;
+	return page->slab->memcg_params.memcg;
+}
+#endif
+
 #if defined(CONFIG_MEMORY_HOTPLUG)
 static int slab_mem_going_offline_callback(void *arg)
 {
@@ -3744,8 +3778,10 @@ static struct kmem_cache *find_mergeable(size_t size,
 	return NULL;
 }
 
-struct kmem_cache *kmem_cache_create(const char *name, size_t size,
-		size_t align, unsigned long flags, void (*ctor)(void *))
+struct kmem_cache *kmem_cache_create_memcg(struct mem_cgroup *memcg,
+		const char *name, size_t size, size_t align,
+		unsigned long flags, void (*ctor)(void *),
+		struct kmem_cache *root_cache)
 {
 	struct kmem_cache *s;
 	char *n;
@@ -3780,12 +3816,17 @@ struct kmem_cache *kmem_cache_create(const char *name, size_t size,
 	if (s) {
 		if (kmem_cache_open(s, n,
 				size, align, flags, ctor)) {
+			memcg_cache_setup(s, memcg, root_cache, size, align,
+					  flags, ctor);
 			list_add(&s->list, &slab_caches);
 			if (sysfs_slab_add(s)) {
 				list_del(&s->list);
+				up_write(&slub_lock);
+				/* Give back the slot of an accounted cache */
+				memcg_unregister_cache(s);
 				kfree(n);
 				kfree(s);
-				goto err;
+				goto err_unlocked;
 			}
 			up_write(&slub_lock);
 			return s;
@@ -3795,13 +3836,20 @@ struct kmem_cache *kmem_cache_create(const char *name, size_t size,
 	}
 err:
 	up_write(&slub_lock);
-
+err_unlocked:
 	if (flags & SLAB_PANIC)
 		panic("Cannot create slabcache %s\n", name);
 	else
 		s = NULL;
 	return s;
 }
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+		size_t align, unsigned long flags, void (*ctor)(void *))
+{
+	return kmem_cache_create_memcg(NULL, name, size, align, flags,
+				       ctor, NULL);
+}
 EXPORT_SYMBOL(kmem_cache_create);
 
 #ifdef CONFIG_SMP
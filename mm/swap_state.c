@@ -19,6 +19,7 @@
 #include <linux/pagevec.h>
 #include <linux/migrate.h>
 #include <linux/page_cgroup.h>
+#include <linux/blkdev.h>
 
 #include <asm/pgtable.h>
 
@@ -60,7 +61,7 @@ void show_swap_cache_info(void)
 	printk("Swap cache stats: add %lu, delete %lu, find %lu/%lu\n",
 		swap_cache_info.add_total, swap_cache_info.del_total,
 		swap_cache_info.find_success, swap_cache_info.find_total);
-	printk("Free swap  = %ldkB\n", nr_swap_pages << (PAGE_SHIFT - 10));
+	printk("Free swap  = %ldkB\n", get_nr_swap_pages() << (PAGE_SHIFT - 10));
 	printk("Total swap = %lukB\n", total_swap_pages << (PAGE_SHIFT - 10));
 }
 
@@ -254,37 +255,89 @@ void free_pages_and_swap_cache(struct page **pages, int nr)
 	}
 }
 
+/*
+ * The state of VMA based swap readahead is kept in one word per vma:
+ * the page aligned address of the last swap fault or swap cache hit,
+ * the readahead window chosen at the last fault, and the number of
+ * pages read ahead since then that turned out to be used.
+ */
+#define SWAP_RA_WIN_SHIFT	(PAGE_SHIFT / 2)
+#define SWAP_RA_HITS_MASK	((1UL << SWAP_RA_WIN_SHIFT) - 1)
+#define SWAP_RA_HITS_MAX	SWAP_RA_HITS_MASK
+#define SWAP_RA_WIN_MASK	(~PAGE_MASK & ~SWAP_RA_HITS_MASK)
+
+#define SWAP_RA_HITS(v)		((v) & SWAP_RA_HITS_MASK)
+#define SWAP_RA_WIN(v)		(((v) & SWAP_RA_WIN_MASK) >> SWAP_RA_WIN_SHIFT)
+#define SWAP_RA_ADDR(v)		((v) & PAGE_MASK)
+
+#define SWAP_RA_VAL(addr, win, hits)				\
+	(((addr) & PAGE_MASK) |					\
+	 (((win) << SWAP_RA_WIN_SHIFT) & SWAP_RA_WIN_MASK) |	\
+	 ((hits) & SWAP_RA_HITS_MASK))
+
+/* Cap the window, the ptes in it are copied onto the stack */
+#if BITS_PER_LONG == 64
+#define SWAP_RA_ORDER_CEILING	5
+#else
+#define SWAP_RA_ORDER_CEILING	3
+#endif
+#define SWAP_RA_PTE_MAX		(1 << SWAP_RA_ORDER_CEILING)
+
+static bool enable_vma_readahead __read_mostly = true;
+
 /*
  * Lookup a swap entry in the swap cache. A found page will be returned
  * unlocked and with its refcount incremented - we rely on the kernel
  * lock getting page table operations atomic even if we drop the page
  * lock before returning.
+ *
+ * When the lookup is for a fault at @addr in @vma, a hit on a page that
+ * was read ahead counts towards the readahead window of the vma.
  */
-struct page * lookup_swap_cache(swp_entry_t entry)
+struct page *lookup_swap_cache(swp_entry_t entry,
+			       struct vm_area_struct *vma, unsigned long addr)
 {
 	struct page *page;
 
 	page = find_get_page(&swapper_space, entry.val);
 
-	if (page)
+	if (page) {
 		INC_CACHE_INFO(find_success);
+		if (vma && swap_use_vma_readahead()) {
+			unsigned long ra_val, win, hits;
+			bool readahead;
+
+			/* PG_readahead is PG_reclaim while under writeback */
+			readahead = !PageWriteback(page) &&
+				    TestClearPageReadahead(page);
+			ra_val = atomic_long_read(&vma->swap_readahead_info);
+			win = SWAP_RA_WIN(ra_val);
+			hits = SWAP_RA_HITS(ra_val);
+			if (readahead && hits < SWAP_RA_HITS_MAX)
+				hits++;
+			atomic_long_set(&vma->swap_readahead_info,
+					SWAP_RA_VAL(addr, win, hits));
+		}
+	}
 
 	INC_CACHE_INFO(find_total);
 	return page;
 }
 
-/* 
- * Locate a page of swap in physical memory, reserving swap cache space
- * and reading the disk if it is not already cached.
- * A failure return means that either the page allocation failed or that
- * the swap entry is no longer in use.
+/*
+ * Find or allocate the swap cache page for @entry, without reading it
+ * in: *new_page_allocated tells the caller whether it has to start the
+ * read, on the page which is then returned locked.
  */
-struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-			struct vm_area_struct *vma, unsigned long addr)
+static struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			bool *new_page_allocated)
 {
 	struct page *found_page, *new_page = NULL;
 	int err;
 
+	*new_page_allocated = false;
+
 	do {
 		/*
 		 * First check the swap cache.  Since this is normally
@@ -330,11 +383,8 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = __add_to_swap_cache(new_page, entry);
 		if (likely(!err)) {
 			radix_tree_preload_end();
-			/*
-			 * Initiate read into locked page and return.
-			 */
 			lru_cache_add_anon(new_page);
-			swap_readpage(new_page);
+			*new_page_allocated = true;
 			return new_page;
 		}
 		radix_tree_preload_end();
@@ -352,6 +402,26 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
+/* 
+ * Locate a page of swap in physical memory, reserving swap cache space
+ * and reading the disk if it is not already cached.
+ * A failure return means that either the page allocation failed or that
+ * the swap entry is no longer in use.
+ */
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	bool page_was_allocated;
+	struct page *page;
+
+	page = __read_swap_cache_async(entry, gfp_mask, vma, addr,
+				       &page_was_allocated);
+	/* Initiate read into locked page */
+	if (page_was_allocated)
+		swap_readpage(page);
+	return page;
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
@@ -398,3 +468,183 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	lru_add_drain();	/* Push any new pages onto the LRU now */
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }
+
+/*
+ * VMA based readahead reads the swap entries of the virtual pages next
+ * to the faulting one, which are likely to be used soon if the task is
+ * walking through its memory, wherever they happen to be in the swap
+ * area.  On rotational devices that costs seeks, and the cheap read of
+ * the neighbouring swap slots in swapin_readahead() is used instead.
+ */
+bool swap_use_vma_readahead(void)
+{
+	return ACCESS_ONCE(enable_vma_readahead) &&
+		!atomic_read(&nr_rotate_swap);
+}
+
+/*
+ * Size the readahead window from the hits since the last fault: grow it
+ * to the power of two above the hits plus two, but do not shrink it by
+ * more than half at a time.  With no hits, keep reading ahead a little
+ * only while the faults are adjacent.
+ */
+static unsigned int swap_ra_window(unsigned long prev_pfn, unsigned long pfn,
+				   unsigned int hits, unsigned int max_win,
+				   unsigned int prev_win)
+{
+	unsigned int win = hits + 2;
+
+	if (!hits) {
+		if (pfn != prev_pfn + 1 && pfn != prev_pfn - 1)
+			win = 1;
+	} else
+		win = roundup_pow_of_two(max(win, 4U));
+
+	if (win > max_win)
+		win = max_win;
+	if (win < prev_win / 2)
+		win = prev_win / 2;
+	return win;
+}
+
+/* Keep the window within the vma and the page table of the fault */
+static void swap_ra_clamp_pfn(struct vm_area_struct *vma, unsigned long faddr,
+			      unsigned long lpfn, unsigned long rpfn,
+			      unsigned long *start, unsigned long *end)
+{
+	*start = max3(lpfn, PFN_DOWN(vma->vm_start),
+		      PFN_DOWN(faddr & PMD_MASK));
+	*end = min3(rpfn, PFN_DOWN(vma->vm_end),
+		    PFN_DOWN((faddr & PMD_MASK) + PMD_SIZE));
+}
+
+/**
+ * swap_vma_readahead - swap in pages in hope we need them soon
+ * @fentry: swap entry of the faulting page
+ * @gfp_mask: memory allocation flags
+ * @vma: user vma the fault is in
+ * @faddr: address of the fault
+ * @pmd: pmd mapping the page table of the fault
+ *
+ * Returns the struct page for @fentry and @faddr, after queueing the
+ * reads of the swap entries found in the ptes around the fault.  The
+ * window follows the direction of the faults, and adapts to how many of
+ * the pages read ahead last time were used.
+ *
+ * Caller must hold down_read on the vma->vm_mm.
+ */
+struct page *swap_vma_readahead(swp_entry_t fentry, gfp_t gfp_mask,
+				struct vm_area_struct *vma, unsigned long faddr,
+				pmd_t *pmd)
+{
+	pte_t ptes[SWAP_RA_PTE_MAX];
+	unsigned long ra_val, prev_pfn, fpfn, start, end, pfn;
+	unsigned int max_win, win, left, i;
+	struct blk_plug plug;
+	pte_t *pte;
+
+	max_win = 1 << min_t(unsigned int, ACCESS_ONCE(page_cluster),
+			     SWAP_RA_ORDER_CEILING);
+	if (max_win == 1)
+		goto skip;
+
+	fpfn = PFN_DOWN(faddr);
+	ra_val = atomic_long_read(&vma->swap_readahead_info);
+	prev_pfn = PFN_DOWN(SWAP_RA_ADDR(ra_val));
+	win = swap_ra_window(prev_pfn, fpfn, SWAP_RA_HITS(ra_val), max_win,
+			     SWAP_RA_WIN(ra_val));
+	atomic_long_set(&vma->swap_readahead_info,
+			SWAP_RA_VAL(faddr, win, 0));
+	if (win == 1)
+		goto skip;
+
+	if (fpfn == prev_pfn + 1) {		/* reading forwards */
+		swap_ra_clamp_pfn(vma, faddr, fpfn, fpfn + win, &start, &end);
+	} else if (fpfn == prev_pfn - 1) {	/* reading backwards */
+		swap_ra_clamp_pfn(vma, faddr, fpfn - win + 1, fpfn + 1,
+				  &start, &end);
+	} else {
+		left = (win - 1) / 2;
+		swap_ra_clamp_pfn(vma, faddr, fpfn - left, fpfn + win - left,
+				  &start, &end);
+	}
+
+	/* Copy the ptes, reading the pages may sleep */
+	pte = pte_offset_map(pmd, PFN_PHYS(start));
+	for (i = 0; i < end - start; i++)
+		ptes[i] = pte[i];
+	pte_unmap(pte);
+
+	blk_start_plug(&plug);
+	for (i = 0, pfn = start; pfn < end; i++, pfn++) {
+		bool page_was_allocated;
+		struct page *page;
+		swp_entry_t entry;
+
+		if (pfn == fpfn || !is_swap_pte(ptes[i]))
+			continue;
+		entry = pte_to_swp_entry(ptes[i]);
+		if (unlikely(non_swap_entry(entry)))
+			continue;
+		page = __read_swap_cache_async(entry, gfp_mask, vma,
+					       PFN_PHYS(pfn),
+					       &page_was_allocated);
+		if (!page)
+			break;
+		if (page_was_allocated) {
+			SetPageReadahead(page);
+			swap_readpage(page);
+		}
+		page_cache_release(page);
+	}
+	blk_finish_plug(&plug);
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+skip:
+	return read_swap_cache_async(fentry, gfp_mask, vma, faddr);
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t vma_ra_enabled_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", enable_vma_readahead ? "true" : "false");
+}
+
+static ssize_t vma_ra_enabled_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	if (!strncmp(buf, "true", 4) || !strncmp(buf, "1", 1))
+		enable_vma_readahead = true;
+	else if (!strncmp(buf, "false", 5) || !strncmp(buf, "0", 1))
+		enable_vma_readahead = false;
+	else
+		return -EINVAL;
+
+	return count;
+}
+static struct kobj_attribute vma_ra_enabled_attr =
+	__ATTR(vma_ra_enabled, 0644, vma_ra_enabled_show,
+	       vma_ra_enabled_store);
+
+static struct attribute *swap_attrs[] = {
+	&vma_ra_enabled_attr.attr,
+	NULL,
+};
+
+static struct attribute_group swap_attr_group = {
+	.attrs = swap_attrs,
+	.name = "swap",
+};
+
+static int __init swap_init_sysfs(void)
+{
+	int err;
+
+	err = sysfs_create_group(mm_kobj, &swap_attr_group);
+	if (err)
+		printk(KERN_ERR "swap: register sysfs failed\n");
+	return err;
+}
+subsys_initcall(swap_init_sysfs);
+#endif
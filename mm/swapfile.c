@@ -43,11 +43,19 @@ static bool swap_count_continued(struct swap_info_struct *, pgoff_t,
 static void free_swap_count_continuations(struct swap_info_struct *);
 static sector_t map_swap_entry(swp_entry_t, struct block_device**);
 
+/*
+ * swap_lock protects swap_list, swap_info[] and the priorities of the
+ * swap areas; each swap area's own lock protects its swap_map and the
+ * allocation state that goes with it.  swap_lock nests outside si->lock.
+ */
 static DEFINE_SPINLOCK(swap_lock);
 static unsigned int nr_swapfiles;
-long nr_swap_pages;
+atomic_long_t nr_swap_pages;
 long total_swap_pages;
+/* Number of swap areas in use on rotational devices */
+atomic_t nr_rotate_swap = ATOMIC_INIT(0);
 static int least_priority;
+static atomic_t highest_priority_index = ATOMIC_INIT(-1);
 
 static const char Bad_file[] = "Bad swap file entry ";
 static const char Unused_file[] = "Unused swap file entry ";
@@ -171,14 +179,161 @@ static void discard_swap_cluster(struct swap_info_struct *si,
 	}
 }
 
-static int wait_for_discard(void *word)
+#define SWAPFILE_CLUSTER	256
+#define LATENCY_LIMIT		256
+
+static inline struct swap_cluster_info *
+offset_to_cluster(struct swap_info_struct *si, unsigned long offset)
 {
-	schedule();
-	return 0;
+	return si->cluster_info + offset / SWAPFILE_CLUSTER;
 }
 
-#define SWAPFILE_CLUSTER	256
-#define LATENCY_LIMIT		256
+static inline unsigned long cluster_to_offset(struct swap_info_struct *si,
+					      struct swap_cluster_info *ci)
+{
+	return (ci - si->cluster_info) * SWAPFILE_CLUSTER;
+}
+
+/* The last cluster of a swap area may be short */
+static inline unsigned long cluster_nr_slots(struct swap_info_struct *si,
+					     unsigned long start)
+{
+	return min_t(unsigned long, SWAPFILE_CLUSTER, si->max - start);
+}
+
+/*
+ * Discard the clusters queued by free_cluster(), then make them free for
+ * allocation again.  Called with si->lock held, which is dropped around
+ * each discard.
+ */
+static void swap_do_scheduled_discard(struct swap_info_struct *si)
+{
+	struct swap_cluster_info *ci;
+	unsigned long start, nr;
+
+	while (!list_empty(&si->discard_clusters)) {
+		ci = list_first_entry(&si->discard_clusters,
+				      struct swap_cluster_info, list);
+		list_del_init(&ci->list);
+		start = cluster_to_offset(si, ci);
+		nr = cluster_nr_slots(si, start);
+		spin_unlock(&si->lock);
+
+		discard_swap_cluster(si, start, nr);
+
+		spin_lock(&si->lock);
+		memset(si->swap_map + start, 0, nr);
+		ci->flags = CLUSTER_FLAG_FREE;
+		list_add_tail(&ci->list, &si->free_clusters);
+	}
+}
+
+static void swap_discard_work(struct work_struct *work)
+{
+	struct swap_info_struct *si;
+
+	si = container_of(work, struct swap_info_struct, discard_work);
+	spin_lock(&si->lock);
+	swap_do_scheduled_discard(si);
+	spin_unlock(&si->lock);
+}
+
+/*
+ * The last slot of a cluster has been freed: put the cluster back on
+ * the free list, or first have it discarded.  Until the discard is done
+ * its slots are marked bad in swap_map, so that nothing scanning the map
+ * for a free slot can take them.
+ */
+static void free_cluster(struct swap_info_struct *si,
+			 struct swap_cluster_info *ci)
+{
+	unsigned long start;
+
+	if (si->flags & SWP_DISCARDABLE) {
+		start = cluster_to_offset(si, ci);
+		memset(si->swap_map + start, SWAP_MAP_BAD,
+		       cluster_nr_slots(si, start));
+		ci->flags = CLUSTER_FLAG_DISCARD;
+		list_add_tail(&ci->list, &si->discard_clusters);
+		schedule_work(&si->discard_work);
+	} else {
+		ci->flags = CLUSTER_FLAG_FREE;
+		list_add_tail(&ci->list, &si->free_clusters);
+	}
+}
+
+static void inc_cluster_count(struct swap_info_struct *si,
+			      unsigned long offset)
+{
+	struct swap_cluster_info *ci;
+
+	if (!si->cluster_info)
+		return;
+	ci = offset_to_cluster(si, offset);
+	if (ci->flags & CLUSTER_FLAG_FREE) {
+		list_del_init(&ci->list);
+		ci->flags = 0;
+	}
+	VM_BUG_ON(ci->flags || ci->count >= SWAPFILE_CLUSTER);
+	ci->count++;
+}
+
+static void dec_cluster_count(struct swap_info_struct *si,
+			      unsigned long offset)
+{
+	struct swap_cluster_info *ci;
+
+	if (!si->cluster_info)
+		return;
+	ci = offset_to_cluster(si, offset);
+	VM_BUG_ON(!ci->count);
+	if (!--ci->count)
+		free_cluster(si, ci);
+}
+
+/*
+ * Find the next free slot in this cpu's cluster, taking a new cluster
+ * off the free list when the current one is used up.  Other cpus only
+ * allocate from our cluster when there are no free clusters left, so
+ * allocations from each cpu stay sequential on the device, and cpus do
+ * not contend for the same cachelines of swap_map.  Returns false when
+ * there are no free clusters to be had.
+ */
+static bool scan_swap_map_cluster(struct swap_info_struct *si,
+				  unsigned long *offset)
+{
+	struct percpu_cluster *cluster;
+	struct swap_cluster_info *ci;
+	unsigned long next, end;
+
+again:
+	cluster = this_cpu_ptr(si->percpu_cluster);
+	next = cluster->next;
+	if (!next || !(next % SWAPFILE_CLUSTER) || next >= si->max) {
+		if (!list_empty(&si->free_clusters)) {
+			ci = list_first_entry(&si->free_clusters,
+					      struct swap_cluster_info, list);
+			next = cluster_to_offset(si, ci);
+		} else if (!list_empty(&si->discard_clusters)) {
+			/* Rather than fall back to scanning, discard now */
+			swap_do_scheduled_discard(si);
+			goto again;
+		} else
+			return false;
+	}
+
+	end = min_t(unsigned long, (next / SWAPFILE_CLUSTER + 1) *
+					SWAPFILE_CLUSTER, si->max);
+	while (next < end && si->swap_map[next])
+		next++;
+	if (next == end) {
+		cluster->next = 0;
+		goto again;
+	}
+	cluster->next = next + 1;
+	*offset = next;
+	return true;
+}
 
 static unsigned long scan_swap_map(struct swap_info_struct *si,
 				   unsigned char usage)
@@ -187,7 +342,6 @@ static unsigned long scan_swap_map(struct swap_info_struct *si,
 	unsigned long scan_base;
 	unsigned long last_in_cluster = 0;
 	int latency_ration = LATENCY_LIMIT;
-	int found_free_cluster = 0;
 
 	/*
 	 * We try to cluster swap pages by allocating them sequentially
@@ -198,41 +352,32 @@ static unsigned long scan_swap_map(struct swap_info_struct *si,
 	 * overall disk seek times between swap pages.  -- sct
 	 * But we do now try to find an empty cluster.  -Andrea
 	 * And we let swap pages go all over an SSD partition.  Hugh
+	 * Solid state devices keep track of their free clusters and
+	 * hand one to each cpu, falling back to scanning when none is
+	 * left.
 	 */
 
 	si->flags += SWP_SCANNING;
 	scan_base = offset = si->cluster_next;
 
+	if (si->cluster_info) {
+		if (scan_swap_map_cluster(si, &offset))
+			scan_base = offset;
+		goto checks;
+	}
+
 	if (unlikely(!si->cluster_nr--)) {
 		if (si->pages - si->inuse_pages < SWAPFILE_CLUSTER) {
 			si->cluster_nr = SWAPFILE_CLUSTER - 1;
 			goto checks;
 		}
-		if (si->flags & SWP_DISCARDABLE) {
-			/*
-			 * Start range check on racing allocations, in case
-			 * they overlap the cluster we eventually decide on
-			 * (we scan without swap_lock to allow preemption).
-			 * It's hardly conceivable that cluster_nr could be
-			 * wrapped during our scan, but don't depend on it.
-			 */
-			if (si->lowest_alloc)
-				goto checks;
-			si->lowest_alloc = si->max;
-			si->highest_alloc = 0;
-		}
-		spin_unlock(&swap_lock);
+		spin_unlock(&si->lock);
 
 		/*
-		 * If seek is expensive, start searching for new cluster from
-		 * start of partition, to minimize the span of allocated swap.
-		 * But if seek is cheap, search from our current position, so
-		 * that swap is allocated from all over the partition: if the
-		 * Flash Translation Layer only remaps within limited zones,
-		 * we don't want to wear out the first zone too quickly.
+		 * Start searching for a new cluster from the start of the
+		 * partition, to minimize the span of allocated swap.
 		 */
-		if (!(si->flags & SWP_SOLIDSTATE))
-			scan_base = offset = si->lowest_bit;
+		scan_base = offset = si->lowest_bit;
 		last_in_cluster = offset + SWAPFILE_CLUSTER - 1;
 
 		/* Locate the first empty (unaligned) cluster */
@@ -240,32 +385,10 @@ static unsigned long scan_swap_map(struct swap_info_struct *si,
 			if (si->swap_map[offset])
 				last_in_cluster = offset + SWAPFILE_CLUSTER;
 			else if (offset == last_in_cluster) {
-				spin_lock(&swap_lock);
+				spin_lock(&si->lock);
 				offset -= SWAPFILE_CLUSTER - 1;
 				si->cluster_next = offset;
 				si->cluster_nr = SWAPFILE_CLUSTER - 1;
-				found_free_cluster = 1;
-				goto checks;
-			}
-			if (unlikely(--latency_ration < 0)) {
-				cond_resched();
-				latency_ration = LATENCY_LIMIT;
-			}
-		}
-
-		offset = si->lowest_bit;
-		last_in_cluster = offset + SWAPFILE_CLUSTER - 1;
-
-		/* Locate the first empty (unaligned) cluster */
-		for (; last_in_cluster < scan_base; offset++) {
-			if (si->swap_map[offset])
-				last_in_cluster = offset + SWAPFILE_CLUSTER;
-			else if (offset == last_in_cluster) {
-				spin_lock(&swap_lock);
-				offset -= SWAPFILE_CLUSTER - 1;
-				si->cluster_next = offset;
-				si->cluster_nr = SWAPFILE_CLUSTER - 1;
-				found_free_cluster = 1;
 				goto checks;
 			}
 			if (unlikely(--latency_ration < 0)) {
@@ -275,9 +398,8 @@ static unsigned long scan_swap_map(struct swap_info_struct *si,
 		}
 
 		offset = scan_base;
-		spin_lock(&swap_lock);
+		spin_lock(&si->lock);
 		si->cluster_nr = SWAPFILE_CLUSTER - 1;
-		si->lowest_alloc = 0;
 	}
 
 checks:
@@ -291,9 +413,9 @@ checks:
 	/* reuse swap entry of cache-only swap if not busy. */
 	if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
 		int swap_was_freed;
-		spin_unlock(&swap_lock);
+		spin_unlock(&si->lock);
 		swap_was_freed = __try_to_reclaim_swap(si, offset);
-		spin_lock(&swap_lock);
+		spin_lock(&si->lock);
 		/* entry was freed successfully, try to use this again */
 		if (swap_was_freed)
 			goto checks;
@@ -313,73 +435,21 @@ checks:
 		si->highest_bit = 0;
 	}
 	si->swap_map[offset] = usage;
+	inc_cluster_count(si, offset);
 	si->cluster_next = offset + 1;
 	si->flags -= SWP_SCANNING;
 
-	if (si->lowest_alloc) {
-		/*
-		 * Only set when SWP_DISCARDABLE, and there's a scan
-		 * for a free cluster in progress or just completed.
-		 */
-		if (found_free_cluster) {
-			/*
-			 * To optimize wear-levelling, discard the
-			 * old data of the cluster, taking care not to
-			 * discard any of its pages that have already
-			 * been allocated by racing tasks (offset has
-			 * already stepped over any at the beginning).
-			 */
-			if (offset < si->highest_alloc &&
-			    si->lowest_alloc <= last_in_cluster)
-				last_in_cluster = si->lowest_alloc - 1;
-			si->flags |= SWP_DISCARDING;
-			spin_unlock(&swap_lock);
-
-			if (offset < last_in_cluster)
-				discard_swap_cluster(si, offset,
-					last_in_cluster - offset + 1);
-
-			spin_lock(&swap_lock);
-			si->lowest_alloc = 0;
-			si->flags &= ~SWP_DISCARDING;
-
-			smp_mb();	/* wake_up_bit advises this */
-			wake_up_bit(&si->flags, ilog2(SWP_DISCARDING));
-
-		} else if (si->flags & SWP_DISCARDING) {
-			/*
-			 * Delay using pages allocated by racing tasks
-			 * until the whole discard has been issued. We
-			 * could defer that delay until swap_writepage,
-			 * but it's easier to keep this self-contained.
-			 */
-			spin_unlock(&swap_lock);
-			wait_on_bit(&si->flags, ilog2(SWP_DISCARDING),
-				wait_for_discard, TASK_UNINTERRUPTIBLE);
-			spin_lock(&swap_lock);
-		} else {
-			/*
-			 * Note pages allocated by racing tasks while
-			 * scan for a free cluster is in progress, so
-			 * that its final discard can exclude them.
-			 */
-			if (offset < si->lowest_alloc)
-				si->lowest_alloc = offset;
-			if (offset > si->highest_alloc)
-				si->highest_alloc = offset;
-		}
-	}
 	return offset;
 
 scan:
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 	while (++offset <= si->highest_bit) {
 		if (!si->swap_map[offset]) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (unlikely(--latency_ration < 0)) {
@@ -390,11 +460,11 @@ scan:
 	offset = si->lowest_bit;
 	while (++offset < scan_base) {
 		if (!si->swap_map[offset]) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (unlikely(--latency_ration < 0)) {
@@ -402,24 +472,52 @@ scan:
 			latency_ration = LATENCY_LIMIT;
 		}
 	}
-	spin_lock(&swap_lock);
+	spin_lock(&si->lock);
 
 no_page:
 	si->flags -= SWP_SCANNING;
 	return 0;
 }
 
+/*
+ * Called from swap_entry_free() without swap_lock, to let get_swap_page()
+ * know that a swap area of higher priority than swap_list.next has free
+ * slots again.  It is only a hint: the swap area may even be swapped off
+ * by the time get_swap_page() looks at it, so that checks SWP_WRITEOK.
+ */
+static void set_highest_priority_index(int type)
+{
+	int old, new = type;
+
+	do {
+		old = atomic_read(&highest_priority_index);
+		if (old != -1 &&
+		    swap_info[old]->prio >= swap_info[type]->prio)
+			break;
+	} while (atomic_cmpxchg(&highest_priority_index, old, new) != old);
+}
+
 swp_entry_t get_swap_page(void)
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
-	int type, next;
+	int type, next, hp_index;
 	int wrapped = 0;
 
+	if (get_nr_swap_pages() <= 0)
+		return (swp_entry_t) {0};
+
 	spin_lock(&swap_lock);
-	if (nr_swap_pages <= 0)
+	if (atomic_long_dec_return(&nr_swap_pages) < 0)
 		goto noswap;
-	nr_swap_pages--;
+
+	hp_index = atomic_xchg(&highest_priority_index, -1);
+	if (hp_index != -1 && hp_index != swap_list.next) {
+		si = swap_info[hp_index];
+		if ((si->flags & SWP_WRITEOK) &&
+		    si->prio > swap_info[swap_list.next]->prio)
+			swap_list.next = hp_index;
+	}
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		si = swap_info[type];
@@ -436,17 +534,25 @@ swp_entry_t get_swap_page(void)
 			continue;
 
 		swap_list.next = next;
-		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_HAS_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
-			return swp_entry(type, offset);
+		spin_unlock(&swap_lock);
+
+		spin_lock(&si->lock);
+		if (si->highest_bit && (si->flags & SWP_WRITEOK)) {
+			/* This is called for allocating swap entry for cache */
+			offset = scan_swap_map(si, SWAP_HAS_CACHE);
+			if (offset) {
+				spin_unlock(&si->lock);
+				return swp_entry(type, offset);
+			}
 		}
+		spin_unlock(&si->lock);
+
+		spin_lock(&swap_lock);
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
 noswap:
+	atomic_long_inc(&nr_swap_pages);
 	spin_unlock(&swap_lock);
 	return (swp_entry_t) {0};
 }
@@ -457,19 +563,21 @@ swp_entry_t get_swap_page_of_type(int type)
 	struct swap_info_struct *si;
 	pgoff_t offset;
 
-	spin_lock(&swap_lock);
+	if ((unsigned int)type >= nr_swapfiles)
+		return (swp_entry_t) {0};
 	si = swap_info[type];
-	if (si && (si->flags & SWP_WRITEOK)) {
-		nr_swap_pages--;
+	spin_lock(&si->lock);
+	if (si->flags & SWP_WRITEOK) {
+		atomic_long_dec(&nr_swap_pages);
 		/* This is called for allocating swap entry, not cache */
 		offset = scan_swap_map(si, 1);
 		if (offset) {
-			spin_unlock(&swap_lock);
+			spin_unlock(&si->lock);
 			return swp_entry(type, offset);
 		}
-		nr_swap_pages++;
+		atomic_long_inc(&nr_swap_pages);
 	}
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 	return (swp_entry_t) {0};
 }
 
@@ -491,7 +599,7 @@ static struct swap_info_struct *swap_info_get(swp_entry_t entry)
 		goto bad_offset;
 	if (!p->swap_map[offset])
 		goto bad_free;
-	spin_lock(&swap_lock);
+	spin_lock(&p->lock);
 	return p;
 
 bad_free:
@@ -548,14 +656,13 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 	/* free if no reference */
 	if (!usage) {
 		struct gendisk *disk = p->bdev->bd_disk;
+		dec_cluster_count(p, offset);
 		if (offset < p->lowest_bit)
 			p->lowest_bit = offset;
 		if (offset > p->highest_bit)
 			p->highest_bit = offset;
-		if (swap_list.next >= 0 &&
-		    p->prio > swap_info[swap_list.next]->prio)
-			swap_list.next = p->type;
-		nr_swap_pages++;
+		set_highest_priority_index(p->type);
+		atomic_long_inc(&nr_swap_pages);
 		p->inuse_pages--;
 		if ((p->flags & SWP_BLKDEV) &&
 				disk->fops->swap_slot_free_notify)
@@ -576,7 +683,7 @@ void swap_free(swp_entry_t entry)
 	p = swap_info_get(entry);
 	if (p) {
 		swap_entry_free(p, entry, 1);
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 }
 
@@ -593,7 +700,7 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 		count = swap_entry_free(p, entry, SWAP_HAS_CACHE);
 		if (page)
 			mem_cgroup_uncharge_swapcache(page, entry, count != 0);
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 }
 
@@ -612,7 +719,7 @@ static inline int page_swapcount(struct page *page)
 	p = swap_info_get(entry);
 	if (p) {
 		count = swap_count(p->swap_map[swp_offset(entry)]);
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 	return count;
 }
@@ -700,7 +807,7 @@ int free_swap_and_cache(swp_entry_t entry)
 				page = NULL;
 			}
 		}
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 	if (page) {
 		/*
@@ -741,7 +848,7 @@ int mem_cgroup_count_swap_user(swp_entry_t ent, struct page **pagep)
 	p = swap_info_get(ent);
 	if (p) {
 		count += swap_count(p->swap_map[swp_offset(ent)]);
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 
 	*pagep = page;
@@ -1029,10 +1136,10 @@ static unsigned int find_next_to_unuse(struct swap_info_struct *si,
 	unsigned char count;
 
 	/*
-	 * No need for swap_lock here: we're just looking
+	 * No need for si->lock here: we're just looking
 	 * for whether an entry is in use, not modifying it; false
 	 * hits are okay, and sys_swapoff() has already prevented new
-	 * allocations from this area (while holding swap_lock).
+	 * allocations from this area (while holding si->lock).
 	 */
 	for (;;) {
 		if (++i >= max) {
@@ -1524,13 +1631,14 @@ static void enable_swap_info(struct swap_info_struct *p, int prio,
 	int i, prev;
 
 	spin_lock(&swap_lock);
+	spin_lock(&p->lock);
 	if (prio >= 0)
 		p->prio = prio;
 	else
 		p->prio = --least_priority;
 	p->swap_map = swap_map;
 	p->flags |= SWP_WRITEOK;
-	nr_swap_pages += p->pages;
+	atomic_long_add(p->pages, &nr_swap_pages);
 	total_swap_pages += p->pages;
 
 	/* insert swap space into swap_list: */
@@ -1545,6 +1653,7 @@ static void enable_swap_info(struct swap_info_struct *p, int prio,
 		swap_list.head = swap_list.next = p->type;
 	else
 		swap_info[prev]->next = p->type;
+	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 }
 
@@ -1552,6 +1661,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 {
 	struct swap_info_struct *p = NULL;
 	unsigned char *swap_map;
+	struct swap_cluster_info *cluster_info;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1597,6 +1707,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 		spin_unlock(&swap_lock);
 		goto out_dput;
 	}
+	spin_lock(&p->lock);
 	if (prev < 0)
 		swap_list.head = p->next;
 	else
@@ -1610,9 +1721,10 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 			swap_info[i]->prio = p->prio--;
 		least_priority++;
 	}
-	nr_swap_pages -= p->pages;
+	atomic_long_sub(p->pages, &nr_swap_pages);
 	total_swap_pages -= p->pages;
 	p->flags &= ~SWP_WRITEOK;
+	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 
 	oom_score_adj = test_set_oom_score_adj(OOM_SCORE_ADJ_MAX);
@@ -1631,6 +1743,9 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 		goto out_dput;
 	}
 
+	flush_work(&p->discard_work);
+	if (!(p->flags & SWP_SOLIDSTATE))
+		atomic_dec(&nr_rotate_swap);
 	destroy_swap_extents(p);
 	if (p->flags & SWP_CONTINUED)
 		free_swap_count_continuations(p);
@@ -1640,11 +1755,14 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	drain_mmlist();
 
 	/* wait for anyone still in scan_swap_map */
+	spin_lock(&p->lock);
 	p->highest_bit = 0;		/* cuts scans short */
 	while (p->flags >= SWP_SCANNING) {
+		spin_unlock(&p->lock);
 		spin_unlock(&swap_lock);
 		schedule_timeout_uninterruptible(1);
 		spin_lock(&swap_lock);
+		spin_lock(&p->lock);
 	}
 
 	swap_file = p->swap_file;
@@ -1652,10 +1770,16 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	cluster_info = p->cluster_info;
+	p->cluster_info = NULL;
 	p->flags = 0;
+	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
+	free_percpu(p->percpu_cluster);
+	p->percpu_cluster = NULL;
 	vfree(swap_map);
+	vfree(cluster_info);
 	/* Destroy swap account informatin */
 	swap_cgroup_swapoff(type);
 
@@ -1853,6 +1977,10 @@ static struct swap_info_struct *alloc_swap_info(void)
 		 */
 	}
 	INIT_LIST_HEAD(&p->first_swap_extent.list);
+	INIT_LIST_HEAD(&p->free_clusters);
+	INIT_LIST_HEAD(&p->discard_clusters);
+	INIT_WORK(&p->discard_work, swap_discard_work);
+	spin_lock_init(&p->lock);
 	p->flags = SWP_USED;
 	p->next = -1;
 	spin_unlock(&swap_lock);
@@ -1984,12 +2112,14 @@ static int setup_swap_map_and_extents(struct swap_info_struct *p,
 			return -EINVAL;
 		if (page_nr < maxpages) {
 			swap_map[page_nr] = SWAP_MAP_BAD;
+			inc_cluster_count(p, page_nr);
 			nr_good_pages--;
 		}
 	}
 
 	if (nr_good_pages) {
 		swap_map[0] = SWAP_MAP_BAD;
+		inc_cluster_count(p, 0);
 		p->max = maxpages;
 		p->pages = nr_good_pages;
 		nr_extents = setup_swap_extents(p, span);
@@ -2005,6 +2135,28 @@ static int setup_swap_map_and_extents(struct swap_info_struct *p,
 	return nr_extents;
 }
 
+/*
+ * Put the clusters with no bad slots on the free list, starting from a
+ * random one so that allocations do not always begin with the first
+ * erase blocks of the device.
+ */
+static void init_swap_clusters(struct swap_info_struct *p)
+{
+	unsigned long nr_clusters = DIV_ROUND_UP(p->max, SWAPFILE_CLUSTER);
+	unsigned long i, idx = random32() % nr_clusters;
+
+	for (i = 0; i < nr_clusters; i++) {
+		struct swap_cluster_info *ci = p->cluster_info + idx;
+
+		if (!ci->count) {
+			ci->flags = CLUSTER_FLAG_FREE;
+			list_add_tail(&ci->list, &p->free_clusters);
+		}
+		if (++idx == nr_clusters)
+			idx = 0;
+	}
+}
+
 SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 {
 	struct swap_info_struct *p;
@@ -2019,6 +2171,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	sector_t span;
 	unsigned long maxpages;
 	unsigned char *swap_map = NULL;
+	struct swap_cluster_info *cluster_info = NULL;
 	struct page *page = NULL;
 	struct inode *inode = NULL;
 
@@ -2089,6 +2242,18 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		goto bad_swap;
 	}
 
+	if (p->bdev && blk_queue_nonrot(bdev_get_queue(p->bdev))) {
+		p->flags |= SWP_SOLIDSTATE;
+		cluster_info = vzalloc(DIV_ROUND_UP(maxpages, SWAPFILE_CLUSTER) *
+				       sizeof(*cluster_info));
+		p->percpu_cluster = alloc_percpu(struct percpu_cluster);
+		if (!cluster_info || !p->percpu_cluster) {
+			error = -ENOMEM;
+			goto bad_swap;
+		}
+		p->cluster_info = cluster_info;
+	}
+
 	error = swap_cgroup_swapon(p->type, maxpages);
 	if (error)
 		goto bad_swap;
@@ -2101,9 +2266,9 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	}
 
 	if (p->bdev) {
-		if (blk_queue_nonrot(bdev_get_queue(p->bdev))) {
-			p->flags |= SWP_SOLIDSTATE;
+		if (p->flags & SWP_SOLIDSTATE) {
 			p->cluster_next = 1 + (random32() % p->highest_bit);
+			init_swap_clusters(p);
 		}
 		if (discard_swap(p) == 0 && (swap_flags & SWAP_FLAG_DISCARD))
 			p->flags |= SWP_DISCARDABLE;
@@ -2115,6 +2280,8 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		prio =
 		  (swap_flags & SWAP_FLAG_PRIO_MASK) >> SWAP_FLAG_PRIO_SHIFT;
 	enable_swap_info(p, prio, swap_map);
+	if (!(p->flags & SWP_SOLIDSTATE))
+		atomic_inc(&nr_rotate_swap);
 
 	printk(KERN_INFO "Adding %uk swap on %s.  "
 			"Priority:%d extents:%d across:%lluk %s%s\n",
@@ -2140,9 +2307,13 @@ bad_swap:
 	swap_cgroup_swapoff(p->type);
 	spin_lock(&swap_lock);
 	p->swap_file = NULL;
+	p->cluster_info = NULL;
 	p->flags = 0;
 	spin_unlock(&swap_lock);
+	free_percpu(p->percpu_cluster);
+	p->percpu_cluster = NULL;
 	vfree(swap_map);
+	vfree(cluster_info);
 	if (swap_file) {
 		if (inode && S_ISREG(inode->i_mode)) {
 			mutex_unlock(&inode->i_mutex);
@@ -2174,7 +2345,7 @@ void si_swapinfo(struct sysinfo *val)
 		if ((si->flags & SWP_USED) && !(si->flags & SWP_WRITEOK))
 			nr_to_be_unused += si->inuse_pages;
 	}
-	val->freeswap = nr_swap_pages + nr_to_be_unused;
+	val->freeswap = get_nr_swap_pages() + nr_to_be_unused;
 	val->totalswap = total_swap_pages + nr_to_be_unused;
 	spin_unlock(&swap_lock);
 }
@@ -2207,7 +2378,7 @@ static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 	p = swap_info[type];
 	offset = swp_offset(entry);
 
-	spin_lock(&swap_lock);
+	spin_lock(&p->lock);
 	if (unlikely(offset >= p->max))
 		goto unlock_out;
 
@@ -2242,7 +2413,7 @@ static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 	p->swap_map[offset] = count | has_cache;
 
 unlock_out:
-	spin_unlock(&swap_lock);
+	spin_unlock(&p->lock);
 out:
 	return err;
 
@@ -2290,7 +2461,7 @@ int swapcache_prepare(swp_entry_t entry)
 }
 
 /*
- * swap_lock prevents swap_map being freed. Don't grab an extra
+ * si->lock prevents swap_map being freed. Don't grab an extra
  * reference on the swaphandle, it doesn't matter if it becomes unused.
  */
 int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
@@ -2311,7 +2482,7 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 	if (!base)		/* first page is swap header */
 		base++;
 
-	spin_lock(&swap_lock);
+	spin_lock(&si->lock);
 	if (end > si->max)	/* don't go beyond end of map */
 		end = si->max;
 
@@ -2331,7 +2502,7 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 		if (swap_count(si->swap_map[toff]) == SWAP_MAP_BAD)
 			break;
 	}
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 
 	/*
 	 * Indicate starting offset, and return number of pages to get:
@@ -2394,7 +2565,7 @@ int add_swap_count_continuation(swp_entry_t entry, gfp_t gfp_mask)
 	}
 
 	if (!page) {
-		spin_unlock(&swap_lock);
+		spin_unlock(&si->lock);
 		return -ENOMEM;
 	}
 
@@ -2442,7 +2613,7 @@ int add_swap_count_continuation(swp_entry_t entry, gfp_t gfp_mask)
 	list_add_tail(&page->lru, &head->lru);
 	page = NULL;			/* now it's attached, don't free it */
 out:
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 outer:
 	if (page)
 		__free_page(page);
@@ -2455,7 +2626,7 @@ outer:
  * into, carry if so, or else fail until a new continuation page is allocated;
  * when the original swap_map count is decremented from 0 with continuation,
  * borrow from the continuation and report whether it still holds more.
- * Called while __swap_duplicate() or swap_entry_free() holds swap_lock.
+ * Called while __swap_duplicate() or swap_entry_free() holds si->lock.
  */
 static bool swap_count_continued(struct swap_info_struct *si,
 				 pgoff_t offset, unsigned char count)
@@ -183,6 +183,61 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+/**
+ * clear_shadow_entries - remove shadow entries from a mapping
+ * @mapping: mapping to clean up
+ * @start: first index to clear
+ * @end: last index to clear (inclusive)
+ *
+ * Shadow entries of evicted pages only carry reclaim history: drop the
+ * ones in the specified range.  This must not be used on shmem/tmpfs
+ * mappings, whose exceptional entries refer to swapped out pages.
+ */
+void clear_shadow_entries(struct address_space *mapping,
+			  pgoff_t start, pgoff_t end)
+{
+	void **slots[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
+	pgoff_t index = start;
+	bool done = false;
+
+	while (!done && mapping->nrshadows) {
+		unsigned int nr_found, nr_shadows = 0;
+		unsigned int i;
+
+		spin_lock_irq(&mapping->tree_lock);
+		nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+					slots, indices, index, PAGEVEC_SIZE);
+		if (nr_found < PAGEVEC_SIZE)
+			done = true;
+		/*
+		 * Collect the indices first: deleting entries might
+		 * shrink the tree and invalidate the remaining slots.
+		 */
+		for (i = 0; i < nr_found; i++) {
+			void *entry;
+
+			if (indices[i] > end) {
+				done = true;
+				break;
+			}
+			index = indices[i] + 1;
+			if (!index || index > end)
+				done = true;
+			entry = radix_tree_deref_slot_protected(slots[i],
+							&mapping->tree_lock);
+			if (radix_tree_exceptional_entry(entry))
+				indices[nr_shadows++] = indices[i];
+		}
+		for (i = 0; i < nr_shadows; i++) {
+			radix_tree_delete(&mapping->page_tree, indices[i]);
+			workingset_shadow_dec(mapping);
+		}
+		spin_unlock_irq(&mapping->tree_lock);
+		cond_resched();
+	}
+}
+
 /**
  * truncate_inode_pages - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -214,7 +269,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	int i;
 
 	cleancache_flush_inode(mapping);
-	if (mapping->nrpages == 0)
+	if (mapping->nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
@@ -292,6 +347,8 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		mem_cgroup_uncharge_end();
 		index++;
 	}
+	if (mapping->nrshadows)
+		clear_shadow_entries(mapping, start, end);
 	cleancache_flush_inode(mapping);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
@@ -336,14 +393,6 @@ unsigned long invalidate_mapping_pages(struct address_space *mapping,
 	unsigned long count = 0;
 	int i;
 
-	/*
-	 * Note: this function may get called on a shmem/tmpfs mapping:
-	 * pagevec_lookup() might then return 0 prematurely (because it
-	 * got a gangful of swap entries); but it's hardly worth worrying
-	 * about - it can rarely have anything to free from such a mapping
-	 * (most pages are dirty), and already skips over any difficulties.
-	 */
-
 	pagevec_init(&pvec, 0);
 	while (index <= end && pagevec_lookup(&pvec, mapping, index,
 			min(end - index, (pgoff_t)PAGEVEC_SIZE - 1) + 1)) {
@@ -400,7 +449,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(page_has_private(page));
-	__delete_from_page_cache(page);
+	__delete_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
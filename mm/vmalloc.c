@@ -257,18 +257,31 @@ struct vmap_area {
 	struct list_head list;		/* address sorted list */
 	struct list_head purge_list;	/* "lazy purge" list */
 	void *private;
-	struct rcu_head rcu_head;
+	unsigned long subtree_max_size;	/* largest free area below, if free */
 };
 
 static DEFINE_SPINLOCK(vmap_area_lock);
 static LIST_HEAD(vmap_area_list);
 static struct rb_root vmap_area_root = RB_ROOT;
 
-/* The vmap cache globals are protected by vmap_area_lock */
-static struct rb_node *free_vmap_cache;
-static unsigned long cached_hole_size;
-static unsigned long cached_vstart;
-static unsigned long cached_align;
+/*
+ * The free parts of the address space are kept in a second rbtree,
+ * sorted by address as well, where every node also records the size
+ * of the largest free area in its subtree.  That is enough to find the
+ * lowest free area that fits a request without walking all the busy
+ * areas below it.  Protected by vmap_area_lock.
+ */
+static struct rb_root free_vmap_area_root = RB_ROOT;
+
+static struct kmem_cache *vmap_area_cachep;
+
+/*
+ * Allocating from the middle of a free area splits it in two, which
+ * needs another vmap_area.  Each cpu keeps one around, allocated before
+ * vmap_area_lock is taken, so the split does not have to allocate with
+ * the lock held.
+ */
+static DEFINE_PER_CPU(struct vmap_area *, ne_fit_preload_node);
 
 static unsigned long vmap_area_pcpu_hole;
 
@@ -318,13 +331,253 @@ static void __insert_vmap_area(struct vmap_area *va)
 	if (tmp) {
 		struct vmap_area *prev;
 		prev = rb_entry(tmp, struct vmap_area, rb_node);
-		list_add_rcu(&va->list, &prev->list);
+		list_add(&va->list, &prev->list);
 	} else
-		list_add_rcu(&va->list, &vmap_area_list);
+		list_add(&va->list, &vmap_area_list);
+}
+
+static inline unsigned long va_size(struct vmap_area *va)
+{
+	return va->va_end - va->va_start;
+}
+
+static inline unsigned long get_subtree_max_size(struct rb_node *node)
+{
+	if (!node)
+		return 0;
+	return rb_entry(node, struct vmap_area, rb_node)->subtree_max_size;
+}
+
+static void free_vmap_area_augment_cb(struct rb_node *node, void *unused)
+{
+	struct vmap_area *va = rb_entry(node, struct vmap_area, rb_node);
+
+	va->subtree_max_size = max3(va_size(va),
+				    get_subtree_max_size(node->rb_left),
+				    get_subtree_max_size(node->rb_right));
+}
+
+/*
+ * Propagate a change of the size of free area @va, which stays at the
+ * same place in the tree, up to the root.
+ */
+static void augment_free_vmap_area_path(struct vmap_area *va)
+{
+	struct rb_node *node;
+
+	for (node = &va->rb_node; node; node = rb_parent(node))
+		free_vmap_area_augment_cb(node, NULL);
+}
+
+static void insert_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node **p = &free_vmap_area_root.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct vmap_area *tmp_va;
+
+		parent = *p;
+		tmp_va = rb_entry(parent, struct vmap_area, rb_node);
+		if (va->va_end <= tmp_va->va_start)
+			p = &(*p)->rb_left;
+		else if (va->va_start >= tmp_va->va_end)
+			p = &(*p)->rb_right;
+		else
+			BUG();
+	}
+
+	va->subtree_max_size = va_size(va);
+	rb_link_node(&va->rb_node, parent, p);
+	rb_insert_color(&va->rb_node, &free_vmap_area_root);
+	rb_augment_insert(&va->rb_node, free_vmap_area_augment_cb, NULL);
+}
+
+static void erase_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node *deepest;
+
+	deepest = rb_augment_erase_begin(&va->rb_node);
+	rb_erase(&va->rb_node, &free_vmap_area_root);
+	RB_CLEAR_NODE(&va->rb_node);
+	rb_augment_erase_end(deepest, free_vmap_area_augment_cb, NULL);
+}
+
+/*
+ * Return the lowest address at or above @vstart where @size bytes
+ * aligned to @align fit into free area @va, or 0 if they don't.
+ */
+static unsigned long va_fit_addr(struct vmap_area *va, unsigned long size,
+				 unsigned long align, unsigned long vstart)
+{
+	unsigned long addr;
+
+	addr = ALIGN(max(va->va_start, vstart), align);
+	/* ALIGN() or the end of the range may wrap */
+	if (addr < vstart || addr + size < addr)
+		return 0;
+
+	return addr + size <= va->va_end ? addr : 0;
+}
+
+/*
+ * Find the lowest free area with room for @size bytes aligned to
+ * @align at or above @vstart, and where in it they go.
+ */
+static struct vmap_area *find_vmap_lowest_match(unsigned long size,
+				unsigned long align, unsigned long vstart,
+				unsigned long *addrp)
+{
+	struct rb_node *node = free_vmap_area_root.rb_node;
+	/* A free area at least this big fits at any alignment */
+	unsigned long length = size + align - 1;
+	struct vmap_area *va;
+
+	while (node) {
+		va = rb_entry(node, struct vmap_area, rb_node);
+
+		if (get_subtree_max_size(node->rb_left) >= length &&
+		    vstart < va->va_start) {
+			node = node->rb_left;
+			continue;
+		}
+
+		*addrp = va_fit_addr(va, size, align, vstart);
+		if (*addrp)
+			return va;
+
+		if (get_subtree_max_size(node->rb_right) >= length) {
+			node = node->rb_right;
+			continue;
+		}
+
+		/*
+		 * Nothing in this subtree, either because of @vstart or
+		 * because of the alignment: go back up to the first node
+		 * that fits itself or has a fitting right subtree.  Any
+		 * area to the right of a node that is entirely above
+		 * @vstart fits, so the search descends again at most once.
+		 */
+		while ((node = rb_parent(node))) {
+			va = rb_entry(node, struct vmap_area, rb_node);
+			*addrp = va_fit_addr(va, size, align, vstart);
+			if (*addrp)
+				return va;
+
+			if (get_subtree_max_size(node->rb_right) >= length &&
+			    vstart <= va->va_start) {
+				node = node->rb_right;
+				break;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Take [@addr, @addr + @size) out of free area @va, which contains it.
+ * If what is left is on both sides, the part below goes into *@spare,
+ * or a new vmap_area if there is none.
+ */
+static int clip_free_vmap_area(struct vmap_area *va, unsigned long addr,
+			       unsigned long size, struct vmap_area **spare)
+{
+	unsigned long end = addr + size;
+	struct vmap_area *lva;
+
+	if (va->va_start == addr && va->va_end == end) {
+		erase_free_vmap_area(va);
+		kmem_cache_free(vmap_area_cachep, va);
+	} else if (va->va_start == addr) {
+		va->va_start = end;
+		augment_free_vmap_area_path(va);
+	} else if (va->va_end == end) {
+		va->va_end = addr;
+		augment_free_vmap_area_path(va);
+	} else {
+		lva = *spare;
+		if (lva)
+			*spare = NULL;
+		else
+			lva = kmem_cache_alloc(vmap_area_cachep, GFP_NOWAIT);
+		if (unlikely(!lva))
+			return -ENOMEM;
+
+		lva->va_start = va->va_start;
+		lva->va_end = addr;
+		va->va_start = end;
+		augment_free_vmap_area_path(va);
+		insert_free_vmap_area(lva);
+	}
+
+	return 0;
+}
+
+/*
+ * Hand the range of busy area @va back to the free tree, merging it
+ * with the free areas next to it.  @va is either reused as a free
+ * area or freed.
+ */
+static void merge_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node *n = free_vmap_area_root.rb_node;
+	struct vmap_area *prev = NULL, *next = NULL;
+
+	while (n) {
+		struct vmap_area *tmp_va;
+
+		tmp_va = rb_entry(n, struct vmap_area, rb_node);
+		if (va->va_start < tmp_va->va_start) {
+			next = tmp_va;
+			n = n->rb_left;
+		} else {
+			prev = tmp_va;
+			n = n->rb_right;
+		}
+	}
+
+	if (prev && prev->va_end != va->va_start)
+		prev = NULL;
+	if (next && next->va_start != va->va_end)
+		next = NULL;
+
+	if (next) {
+		unsigned long start = va->va_start;
+
+		if (prev) {
+			start = prev->va_start;
+			erase_free_vmap_area(prev);
+			kmem_cache_free(vmap_area_cachep, prev);
+		}
+		next->va_start = start;
+		augment_free_vmap_area_path(next);
+		kmem_cache_free(vmap_area_cachep, va);
+	} else if (prev) {
+		prev->va_end = va->va_end;
+		augment_free_vmap_area_path(prev);
+		kmem_cache_free(vmap_area_cachep, va);
+	} else
+		insert_free_vmap_area(va);
 }
 
 static void purge_vmap_area_lazy(void);
 
+/*
+ * Make sure this cpu has a spare vmap_area for clip_free_vmap_area().
+ */
+static void preload_free_vmap_area(gfp_t gfp_mask, int node)
+{
+	struct vmap_area *pva;
+
+	if (this_cpu_read(ne_fit_preload_node))
+		return;
+
+	pva = kmem_cache_alloc_node(vmap_area_cachep, gfp_mask, node);
+	if (pva && this_cpu_cmpxchg(ne_fit_preload_node, NULL, pva))
+		kmem_cache_free(vmap_area_cachep, pva);
+}
+
 /*
  * Allocate a region of KVA of the specified size and alignment, within the
  * vstart and vend.
@@ -334,101 +587,39 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				unsigned long vstart, unsigned long vend,
 				int node, gfp_t gfp_mask)
 {
-	struct vmap_area *va;
-	struct rb_node *n;
+	struct vmap_area *va, *free_va;
 	unsigned long addr;
 	int purged = 0;
-	struct vmap_area *first;
 
 	BUG_ON(!size);
 	BUG_ON(size & ~PAGE_MASK);
 	BUG_ON(!is_power_of_2(align));
 
-	va = kmalloc_node(sizeof(struct vmap_area),
-			gfp_mask & GFP_RECLAIM_MASK, node);
+	gfp_mask &= GFP_RECLAIM_MASK;
+	va = kmem_cache_alloc_node(vmap_area_cachep, gfp_mask, node);
 	if (unlikely(!va))
 		return ERR_PTR(-ENOMEM);
 
 retry:
-	spin_lock(&vmap_area_lock);
 	/*
-	 * Invalidate cache if we have more permissive parameters.
-	 * cached_hole_size notes the largest hole noticed _below_
-	 * the vmap_area cached in free_vmap_cache: if size fits
-	 * into that hole, we want to scan from vstart to reuse
-	 * the hole instead of allocating above free_vmap_cache.
-	 * Note that __free_vmap_area may update free_vmap_cache
-	 * without updating cached_hole_size or cached_align.
+	 * A failed preload is not fatal, the split falls back to a
+	 * GFP_NOWAIT allocation under the lock.
 	 */
-	if (!free_vmap_cache ||
-			size < cached_hole_size ||
-			vstart < cached_vstart ||
-			align < cached_align) {
-nocache:
-		cached_hole_size = 0;
-		free_vmap_cache = NULL;
-	}
-	/* record if we encounter less permissive parameters */
-	cached_vstart = vstart;
-	cached_align = align;
-
-	/* find starting point for our search */
-	if (free_vmap_cache) {
-		first = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-		addr = ALIGN(first->va_end, align);
-		if (addr < vstart)
-			goto nocache;
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-	} else {
-		addr = ALIGN(vstart, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = vmap_area_root.rb_node;
-		first = NULL;
-
-		while (n) {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				first = tmp;
-				if (tmp->va_start <= addr)
-					break;
-				n = n->rb_left;
-			} else
-				n = n->rb_right;
-		}
-
-		if (!first)
-			goto found;
-	}
+	preload_free_vmap_area(gfp_mask, node);
 
-	/* from the starting point, walk areas until a suitable hole is found */
-	while (addr + size > first->va_start && addr + size <= vend) {
-		if (addr + cached_hole_size < first->va_start)
-			cached_hole_size = first->va_start - addr;
-		addr = ALIGN(first->va_end, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = rb_next(&first->rb_node);
-		if (n)
-			first = rb_entry(n, struct vmap_area, rb_node);
-		else
-			goto found;
-	}
+	spin_lock(&vmap_area_lock);
+	free_va = find_vmap_lowest_match(size, align, vstart, &addr);
+	if (!free_va || addr + size > vend)
+		goto overflow;
 
-found:
-	if (addr + size > vend)
+	if (clip_free_vmap_area(free_va, addr, size,
+				this_cpu_ptr(&ne_fit_preload_node)))
 		goto overflow;
 
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
 	__insert_vmap_area(va);
-	free_vmap_cache = &va->rb_node;
 	spin_unlock(&vmap_area_lock);
 
 	BUG_ON(va->va_start & (align-1));
@@ -448,7 +639,7 @@ overflow:
 		printk(KERN_WARNING
 			"vmap allocation for size %lu failed: "
 			"use vmalloc=<size> to increase size.\n", size);
-	kfree(va);
+	kmem_cache_free(vmap_area_cachep, va);
 	return ERR_PTR(-EBUSY);
 }
 
@@ -456,24 +647,9 @@ static void __free_vmap_area(struct vmap_area *va)
 {
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
 
-	if (free_vmap_cache) {
-		if (va->va_end < cached_vstart) {
-			free_vmap_cache = NULL;
-		} else {
-			struct vmap_area *cache;
-			cache = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-			if (va->va_start <= cache->va_start) {
-				free_vmap_cache = rb_prev(&va->rb_node);
-				/*
-				 * We don't try to update cached_hole_size or
-				 * cached_align, but it won't go very wrong.
-				 */
-			}
-		}
-	}
 	rb_erase(&va->rb_node, &vmap_area_root);
 	RB_CLEAR_NODE(&va->rb_node);
-	list_del_rcu(&va->list);
+	list_del(&va->list);
 
 	/*
 	 * Track the highest possible candidate for pcpu area
@@ -484,7 +660,7 @@ static void __free_vmap_area(struct vmap_area *va)
 	if (va->va_end > VMALLOC_START && va->va_end <= VMALLOC_END)
 		vmap_area_pcpu_hole = max(vmap_area_pcpu_hole, va->va_end);
 
-	kfree_rcu(va, rcu_head);
+	merge_free_vmap_area(va);
 }
 
 /*
@@ -553,6 +729,21 @@ static unsigned long lazy_max_pages(void)
 
 static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);
 
+/*
+ * Lazily freed areas waiting for the next purge.  They stay in the
+ * busy tree until then, so their range is not handed out again before
+ * the TLB has been flushed.
+ */
+static LIST_HEAD(vmap_purge_list);
+static DEFINE_SPINLOCK(vmap_purge_lock);
+
+/*
+ * Number of areas returned to the free tree per vmap_area_lock hold
+ * time while purging, so allocations are not stalled behind a big
+ * purge.
+ */
+#define VMAP_PURGE_BATCH	32
+
 /* for per-CPU blocks */
 static void purge_fragmented_blocks_allcpus(void);
 
@@ -582,7 +773,7 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	LIST_HEAD(valist);
 	struct vmap_area *va;
 	struct vmap_area *n_va;
-	int nr = 0;
+	int nr = 0, batch = 0;
 
 	/*
 	 * If sync is 0 but force_flush is 1, we'll go sync anyway but callers
@@ -598,31 +789,38 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
-			if (va->va_start < *start)
-				*start = va->va_start;
-			if (va->va_end > *end)
-				*end = va->va_end;
-			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			list_add_tail(&va->purge_list, &valist);
-			va->flags |= VM_LAZY_FREEING;
-			va->flags &= ~VM_LAZY_FREE;
-		}
+	spin_lock(&vmap_purge_lock);
+	list_splice_init(&vmap_purge_list, &valist);
+	spin_unlock(&vmap_purge_lock);
+
+	list_for_each_entry(va, &valist, purge_list) {
+		if (va->va_start < *start)
+			*start = va->va_start;
+		if (va->va_end > *end)
+			*end = va->va_end;
+		nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+		va->flags |= VM_LAZY_FREEING;
+		va->flags &= ~VM_LAZY_FREE;
 	}
-	rcu_read_unlock();
 
 	if (nr)
 		atomic_sub(nr, &vmap_lazy_nr);
 
+	/* One flush covers the whole batch */
 	if (nr || force_flush)
 		flush_tlb_kernel_range(*start, *end);
 
 	if (nr) {
 		spin_lock(&vmap_area_lock);
-		list_for_each_entry_safe(va, n_va, &valist, purge_list)
+		list_for_each_entry_safe(va, n_va, &valist, purge_list) {
 			__free_vmap_area(va);
+			if (++batch == VMAP_PURGE_BATCH) {
+				spin_unlock(&vmap_area_lock);
+				cpu_relax();
+				spin_lock(&vmap_area_lock);
+				batch = 0;
+			}
+		}
 		spin_unlock(&vmap_area_lock);
 	}
 	spin_unlock(&purge_lock);
@@ -649,17 +847,34 @@ static void purge_vmap_area_lazy(void)
 	__purge_vmap_area_lazy(&start, &end, 1, 0);
 }
 
+static void purge_vmap_work_fn(struct work_struct *work)
+{
+	try_purge_vmap_area_lazy();
+}
+static DECLARE_WORK(purge_vmap_work, purge_vmap_work_fn);
+
 /*
  * Free a vmap area, caller ensuring that the area has been unmapped
  * and flush_cache_vunmap had been called for the correct range
  * previously.
+ *
+ * The purge itself is left to a worker, so that the task which happens
+ * to push the lazy count over the limit does not pay for the flush and
+ * concurrent frees are gathered into a single purge.
  */
 static void free_vmap_area_noflush(struct vmap_area *va)
 {
+	int nr_lazy;
+
 	va->flags |= VM_LAZY_FREE;
-	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
-	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
-		try_purge_vmap_area_lazy();
+	spin_lock(&vmap_purge_lock);
+	list_add_tail(&va->purge_list, &vmap_purge_list);
+	spin_unlock(&vmap_purge_lock);
+
+	nr_lazy = atomic_add_return((va->va_end - va->va_start) >> PAGE_SHIFT,
+				    &vmap_lazy_nr);
+	if (unlikely(nr_lazy > lazy_max_pages()))
+		schedule_work(&purge_vmap_work);
 }
 
 /*
@@ -1143,6 +1358,33 @@ void __init vm_area_register_early(struct vm_struct *vm, size_t align)
 	vmlist = vm;
 }
 
+/*
+ * Everything that is not busy after the vmlist import is free, except
+ * for address 0.
+ */
+static void __init vmap_init_free_space(void)
+{
+	unsigned long vmap_start = 1;
+	struct vmap_area *busy, *free;
+
+	list_for_each_entry(busy, &vmap_area_list, list) {
+		if (busy->va_start > vmap_start) {
+			free = kmem_cache_zalloc(vmap_area_cachep, GFP_NOWAIT);
+			free->va_start = vmap_start;
+			free->va_end = busy->va_start;
+			insert_free_vmap_area(free);
+		}
+		vmap_start = busy->va_end;
+	}
+
+	if (ULONG_MAX > vmap_start) {
+		free = kmem_cache_zalloc(vmap_area_cachep, GFP_NOWAIT);
+		free->va_start = vmap_start;
+		free->va_end = ULONG_MAX;
+		insert_free_vmap_area(free);
+	}
+}
+
 void __init vmalloc_init(void)
 {
 	struct vmap_area *va;
@@ -1157,15 +1399,19 @@ void __init vmalloc_init(void)
 		INIT_LIST_HEAD(&vbq->free);
 	}
 
+	vmap_area_cachep = KMEM_CACHE(vmap_area, SLAB_PANIC);
+
 	/* Import existing vmlist entries. */
 	for (tmp = vmlist; tmp; tmp = tmp->next) {
-		va = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+		va = kmem_cache_zalloc(vmap_area_cachep, GFP_NOWAIT);
 		va->flags = tmp->flags | VM_VM_AREA;
 		va->va_start = (unsigned long)tmp->addr;
 		va->va_end = va->va_start + tmp->size;
 		__insert_vmap_area(va);
 	}
 
+	vmap_init_free_space();
+
 	vmap_area_pcpu_hole = VMALLOC_END;
 
 	vmap_initialized = true;
@@ -2167,6 +2413,29 @@ static struct vmap_area *node_to_va(struct rb_node *n)
 	return n ? rb_entry(n, struct vmap_area, rb_node) : NULL;
 }
 
+/*
+ * Find the free area containing [@addr, @addr + @size).
+ */
+static struct vmap_area *find_free_vmap_area(unsigned long addr,
+					     unsigned long size)
+{
+	struct rb_node *n = free_vmap_area_root.rb_node;
+
+	while (n) {
+		struct vmap_area *va;
+
+		va = rb_entry(n, struct vmap_area, rb_node);
+		if (addr < va->va_start)
+			n = n->rb_left;
+		else if (addr >= va->va_end)
+			n = n->rb_right;
+		else
+			return addr + size <= va->va_end ? va : NULL;
+	}
+
+	return NULL;
+}
+
 /**
  * pvm_find_next_prev - find the next and prev vmap_area surrounding @end
  * @end: target address
@@ -2313,15 +2582,21 @@ struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 		return NULL;
 	}
 
+	/*
+	 * vas[nr_vms + area] is a spare for when carving out area splits
+	 * a free area in two.
+	 */
 	vms = kzalloc(sizeof(vms[0]) * nr_vms, GFP_KERNEL);
-	vas = kzalloc(sizeof(vas[0]) * nr_vms, GFP_KERNEL);
+	vas = kzalloc(sizeof(vas[0]) * nr_vms * 2, GFP_KERNEL);
 	if (!vas || !vms)
 		goto err_free;
 
 	for (area = 0; area < nr_vms; area++) {
-		vas[area] = kzalloc(sizeof(struct vmap_area), GFP_KERNEL);
+		vas[area] = kmem_cache_zalloc(vmap_area_cachep, GFP_KERNEL);
+		vas[nr_vms + area] = kmem_cache_zalloc(vmap_area_cachep,
+						       GFP_KERNEL);
 		vms[area] = kzalloc(sizeof(struct vm_struct), GFP_KERNEL);
-		if (!vas[area] || !vms[area])
+		if (!vas[area] || !vas[nr_vms + area] || !vms[area])
 			goto err_free;
 	}
 retry:
@@ -2394,9 +2669,16 @@ found:
 	/* we've found a fitting base, insert all va's */
 	for (area = 0; area < nr_vms; area++) {
 		struct vmap_area *va = vas[area];
+		struct vmap_area *free_va;
 
 		va->va_start = base + offsets[area];
 		va->va_end = va->va_start + sizes[area];
+
+		/* nothing busy overlaps, so it is all in one free area */
+		free_va = find_free_vmap_area(va->va_start, sizes[area]);
+		BUG_ON(!free_va);
+		clip_free_vmap_area(free_va, va->va_start, sizes[area],
+				    &vas[nr_vms + area]);
 		__insert_vmap_area(va);
 	}
 
@@ -2409,13 +2691,18 @@ found:
 		insert_vmalloc_vm(vms[area], vas[area], VM_ALLOC,
 				  pcpu_get_vm_areas);
 
+	for (area = 0; area < nr_vms; area++)
+		if (vas[nr_vms + area])
+			kmem_cache_free(vmap_area_cachep, vas[nr_vms + area]);
 	kfree(vas);
 	return vms;
 
 err_free:
 	for (area = 0; area < nr_vms; area++) {
-		if (vas)
-			kfree(vas[area]);
+		if (vas && vas[area])
+			kmem_cache_free(vmap_area_cachep, vas[area]);
+		if (vas && vas[nr_vms + area])
+			kmem_cache_free(vmap_area_cachep, vas[nr_vms + area]);
 		if (vms)
 			kfree(vms[area]);
 	}
@@ -0,0 +1,261 @@
+/*
+ * linux/mm/workingset.c
+ *
+ * Workingset detection
+ *
+ * Reclaim of page cache pages leaves a "shadow entry" in the page
+ * cache radix tree slot the page occupied.  The shadow entry records
+ * the zone the page lived in and a snapshot of that zone's inactive
+ * list aging clock at the time of eviction.
+ *
+ * Every eviction from the inactive file list and every activation
+ * out of it advance the zone's aging clock (zone->inactive_age), so
+ * the difference between the clock at refault time and the clock
+ * stored in the shadow entry - the refault distance - is the minimum
+ * number of additional inactive list slots the page would have needed
+ * to still be resident when it was accessed again.
+ *
+ * Those slots could only have come out of the active list.  So when
+ * the refault distance is no bigger than the current size of the
+ * active file list, the page is part of the working set and the
+ * active list is protecting pages that have not been used for longer
+ * than this one: activate it right away instead of letting it churn
+ * through the inactive list again.
+ */
+
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/module.h>
+#include <linux/mmzone.h>
+#include <linux/pagemap.h>
+#include <linux/percpu_counter.h>
+#include <linux/radix-tree.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+
+#include "internal.h"
+
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 ZONES_SHIFT + NODES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zonep,
+			  unsigned long *distancep)
+{
+	unsigned long entry = (unsigned long)shadow;
+	unsigned long eviction;
+	unsigned long refault;
+	int zid, nid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+	entry >>= NODES_SHIFT;
+	eviction = entry;
+
+	*zonep = NODE_DATA(nid)->node_zones + zid;
+
+	refault = atomic_long_read(&(*zonep)->inactive_age);
+	/*
+	 * The unsigned subtraction here gives an accurate distance
+	 * across inactive_age overflows in most cases.  There is a
+	 * special case: usually, shadow entries have a short lifetime
+	 * and are either refaulted or reclaimed along with the inode
+	 * before they get too old.  But it is not impossible for the
+	 * inactive_age to lap a shadow entry in the field, which can
+	 * then result in a false small refault distance, leading to a
+	 * false activation should this old entry actually refault
+	 * again.  However, earlier kernels used to deactivate
+	 * unconditionally with *every* reclaim invocation for the
+	 * longest time, so the occasional inappropriate activation
+	 * leading to pressure on the active list is not a problem.
+	 */
+	*distancep = (refault - eviction) & EVICTION_MASK;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @mapping: address space the page was backing
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in @mapping->page_tree in place
+ * of the evicted @page so that a later refault can be detected.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Calculates and evaluates the refault distance of the previously
+ * evicted page in the context of the zone it was allocated in.
+ *
+ * Returns %true if the page should be activated, %false otherwise.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/*
+ * Shadow entries reflect the share of the working set that does not
+ * fit into memory, so their number should be bounded by a multiple of
+ * memory.  Most of them go away naturally with refaults, truncation
+ * and inode reclaim, but a workload that streams through a set of
+ * files that stay cached in the icache would grow them unbounded.
+ *
+ * Track the mappings that hold shadow entries and let a shrinker
+ * clear them out when there are more than could ever refault with a
+ * distance small enough to cause an activation.
+ *
+ * shadow_mappings_lock nests inside mapping->tree_lock, which is
+ * taken from IRQ context, so it must always be taken with IRQs
+ * disabled.  Lock order: tree_lock -> shadow_mappings_lock -> i_lock.
+ */
+static LIST_HEAD(shadow_mappings);
+static unsigned long nr_shadow_mappings;
+static DEFINE_SPINLOCK(shadow_mappings_lock);
+static struct percpu_counter nr_shadow_entries;
+
+/*
+ * Called under mapping->tree_lock after a shadow entry was stored.
+ */
+void workingset_shadow_inc(struct address_space *mapping)
+{
+	percpu_counter_inc(&nr_shadow_entries);
+	if (mapping->nrshadows++)
+		return;
+	spin_lock(&shadow_mappings_lock);
+	list_add_tail(&mapping->shadow_list, &shadow_mappings);
+	nr_shadow_mappings++;
+	spin_unlock(&shadow_mappings_lock);
+}
+
+/*
+ * Called under mapping->tree_lock after a shadow entry was removed.
+ */
+void workingset_shadow_dec(struct address_space *mapping)
+{
+	percpu_counter_dec(&nr_shadow_entries);
+	VM_BUG_ON(!mapping->nrshadows);
+	if (--mapping->nrshadows)
+		return;
+	spin_lock(&shadow_mappings_lock);
+	list_del_init(&mapping->shadow_list);
+	nr_shadow_mappings--;
+	spin_unlock(&shadow_mappings_lock);
+}
+
+static long excess_shadow_entries(void)
+{
+	/*
+	 * A refault distance can never exceed the amount of memory,
+	 * which bounds the number of useful shadow entries as well.
+	 */
+	return percpu_counter_read_positive(&nr_shadow_entries) -
+		(long)totalram_pages;
+}
+
+static int shrink_shadow_entries(struct shrinker *shrink,
+				 struct shrink_control *sc)
+{
+	long nr_to_scan = sc->nr_to_scan;
+	unsigned long nr_mappings;
+	long excess;
+
+	if (!nr_to_scan)
+		goto out;
+
+	/* iput() might end up in the filesystem */
+	if (!(sc->gfp_mask & __GFP_FS))
+		return -1;
+
+	spin_lock_irq(&shadow_mappings_lock);
+	nr_mappings = nr_shadow_mappings;
+	spin_unlock_irq(&shadow_mappings_lock);
+
+	while (nr_to_scan > 0 && nr_mappings-- &&
+	       excess_shadow_entries() > 0) {
+		struct address_space *mapping;
+		struct inode *inode;
+
+		spin_lock_irq(&shadow_mappings_lock);
+		if (list_empty(&shadow_mappings)) {
+			spin_unlock_irq(&shadow_mappings_lock);
+			break;
+		}
+		mapping = list_first_entry(&shadow_mappings,
+					   struct address_space, shadow_list);
+		list_move_tail(&mapping->shadow_list, &shadow_mappings);
+		/*
+		 * Shadow entries are only stored in an inode's own
+		 * i_data, so pinning the host pins the mapping.
+		 */
+		inode = igrab(mapping->host);
+		spin_unlock_irq(&shadow_mappings_lock);
+
+		if (!inode)
+			continue;
+
+		nr_to_scan -= mapping->nrshadows;
+		clear_shadow_entries(mapping, 0, ULONG_MAX);
+		iput(inode);
+	}
+out:
+	excess = excess_shadow_entries();
+	return excess > 0 ? excess : 0;
+}
+
+static struct shrinker workingset_shrinker = {
+	.shrink = shrink_shadow_entries,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init workingset_init(void)
+{
+	int err;
+
+	err = percpu_counter_init(&nr_shadow_entries, 0);
+	if (err)
+		return err;
+	register_shrinker(&workingset_shrinker);
+	return 0;
+}
+core_initcall(workingset_init);
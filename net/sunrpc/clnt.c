@@ -190,6 +190,8 @@ static struct rpc_clnt * rpc_new_client(const struct rpc_create_args *args, stru
 	strlcpy(clnt->cl_server, args->servername, len);
 
 	clnt->cl_xprt     = xprt;
+	clnt->cl_xprts[0] = xprt;
+	clnt->cl_nconnect = 1;
 	clnt->cl_procinfo = version->procs;
 	clnt->cl_maxproc  = version->nrprocs;
 	clnt->cl_protname = program->name;
@@ -342,6 +344,21 @@ struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 	if (IS_ERR(clnt))
 		return clnt;
 
+	/*
+	 * Additional transports to the same server.  Only the first one
+	 * carries the backchannel.  Failing to set them up isn't fatal,
+	 * the client just uses fewer connections.
+	 */
+	xprtargs.bc_xprt = NULL;
+	while (clnt->cl_nconnect < min_t(unsigned int, args->nconnect,
+					 RPC_MAX_NCONNECT)) {
+		xprt = xprt_create_transport(&xprtargs);
+		if (IS_ERR(xprt))
+			break;
+		xprt->resvport = clnt->cl_xprt->resvport;
+		clnt->cl_xprts[clnt->cl_nconnect++] = xprt;
+	}
+
 	if (!(args->flags & RPC_CLNT_CREATE_NOPING)) {
 		int err = rpc_ping(clnt);
 		if (err != 0) {
@@ -374,6 +391,7 @@ struct rpc_clnt *
 rpc_clone_client(struct rpc_clnt *clnt)
 {
 	struct rpc_clnt *new;
+	unsigned int i;
 	int err = -ENOMEM;
 
 	new = kmemdup(clnt, sizeof(*new), GFP_KERNEL);
@@ -399,7 +417,8 @@ rpc_clone_client(struct rpc_clnt *clnt)
 		goto out_no_path;
 	if (new->cl_auth)
 		atomic_inc(&new->cl_auth->au_count);
-	xprt_get(clnt->cl_xprt);
+	for (i = 0; i < clnt->cl_nconnect; i++)
+		xprt_get(clnt->cl_xprts[i]);
 	atomic_inc(&clnt->cl_count);
 	rpc_register_client(new);
 	rpciod_up();
@@ -472,6 +491,8 @@ EXPORT_SYMBOL_GPL(rpc_shutdown_client);
 static void
 rpc_free_client(struct rpc_clnt *clnt)
 {
+	unsigned int i;
+
 	dprintk("RPC:       destroying %s client for %s\n",
 			clnt->cl_protname, clnt->cl_server);
 	if (!IS_ERR(clnt->cl_path.dentry)) {
@@ -489,7 +510,8 @@ out_free:
 	rpc_free_iostats(clnt->cl_metrics);
 	kfree(clnt->cl_principal);
 	clnt->cl_metrics = NULL;
-	xprt_put(clnt->cl_xprt);
+	for (i = 0; i < clnt->cl_nconnect; i++)
+		xprt_put(clnt->cl_xprts[i]);
 	rpciod_down();
 	kfree(clnt);
 }
@@ -580,17 +602,35 @@ void rpc_task_release_client(struct rpc_task *task)
 		list_del(&task->tk_task);
 		spin_unlock(&clnt->cl_lock);
 		task->tk_client = NULL;
+		xprt_put(task->tk_xprt);
+		task->tk_xprt = NULL;
 
 		rpc_release_client(clnt);
 	}
 }
 
+/*
+ * Pick the transport for a new task.  With several transports to the
+ * server, tasks are spread over them round-robin; a task sticks to
+ * its transport for its whole lifetime, retransmissions included.
+ */
+static struct rpc_xprt *rpc_task_get_xprt(struct rpc_clnt *clnt)
+{
+	unsigned int idx = 0;
+
+	if (clnt->cl_nconnect > 1)
+		idx = (unsigned int)atomic_inc_return(&clnt->cl_xprt_next) %
+			clnt->cl_nconnect;
+	return xprt_get(clnt->cl_xprts[idx]);
+}
+
 static
 void rpc_task_set_client(struct rpc_task *task, struct rpc_clnt *clnt)
 {
 	if (clnt != NULL) {
 		rpc_task_release_client(task);
 		task->tk_client = clnt;
+		task->tk_xprt = rpc_task_get_xprt(clnt);
 		atomic_inc(&clnt->cl_count);
 		if (clnt->cl_softrtry)
 			task->tk_flags |= RPC_TASK_SOFT;
@@ -836,8 +876,11 @@ EXPORT_SYMBOL_GPL(rpc_max_payload);
  */
 void rpc_force_rebind(struct rpc_clnt *clnt)
 {
+	unsigned int i;
+
 	if (clnt->cl_autobind)
-		xprt_clear_bound(clnt->cl_xprt);
+		for (i = 0; i < clnt->cl_nconnect; i++)
+			xprt_clear_bound(clnt->cl_xprts[i]);
 }
 EXPORT_SYMBOL_GPL(rpc_force_rebind);
 